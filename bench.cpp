@@ -0,0 +1,368 @@
+#include "bench.hpp"
+
+#include "build.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+BenchStats summarizeSamples(std::vector<double> samples)
+{
+    BenchStats stats;
+    stats.samples = samples.size();
+    if (samples.empty())
+        return stats;
+
+    std::ranges::sort(samples);
+    // Linear interpolation between the closest ranks, so small sample counts still give a stable p95
+    const auto quantile = [](const std::vector<double> &sorted, const double q) {
+        const double pos = q * static_cast<double>(sorted.size() - 1);
+        const auto lo = static_cast<size_t>(pos);
+        const size_t hi = std::min(lo + 1, sorted.size() - 1);
+        return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - static_cast<double>(lo));
+    };
+    stats.min = samples.front();
+    stats.median = quantile(samples, 0.5);
+    stats.p95 = quantile(samples, 0.95);
+
+    std::vector<double> deviations;
+    deviations.reserve(samples.size());
+    for (const double s : samples)
+        deviations.push_back(std::abs(s - stats.median));
+    std::ranges::sort(deviations);
+    stats.mad = quantile(deviations, 0.5);
+    return stats;
+}
+
+double mannWhitneyPValue(const std::vector<double> &a, const std::vector<double> &b)
+{
+    if (a.empty() || b.empty())
+        return 1.0;
+
+    // Rank both samples together; tied values share the average of their ranks
+    std::vector<std::pair<double, bool>> all; // Value, comes from a
+    all.reserve(a.size() + b.size());
+    for (const double v : a)
+        all.emplace_back(v, true);
+    for (const double v : b)
+        all.emplace_back(v, false);
+    std::ranges::sort(all, {}, &std::pair<double, bool>::first);
+
+    const auto n1 = static_cast<double>(a.size());
+    const auto n2 = static_cast<double>(b.size());
+    const double n = n1 + n2;
+    double rank_sum_a = 0;
+    double tie_term = 0;
+    for (size_t i = 0; i < all.size();)
+    {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first)
+            ++j;
+        const double avg_rank = (static_cast<double>(i + j) + 1.0) / 2.0;
+        for (size_t k = i; k < j; ++k)
+        {
+            if (all[k].second)
+                rank_sum_a += avg_rank;
+        }
+        const auto t = static_cast<double>(j - i);
+        tie_term += t * t * t - t;
+        i = j;
+    }
+
+    const double u = rank_sum_a - n1 * (n1 + 1) / 2;
+    const double mean = n1 * n2 / 2;
+    const double variance = n1 * n2 / 12 * ((n + 1) - tie_term / (n * (n - 1)));
+    if (variance <= 0)
+        return 1.0; // Every value identical
+    const double z = std::max(0.0, std::abs(u - mean) - 0.5) / std::sqrt(variance);
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+std::string formatNanoseconds(const double ns)
+{
+    if (ns < 1e3)
+        return fmt::format("{:.0f} ns", ns);
+    if (ns < 1e6)
+        return fmt::format("{:.2f} us", ns / 1e3);
+    if (ns < 1e9)
+        return fmt::format("{:.2f} ms", ns / 1e6);
+    return fmt::format("{:.3f} s", ns / 1e9);
+}
+
+namespace
+{
+json statsToJson(const BenchStats &stats, const std::vector<double> &samples)
+{
+    return json{{"samples_ns", samples},
+                {"median_ns", stats.median},
+                {"p95_ns", stats.p95},
+                {"mad_ns", stats.mad},
+                {"min_ns", stats.min}};
+}
+
+void pinToCpu(const int cpu)
+{
+#if defined(__linux__)
+    // The affinity of cppx is inherited by every benchmark it spawns
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        throw CPPX_Exception(fmt::format("Cannot pin benchmarks to CPU {}: {}", cpu, std::strerror(errno)));
+    LOG_VERBOSE("Pinned to CPU {}\n", cpu);
+#else
+    fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+               "[WARNING] CPU pinning is only supported on Linux; running unpinned.\n");
+    (void)cpu;
+#endif
+}
+} // namespace
+
+std::vector<Benchmark> buildBenchmarks(const ProjectContext &ctx, const BuildOptions &buildOpts,
+                                       const std::string &filter, const size_t jobs, fs::path *startupProbe)
+{
+    const ProjectConfig &proj = ctx.project();
+    const fs::path bench_src_dir = fs::path(proj.path) / "benches";
+    if (!fs::exists(bench_src_dir) || fs::is_empty(bench_src_dir))
+        throw CPPX_Exception("The 'benches' directory does not exist or is empty. No benchmarks to run.");
+
+    std::vector<fs::path> bench_files;
+    for (const auto &entry : fs::directory_iterator(bench_src_dir))
+    {
+        const auto ext = entry.path().extension();
+        if (entry.is_regular_file() && (ext == ".cpp" || ext == ".cc") &&
+            entry.path().stem().string().find(filter) != std::string::npos)
+            bench_files.push_back(entry.path());
+    }
+    std::ranges::sort(bench_files);
+    if (bench_files.empty())
+        throw CPPX_Exception(fmt::format("No benchmark matches '{}'.", filter));
+
+    // Unity batches are off so main.cpp can be left out
+    BuildOptions build_opts = buildOpts;
+    build_opts.noUnity = true;
+    const BuildPlan plan = makeBuildPlan(ctx, build_opts);
+    BuildDatabase db(plan.objDir / "build_db.json");
+    const fs::path bin_dir = plan.buildDir / "bench" / "bin" / plan.objDir.filename();
+    fs::create_directories(bin_dir);
+
+    const CacheSettings cache_settings = loadCacheSettings(ctx.globalConfig(), &ctx.config());
+    const std::unique_ptr<CompilationCache> cache =
+        buildOpts.noCache ? nullptr : openCompilationCache(cache_settings);
+    JobScheduler scheduler(jobs);
+
+    std::vector<const CompileUnit *> project_units;
+    for (const auto &unit : plan.units)
+    {
+        if (unit.source.filename() != "main.cpp")
+            project_units.push_back(&unit);
+    }
+    std::vector<CompileUnit> bench_units;
+    bench_units.reserve(bench_files.size() + 1);
+    for (const auto &file : bench_files)
+        bench_units.push_back(
+            makeCompileUnit(plan, file, plan.objDir / "benches" / (file.filename().string() + ".o")));
+    std::vector<std::string> programs; // One executable per unit in bench_units
+    for (const auto &file : bench_files)
+        programs.push_back(file.stem().string());
+    if (startupProbe)
+    {
+        // Written once, so its object stays up to date
+        const fs::path noop = plan.buildDir / "bench" / "cppx-noop.cpp";
+        if (!fs::exists(noop))
+        {
+            fs::create_directories(noop.parent_path());
+            writeFileAtomic(noop, "int main()\n{\n    return 0;\n}\n");
+        }
+        bench_units.push_back(makeCompileUnit(plan, noop, plan.objDir / "benches" / "cppx-noop.cpp.o"));
+        programs.emplace_back("cppx-noop");
+        *startupProbe = bin_dir / "cppx-noop";
+    }
+
+    // Staleness has to be decided before anything runs, while the database still describes the old objects
+    std::error_code ec;
+    bool objects_stale = plan.pch && !db.isUpToDate(*plan.pch, plan.toolchainId);
+    for (const CompileUnit *unit : project_units)
+        objects_stale = objects_stale || !db.isUpToDate(*unit, plan.toolchainId);
+
+    std::vector<const CompileUnit *> all_units = project_units;
+    for (const auto &unit : bench_units)
+        all_units.push_back(&unit);
+    const auto compile_jobs = scheduleCompiles(scheduler, plan, db, cache.get(), all_units);
+
+    std::vector<Benchmark> benchmarks;
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+        const std::string &name = programs[i];
+        const fs::path executable = bin_dir / name;
+        // The probe is linked without the project's objects: it stands for the loader and process start-up only
+        const bool probe = i == bench_files.size();
+        if (!probe)
+            benchmarks.push_back({name, executable, plan.toolchainId});
+
+        const auto exe_time = fs::last_write_time(executable, ec);
+        bool stale = ec || (objects_stale && !probe) || !db.isUpToDate(bench_units[i], plan.toolchainId);
+        if (!probe)
+        {
+            for (const CompileUnit *unit : project_units)
+                stale = stale || fs::last_write_time(unit->object, ec) > exe_time || ec;
+        }
+        stale = stale || fs::last_write_time(bench_units[i].object, ec) > exe_time || ec;
+        if (!stale)
+            continue;
+
+        std::vector<std::string> link_args{plan.compiler};
+        link_args.insert(link_args.end(), plan.linkFlags.begin(), plan.linkFlags.end());
+        link_args.push_back(bench_units[i].object.string());
+        if (!probe)
+        {
+            for (const CompileUnit *unit : project_units)
+                link_args.push_back(unit->object.string());
+        }
+        link_args.insert(link_args.end(), plan.linkLibs.begin(), plan.linkLibs.end());
+        link_args.insert(link_args.end(), {"-o", executable.string()});
+        LOG_VERBOSE("Link command: {}\n", joinCommand(link_args));
+        scheduler.add(
+            {fmt::format("Linking benchmark: {}", name), [link_args] { return runProcess(link_args); }},
+            compile_jobs);
+    }
+
+    print_status_message(fmt::format("Building {} benchmarks ({})...", bench_files.size(),
+                                     plan.objDir.filename().string()),
+                         "...", fmt::color::cyan);
+    const bool ok = scheduler.run();
+    db.save();
+    if (cache)
+    {
+        cache->flushStats();
+        if (cache->storedAnything())
+            cache->prune(cache_settings.maxSize);
+    }
+    if (!ok)
+        throw CPPX_Exception("Building the benchmarks failed.");
+    return benchmarks;
+}
+
+void handle_bench(const ProjectContext &ctx, const BenchOptions &opts)
+{
+    if (opts.repetitions == 0)
+        throw CPPX_Exception("--repetitions must be at least 1.");
+
+    // Load the baseline first, since this run is about to overwrite 'latest'
+    const fs::path bench_dir = fs::path(ctx.project().path) / "build" / "bench";
+    std::optional<json> baseline;
+    if (!opts.compare.empty())
+        baseline = loadBaseline(bench_dir, opts.compare);
+
+    // Built like the project's release output. A build falls back to the default flags for an unknown
+    // configuration, but numbers measured with the wrong flags are worse than none.
+    const toml::table *configs = ctx.config()["configurations"].as_table();
+    if (!configs || !configs->contains(opts.config))
+        throw CPPX_Exception(fmt::format(
+            "config.toml has no [configurations.{}] to build the benchmarks with; add it or pick another with -c.",
+            opts.config));
+    BuildOptions build_opts;
+    build_opts.config = opts.config;
+    fs::path startup_probe;
+    const std::vector<Benchmark> benchmarks =
+        buildBenchmarks(ctx, build_opts, opts.filter, opts.jobs, &startup_probe);
+
+    // Nothing else of ours runs from here on, so the measurements only compete with the rest of the system
+    if (opts.cpu)
+        pinToCpu(*opts.cpu);
+
+    // Wall time of a whole process, so the benchmark needs no harness, minus what starting one costs: the median
+    // of the same runs of an empty program linked like the benchmarks
+    const auto time_runs = [&opts](const std::string &name, const fs::path &executable) {
+        std::vector<double> samples;
+        samples.reserve(opts.repetitions);
+        for (size_t rep = 0; rep < opts.warmup + opts.repetitions; ++rep)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const JobResult result = runProcess({executable.string()});
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            if (result.exitCode != 0)
+            {
+                fmt::print(stderr, "{}", result.output);
+                throw CPPX_Exception(fmt::format("Benchmark {} failed with exit code {}.", name, result.exitCode));
+            }
+            if (rep >= opts.warmup)
+                samples.push_back(
+                    static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+        return samples;
+    };
+    const double startup = summarizeSamples(time_runs("start-up probe", startup_probe)).median;
+    LOG_VERBOSE("Process start-up takes {}, subtracted from every sample\n", formatNanoseconds(startup));
+
+    json run{{"timestamp", utcTimestamp("%Y-%m-%dT%H:%M:%SZ")},
+             {"config", opts.config},
+             {"toolchain", benchmarks.front().toolchainId},
+             {"warmup", opts.warmup},
+             {"repetitions", opts.repetitions},
+             {"cpu", opts.cpu ? json(*opts.cpu) : json(nullptr)},
+             {"startup_ns", startup},
+             {"benchmarks", json::object()}};
+
+    size_t regressions = 0;
+    for (const auto &[name, executable, toolchain] : benchmarks)
+    {
+        std::vector<double> samples = time_runs(name, executable);
+        for (double &sample : samples)
+            sample = std::max(0.0, sample - startup);
+
+        const BenchStats stats = summarizeSamples(samples);
+        run["benchmarks"][name] = statsToJson(stats, samples);
+        fmt::print("{:<24} median {:>10}  p95 {:>10}  MAD {:>10}", name, formatNanoseconds(stats.median),
+                   formatNanoseconds(stats.p95), formatNanoseconds(stats.mad));
+
+        if (!baseline)
+        {
+            fmt::print("\n");
+            continue;
+        }
+        const json &base = baseline->contains("benchmarks") ? (*baseline)["benchmarks"] : json::object();
+        if (!base.is_object() || !base.contains(name) || !base[name].contains("samples_ns"))
+        {
+            fmt::print(fg(fmt::color::gray), "  (new)\n");
+            continue;
+        }
+        const auto base_samples = base[name]["samples_ns"].get<std::vector<double>>();
+        const BenchStats base_stats = summarizeSamples(base_samples);
+        const double change = base_stats.median > 0 ? stats.median / base_stats.median - 1.0 : 0.0;
+        const double p = mannWhitneyPValue(base_samples, samples);
+        // A change has to be both statistically significant and larger than the threshold to count
+        if (p < opts.alpha && change > opts.threshold)
+        {
+            ++regressions;
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "  {:+.1f}% (p={:.4f}) REGRESSION\n",
+                       change * 100, p);
+        }
+        else if (p < opts.alpha && change < -opts.threshold)
+        {
+            fmt::print(fg(fmt::color::green), "  {:+.1f}% (p={:.4f}) improved\n", change * 100, p);
+        }
+        else
+        {
+            fmt::print(fg(fmt::color::gray), "  {:+.1f}% (p={:.4f}) unchanged\n", change * 100, p);
+        }
+    }
+
+    const std::string content = run.dump(2) + "\n";
+    const fs::path history = bench_dir / "history" / (utcTimestamp("%Y%m%d-%H%M%S") + ".json");
+    fs::create_directories(history.parent_path());
+    writeFileAtomic(history, content);
+    writeFileAtomic(bench_dir / "latest.json", content);
+    if (!opts.save.empty())
+        writeFileAtomic(bench_dir / (opts.save + ".json"), content);
+    LOG_VERBOSE("Results written to {}\n", history.string());
+
+    if (regressions > 0)
+        throw CPPX_Exception(fmt::format("{} benchmark(s) regressed against '{}'.", regressions, opts.compare));
+    print_status_message("Benchmarks finished", "✔", fmt::color::green);
+}
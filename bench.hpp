@@ -0,0 +1,36 @@
+#pragma once
+
+#include "helpers.hpp"
+
+// Robust summary of one benchmark's samples, in nanoseconds
+struct BenchStats
+{
+    size_t samples = 0;
+    double median = 0;
+    double p95 = 0;
+    double mad = 0; // Median absolute deviation from the median
+    double min = 0;
+};
+
+BenchStats summarizeSamples(std::vector<double> samples);
+
+// Two-sided p-value of the Mann-Whitney U test (normal approximation with tie correction) for the hypothesis that
+// both sample sets come from the same distribution
+double mannWhitneyPValue(const std::vector<double> &a, const std::vector<double> &b);
+
+// Formats nanoseconds with a unit that keeps three significant digits readable (ns, us, ms, s)
+std::string formatNanoseconds(double ns);
+
+struct Benchmark
+{
+    std::string name;
+    fs::path executable;
+    std::string toolchainId;
+};
+
+// Builds every benches/ file whose name contains filter against the project's objects (everything but main.cpp)
+// of the given configuration; binaries go to build/bench/bin/<profile>/. With startupProbe, an empty program
+// linked like the benchmarks is built there too, whose run time is the cost of starting a benchmark process.
+std::vector<Benchmark> buildBenchmarks(const ProjectContext &ctx, const BuildOptions &buildOpts,
+                                       const std::string &filter = {}, size_t jobs = 0,
+                                       fs::path *startupProbe = nullptr);
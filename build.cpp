@@ -0,0 +1,1303 @@
+#include "build.hpp"
+
+#include "distribute.hpp"
+#include "modules.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+fs::path resolveProjectPath(const ProjectConfig &proj, const std::string &p)
+{
+    const fs::path path = p;
+    return path.is_absolute() ? path : fs::path(proj.path) / path;
+}
+
+// Objects mirror the source tree under build/obj/<profile>/ so that two files with the same stem never collide.
+fs::path objectPathFor(const fs::path &objDir, const std::string &src)
+{
+    fs::path rel = fs::path(src).lexically_normal();
+    if (rel.is_absolute() || (!rel.empty() && *rel.begin() == ".."))
+    {
+        rel = fs::path("external") / fmt::format("{:x}_{}", std::hash<std::string>{}(rel.generic_string()),
+                                                  rel.filename().string());
+    }
+    rel += ".o";
+    return objDir / rel;
+}
+
+// The PCH is an input of every TU, so hash it once per build instead of once per TU
+std::string hashFileMemoized(const fs::path &file)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::pair<fs::file_time_type, std::string>> memo;
+
+    std::error_code ec;
+    const auto mtime = fs::last_write_time(file, ec);
+    if (ec)
+        return {};
+    {
+        std::lock_guard lock(mutex);
+        if (const auto it = memo.find(file.string()); it != memo.end() && it->second.first == mtime)
+            return it->second.second;
+    }
+    std::string digest = hashFile(file);
+    std::lock_guard lock(mutex);
+    memo.insert_or_assign(file.string(), std::pair(mtime, digest));
+    return digest;
+}
+
+// Replaces the project root by '.' wherever it starts a path, as in -I flags and the preprocessor's line markers, so a
+// checkout elsewhere computes the same cache keys
+std::string relativeToProject(const std::string &text, const std::string &root)
+{
+    if (root.empty())
+        return text;
+    std::string out;
+    out.reserve(text.size());
+    size_t pos = 0;
+    for (size_t found; (found = text.find(root, pos)) != std::string::npos; pos = found + root.size())
+    {
+        out.append(text, pos, found - pos);
+        const size_t end = found + root.size();
+        const bool whole = end == text.size() || text[end] == '/' || text[end] == '\\' || text[end] == '"';
+        out += whole ? std::string_view(".") : std::string_view(root);
+    }
+    out.append(text, pos);
+    return out;
+}
+
+// Rewriting an unchanged file would bump its mtime and rebuild everything that includes it
+void writeIfChanged(const fs::path &file, const std::string &content)
+{
+    std::ifstream existing(file, std::ios::binary);
+    const std::string current{std::istreambuf_iterator<char>(existing), std::istreambuf_iterator<char>()};
+    if (current != content)
+        std::ofstream(file, std::ios::binary) << content;
+}
+
+// Groups the sorted sources into unity batches of at most batchSize files. A batch starts at every file whose path
+// hash is a multiple of batchSize, so the cuts depend on the files around them and not on their count: adding or
+// removing a file only changes the batches up to the next of these cuts.
+std::vector<std::vector<std::string>> unityBatches(std::vector<std::string> sources, const size_t batchSize)
+{
+    std::ranges::sort(sources);
+    std::vector<std::vector<std::string>> batches;
+    for (auto &src : sources)
+    {
+        const uint64_t h = std::stoull(Hasher().update(fs::path(src).generic_string()).hexdigest().substr(0, 16),
+                                       nullptr, 16);
+        if (batches.empty() || batches.back().size() == batchSize || h % batchSize == 0)
+            batches.emplace_back();
+        batches.back().push_back(std::move(src));
+    }
+    return batches;
+}
+
+// Translates the structured fields of a profile into compile and link flags for compiler
+void applyBuildProfile(BuildPlan &plan, const BuildProfile &profile, const bool debug,
+                       std::vector<std::string> &compileFlags, std::vector<std::string> &linkFlags)
+{
+    const bool clang = isClangCompiler(plan.compiler);
+    const auto both = [&](const std::string &flag) {
+        compileFlags.push_back(flag);
+        linkFlags.push_back(flag); // LTO generates code at link time, so it needs the same options there
+    };
+
+    if (!profile.optLevel.empty())
+        both("-O" + profile.optLevel);
+    if (!profile.march.empty())
+        both("-march=" + profile.march);
+
+    std::string linker = profile.linker;
+    if (profile.lto == "thin")
+    {
+        both("-flto=thin");
+        // ThinLTO caches per-module codegen, which turns an incremental release link into relinking a few modules
+        const fs::path cache_dir = plan.buildDir / "lto-cache" / plan.objDir.filename();
+        fs::create_directories(cache_dir);
+#if defined(__APPLE__)
+        linkFlags.push_back("-Wl,-cache_path_lto," + cache_dir.string());
+#else
+        if (linker.empty() && (findProgram("ld.lld") || findProgram("lld")))
+            linker = "lld";
+        linkFlags.push_back(linker == "lld" ? "-Wl,--thinlto-cache-dir=" + cache_dir.string()
+                                            : "-Wl,-plugin-opt,cache-dir=" + cache_dir.string());
+#endif
+    }
+    else if (profile.lto == "full")
+    {
+        both(clang ? "-flto" : "-flto=auto");
+    }
+    if (!profile.lto.empty() && profile.lto != "off")
+        plan.archiver = clang ? (findProgram("llvm-ar") ? "llvm-ar" : "ar") : "gcc-ar";
+
+    if (!linker.empty())
+        linkFlags.push_back("-fuse-ld=" + linker);
+
+    const std::string debug_info = !profile.debugInfo.empty() ? profile.debugInfo : debug ? "full" : "none";
+    if (debug_info == "full")
+    {
+        both("-g");
+    }
+    else if (debug_info == "line-tables")
+    {
+        both(clang ? "-gline-tables-only" : "-g1");
+    }
+    else if (debug_info == "split")
+    {
+        // Debug info stays in a .dwo per object, so the linker only has to copy a fraction of it
+        both("-g");
+        compileFlags.emplace_back("-gsplit-dwarf");
+        if (linker == "lld" || linker == "gold" || linker == "mold")
+            linkFlags.emplace_back("-Wl,--gdb-index");
+        plan.splitDwarf = true;
+    }
+}
+
+bool isLinkableFile(const fs::path &libPath)
+{
+    return libPath.has_extension() &&
+           (libPath.extension() == ".a" || libPath.extension() == ".so" || libPath.extension() == ".lib");
+}
+
+// Plans the project itself (target empty) or one target of its workspace, whose objects and unity files live
+// under build/targets/<target>/ so that they never collide with the project's
+BuildPlan planTarget(const ProjectContext &ctx, const ProjectSettings &ps, const BuildOptions &opts,
+                     const std::string &target)
+{
+    const ProjectConfig &proj = ctx.project();
+    const toml::table &config = ctx.config();
+    const std::string &compiler = ctx.compiler();
+
+    BuildPlan plan;
+    plan.target = target;
+    plan.btype = ps.buildsettings.btype;
+    plan.projectDir = proj.path;
+    plan.buildDir = plan.projectDir / "build";
+    const fs::path target_dir = target.empty() ? plan.buildDir : plan.buildDir / "targets" / target;
+    plan.toolchainId =
+        fmt::format("{} {} {}", compiler, proj.toolchain.compilerPath.string(), proj.toolchain.compilerVersion);
+    const ToolchainCapabilities caps = toolchainCapabilities(compiler, ctx.globalConfig());
+
+    std::string output_name = ps.buildsettings.outputName;
+    BuildProfile build_profile;
+    if (!opts.config.empty())
+    {
+        if (auto loaded = loadBuildProfile(config, opts.config, compiler, caps))
+        {
+            build_profile = std::move(*loaded);
+        }
+        else
+        {
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                       "[WARNING] Configuration '{}' not found. Using default.\n", opts.config);
+        }
+    }
+    if (!build_profile.output.empty())
+        output_name = build_profile.output;
+
+    // Every configuration gets its own object directory so switching between them does not force a rebuild.
+    std::string profile = opts.config.empty() ? "default" : opts.config;
+    if (opts.debug)
+        profile += "-debug";
+    // Both PGO stages keep their own objects, so the instrumented build stays usable for retraining
+    plan.pgo = opts.pgoStage;
+    std::vector<std::string> pgo_flags;
+    if (opts.pgoStage != PgoStage::None)
+    {
+        plan.pgoDir = plan.buildDir / "pgo" / profile;
+        const bool clang = isClangCompiler(compiler);
+        if (opts.pgoStage == PgoStage::Instrument)
+        {
+            profile += "-pgo-gen";
+            pgo_flags = clang ? std::vector<std::string>{"-fprofile-instr-generate"}
+                              : std::vector<std::string>{"-fprofile-generate", "-fprofile-update=atomic"};
+        }
+        else
+        {
+            profile += "-pgo-use";
+            // GCC looks for <object>.gcda next to each object, where buildWithPgo puts the trained data
+            pgo_flags = clang ? std::vector<std::string>{"-fprofile-instr-use=" +
+                                                             (plan.pgoDir / "merged.profdata").string(),
+                                                         "-Wno-profile-instr-unprofiled"}
+                              : std::vector<std::string>{"-fprofile-use", "-Wno-missing-profile"};
+        }
+    }
+    if (opts.profiling)
+        profile += "-perf";
+    // -ftime-trace changes every command line, so traced objects live apart instead of invalidating the usual ones
+    if (opts.timeTrace && (caps.version.empty() ? isClangCompiler(compiler) : caps.timeTrace))
+    {
+        profile += "-time-trace";
+        plan.timeTrace = true;
+    }
+    else if (opts.timeTrace)
+    {
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                   "[WARNING] --time-trace needs Clang; {} does not support it, building without it.\n", compiler);
+    }
+    plan.objDir = target_dir / "obj" / profile;
+    plan.compiler = compiler;
+
+    std::vector<std::string> compile_flags;
+    std::vector<std::string> profile_link_flags;
+    applyBuildProfile(plan, build_profile, opts.debug, compile_flags, profile_link_flags);
+    compile_flags.insert(compile_flags.end(), build_profile.flags.begin(), build_profile.flags.end());
+    compile_flags.insert(compile_flags.end(), pgo_flags.begin(), pgo_flags.end());
+    if (plan.timeTrace)
+        compile_flags.emplace_back("-ftime-trace");
+    if (opts.profiling)
+    {
+        // Frame pointers make perf's call graphs cheap and complete; line tables are enough for symbolized stacks
+        compile_flags.insert(compile_flags.end(), {"-fno-omit-frame-pointer", "-g"});
+#if defined(__x86_64__) || defined(__aarch64__)
+        compile_flags.emplace_back("-mno-omit-leaf-frame-pointer");
+#endif
+        profile_link_flags.emplace_back("-g");
+    }
+    if (plan.btype == buildType::BUILD_DYNAMICLINK || ps.buildsettings.pic)
+        compile_flags.emplace_back("-fPIC");
+    // Debug info and __FILE__ then name sources relative to the project, so an object does not depend on where the
+    // project is checked out and the cache can share it between checkouts (GCC 8+, Clang 10+)
+    if (const int major = compilerMajorVersion(caps.version);
+        major == 0 || major >= ((caps.version.empty() ? isClangCompiler(compiler) : caps.family == "clang") ? 10 : 8))
+        compile_flags.push_back(fmt::format("-ffile-prefix-map={}=.", proj.path));
+    for (const auto &inc : ps.includepaths)
+        compile_flags.push_back("-I" + resolveProjectPath(proj, inc).string());
+    for (const auto &[name, value] : ps.defines)
+        compile_flags.push_back(fmt::format("-D{}={}", name, value));
+
+    // C++20 named modules: the units are scanned for what they import once they exist, see resolveModules
+    const bool modules = ps.buildsettings.modules || std::ranges::any_of(ps.srcfiles, [](const std::string &src) {
+                             return isModuleInterfaceFile(src);
+                         });
+    if (modules)
+    {
+        if (!caps.version.empty() && !caps.modules)
+            throw CPPX_Exception(fmt::format("{} cannot compile C++20 modules.", compiler));
+        if (std::ranges::none_of(compile_flags, [](const std::string &flag) { return flag.starts_with("-std="); }))
+            compile_flags.emplace_back("-std=c++20");
+        if (!isClangCompiler(compiler))
+            compile_flags.emplace_back("-fmodules-ts");
+    }
+
+    plan.compileFlags = compile_flags;
+
+    if (!ps.buildsettings.pch.empty())
+    {
+        // One PCH per configuration, compiler and flags, since it is only valid for the exact flags it was built
+        // with; workspace targets whose flags match end up with the same PCH and share it
+        CompileUnit pch;
+        pch.source = resolveProjectPath(proj, ps.buildsettings.pch);
+        const std::string pch_id =
+            Hasher().update(plan.toolchainId).update(joinCommand(compile_flags)).hexdigest().substr(0, 8);
+        const fs::path pchDir = plan.buildDir / "pch" / fmt::format("{}-{}", profile, pch_id);
+        if (isClangCompiler(compiler))
+        {
+            pch.object = pchDir / (pch.source.filename().string() + ".pch");
+            plan.pchFlags = {"-include-pch", pch.object.string()};
+        }
+        else
+        {
+            // GCC picks up <name>.gch next to the forwarding header written by schedulePch, or falls back to the
+            // header itself if the PCH is unusable
+            pch.object = pchDir / (pch.source.filename().string() + ".gch");
+            plan.pchFlags = {"-include", (pchDir / pch.source.filename()).string()};
+        }
+        pch.depfile = fs::path(pch.object).replace_extension(".d");
+        pch.args.push_back(compiler);
+        pch.args.insert(pch.args.end(), compile_flags.begin(), compile_flags.end());
+        pch.args.insert(pch.args.end(), {"-x", "c++-header", pch.source.string(), "-MMD", "-MF",
+                                         pch.depfile.string(), "-o", pch.object.string()});
+        plan.pch = std::move(pch);
+    }
+
+    // Unity mode: batch everything not excluded into build/unity/unity_<hash>.cpp; the rest compiles as usual
+    const fs::path unity_dir = target_dir / "unity";
+    std::vector<std::string> sources;
+    size_t unity_batch = ps.buildsettings.unityBatch > 0 ? ps.buildsettings.unityBatch : opts.unity ? 16 : 0;
+    if (modules && unity_batch > 0 && !opts.noUnity)
+    {
+        // A module unit has to start its own TU
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                   "[WARNING] Unity builds do not support C++20 modules, compiling every source on its own.\n");
+    }
+    if (opts.noUnity || modules)
+        unity_batch = 0;
+    if (unity_batch > 0)
+    {
+        plan.unityDir = unity_dir;
+        std::vector<std::string> batched;
+        for (const auto &src : ps.srcfiles)
+        {
+            const bool excluded = std::ranges::any_of(ps.buildsettings.unityExclude, [&](const std::string &ex) {
+                return fs::path(ex).lexically_normal() == fs::path(src).lexically_normal();
+            });
+            (excluded ? sources : batched).push_back(src);
+        }
+        for (const auto &batch : unityBatches(std::move(batched), unity_batch))
+        {
+            // Named after its first file rather than its position, so batches behind a moved cut keep their objects
+            GeneratedFile file;
+            file.path = unity_dir / fmt::format("unity_{}.cpp",
+                                                Hasher().update(fs::path(batch.front()).generic_string())
+                                                    .hexdigest()
+                                                    .substr(0, 8));
+            file.content = "// Generated by cppx for unity builds, do not edit\n";
+            for (const auto &src : batch)
+                file.content += fmt::format("#include \"{}\"\n", resolveProjectPath(proj, src).generic_string());
+            sources.push_back(file.path.string());
+            plan.generated.push_back(std::move(file));
+        }
+    }
+    else
+    {
+        sources = ps.srcfiles;
+    }
+
+    for (const auto &src : sources)
+    {
+        const fs::path source = resolveProjectPath(proj, src);
+        plan.units.push_back(makeCompileUnit(plan, source,
+                                             source.parent_path() == unity_dir
+                                                 ? plan.objDir / "unity" / (source.filename().string() + ".o")
+                                                 : objectPathFor(plan.objDir, src)));
+    }
+
+    // BMIs are only valid for the flags they were built with, like the objects
+    if (modules)
+        resolveModules(plan, caps, plan.buildDir / "modules" / (target.empty() ? profile : profile + "/" + target));
+
+    switch (plan.btype)
+    {
+    case buildType::BUILD_EXECUTABLE:
+        // Profiling builds must not replace the regular executable
+        plan.output = opts.profiling ? plan.buildDir / "perf" / output_name : plan.buildDir / output_name;
+        break;
+    case buildType::BUILD_DYNAMICLINK:
+        plan.output = plan.buildDir / fmt::format("lib{}.so", output_name);
+        break;
+    case buildType::BUILD_STATICLINK:
+        plan.output = plan.buildDir / fmt::format("lib{}.a", output_name);
+        break;
+    default:
+        throw CPPX_Exception("Unsupported buildType!");
+    }
+
+    plan.linkFlags = profile_link_flags;
+    plan.linkFlags.insert(plan.linkFlags.end(), build_profile.flags.begin(), build_profile.flags.end());
+    if (opts.pgoStage == PgoStage::Instrument)
+        plan.linkFlags.insert(plan.linkFlags.end(), pgo_flags.begin(), pgo_flags.end());
+    for (const auto &lib : ps.staticLinkFiles)
+    {
+        if (isLinkableFile(lib))
+            plan.linkLibs.push_back(lib);
+        else
+            plan.linkLibs.push_back("-l" + lib);
+    }
+    for (const auto &libpath : ps.LinkDirs)
+        plan.linkLibs.push_back("-L" + libpath);
+
+    computeLinkArgs(plan);
+    return plan;
+}
+
+// A [targets.<name>] table: the project's settings with the sources, type and output of the target, its include
+// directories in front of the project's and its defines merged over the project's
+ProjectSettings targetSettings(const ProjectSettings &project, const std::string &name, const toml::table &table)
+{
+    ProjectSettings ps = project;
+    ps.srcfiles = readTomlArray(&table, "src files");
+    if (ps.srcfiles.empty())
+        throw CPPX_Exception(fmt::format("Invalid configuration: [targets.{}] has no 'src files'!", name));
+    if (table.contains("include directories"))
+    {
+        std::vector<std::string> includes = readTomlArray(&table, "include directories");
+        ps.includepaths.insert(ps.includepaths.begin(), includes.begin(), includes.end());
+    }
+    if (table.contains("static_linked"))
+    {
+        for (auto &lib : readTomlArray(&table, "static_linked"))
+            ps.staticLinkFiles.push_back(std::move(lib));
+    }
+    if (table.contains("static_linked_dirs"))
+    {
+        for (auto &dir : readTomlArray(&table, "static_linked_dirs"))
+            ps.LinkDirs.push_back(std::move(dir));
+    }
+
+    BuildSettings &bset = ps.buildsettings;
+    bset.btype = parseBuildType(table["build_type"].value_or<std::string>("_default"));
+    bset.outputName = table["build_name"].value_or<std::string>(name);
+    bset.deps = table.contains("deps") ? readTomlArray(&table, "deps") : std::vector<std::string>{};
+    bset.pch = table["pch"].value_or<std::string>(bset.pch);
+    if (table.contains("unity_batch"))
+        bset.unityBatch = static_cast<size_t>(std::max<int64_t>(table["unity_batch"].value_or<int64_t>(0), 0));
+    if (table.contains("unity_exclude"))
+        bset.unityExclude = readTomlArray(&table, "unity_exclude");
+    bset.modules = table["modules"].value_or(bset.modules);
+
+    if (const toml::table *defines = table["defines"].as_table())
+    {
+        for (const auto &[key, node] : *defines)
+        {
+            if (!node.is_string())
+            {
+                throw CPPX_Exception(fmt::format(
+                    "Invalid configuration: define value for '{}' in [targets.{}] is not a string!", key.str(), name));
+            }
+            ps.defines[std::string(key.str())] = node.value_or("");
+        }
+    }
+
+    for (const auto &[key, node] : table)
+    {
+        static const std::vector<std::string_view> known{
+            "src files", "include directories", "static_linked", "static_linked_dirs", "build_type", "build_name",
+            "deps",      "pch",                 "unity_batch",   "unity_exclude",      "defines",    "modules"};
+        if (std::ranges::find(known, key.str()) == known.end())
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                       "[WARNING] Unknown key '{}' in [targets.{}], ignoring it.\n", key.str(), name);
+    }
+    return ps;
+}
+
+// The plans of the whole workspace, dependencies first. only limits them to one target ("" = the project itself)
+// and what it depends on; the project itself is left out of a full build when [targets] exist and it has no sources.
+std::vector<BuildPlan> workspacePlans(const ProjectContext &ctx, const BuildOptions &opts,
+                                      const std::optional<std::string> &only)
+{
+    const toml::table *targets_table = ctx.config()["targets"].as_table();
+    if (!targets_table)
+        return {planTarget(ctx, ctx.settings(), opts, "")};
+
+    // Every target by name; the project itself is "", which no target can depend on
+    std::map<std::string, ProjectSettings> targets;
+    std::map<std::string, std::vector<std::string>> exported; // Include directories dependents compile with
+    targets.emplace("", ctx.settings());
+    exported.emplace("", std::vector<std::string>{});
+    for (const auto &[key, node] : *targets_table)
+    {
+        const std::string name(key.str());
+        const toml::table *table = node.as_table();
+        if (!table)
+            throw CPPX_Exception(fmt::format("Invalid configuration: [targets.{}] is not a table!", name));
+        targets.emplace(name, targetSettings(ctx.settings(), name, *table));
+        exported.emplace(name, table->contains("include directories")
+                                   ? readTomlArray(table, "include directories")
+                                   : std::vector<std::string>{});
+    }
+    const auto label = [&ctx](const std::string &name) {
+        return name.empty() ? fmt::format("project '{}'", ctx.project().name) : fmt::format("target '{}'", name);
+    };
+
+    // Dependencies before dependents; also rejects unknown targets, executables as dependencies and cycles
+    std::vector<std::string> order;
+    std::map<std::string, bool> on_stack;
+    const std::function<void(const std::string &)> visit = [&](const std::string &name) {
+        if (const auto it = on_stack.find(name); it != on_stack.end())
+        {
+            if (it->second)
+                throw CPPX_Exception(fmt::format("Invalid configuration: {} depends on itself!", label(name)));
+            return;
+        }
+        on_stack[name] = true;
+        for (const auto &dep : targets.at(name).buildsettings.deps)
+        {
+            const auto it = targets.find(dep);
+            if (dep.empty() || it == targets.end())
+                throw CPPX_Exception(
+                    fmt::format("Invalid configuration: {} depends on unknown target '{}'!", label(name), dep));
+            if (it->second.buildsettings.btype == buildType::BUILD_EXECUTABLE)
+                throw CPPX_Exception(fmt::format(
+                    "Invalid configuration: {} depends on executable '{}', which cannot be linked!", label(name), dep));
+            visit(dep);
+        }
+        on_stack[name] = false;
+        order.push_back(name);
+    };
+    for (const auto &[name, settings] : targets)
+    {
+        if (!name.empty())
+            visit(name);
+    }
+    visit("");
+
+    // Static libraries that end up inside a shared one need position-independent code. Flags never depend on which
+    // targets are selected, so building one target reuses the objects of a full build.
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+    {
+        const BuildSettings &bset = targets.at(*it).buildsettings;
+        if (bset.btype != buildType::BUILD_DYNAMICLINK && !bset.pic)
+            continue;
+        for (const auto &dep : bset.deps)
+        {
+            if (BuildSettings &dep_bset = targets.at(dep).buildsettings; dep_bset.btype == buildType::BUILD_STATICLINK)
+                dep_bset.pic = true;
+        }
+    }
+    for (const auto &name : order)
+    {
+        ProjectSettings &ps = targets.at(name);
+        std::vector<std::string> includes = exported.at(name);
+        for (const auto &dep : ps.buildsettings.deps)
+        {
+            for (const auto &dir : exported.at(dep))
+            {
+                if (std::ranges::find(includes, dir) == includes.end())
+                    includes.push_back(dir);
+                if (std::ranges::find(ps.includepaths, dir) == ps.includepaths.end())
+                    ps.includepaths.push_back(dir);
+            }
+        }
+        exported.at(name) = std::move(includes);
+    }
+
+    std::set<std::string> selected;
+    const std::function<void(const std::string &)> select = [&](const std::string &name) {
+        if (selected.insert(name).second)
+        {
+            for (const auto &dep : targets.at(name).buildsettings.deps)
+                select(dep);
+        }
+    };
+    if (only)
+    {
+        if (!targets.contains(*only))
+            throw CPPX_Exception(fmt::format("Unknown target '{}'. Targets are listed under [targets] in config.toml.",
+                                             *only));
+        select(*only);
+    }
+    else
+    {
+        for (const auto &[name, settings] : targets)
+        {
+            if (!name.empty() || !settings.srcfiles.empty() || targets.size() == 1)
+                select(name);
+        }
+    }
+
+    std::vector<BuildPlan> plans;
+    std::map<std::string, size_t> plan_of;
+    std::unordered_map<std::string, CompileUnit> units_by_flags; // Lets targets reuse objects compiled the same way
+    std::map<fs::path, std::string> output_of;
+    for (const auto &name : order)
+    {
+        if (!selected.contains(name))
+            continue;
+        BuildPlan plan = planTarget(ctx, targets.at(name), opts, name);
+        if (const auto [it, inserted] = output_of.emplace(plan.output, name); !inserted)
+            throw CPPX_Exception(fmt::format("Invalid configuration: {} and {} both build {}.", label(it->second),
+                                             label(name), plan.output.string()));
+
+        const std::string flags = joinCommand(plan.compileFlags) + '\0' + joinCommand(plan.pchFlags);
+        for (auto &unit : plan.units)
+        {
+            // Module units read and write the BMIs of their own target, so only plain TUs are shared
+            if (!unit.extraOutputs.empty() || unit.implicitDeps.size() > (plan.pch ? 1 : 0))
+                continue;
+            const auto [it, inserted] = units_by_flags.try_emplace(unit.source.string() + '\0' + flags, unit);
+            if (!inserted)
+                unit = it->second;
+        }
+
+        // Dependents link before their dependencies; a shared library already contains its static dependencies
+        if (plan.btype != buildType::BUILD_STATICLINK)
+        {
+            const std::function<void(const std::string &)> link = [&](const std::string &dep) {
+                std::erase(plan.linkedTargets, dep);
+                plan.linkedTargets.push_back(dep);
+                if (targets.at(dep).buildsettings.btype == buildType::BUILD_STATICLINK)
+                {
+                    for (const auto &next : targets.at(dep).buildsettings.deps)
+                        link(next);
+                }
+            };
+            for (const auto &dep : targets.at(name).buildsettings.deps)
+                link(dep);
+
+            std::vector<std::string> libs;
+            bool shared = false;
+            for (const auto &dep : plan.linkedTargets)
+            {
+                const BuildPlan &dep_plan = plans[plan_of.at(dep)];
+                libs.push_back(dep_plan.output.string());
+                shared = shared || dep_plan.btype == buildType::BUILD_DYNAMICLINK;
+            }
+#if !defined(_WIN32)
+            // Shared targets are loaded from build/ wherever the executable is started from
+            if (shared)
+                libs.push_back("-Wl,-rpath," + plan.buildDir.string());
+#endif
+            plan.linkLibs.insert(plan.linkLibs.begin(), libs.begin(), libs.end());
+            computeLinkArgs(plan);
+        }
+        plan_of.emplace(name, plans.size());
+        plans.push_back(std::move(plan));
+    }
+    return plans;
+}
+} // namespace
+
+BuildPlan makeBuildPlan(const ProjectContext &ctx, const BuildOptions &opts)
+{
+    return workspacePlans(ctx, opts, "").back();
+}
+
+std::vector<BuildPlan> makeWorkspacePlans(const ProjectContext &ctx, const BuildOptions &opts)
+{
+    if (opts.target.empty())
+        return workspacePlans(ctx, opts, std::nullopt);
+    // The project itself goes by its name, unless a target has the same one
+    const toml::table *targets = ctx.config()["targets"].as_table();
+    if (opts.target == ctx.project().name && !(targets && targets->contains(opts.target)))
+        return workspacePlans(ctx, opts, "");
+    if (!targets)
+        throw CPPX_Exception(fmt::format("Unknown target '{}': config.toml has no [targets].", opts.target));
+    return workspacePlans(ctx, opts, opts.target);
+}
+
+void computeLinkArgs(BuildPlan &plan)
+{
+    plan.linkArgs.clear();
+    if (plan.btype == buildType::BUILD_STATICLINK)
+    {
+        plan.linkArgs = {plan.archiver, "rcs", plan.output.string()};
+        for (const auto &unit : plan.units)
+            plan.linkArgs.push_back(unit.object.string());
+        return;
+    }
+
+    plan.linkArgs.push_back(plan.compiler);
+    plan.linkArgs.insert(plan.linkArgs.end(), plan.linkFlags.begin(), plan.linkFlags.end());
+    if (plan.btype == buildType::BUILD_DYNAMICLINK)
+        plan.linkArgs.emplace_back("-shared");
+    for (const auto &unit : plan.units)
+        plan.linkArgs.push_back(unit.object.string());
+    plan.linkArgs.insert(plan.linkArgs.end(), plan.linkLibs.begin(), plan.linkLibs.end());
+    plan.linkArgs.insert(plan.linkArgs.end(), {"-o", plan.output.string()});
+}
+
+std::optional<BuildProfile> loadBuildProfile(const toml::table &config, const std::string &name,
+                                             const std::string &compiler, const ToolchainCapabilities &caps)
+{
+    const toml::table *configs = config["configurations"].as_table();
+    const toml::table *conf = configs ? (*configs)[name].as_table() : nullptr;
+    if (!conf)
+        return std::nullopt;
+
+    const auto field = [&](const std::string_view key, const std::vector<std::string> &allowed) -> std::string {
+        const toml::node *node = conf->get(key);
+        if (!node)
+            return {};
+        std::optional<std::string> value = node->value<std::string>();
+        if (!value && node->is_integer())
+            value = std::to_string(node->value_or(int64_t{0})); // opt_level = 2
+        if (!value)
+            throw CPPX_Exception(fmt::format("[configurations.{}] {} must be a string.", name, key));
+        if (!allowed.empty() && std::ranges::find(allowed, *value) == allowed.end())
+            throw CPPX_Exception(fmt::format("[configurations.{}] {} = \"{}\" is not one of: {}.", name, key, *value,
+                                             fmt::join(allowed, ", ")));
+        return *value;
+    };
+
+    BuildProfile profile;
+    profile.name = name;
+    if (conf->contains("flags"))
+        profile.flags = readTomlArray(conf, "flags");
+    profile.output = (*conf)["output"].value_or(std::string{});
+    profile.optLevel = field("opt_level", {"0", "1", "2", "3", "s", "z", "g", "fast"});
+    profile.lto = field("lto", {"off", "thin", "full"});
+    profile.march = field("march", {});
+    profile.linker = field("linker", {"mold", "lld", "gold", "bfd"});
+    profile.debugInfo = field("debug_info", {"none", "line-tables", "full", "split"});
+
+    // Only what the active toolchain can actually do gets through, instead of failing halfway through a build.
+    // The probed capabilities decide where known; a compiler that could not be probed gets the name-based checks.
+    const bool probed = !caps.version.empty();
+    const bool clang = probed ? caps.family == "clang" : isClangCompiler(compiler);
+    const int major = compilerMajorVersion(caps.version);
+    if (profile.lto == "thin" && (probed ? !caps.thinLto : !clang))
+        throw CPPX_Exception(fmt::format("[configurations.{}] lto = \"thin\" needs Clang; {} supports lto = \"full\".",
+                                         name, compiler));
+    if (profile.optLevel == "z" && !clang && major > 0 && major < 12)
+        throw CPPX_Exception(fmt::format("[configurations.{}] opt_level = \"z\" needs GCC 12 or Clang.", name));
+    if (!profile.march.empty() && probed && !caps.march.empty() &&
+        std::ranges::find(caps.march, profile.march) == caps.march.end())
+        throw CPPX_Exception(fmt::format("[configurations.{}] march = \"{}\" is not supported by {}.", name,
+                                         profile.march, compiler));
+    if (!profile.linker.empty() && probed)
+    {
+        if (std::ranges::find(caps.linkers, profile.linker) == caps.linkers.end())
+            throw CPPX_Exception(fmt::format("[configurations.{}] linker = \"{}\" does not link with {} (usable: {}).",
+                                             name, profile.linker, compiler,
+                                             caps.linkers.empty() ? "none" : fmt::format("{}", fmt::join(caps.linkers, ", "))));
+    }
+    else if (!profile.linker.empty())
+    {
+        const std::string program = profile.linker == "mold" ? "mold" : "ld." + profile.linker;
+        if (!findProgram(program) && !findProgram(profile.linker == "lld" ? "ld64.lld" : program))
+            throw CPPX_Exception(
+                fmt::format("[configurations.{}] linker = \"{}\", but {} is not on PATH.", name, profile.linker, program));
+        if (profile.linker == "mold" && !clang && major > 0 && major < 12)
+            throw CPPX_Exception(fmt::format("[configurations.{}] -fuse-ld=mold needs GCC 12.1 or newer.", name));
+    }
+#if defined(__APPLE__) || defined(_WIN32)
+    if (profile.debugInfo == "split")
+        throw CPPX_Exception(fmt::format("[configurations.{}] debug_info = \"split\" needs an ELF platform.", name));
+#endif
+    for (const auto &[key, value] : *conf)
+    {
+        static const std::vector<std::string_view> known{"flags",  "output", "opt_level", "lto",
+                                                         "march",  "linker", "debug_info"};
+        if (std::ranges::find(known, key.str()) == known.end())
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                       "[WARNING] Unknown key '{}' in [configurations.{}], ignoring it.\n", key.str(), name);
+    }
+    return profile;
+}
+
+CompileUnit makeCompileUnit(const BuildPlan &plan, const fs::path &source, const fs::path &object)
+{
+    CompileUnit unit;
+    unit.source = source;
+    unit.object = object;
+    unit.depfile = fs::path(object).replace_extension(".d");
+    unit.projectDir = plan.projectDir;
+    if (plan.splitDwarf)
+        unit.extraOutputs.push_back(fs::path(object).replace_extension(".dwo"));
+    if (plan.timeTrace)
+        unit.extraOutputs.push_back(fs::path(object).replace_extension(".json"));
+    if (plan.pch)
+        unit.implicitDeps.push_back(plan.pch->object);
+    if (plan.pgo == PgoStage::Optimize)
+    {
+        // The profile is an input of the object just like the source, for the database and the cache key
+        const fs::path profile = isClangCompiler(plan.compiler) ? plan.pgoDir / "merged.profdata"
+                                                                : fs::path(object).replace_extension(".gcda");
+        if (std::error_code ec; fs::exists(profile, ec))
+            unit.implicitDeps.push_back(profile);
+    }
+    unit.args.push_back(plan.compiler);
+    unit.args.insert(unit.args.end(), plan.compileFlags.begin(), plan.compileFlags.end());
+    unit.args.insert(unit.args.end(), plan.pchFlags.begin(), plan.pchFlags.end());
+    unit.args.insert(unit.args.end(), {"-MMD", "-MF", unit.depfile.string()});
+    unit.args.emplace_back("-c");
+    // Not every compiler recognizes the extensions of module interfaces
+    if (isModuleInterfaceFile(source))
+        unit.args.insert(unit.args.end(), {"-x", isClangCompiler(plan.compiler) ? "c++-module" : "c++"});
+    unit.args.insert(unit.args.end(), {unit.source.string(), "-o", unit.object.string()});
+    return unit;
+}
+
+std::vector<JobScheduler::JobId> scheduleCompiles(JobScheduler &scheduler, const BuildPlan &plan,
+                                                  BuildDatabase &db, CompilationCache *cache,
+                                                  const std::vector<const CompileUnit *> &units,
+                                                  RemoteCompiler *remote)
+{
+    return scheduleUnitCompiles(scheduler, plan, db, cache, units, schedulePch(scheduler, plan, db), remote);
+}
+
+std::vector<JobScheduler::JobId> scheduleUnitCompiles(JobScheduler &scheduler, const BuildPlan &plan,
+                                                      BuildDatabase &db, CompilationCache *cache,
+                                                      const std::vector<const CompileUnit *> &units,
+                                                      const std::optional<JobScheduler::JobId> pch_job,
+                                                      RemoteCompiler *remote)
+{
+    // A rebuilt PCH invalidates every TU; the cache still deduplicates the ones whose inputs did not change
+    std::vector<JobScheduler::JobId> pch_deps;
+    if (pch_job)
+        pch_deps.push_back(*pch_job);
+
+    // A unit reading another one's extra output, such as a module BMI, compiles after it and whenever it does
+    std::unordered_map<std::string, JobScheduler::JobId> producers;
+    std::vector<JobScheduler::JobId> jobs;
+    for (const CompileUnit *unit : units)
+    {
+        std::vector<JobScheduler::JobId> deps = pch_deps;
+        for (const auto &input : unit->implicitDeps)
+        {
+            if (const auto it = producers.find(input.string()); it != producers.end())
+                deps.push_back(it->second);
+        }
+        if (deps.empty() && db.isUpToDate(*unit, plan.toolchainId))
+        {
+            LOG_VERBOSE("Up to date: {}\n", unit->source.string());
+            continue;
+        }
+        fs::create_directories(unit->object.parent_path());
+        LOG_VERBOSE("Compiling: {}\n", joinCommand(unit->args));
+        jobs.push_back(scheduler.add({fmt::format("Compiling: {}", unit->source.filename().string()),
+                                      [unit, &plan, cache, remote] {
+                                          return compileUnit(*unit, cache, plan.toolchainId, remote);
+                                      },
+                                      [&db, unit, &plan](const JobResult &) { db.record(*unit, plan.toolchainId); }},
+                                     deps));
+        for (const auto &output : unit->extraOutputs)
+            producers.emplace(output.string(), jobs.back());
+    }
+    return jobs;
+}
+
+void writeGeneratedFiles(const BuildPlan &plan)
+{
+    for (const auto &file : plan.generated)
+    {
+        fs::create_directories(file.path.parent_path());
+        writeIfChanged(file.path, file.content);
+    }
+
+    // Only clean up while in unity mode; a non-unity build of another configuration plans no unity files at all
+    if (plan.unityDir.empty())
+        return;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(plan.unityDir, ec))
+    {
+        const bool planned =
+            std::ranges::any_of(plan.generated, [&](const GeneratedFile &f) { return f.path == entry.path(); });
+        if (!planned && entry.is_regular_file(ec))
+            fs::remove(entry.path(), ec);
+    }
+}
+
+bool isClangCompiler(const std::string &compiler)
+{
+    return fs::path(compiler).filename().string().find("clang") != std::string::npos;
+}
+
+void writePchForwarder(const BuildPlan &plan)
+{
+    if (!plan.pch)
+        return;
+    fs::create_directories(plan.pch->object.parent_path());
+    if (!isClangCompiler(plan.pch->args.front()))
+    {
+        const fs::path forward = plan.pch->object.parent_path() / plan.pch->source.filename();
+        writeIfChanged(forward, fmt::format("#include \"{}\"\n", plan.pch->source.generic_string()));
+    }
+}
+
+std::optional<JobScheduler::JobId> schedulePch(JobScheduler &scheduler, const BuildPlan &plan, BuildDatabase &db)
+{
+    if (!plan.pch)
+        return std::nullopt;
+
+    const CompileUnit &pch = *plan.pch;
+    writePchForwarder(plan);
+
+    if (db.isUpToDate(pch, plan.toolchainId))
+    {
+        LOG_VERBOSE("Precompiled header is up to date: {}\n", pch.object.string());
+        return std::nullopt;
+    }
+    LOG_VERBOSE("Precompiling: {}\n", joinCommand(pch.args));
+    return scheduler.add({fmt::format("Precompiling header: {}", pch.source.filename().string()),
+                          [&pch] { return compileUnit(pch, nullptr, {}); },
+                          [&db, &pch, &plan](const JobResult &) { db.record(pch, plan.toolchainId); }});
+}
+
+JobResult compileUnit(const CompileUnit &unit, CompilationCache *cache, const std::string &toolchainId,
+                      RemoteCompiler *remote)
+{
+    std::error_code ec;
+    fs::remove(unit.object, ec); // Never write through a hardlink into the cache
+
+    const bool distribute = remote && remote->eligible(unit);
+    if ((!cache && !distribute) || !unit.extraOutputs.empty())
+        return runProcess(unit.args);
+
+    // Same invocation with -E: also writes the depfile, which a cache hit or a remote compile would otherwise lack
+    const fs::path preprocessed = fs::path(unit.object) += ".ii";
+    std::vector<std::string> preprocess = unit.args;
+    const std::string root = unit.projectDir.string();
+    Hasher hasher;
+    hasher.update(toolchainId);
+    for (size_t i = 0; i < preprocess.size(); ++i)
+    {
+        if (preprocess[i] == "-c")
+        {
+            preprocess[i] = "-E";
+        }
+        else if ((preprocess[i] == "-o" || preprocess[i] == "-MF") && i + 1 < preprocess.size())
+        {
+            // Output locations do not change the object, keep them out of the key
+            if (preprocess[i] == "-o")
+                preprocess[i + 1] = preprocessed.string();
+            ++i;
+            continue;
+        }
+        hasher.update(relativeToProject(preprocess[i], root)).update(std::string_view("\0", 1));
+    }
+
+    Trace::Clock::time_point phase = Trace::Clock::now();
+    const bool preprocessed_ok = runProcess(preprocess).exitCode == 0;
+    if (Trace::enabled())
+        Trace::complete("preprocess", "compile", phase, Trace::Clock::now(), {{"source", unit.source.string()}});
+    if (!preprocessed_ok)
+    {
+        // Let the real compile report the error
+        fs::remove(preprocessed, ec);
+        return runProcess(unit.args);
+    }
+
+    std::string key;
+    if (cache)
+    {
+        if (root.empty())
+        {
+            hasher.updateFile(preprocessed);
+        }
+        else
+        {
+            std::ifstream in(preprocessed, std::ios::binary);
+            std::ostringstream text;
+            text << in.rdbuf();
+            hasher.update(relativeToProject(text.str(), root));
+        }
+        // With -include-pch the preprocessed output does not contain the PCH's headers
+        for (const auto &dep : unit.implicitDeps)
+            hasher.update(hashFileMemoized(dep));
+
+        key = hasher.hexdigest();
+        phase = Trace::Clock::now();
+        const bool hit = cache->fetch(key, unit.object);
+        if (Trace::enabled())
+            Trace::complete(hit ? "cache hit" : "cache miss", "cache", phase, Trace::Clock::now(),
+                            {{"source", unit.source.string()}, {"key", key}});
+        if (hit)
+        {
+            fs::remove(preprocessed, ec);
+            return {0, ""};
+        }
+    }
+
+    std::optional<JobResult> result;
+    if (distribute)
+        result = remote->compile(unit, preprocessed);
+    fs::remove(preprocessed, ec);
+    if (!result)
+    {
+        phase = Trace::Clock::now();
+        result = runProcess(unit.args);
+        if (Trace::enabled())
+            Trace::complete("compile", "compile", phase, Trace::Clock::now(), {{"source", unit.source.string()}});
+    }
+    if (cache && result->exitCode == 0)
+        cache->store(key, unit.object);
+    return *result;
+}
+
+std::vector<std::string> parseDepfile(const std::string &content)
+{
+    std::vector<std::string> deps;
+    std::string current;
+    bool in_prerequisites = false;
+
+    auto flush = [&] {
+        if (!current.empty() && in_prerequisites)
+            deps.push_back(current);
+        current.clear();
+    };
+
+    for (size_t i = 0; i < content.size(); ++i)
+    {
+        const char c = content[i];
+        if (c == '\\' && i + 1 < content.size())
+        {
+            const char next = content[i + 1];
+            if (next == '\n' || next == '\r')
+            {
+                // Line continuation
+                flush();
+                i += (next == '\r' && i + 2 < content.size() && content[i + 2] == '\n') ? 2 : 1;
+                continue;
+            }
+            if (next == ' ' || next == '#' || next == '\\')
+            {
+                current += next;
+                ++i;
+                continue;
+            }
+            current += c;
+        }
+        else if (c == '$' && i + 1 < content.size() && content[i + 1] == '$')
+        {
+            current += '$';
+            ++i;
+        }
+        else if (c == ':' && !in_prerequisites &&
+                 (i + 1 == content.size() || content[i + 1] == ' ' || content[i + 1] == '\n' ||
+                  content[i + 1] == '\r'))
+        {
+            // The target ends at the first ':' followed by whitespace, so drive letters like C:\ survive
+            current.clear();
+            in_prerequisites = true;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r')
+        {
+            flush();
+        }
+        else if (c == '\n')
+        {
+            flush();
+            if (in_prerequisites)
+                break; // Only the first rule lists the real prerequisites
+        }
+        else
+        {
+            current += c;
+        }
+    }
+    flush();
+    return deps;
+}
+
+namespace
+{
+struct RetainedDatabase
+{
+    std::pair<fs::file_time_type, uintmax_t> stamp;
+    std::shared_ptr<const BuildDatabase> db;
+};
+
+std::mutex retained_mutex;
+std::unordered_map<std::string, RetainedDatabase> retained_databases;
+
+std::optional<std::pair<fs::file_time_type, uintmax_t>> databaseStamp(const fs::path &file)
+{
+    std::error_code ec;
+    const auto mtime = fs::last_write_time(file, ec);
+    if (ec)
+        return std::nullopt;
+    const auto size = fs::file_size(file, ec);
+    if (ec)
+        return std::nullopt;
+    return std::pair(mtime, size);
+}
+
+std::shared_ptr<const BuildDatabase> retainedDatabase(const fs::path &file)
+{
+    std::lock_guard lock(retained_mutex);
+    const auto it = retained_databases.find(file.string());
+    if (it == retained_databases.end())
+        return nullptr;
+    if (databaseStamp(file) != it->second.stamp)
+    {
+        retained_databases.erase(it);
+        return nullptr;
+    }
+    return it->second.db;
+}
+} // namespace
+
+BuildDatabase::BuildDatabase(fs::path file) : _file(std::move(file))
+{
+    // Only the daemon retains databases, so a plain CLI run always parses
+    if (const auto retained = retainedDatabase(_file))
+    {
+        *this = *retained;
+        return;
+    }
+    parse();
+}
+
+void BuildDatabase::retain(const fs::path &file)
+{
+    const auto stamp = databaseStamp(file);
+    if (!stamp)
+        return;
+    {
+        std::lock_guard lock(retained_mutex);
+        if (const auto it = retained_databases.find(file.string());
+            it != retained_databases.end() && it->second.stamp == *stamp)
+            return;
+    }
+    auto db = std::make_shared<BuildDatabase>(file);
+    std::lock_guard lock(retained_mutex);
+    retained_databases.insert_or_assign(file.string(), RetainedDatabase{*stamp, std::move(db)});
+}
+
+void BuildDatabase::parse()
+{
+    std::ifstream in(_file);
+    if (!in.is_open())
+        return;
+
+    const json data = json::parse(in, nullptr, false);
+    if (!data.is_object() || !data.contains("files") || !data.contains("units"))
+        return;
+
+    for (const auto &f : data["files"])
+        intern(f.get<std::string>());
+    for (const auto &[object, unit] : data["units"].items())
+    {
+        Entry entry;
+        entry.command = unit.value("command", "");
+        entry.toolchain = unit.value("toolchain", "");
+        if (unit.contains("deps"))
+        {
+            for (const auto &dep : unit["deps"])
+            {
+                if (const auto id = dep.get<uint32_t>(); id < _files.size())
+                    entry.deps.push_back(id);
+            }
+        }
+        _units.emplace(object, std::move(entry));
+    }
+    _link = data.value("link", "");
+}
+
+uint32_t BuildDatabase::intern(const std::string &path)
+{
+    if (const auto it = _fileIndex.find(path); it != _fileIndex.end())
+        return it->second;
+    const auto id = static_cast<uint32_t>(_files.size());
+    _files.push_back(path);
+    _fileIndex.emplace(path, id);
+    _mtimes.emplace_back();
+    _statted.push_back(false);
+    return id;
+}
+
+std::optional<fs::file_time_type> BuildDatabase::mtime(const uint32_t file) const
+{
+    if (!_statted[file])
+    {
+        std::error_code ec;
+        const auto t = fs::last_write_time(_files[file], ec);
+        _mtimes[file] = ec ? std::nullopt : std::optional(t);
+        _statted[file] = true;
+    }
+    return _mtimes[file];
+}
+
+bool BuildDatabase::isUpToDate(const CompileUnit &unit, const std::string &toolchainId) const
+{
+    const auto it = _units.find(unit.object.string());
+    if (it == _units.end())
+        return false;
+    const Entry &entry = it->second;
+    if (entry.command != joinCommand(unit.args) || entry.toolchain != toolchainId)
+        return false;
+
+    std::error_code ec;
+    const auto objTime = fs::last_write_time(unit.object, ec);
+    if (ec)
+        return false;
+    // Such as a module's BMI, which its importers cannot do without
+    if (!std::ranges::all_of(unit.extraOutputs, [&ec](const fs::path &output) { return fs::exists(output, ec); }))
+        return false;
+    const auto srcTime = fs::last_write_time(unit.source, ec);
+    if (ec || srcTime > objTime)
+        return false;
+    for (const auto &dep : unit.implicitDeps)
+    {
+        if (const auto depTime = fs::last_write_time(dep, ec); ec || depTime > objTime)
+            return false;
+    }
+
+    // A header that disappeared also means the TU has to be rebuilt
+    return std::ranges::all_of(entry.deps, [&](const uint32_t dep) {
+        const auto depTime = mtime(dep);
+        return depTime && *depTime <= objTime;
+    });
+}
+
+void BuildDatabase::record(const CompileUnit &unit, const std::string &toolchainId)
+{
+    Entry entry;
+    entry.command = joinCommand(unit.args);
+    entry.toolchain = toolchainId;
+
+    if (std::ifstream in(unit.depfile); in.is_open())
+    {
+        const std::string content{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        for (const auto &dep : parseDepfile(content))
+        {
+            const uint32_t id = intern(fs::absolute(dep).lexically_normal().string());
+            _statted[id] = false; // The compile may have regenerated it
+            entry.deps.push_back(id);
+        }
+    }
+    else
+    {
+        LOG_VERBOSE("No depfile for {}, header changes will not be tracked\n", unit.source.string());
+    }
+    _units.insert_or_assign(unit.object.string(), std::move(entry));
+}
+
+bool BuildDatabase::isLinkUpToDate(const BuildPlan &plan) const
+{
+    if (_link != joinCommand(plan.linkArgs))
+        return false;
+
+    std::error_code ec;
+    const auto outTime = fs::last_write_time(plan.output, ec);
+    if (ec)
+        return false;
+    for (const auto &unit : plan.units)
+    {
+        const auto objTime = fs::last_write_time(unit.object, ec);
+        if (ec || objTime > outTime)
+            return false;
+    }
+    // Libraries given as files, such as the outputs of workspace targets, relink the output when they change
+    for (const auto &lib : plan.linkLibs)
+    {
+        if (lib.starts_with("-"))
+            continue;
+        if (const auto libTime = fs::last_write_time(lib, ec); !ec && libTime > outTime)
+            return false;
+    }
+    return true;
+}
+
+void BuildDatabase::recordLink(const BuildPlan &plan)
+{
+    _link = joinCommand(plan.linkArgs);
+}
+
+void BuildDatabase::save() const
+{
+    // Re-intern only the files still referenced, so headers of deleted TUs drop out of the table
+    std::vector<std::string> files;
+    std::unordered_map<uint32_t, uint32_t> remap;
+    json units = json::object();
+    for (const auto &[object, entry] : _units)
+    {
+        json deps = json::array();
+        for (const uint32_t dep : entry.deps)
+        {
+            auto [it, inserted] = remap.try_emplace(dep, static_cast<uint32_t>(files.size()));
+            if (inserted)
+                files.push_back(_files[dep]);
+            deps.push_back(it->second);
+        }
+        units[object] = {{"command", entry.command}, {"toolchain", entry.toolchain}, {"deps", std::move(deps)}};
+    }
+
+    const json data = {{"files", files}, {"units", std::move(units)}, {"link", _link}};
+
+    fs::create_directories(_file.parent_path());
+    if (std::ofstream out(_file); out.is_open())
+    {
+        out << data.dump();
+    }
+    else
+    {
+        throw CPPX_Exception(fmt::format("Failed to write build database: {}", _file.string()));
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "cache.hpp"
+#include "helpers.hpp"
+#include "scheduler.hpp"
+#include "toolchain.hpp"
+
+class RemoteCompiler;
+
+// One translation unit: the source, the object it produces and the exact compiler invocation (argv form).
+struct CompileUnit
+{
+    fs::path source;
+    fs::path object;
+    fs::path depfile;
+    std::vector<std::string> args;
+    std::vector<fs::path> implicitDeps; // Inputs the depfile does not list, such as the PCH
+    std::vector<fs::path> extraOutputs; // Written by the compiler besides the object, e.g. the .dwo of split DWARF
+    fs::path projectDir;                // Paths under it enter the cache key relative to it
+};
+
+// A file the plan needs on disk before compiling, such as a unity TU
+struct GeneratedFile
+{
+    fs::path path;
+    std::string content;
+};
+
+// One [configurations.<name>] table of config.toml. The structured fields are translated into flags for the
+// active compiler; 'flags' is passed through unchanged after them.
+struct BuildProfile
+{
+    std::string name;
+    std::vector<std::string> flags;
+    std::string output;
+    std::string optLevel;  // 0, 1, 2, 3, s, z, g or fast; empty = compiler default
+    std::string lto;       // off, thin (Clang only) or full
+    std::string march;
+    std::string linker;    // mold, lld, gold or bfd; empty = compiler default (lld with ThinLTO if installed)
+    std::string debugInfo; // none, line-tables, full or split; empty = full with -d, none otherwise
+};
+
+// Reads and validates [configurations.<name>] against the compiler's probed capabilities; nullopt if there is no
+// such table. Throws CPPX_Exception for unknown values and for features the toolchain cannot provide.
+std::optional<BuildProfile> loadBuildProfile(const toml::table &config, const std::string &name,
+                                             const std::string &compiler, const ToolchainCapabilities &caps);
+
+struct BuildPlan
+{
+    std::string target; // [targets.<name>] of config.toml this plan builds; empty for the project itself
+    buildType btype = buildType::BUILD_EXECUTABLE;
+    fs::path projectDir;
+    fs::path buildDir;
+    fs::path objDir;
+    fs::path output;
+    std::string toolchainId;
+    std::string compiler;
+    std::vector<std::string> compileFlags; // Shared by every TU, without the PCH
+    std::optional<CompileUnit> pch;
+    std::vector<std::string> pchFlags; // Makes a TU use the PCH
+    std::vector<CompileUnit> units;
+    std::vector<GeneratedFile> generated;
+    fs::path unityDir; // Where the unity TUs among generated go; empty when the plan has none
+    std::vector<std::string> linkFlags; // Go before the objects when linking an executable or shared library
+    std::vector<std::string> linkLibs;  // Libraries and library directories, after the objects
+    std::vector<std::string> linkArgs;
+    std::vector<std::string> linkedTargets; // Workspace targets whose outputs are in linkLibs, so link before this
+    std::string archiver = "ar"; // gcc-ar/llvm-ar with LTO, since plain ar cannot index bitcode objects
+    bool splitDwarf = false;
+    bool timeTrace = false; // Every unit writes <object>.json next to its object
+    PgoStage pgo = PgoStage::None;
+    fs::path pgoDir; // build/pgo/<profile>/, where the stored profile of a PGO build lives
+};
+
+// Plans the project itself. In a workspace it compiles with the include directories of the targets it depends on
+// and links their outputs, as built by 'cppx build'.
+BuildPlan makeBuildPlan(const ProjectContext &ctx, const BuildOptions &opts);
+
+// Plans every target of the workspace, dependencies first: the project itself and each [targets.<name>] table of
+// config.toml, or just opts.target and what it depends on. A target inherits the project's [source] settings and
+// defines, compiles with the include directories of its dependencies and links their outputs. Units that two
+// targets compile with the same flags share one object, and so does a PCH.
+std::vector<BuildPlan> makeWorkspacePlans(const ProjectContext &ctx, const BuildOptions &opts);
+
+// Derives plan.linkArgs from its units, linkFlags and linkLibs
+void computeLinkArgs(BuildPlan &plan);
+
+// Builds the unit for one more source with the plan's flags and PCH, e.g. a test file
+CompileUnit makeCompileUnit(const BuildPlan &plan, const fs::path &source, const fs::path &object);
+
+// Writes plan.generated, leaving files whose content did not change untouched so their TUs stay up to date,
+// and removes unity files left over from an earlier batching
+void writeGeneratedFiles(const BuildPlan &plan);
+
+// Compiles one unit. With a cache, the TU is preprocessed first and the preprocessed source, toolchain and flags
+// form the cache key; a hit links the cached object into place instead of compiling. A miss is compiled on a
+// worker when remote is given and the unit is eligible, and locally otherwise or if the worker fails. Units with
+// extra outputs bypass the cache, which only stores objects.
+JobResult compileUnit(const CompileUnit &unit, CompilationCache *cache, const std::string &toolchainId,
+                      RemoteCompiler *remote = nullptr);
+
+bool isClangCompiler(const std::string &compiler);
+
+// Parses a make-style depfile as written by -MMD -MF and returns the prerequisites of its first rule
+std::vector<std::string> parseDepfile(const std::string &content);
+
+// Persistent record of what every object in build/obj/ was compiled with and which files it depends on.
+// File paths are interned in one table and units refer to them by index, so shared headers are stored
+// (and stat'ed) once no matter how many TUs include them.
+class BuildDatabase
+{
+  public:
+    explicit BuildDatabase(fs::path file);
+
+    // Parses file and keeps it in memory: databases opened later in this process, or in a process forked from it
+    // such as a 'cppx daemon' request, are copied from it instead of parsed while the file is unchanged
+    static void retain(const fs::path &file);
+
+    [[nodiscard]] bool isUpToDate(const CompileUnit &unit, const std::string &toolchainId) const;
+    // Records a freshly compiled unit and ingests its depfile
+    void record(const CompileUnit &unit, const std::string &toolchainId);
+    [[nodiscard]] bool isLinkUpToDate(const BuildPlan &plan) const;
+    void recordLink(const BuildPlan &plan);
+    void save() const;
+
+  private:
+    struct Entry
+    {
+        std::string command;
+        std::string toolchain;
+        std::vector<uint32_t> deps;
+    };
+
+    fs::path _file;
+    std::vector<std::string> _files;
+    std::unordered_map<std::string, uint32_t> _fileIndex;
+    std::unordered_map<std::string, Entry> _units;
+    std::string _link;
+    mutable std::vector<std::optional<fs::file_time_type>> _mtimes;
+    mutable std::vector<bool> _statted;
+
+    void parse();
+    uint32_t intern(const std::string &path);
+    [[nodiscard]] std::optional<fs::file_time_type> mtime(uint32_t file) const;
+};
+
+// Creates the PCH directory and, for GCC, the forwarding header that TUs include to pick up the .gch
+void writePchForwarder(const BuildPlan &plan);
+
+// Adds the PCH compile to scheduler unless it is up to date; every TU job must depend on the returned job
+std::optional<JobScheduler::JobId> schedulePch(JobScheduler &scheduler, const BuildPlan &plan, BuildDatabase &db);
+
+// Schedules the PCH and every unit of units that is not up to date, recording each one in db once it compiled.
+// Returns the compile jobs, which anything consuming the objects has to depend on.
+std::vector<JobScheduler::JobId> scheduleCompiles(JobScheduler &scheduler, const BuildPlan &plan,
+                                                  BuildDatabase &db, CompilationCache *cache,
+                                                  const std::vector<const CompileUnit *> &units,
+                                                  RemoteCompiler *remote = nullptr);
+
+// The same for a PCH scheduled already, possibly for another plan sharing it: pchJob is its compile, or nullopt if
+// it was up to date
+std::vector<JobScheduler::JobId> scheduleUnitCompiles(JobScheduler &scheduler, const BuildPlan &plan,
+                                                      BuildDatabase &db, CompilationCache *cache,
+                                                      const std::vector<const CompileUnit *> &units,
+                                                      std::optional<JobScheduler::JobId> pchJob,
+                                                      RemoteCompiler *remote = nullptr);
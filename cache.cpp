@@ -0,0 +1,491 @@
+#include "cache.hpp"
+
+#include <curl/curl.h>
+#include <random>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+bool reflink(const fs::path &source, const fs::path &target)
+{
+#if defined(__linux__) && defined(FICLONE)
+    const int in = open(source.c_str(), O_RDONLY);
+    if (in < 0)
+        return false;
+    const int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+    const bool ok = ioctl(out, FICLONE, in) == 0;
+    close(in);
+    close(out);
+    if (!ok)
+        fs::remove(target);
+    return ok;
+#else
+    (void)source;
+    (void)target;
+    return false;
+#endif
+}
+
+// The token is only ever sent to the remote configured next to it: a project naming its own remote must not
+// receive the one from the user's global file
+void readRemoteSettings(const toml::table &cache, CacheSettings &settings)
+{
+    if (const auto url = cache["remote"].value<std::string>())
+    {
+        settings.remoteUrl = *url;
+        settings.remoteToken = cache["remote_token"].value_or(std::string());
+    }
+    if (const auto timeout = cache["remote_timeout_ms"].value<int64_t>())
+        settings.remoteTimeout = std::chrono::milliseconds(*timeout);
+    if (const auto upload = cache["remote_upload"].value<bool>())
+        settings.remoteUpload = *upload;
+}
+
+} // namespace
+
+CacheSettings loadCacheSettings(const toml::table &globalConfig, const toml::table *projectConfig)
+{
+    CacheSettings settings;
+    settings.directory = CompilationCache::defaultDirectory();
+
+    if (const auto cache = globalConfig["cache"].as_table())
+    {
+        settings.enabled = (*cache)["enabled"].value_or(true);
+        if (const auto dir = (*cache)["dir"].value<std::string>())
+            settings.directory = *dir;
+        if (const auto size = (*cache)["max_size"].value<std::string>())
+            settings.maxSize = parseSize(*size);
+        else if (const auto bytes = (*cache)["max_size"].value<int64_t>())
+            settings.maxSize = static_cast<uint64_t>(*bytes);
+        readRemoteSettings(*cache, settings);
+    }
+
+    // A project can point at its team's remote cache without every developer editing their global file
+    if (projectConfig)
+    {
+        if (const auto cache = (*projectConfig)["cache"].as_table())
+            readRemoteSettings(*cache, settings);
+    }
+
+    if (const char *token = std::getenv("CPPX_REMOTE_CACHE_TOKEN"); token && *token)
+        settings.remoteToken = token;
+    return settings;
+}
+
+CacheSettings loadCacheSettings()
+{
+    const fs::path pathToGlobal = globalConfigPath();
+    return loadCacheSettings(fs::exists(pathToGlobal) ? parseTomlFile(pathToGlobal) : toml::table{});
+}
+
+std::unique_ptr<CompilationCache> openCompilationCache(const CacheSettings &settings)
+{
+    if (!settings.enabled)
+        return nullptr;
+    std::unique_ptr<RemoteCache> remote;
+    if (!settings.remoteUrl.empty())
+        remote = std::make_unique<RemoteCache>(settings.remoteUrl, settings.remoteToken, settings.remoteTimeout,
+                                               settings.remoteUpload);
+    return std::make_unique<CompilationCache>(settings.directory, std::move(remote));
+}
+
+RemoteCache::RemoteCache(std::string url, std::string token, const std::chrono::milliseconds timeout,
+                         const bool upload)
+    : _url(std::move(url)), _token(std::move(token)), _timeout(timeout), _upload(upload)
+{
+    while (!_url.empty() && _url.back() == '/')
+        _url.pop_back();
+
+    static std::once_flag curl_init;
+    std::call_once(curl_init, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
+    if (_upload)
+    {
+        for (int i = 0; i < 4; ++i)
+            _uploaders.emplace_back([this](const std::stop_token &st) { uploadLoop(st); });
+    }
+}
+
+RemoteCache::~RemoteCache()
+{
+    finish(std::chrono::milliseconds(0));
+}
+
+bool RemoteCache::available() const
+{
+    return !_disabled;
+}
+
+void RemoteCache::reportResult(const bool ok, const std::string &what, const bool unreachable)
+{
+    if (ok)
+    {
+        _failures = 0;
+        return;
+    }
+    LOG_VERBOSE("Remote cache: {}\n", what);
+    // Fetches are synchronous, so a server that is down would otherwise cost a timeout per TU
+    if ((unreachable || ++_failures >= 3) && !_disabled.exchange(true))
+    {
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                   "[WARNING] Remote cache {} is not responding ({}), compiling locally.\n", _url, what);
+    }
+}
+
+namespace
+{
+// One connection per thread, so consecutive requests reuse the same keep-alive connection
+CURL *threadCurlHandle()
+{
+    thread_local std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> handle(curl_easy_init(), &curl_easy_cleanup);
+    if (handle)
+        curl_easy_reset(handle.get());
+    return handle.get();
+}
+
+bool isUnreachable(const CURLcode res)
+{
+    return res == CURLE_COULDNT_RESOLVE_PROXY || res == CURLE_COULDNT_RESOLVE_HOST || res == CURLE_COULDNT_CONNECT ||
+           res == CURLE_OPERATION_TIMEDOUT;
+}
+
+curl_slist *authHeaders(const std::string &token)
+{
+    if (token.empty())
+        return nullptr;
+    return curl_slist_append(nullptr, fmt::format("Authorization: Bearer {}", token).c_str());
+}
+} // namespace
+
+bool RemoteCache::download(const std::string &key, const fs::path &target)
+{
+    if (!available())
+        return false;
+    CURL *curl = threadCurlHandle();
+    if (!curl)
+        return false;
+
+    const fs::path tmp = fs::path(target) += fmt::format(".tmp{}", std::random_device{}());
+    fs::create_directories(target.parent_path());
+    FILE *out = std::fopen(tmp.string().c_str(), "wb");
+    if (!out)
+        return false;
+
+    const std::string url = fmt::format("{}/{}", _url, key);
+    curl_slist *headers = authHeaders(_token);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "cppx");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, out);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(_timeout.count()) * 5);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    const CURLcode res = curl_easy_perform(curl);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    std::fclose(out);
+    curl_slist_free_all(headers);
+
+    std::error_code ec;
+    if (res != CURLE_OK || status != 200)
+    {
+        fs::remove(tmp, ec);
+        // 404 is an ordinary miss, not a sign that the server is down
+        reportResult(res == CURLE_OK && status == 404,
+                     res != CURLE_OK ? curl_easy_strerror(res) : fmt::format("HTTP {}", status), isUnreachable(res));
+        return false;
+    }
+    reportResult(true, {});
+    fs::rename(tmp, target, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool RemoteCache::upload(const std::string &key, const fs::path &file)
+{
+    CURL *curl = threadCurlHandle();
+    if (!curl)
+        return false;
+    FILE *in = std::fopen(file.string().c_str(), "rb");
+    if (!in)
+        return false;
+
+    std::error_code ec;
+    const auto size = fs::file_size(file, ec);
+    const std::string url = fmt::format("{}/{}", _url, key);
+    curl_slist *headers = authHeaders(_token);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "cppx");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_READDATA, in);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(ec ? 0 : size));
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(_timeout.count()) * 15);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    const CURLcode res = curl_easy_perform(curl);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    std::fclose(in);
+    curl_slist_free_all(headers);
+
+    const bool ok = res == CURLE_OK && status >= 200 && status < 300;
+    reportResult(ok, res != CURLE_OK ? curl_easy_strerror(res) : fmt::format("HTTP {} on upload", status),
+                 isUnreachable(res));
+    return ok;
+}
+
+void RemoteCache::uploadAsync(const std::string &key, const fs::path &file)
+{
+    if (!available())
+        return;
+    {
+        std::lock_guard lock(_mutex);
+        if (!_upload)
+            return;
+        _queue.emplace_back(key, file);
+    }
+    _cv.notify_one();
+}
+
+void RemoteCache::uploadLoop(const std::stop_token &stoken)
+{
+    while (true)
+    {
+        std::pair<std::string, fs::path> item;
+        {
+            std::unique_lock lock(_mutex);
+            if (!_cv.wait(lock, stoken, [this] { return !_queue.empty(); }))
+                return;
+            item = std::move(_queue.front());
+            _queue.pop_front();
+            ++_active;
+        }
+        if (available())
+            upload(item.first, item.second);
+        {
+            std::lock_guard lock(_mutex);
+            --_active;
+        }
+        _cv.notify_all();
+    }
+}
+
+void RemoteCache::finish(const std::chrono::milliseconds grace)
+{
+    {
+        std::unique_lock lock(_mutex);
+        _cv.wait_for(lock, grace, [this] { return _queue.empty() && _active == 0; });
+        _upload = false;
+        if (!_queue.empty())
+        {
+            LOG_VERBOSE("Remote cache: dropping {} pending uploads\n", _queue.size());
+            _queue.clear();
+        }
+    }
+    // Requests already in flight are bounded by their own timeouts
+    for (auto &t : _uploaders)
+        t.request_stop();
+    _uploaders.clear();
+}
+
+CompilationCache::CompilationCache(fs::path root, std::unique_ptr<RemoteCache> remote)
+    : _root(std::move(root)), _remote(std::move(remote))
+{
+    fs::create_directories(_root / "objects");
+}
+
+fs::path CompilationCache::defaultDirectory()
+{
+    if (const char *dir = std::getenv("CPPX_CACHE_DIR"); dir && *dir)
+        return dir;
+#if defined(_WIN32)
+    if (const char *local = std::getenv("LOCALAPPDATA"); local && *local)
+        return fs::path(local) / "cppx";
+#else
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return fs::path(xdg) / "cppx";
+#endif
+    return globalConfigPath().parent_path() / ".cache" / "cppx";
+}
+
+const fs::path &CompilationCache::root() const
+{
+    return _root;
+}
+
+uint64_t CompilationCache::sessionHits() const
+{
+    return _hits;
+}
+
+bool CompilationCache::storedAnything() const
+{
+    return _stored;
+}
+
+fs::path CompilationCache::entryPath(const std::string &key) const
+{
+    return _root / "objects" / key.substr(0, 2) / (key + ".o");
+}
+
+bool linkOrCopy(const fs::path &source, const fs::path &target)
+{
+    std::error_code ec;
+    fs::remove(target, ec);
+    fs::create_hard_link(source, target, ec);
+    if (!ec)
+        return true;
+    if (reflink(source, target))
+        return true;
+    return fs::copy_file(source, target, fs::copy_options::overwrite_existing, ec) && !ec;
+}
+
+bool CompilationCache::fetch(const std::string &key, const fs::path &object)
+{
+    const fs::path entry = entryPath(key);
+    std::error_code ec;
+    bool remote_hit = false;
+    if (!fs::is_regular_file(entry, ec))
+        remote_hit = _remote && _remote->download(key, entry);
+    if (!fs::is_regular_file(entry, ec) || !linkOrCopy(entry, object))
+    {
+        ++_misses;
+        return false;
+    }
+    if (remote_hit)
+        ++_remoteHits;
+    // Marks the entry as recently used and makes the object newer than its sources
+    fs::last_write_time(object, fs::file_time_type::clock::now(), ec);
+    ++_hits;
+    return true;
+}
+
+void CompilationCache::store(const std::string &key, const fs::path &object)
+{
+    const fs::path entry = entryPath(key);
+    std::error_code ec;
+    if (fs::exists(entry, ec))
+        return;
+
+    // Copy rather than link: the compiler may later rewrite build/obj/ in place
+    fs::create_directories(entry.parent_path(), ec);
+    const fs::path tmp = fs::path(entry) += fmt::format(".tmp{}", std::random_device{}());
+    if (!fs::copy_file(object, tmp, fs::copy_options::overwrite_existing, ec) || ec)
+    {
+        LOG_VERBOSE("Failed to store {} in the cache: {}\n", object.string(), ec.message());
+        return;
+    }
+    fs::rename(tmp, entry, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        return;
+    }
+    _stored = true;
+    if (_remote)
+        _remote->uploadAsync(key, entry);
+}
+
+CompilationCache::Stats CompilationCache::stats() const
+{
+    Stats s;
+    if (std::ifstream in(_root / "stats.json"); in.is_open())
+    {
+        if (const json j = json::parse(in, nullptr, false); j.is_object())
+        {
+            s.hits = j.value("hits", uint64_t{0});
+            s.remoteHits = j.value("remote_hits", uint64_t{0});
+            s.misses = j.value("misses", uint64_t{0});
+        }
+    }
+    s.hits += _hits;
+    s.remoteHits += _remoteHits;
+    s.misses += _misses;
+    return s;
+}
+
+void CompilationCache::flushStats()
+{
+    if (_remote)
+        _remote->finish(std::chrono::seconds(10));
+    if (_hits == 0 && _misses == 0)
+        return;
+    const Stats s = stats();
+    writeFileAtomic(_root / "stats.json",
+                    json{{"hits", s.hits}, {"remote_hits", s.remoteHits}, {"misses", s.misses}}.dump());
+    _hits = 0;
+    _remoteHits = 0;
+    _misses = 0;
+}
+
+CompilationCache::Usage CompilationCache::usage() const
+{
+    Usage u;
+    std::error_code ec;
+    for (const auto &entry : fs::recursive_directory_iterator(_root / "objects", ec))
+    {
+        if (entry.is_regular_file(ec))
+        {
+            ++u.entries;
+            u.bytes += entry.file_size(ec);
+        }
+    }
+    return u;
+}
+
+CompilationCache::Usage CompilationCache::prune(const uint64_t maxSize) const
+{
+    struct Item
+    {
+        fs::file_time_type time;
+        uint64_t size;
+        fs::path path;
+    };
+    std::vector<Item> items;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (const auto &entry : fs::recursive_directory_iterator(_root / "objects", ec))
+    {
+        if (entry.is_regular_file(ec))
+        {
+            items.push_back({entry.last_write_time(ec), entry.file_size(ec), entry.path()});
+            total += items.back().size;
+        }
+    }
+
+    Usage removed;
+    if (total <= maxSize)
+        return removed;
+
+    std::ranges::sort(items, {}, &Item::time);
+    for (const auto &item : items)
+    {
+        if (total <= maxSize)
+            break;
+        if (fs::remove(item.path, ec))
+        {
+            total -= item.size;
+            ++removed.entries;
+            removed.bytes += item.size;
+        }
+    }
+    return removed;
+}
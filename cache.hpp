@@ -0,0 +1,116 @@
+#pragma once
+
+#include "helpers.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// [cache] section of ~/.cppxglobal.toml; the remote_* keys may also be set in the project's config.toml
+struct CacheSettings
+{
+    bool enabled = true;
+    fs::path directory;
+    uint64_t maxSize = 5ull << 30;
+
+    std::string remoteUrl;
+    std::string remoteToken;
+    std::chrono::milliseconds remoteTimeout{2000};
+    bool remoteUpload = true;
+};
+
+CacheSettings loadCacheSettings(const toml::table &globalConfig, const toml::table *projectConfig = nullptr);
+// Outside of a project: reads only ~/.cppxglobal.toml
+CacheSettings loadCacheSettings();
+
+// HTTP backend shared by a fleet of machines: GET/PUT <url>/<key>. Any error or timeout is treated as a miss. The
+// remote is ignored for the rest of the process once it cannot be reached at all, or after a few consecutive errors.
+class RemoteCache
+{
+  public:
+    RemoteCache(std::string url, std::string token, std::chrono::milliseconds timeout, bool upload);
+    ~RemoteCache();
+
+    RemoteCache(const RemoteCache &) = delete;
+    RemoteCache &operator=(const RemoteCache &) = delete;
+
+    bool download(const std::string &key, const fs::path &target);
+    // Queues an upload; file must stay in place until the upload finished
+    void uploadAsync(const std::string &key, const fs::path &file);
+    // Waits up to grace for queued uploads, then drops the ones that have not started
+    void finish(std::chrono::milliseconds grace);
+
+  private:
+    std::string _url;
+    std::string _token;
+    std::chrono::milliseconds _timeout;
+    bool _upload;
+    std::atomic<int> _failures{0};
+    std::atomic<bool> _disabled{false};
+
+    std::mutex _mutex;
+    std::condition_variable_any _cv;
+    std::deque<std::pair<std::string, fs::path>> _queue;
+    size_t _active = 0;
+    std::vector<std::jthread> _uploaders;
+
+    [[nodiscard]] bool available() const;
+    void reportResult(bool ok, const std::string &what, bool unreachable = false);
+    void uploadLoop(const std::stop_token &stoken);
+    bool upload(const std::string &key, const fs::path &file);
+};
+
+// Content-addressed object store shared by all projects (ccache-style). Entries are immutable:
+// they are written once under their key and hardlinked (or reflinked/copied) into build/obj/.
+class CompilationCache
+{
+  public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t remoteHits = 0; // Subset of hits that came from the remote cache
+        uint64_t misses = 0;
+    };
+
+    struct Usage
+    {
+        size_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit CompilationCache(fs::path root, std::unique_ptr<RemoteCache> remote = nullptr);
+
+    static fs::path defaultDirectory();
+
+    // Materializes the cached object for key at object; counts a hit or a miss
+    bool fetch(const std::string &key, const fs::path &object);
+    void store(const std::string &key, const fs::path &object);
+
+    // Waits for remote uploads and merges this process' hit/miss counters into the persistent statistics
+    void flushStats();
+    [[nodiscard]] Stats stats() const;
+    [[nodiscard]] Usage usage() const;
+    // Removes least recently used entries until the cache fits in maxSize
+    Usage prune(uint64_t maxSize) const;
+
+    [[nodiscard]] const fs::path &root() const;
+    [[nodiscard]] uint64_t sessionHits() const;
+    [[nodiscard]] bool storedAnything() const;
+
+  private:
+    fs::path _root;
+    std::unique_ptr<RemoteCache> _remote;
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _remoteHits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<bool> _stored{false};
+
+    [[nodiscard]] fs::path entryPath(const std::string &key) const;
+};
+
+// Opens the local cache (plus the remote one, if configured), or returns nullptr if caching is disabled
+std::unique_ptr<CompilationCache> openCompilationCache(const CacheSettings &settings);
+
+// Places a cache entry at target: hardlink, then reflink, then a plain copy
+bool linkOrCopy(const fs::path &source, const fs::path &target);
@@ -0,0 +1,809 @@
+#include "daemon.hpp"
+
+#include "build.hpp"
+#include "toolchain.hpp"
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+#if !defined(_WIN32)
+namespace
+{
+#if defined(MSG_NOSIGNAL)
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;
+#endif
+
+constexpr uint32_t max_message_size = 16 * 1024 * 1024;
+
+// Commands that need to own the terminal: job control, Ctrl-C and the program's own stdin have to reach them
+// directly, so they always run in the calling process
+bool needsTerminal(const std::string_view command)
+{
+    return command == "daemon" || command == "worker" || command == "watch" || command == "run" || command == "perf";
+}
+
+// A message is its length (native endianness, the peer is on the same machine) and a JSON payload. File
+// descriptors travel as SCM_RIGHTS ancillary data on the first byte.
+bool sendMessage(const int fd, const std::string &payload, const std::vector<int> &fds = {})
+{
+    std::string data(sizeof(uint32_t), '\0');
+    const auto size = static_cast<uint32_t>(payload.size());
+    std::memcpy(data.data(), &size, sizeof size);
+    data += payload;
+
+    iovec iov{data.data(), data.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    std::vector<char> control;
+    if (!fds.empty())
+    {
+        control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+
+    ssize_t sent = 0;
+    do
+        sent = sendmsg(fd, &msg, send_flags);
+    while (sent < 0 && errno == EINTR);
+    if (sent <= 0)
+        return false;
+    return sendAll(fd, data.data() + sent, data.size() - static_cast<size_t>(sent));
+}
+
+std::optional<std::string> receiveMessage(const int fd, std::vector<int> *fds = nullptr)
+{
+    uint32_t size = 0;
+    iovec iov{&size, sizeof size};
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * 3)> control{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    ssize_t n = 0;
+    do
+        n = recvmsg(fd, &msg, 0);
+    while (n < 0 && errno == EINTR);
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i)
+        {
+            int received = -1;
+            std::memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            setCloseOnExec(received);
+            if (fds)
+                fds->push_back(received);
+            else
+                close(received);
+        }
+    }
+
+    if (n <= 0)
+        return std::nullopt;
+    if (static_cast<size_t>(n) < sizeof size &&
+        !receiveAll(fd, reinterpret_cast<char *>(&size) + n, sizeof size - static_cast<size_t>(n)))
+        return std::nullopt;
+    if (size > max_message_size)
+        return std::nullopt;
+    std::string payload(size, '\0');
+    if (!receiveAll(fd, payload.data(), size))
+        return std::nullopt;
+    return payload;
+}
+
+// The directory holding the socket must be ours alone, or someone else could pose as the daemon and be handed
+// our terminal
+bool socketDirIsPrivate(const fs::path &dir)
+{
+    struct stat st{};
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+           (st.st_mode & 077) == 0;
+}
+
+int connectToDaemon()
+{
+    const fs::path path = daemonSocketPath();
+    if (!socketDirIsPrivate(path.parent_path()))
+        return -1;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof addr.sun_path)
+        return -1;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    setCloseOnExec(fd);
+#if defined(SO_NOSIGPIPE)
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends a control request and returns the daemon's answer; nullopt if no daemon is running
+std::optional<json> controlRequest(const std::string &control)
+{
+    const int fd = connectToDaemon();
+    if (fd < 0)
+        return std::nullopt;
+    std::optional<std::string> reply;
+    if (sendMessage(fd, json{{"control", control}}.dump()))
+        reply = receiveMessage(fd);
+    close(fd);
+    if (!reply)
+        return std::nullopt;
+    json data = json::parse(*reply, nullptr, false);
+    return data.is_discarded() ? std::nullopt : std::optional(std::move(data));
+}
+
+// Identifies the running binary, so a daemon started before cppx was rebuilt never serves the new one. Empty
+// where the executable cannot be found, in which case any daemon is accepted.
+std::string executableIdentity()
+{
+    std::error_code ec;
+    const fs::path exe = fs::read_symlink("/proc/self/exe", ec);
+    if (ec)
+        return {};
+    const auto mtime = fs::last_write_time(exe, ec).time_since_epoch().count();
+    const auto size = fs::file_size(exe, ec);
+    return ec ? std::string{} : fmt::format("{}:{}:{}", exe.string(), mtime, size);
+}
+
+volatile sig_atomic_t forwarded_group = 0;
+volatile sig_atomic_t forwarded_signal = 0;
+
+void forwardSignal(const int signal)
+{
+    forwarded_signal = signal;
+    if (forwarded_group > 0)
+        kill(-forwarded_group, signal);
+}
+
+int signal_pipe[2] = {-1, -1};
+
+void notifySignal(const int signal)
+{
+    const int saved = errno;
+    const auto byte = static_cast<unsigned char>(signal);
+    [[maybe_unused]] const ssize_t n = write(signal_pipe[1], &byte, 1);
+    errno = saved;
+}
+
+void installHandler(const int signal, void (*handler)(int))
+{
+    struct sigaction action{};
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(signal, &action, nullptr);
+}
+
+struct RunningRequest
+{
+    int conn = -1;
+    std::string summary;
+    std::chrono::steady_clock::time_point started;
+};
+
+class Daemon
+{
+  public:
+    Daemon(const DaemonOptions &opts, const DaemonCommand command, const DaemonWatchHandler onChanges)
+        : _opts(opts), _command(command), _onChanges(onChanges), _identity(executableIdentity()),
+          _started(std::chrono::steady_clock::now())
+    {
+    }
+
+    // Binds the socket, so it already accepts connections when 'cppx daemon start' returns
+    void listen()
+    {
+        const fs::path path = daemonSocketPath();
+        fs::create_directories(path.parent_path());
+        fs::permissions(path.parent_path(), fs::perms::owner_all, fs::perm_options::replace);
+        if (!socketDirIsPrivate(path.parent_path()))
+            throw CPPX_Exception(fmt::format("{} is not a private directory of this user.",
+                                             path.parent_path().string()));
+        if (const int existing = connectToDaemon(); existing >= 0)
+        {
+            close(existing);
+            throw CPPX_Exception(fmt::format("A cppx daemon is already listening on {}.", path.string()));
+        }
+        std::error_code ec;
+        fs::remove(path, ec); // Left behind by a daemon that did not shut down cleanly
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.string().size() >= sizeof addr.sun_path)
+            throw CPPX_Exception(fmt::format("Socket path is too long: {}", path.string()));
+        std::strncpy(addr.sun_path, path.c_str(), sizeof addr.sun_path - 1);
+        _listen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen < 0)
+            throw CPPX_Exception(fmt::format("Failed to create the daemon socket: {}", std::strerror(errno)));
+        setCloseOnExec(_listen);
+        if (bind(_listen, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) != 0 || ::listen(_listen, 64) != 0)
+            throw CPPX_Exception(fmt::format("Failed to listen on {}: {}", path.string(), std::strerror(errno)));
+    }
+
+    void serve()
+    {
+        if (pipe(signal_pipe) != 0)
+            throw CPPX_Exception(fmt::format("Failed to create a pipe: {}", std::strerror(errno)));
+        for (const int fd : signal_pipe)
+        {
+            setCloseOnExec(fd);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+        for (const int signal : {SIGCHLD, SIGINT, SIGTERM, SIGHUP})
+            installHandler(signal, notifySignal);
+        installHandler(SIGPIPE, SIG_IGN);
+
+        refresh();
+        startWatching();
+        print_status_message(fmt::format("cppx daemon listening on {} (pid {})", daemonSocketPath().string(), getpid()),
+                             "✔", fmt::color::green);
+        std::fflush(stdout);
+
+        bool running = true;
+        while (running || !_running.empty())
+        {
+            std::array<pollfd, 2> fds{pollfd{signal_pipe[0], POLLIN, 0}, pollfd{running ? _listen : -1, POLLIN, 0}};
+            if (poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw CPPX_Exception(fmt::format("poll failed: {}", std::strerror(errno)));
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                unsigned char byte = 0;
+                while (read(signal_pipe[0], &byte, 1) == 1)
+                {
+                    if (byte == SIGCHLD)
+                        reapChildren();
+                    else
+                        running = false;
+                }
+            }
+            if (running && (fds[1].revents & POLLIN))
+            {
+                const int conn = accept(_listen, nullptr, nullptr);
+                if (conn >= 0)
+                {
+                    setCloseOnExec(conn);
+                    running = handleConnection(conn);
+                }
+            }
+        }
+
+        if (_watcher > 0)
+        {
+            close(_watcherAlive);
+            waitpid(_watcher, nullptr, 0);
+        }
+        close(_listen);
+        std::error_code ec;
+        fs::remove(daemonSocketPath(), ec);
+        print_status_message("cppx daemon stopped", "✔", fmt::color::green);
+    }
+
+  private:
+    DaemonOptions _opts;
+    DaemonCommand _command;
+    DaemonWatchHandler _onChanges;
+    std::string _identity;
+    std::chrono::steady_clock::time_point _started;
+    int _listen = -1;
+    size_t _served = 0;
+
+    std::optional<ProjectContext> _ctx;
+    std::unordered_map<pid_t, RunningRequest> _running;
+    pid_t _watcher = -1;
+    int _watcherAlive = -1; // Write end of a pipe the watcher process reads until the server closes it
+
+    // Only ever set in the watcher process
+    std::unique_ptr<ChangeBatcher> _batcher;
+    std::vector<std::jthread> _watchers;
+
+    // Brings the kept state up to date with the files: cheap when nothing changed, since every part only re-reads
+    // what it finds modified
+    void refresh()
+    {
+        try
+        {
+            if (_ctx)
+                _ctx->reload();
+            else
+                _ctx.emplace();
+        }
+        catch (const std::exception &e)
+        {
+            // No project yet, or a broken config.toml; requests load it themselves and report the error
+            LOG_VERBOSE("Daemon has no project loaded: {}\n", e.what());
+            _ctx.reset();
+            return;
+        }
+        toolchainCapabilities(_ctx->compiler(), _ctx->globalConfig());
+        std::error_code ec;
+        std::vector<fs::path> obj_dirs{_ctx->path() / "build" / "obj"};
+        for (const auto &target : fs::directory_iterator(_ctx->path() / "build" / "targets", ec))
+            obj_dirs.push_back(target.path() / "obj");
+        for (const auto &obj_dir : obj_dirs)
+        {
+            for (const auto &entry : fs::directory_iterator(obj_dir, ec))
+            {
+                if (entry.is_directory(ec))
+                    BuildDatabase::retain(entry.path() / "build_db.json");
+            }
+        }
+    }
+
+    // The watchers run in a process of their own, forked before any thread exists. The server thus stays
+    // single-threaded, and forking it for every request can never copy a lock that some other thread held.
+    void startWatching()
+    {
+        if (_opts.watchDirs.empty() || !_ctx)
+            return;
+        const fs::path root = _ctx->path();
+        std::vector<fs::path> dirs;
+        for (const auto &dir : _opts.watchDirs)
+        {
+            const fs::path abs = (fs::path(dir).is_absolute() ? fs::path(dir) : root / dir).lexically_normal();
+            fs::path rel = abs.lexically_relative(root);
+            if (rel.empty() || *rel.begin() == ".." || !fs::is_directory(abs))
+                throw CPPX_Exception(fmt::format("Invalid directory: {}, it must exist inside the project", dir));
+            if (rel == ".")
+                rel.clear();
+            print_status_message(fmt::format("Monitoring directory: {}", abs.string()), "...", fmt::color::cyan);
+            dirs.push_back(std::move(rel));
+        }
+
+        int alive[2];
+        if (pipe(alive) != 0)
+            throw CPPX_Exception(fmt::format("Failed to create a pipe: {}", std::strerror(errno)));
+        std::fflush(nullptr);
+        _watcher = fork();
+        if (_watcher < 0)
+            throw CPPX_Exception(fmt::format("fork failed: {}", std::strerror(errno)));
+        if (_watcher == 0)
+        {
+            close(alive[1]);
+            runWatchers(root, dirs, alive[0]);
+        }
+        close(alive[0]);
+        setCloseOnExec(alive[1]);
+        _watcherAlive = alive[1];
+    }
+
+    [[noreturn]] void runWatchers(const fs::path &root, const std::vector<fs::path> &dirs, const int alive)
+    {
+        // Ctrl-C of a foreground daemon reaches this process too; the server ends it once its requests finished
+        for (const int signal : {SIGINT, SIGHUP})
+            std::signal(signal, SIG_IGN);
+        for (const int signal : {SIGCHLD, SIGTERM, SIGPIPE})
+            std::signal(signal, SIG_DFL);
+        close(_listen);
+        close(signal_pipe[0]);
+        close(signal_pipe[1]);
+
+        _batcher = std::make_unique<ChangeBatcher>(std::chrono::milliseconds(200));
+        for (const auto &rel : dirs)
+        {
+            _watchers.emplace_back([this, root, rel](const std::stop_token &st) {
+                FileWatcher fw(
+                    root / rel,
+                    [this, &rel](const FileChange &change) {
+                        const fs::path old_path = change.oldPath.empty() ? fs::path{} : rel / change.oldPath;
+                        _batcher->push({change.event, rel / change.path, old_path});
+                    },
+                    std::chrono::seconds(1));
+                fw.run(st);
+            });
+        }
+        _watchers.emplace_back([this](const std::stop_token &st) {
+            while (!st.stop_requested())
+            {
+                const auto batch = _batcher->next(st);
+                if (batch.empty())
+                    continue;
+                try
+                {
+                    // Requests run in other processes and may have changed config.toml meanwhile
+                    _ctx->reload();
+                    _onChanges(*_ctx, batch);
+                }
+                catch (const std::exception &e)
+                {
+                    fmt::print(stderr, fg(fmt::color::red), "Error during watch callback: {}\n", e.what());
+                }
+            }
+        });
+
+        // EOF once the server closed its end or died
+        char byte = 0;
+        while (read(alive, &byte, 1) < 0 && errno == EINTR)
+        {
+        }
+        _watchers.clear();
+        std::fflush(nullptr);
+        _exit(0);
+    }
+
+    // Returns false once the daemon was asked to stop
+    bool handleConnection(const int conn)
+    {
+        // A client that connects and sends nothing must not hold up everyone else
+        const timeval timeout{1, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+        std::vector<int> fds;
+        const std::optional<std::string> payload = receiveMessage(conn, &fds);
+        const json request = payload ? json::parse(*payload, nullptr, false) : json();
+        const auto finish = [&] {
+            for (const int fd : fds)
+                close(fd);
+            close(conn);
+        };
+
+        if (!request.is_object())
+        {
+            finish();
+            return true;
+        }
+        if (const std::string control = request.value("control", ""); !control.empty())
+        {
+            json reply = {{"pid", getpid()},
+                          {"uptime", std::chrono::duration_cast<std::chrono::seconds>(
+                                         std::chrono::steady_clock::now() - _started)
+                                         .count()},
+                          {"served", _served},
+                          {"running", _running.size()},
+                          {"watching", _opts.watchDirs}};
+            reply["project"] = _ctx ? _ctx->path().string() : std::string{};
+            sendMessage(conn, reply.dump());
+            finish();
+            return control != "stop";
+        }
+
+        const int32_t refused = -1;
+        if (request.value("exe", "") != _identity || fds.size() != 3 || !request.contains("argv") ||
+            !request["argv"].is_array())
+        {
+            sendAll(conn, &refused, sizeof refused);
+            finish();
+            return true;
+        }
+
+        std::vector<std::string> args;
+        for (const auto &arg : request["argv"])
+            args.push_back(arg.is_string() ? arg.get<std::string>() : std::string{});
+        std::vector<std::string> env;
+        for (const auto &var : request.value("env", json::array()))
+            env.push_back(var.is_string() ? var.get<std::string>() : std::string{});
+        const std::string cwd = request.value("cwd", "");
+
+        refresh();
+        std::fflush(nullptr); // Whatever is still buffered would otherwise be written twice
+        const pid_t pid = fork();
+        if (pid == 0)
+            runChild(conn, fds, args, env, cwd);
+        if (pid < 0)
+        {
+            fmt::print(stderr, fg(fmt::color::red), "fork failed: {}\n", std::strerror(errno));
+            sendAll(conn, &refused, sizeof refused);
+            finish();
+            return true;
+        }
+        setpgid(pid, pid); // Also done by the child; whichever runs first wins the race against a forwarded Ctrl-C
+        for (const int fd : fds)
+            close(fd);
+        const auto group = static_cast<int32_t>(pid);
+        sendAll(conn, &group, sizeof group);
+
+        std::string summary;
+        for (size_t i = 1; i < args.size(); ++i)
+            summary += (i > 1 ? " " : "") + args[i];
+        _running.emplace(pid, RunningRequest{conn, std::move(summary), std::chrono::steady_clock::now()});
+        ++_served;
+        return true;
+    }
+
+    [[noreturn]] void runChild(const int conn, const std::vector<int> &fds, std::vector<std::string> &args,
+                               std::vector<std::string> &env, const std::string &cwd)
+    {
+        for (const int signal : {SIGCHLD, SIGINT, SIGTERM, SIGHUP, SIGPIPE})
+            std::signal(signal, SIG_DFL);
+        setpgid(0, 0);
+        close(_listen);
+        close(signal_pipe[0]);
+        close(signal_pipe[1]);
+        close(conn); // The parent reports the exit status, which also covers crashes
+        if (_watcherAlive >= 0)
+            close(_watcherAlive);
+
+        for (int i = 0; i < 3; ++i)
+        {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        if (!cwd.empty() && chdir(cwd.c_str()) != 0)
+        {
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "[ERROR] Cannot enter {}: {}\n", cwd,
+                       std::strerror(errno));
+            _exit(1);
+        }
+
+        // The client's environment replaces ours, since commands read PATH, CXX, XDG_* and friends
+        static std::vector<char *> environment;
+        for (auto &var : env)
+            environment.push_back(var.data());
+        environment.push_back(nullptr);
+        environ = environment.data();
+
+        std::vector<char *> argv;
+        for (auto &arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        int code = 1;
+        try
+        {
+            code = _command(static_cast<int>(args.size()), argv.data(), _ctx);
+        }
+        catch (const std::exception &e)
+        {
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "[CRITICAL ERROR] {}\n", e.what());
+        }
+        std::fflush(nullptr);
+        // The parent's objects were copied but are not ours to tear down
+        _exit(code);
+    }
+
+    void reapChildren()
+    {
+        int status = 0;
+        pid_t pid = 0;
+        bool finished = false;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            if (pid == _watcher)
+            {
+                fmt::print(stderr, fg(fmt::color::red),
+                           "The file watcher exited; restart the daemon to watch again.\n");
+                _watcher = -1;
+                continue;
+            }
+            const auto it = _running.find(pid);
+            if (it == _running.end())
+                continue;
+            const int32_t code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            sendAll(it->second.conn, &code, sizeof code);
+            close(it->second.conn);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - it->second.started);
+            print_status_message(fmt::format("cppx {} ({} ms, exit code {})", it->second.summary, elapsed.count(), code),
+                                 code == 0 ? "✔" : "✘", code == 0 ? fmt::color::green : fmt::color::red);
+            std::fflush(stdout);
+            _running.erase(it);
+            finished = true;
+        }
+        if (finished)
+        {
+            // Re-read what the request changed (build databases, config.toml) now rather than in the next request
+            refresh();
+        }
+    }
+};
+} // namespace
+#endif
+
+fs::path daemonSocketPath()
+{
+#if defined(_WIN32)
+    return {};
+#else
+    if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+        return fs::path(runtime) / "cppx" / "daemon.sock";
+    return fs::temp_directory_path() / fmt::format("cppx-{}", getuid()) / "daemon.sock";
+#endif
+}
+
+std::optional<int> forwardToDaemon(int argc, char **argv)
+{
+#if defined(_WIN32)
+    (void)argc;
+    (void)argv;
+    return std::nullopt;
+#else
+    if (const char *disabled = std::getenv("CPPX_NO_DAEMON"); disabled && *disabled)
+        return std::nullopt;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with('-'))
+            continue;
+        if (needsTerminal(arg))
+            return std::nullopt;
+        break;
+    }
+
+    json request;
+    try
+    {
+        request["cwd"] = fs::current_path().string();
+    }
+    catch (const fs::filesystem_error &)
+    {
+        return std::nullopt;
+    }
+    request["argv"] = std::vector<std::string>(argv, argv + argc);
+    json env = json::array();
+    for (char **var = environ; *var; ++var)
+        env.push_back(*var);
+    request["env"] = std::move(env);
+    request["exe"] = executableIdentity();
+
+    const int fd = connectToDaemon();
+    if (fd < 0)
+        return std::nullopt;
+    int32_t group = -1;
+    if (!sendMessage(fd, request.dump(), {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO}) ||
+        !receiveAll(fd, &group, sizeof group) || group <= 0)
+    {
+        // Refused (another cppx build) or gone; the command has not started, so it can still run here
+        close(fd);
+        return std::nullopt;
+    }
+
+    forwarded_group = group;
+    for (const int signal : {SIGINT, SIGTERM, SIGHUP, SIGQUIT})
+        installHandler(signal, forwardSignal);
+    int32_t code = 0;
+    const bool reported = receiveAll(fd, &code, sizeof code);
+    close(fd);
+    if (reported)
+        return code;
+    if (forwarded_signal != 0)
+        return 128 + forwarded_signal;
+    fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red),
+               "[ERROR] Lost the connection to the cppx daemon while it was running the command.\n");
+    return 1;
+#endif
+}
+
+void runDaemon(const DaemonOptions &opts, const DaemonCommand command, const DaemonWatchHandler onChanges)
+{
+#if defined(_WIN32)
+    (void)opts;
+    (void)command;
+    (void)onChanges;
+    throw CPPX_Exception("cppx daemon needs Unix domain sockets and is not available on Windows.");
+#else
+    // Line-buffered for the log and for the terminals that requests print to: setvbuf is only valid before the
+    // stream's first use, and a request's fds are swapped in underneath with dup2
+    std::setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+    Daemon daemon(opts, command, onChanges);
+    daemon.listen();
+    if (!opts.foreground)
+    {
+        const fs::path log = daemonSocketPath().parent_path() / "daemon.log";
+        std::fflush(nullptr);
+        const pid_t pid = fork();
+        if (pid < 0)
+            throw CPPX_Exception(fmt::format("fork failed: {}", std::strerror(errno)));
+        if (pid > 0)
+        {
+            print_status_message(fmt::format("Started cppx daemon (pid {}), logging to {}", pid, log.string()), "✔",
+                                 fmt::color::green);
+            return;
+        }
+        setsid();
+        const int null_fd = open("/dev/null", O_RDONLY);
+        const int log_fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (null_fd >= 0)
+            dup2(null_fd, STDIN_FILENO);
+        if (log_fd >= 0)
+        {
+            dup2(log_fd, STDOUT_FILENO);
+            dup2(log_fd, STDERR_FILENO);
+        }
+        for (const int fd : {null_fd, log_fd})
+        {
+            if (fd > STDERR_FILENO)
+                close(fd);
+        }
+        try
+        {
+            daemon.serve();
+        }
+        catch (const std::exception &e)
+        {
+            fmt::print(stderr, "[ERROR] {}\n", e.what());
+            std::fflush(nullptr);
+            _exit(1);
+        }
+        std::fflush(nullptr);
+        _exit(0);
+    }
+    daemon.serve();
+#endif
+}
+
+void stopDaemon()
+{
+#if defined(_WIN32)
+    throw CPPX_Exception("cppx daemon needs Unix domain sockets and is not available on Windows.");
+#else
+    const auto reply = controlRequest("stop");
+    if (!reply)
+    {
+        print_status_message("No cppx daemon is running", "!", fmt::color::yellow);
+        return;
+    }
+    print_status_message(fmt::format("Stopping cppx daemon (pid {}) after {} served commands",
+                                     reply->value("pid", 0), reply->value("served", 0)),
+                         "✔", fmt::color::green);
+#endif
+}
+
+void printDaemonStatus()
+{
+#if defined(_WIN32)
+    throw CPPX_Exception("cppx daemon needs Unix domain sockets and is not available on Windows.");
+#else
+    const auto reply = controlRequest("status");
+    if (!reply)
+    {
+        print_status_message(fmt::format("No cppx daemon is running on {}", daemonSocketPath().string()), "!",
+                             fmt::color::yellow);
+        return;
+    }
+    print_status_message(fmt::format("cppx daemon running on {}", daemonSocketPath().string()), "✔",
+                         fmt::color::green);
+    fmt::print("  {:<10} {}\n", "PID", reply->value("pid", 0));
+    fmt::print("  {:<10} {} s\n", "Uptime", reply->value("uptime", 0));
+    const std::string project = reply->value("project", std::string{});
+    fmt::print("  {:<10} {}\n", "Project", project.empty() ? "(none)" : project);
+    fmt::print("  {:<10} {} ({} running)\n", "Served", reply->value("served", 0), reply->value("running", 0));
+    if (const auto watching = reply->value("watching", std::vector<std::string>{}); !watching.empty())
+        fmt::print("  {:<10} {}\n", "Watching", fmt::join(watching, ", "));
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "helpers.hpp"
+#include "watcher.hpp"
+
+struct DaemonOptions
+{
+    bool foreground = false;            // Stays attached to the terminal instead of logging to daemon.log
+    std::vector<std::string> watchDirs; // Kept in sync with config.toml like 'cppx watch' does; empty = none
+};
+
+// Runs one command line; ctx is the daemon's loaded project, or empty when no project could be loaded
+using DaemonCommand = int (*)(int argc, char **argv, std::optional<ProjectContext> &ctx);
+using DaemonWatchHandler = void (*)(ProjectContext &ctx, const std::vector<FileChange> &batch);
+
+// $XDG_RUNTIME_DIR/cppx/daemon.sock, or /tmp/cppx-<uid>/daemon.sock
+fs::path daemonSocketPath();
+
+// If a daemon of this same cppx binary is listening, runs the command there with our stdin, stdout, stderr,
+// working directory and environment and returns its exit code. nullopt means the command has to run in this
+// process: no daemon, a daemon of another build, $CPPX_NO_DAEMON set, or a command that needs our terminal.
+std::optional<int> forwardToDaemon(int argc, char **argv);
+
+// 'cppx daemon start': serves forwarded commands until stopped. The parent keeps the project context, the
+// toolchain capabilities and the build databases loaded and refreshes them between requests; every request runs
+// in a child forked from it, so it starts with all of that in memory and cannot corrupt it. The watchers of
+// watchDirs live in a process of their own, so the one that forks never has other threads. Call it before
+// anything is written to stdout.
+void runDaemon(const DaemonOptions &opts, DaemonCommand command, DaemonWatchHandler onChanges);
+void stopDaemon();
+void printDaemonStatus();
@@ -0,0 +1,811 @@
+#include "distribute.hpp"
+
+#include "trace.hpp"
+
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr auto retry_after = std::chrono::seconds(30);
+
+std::string readWholeFile(const fs::path &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+// host:port, [v6 address]:port, or just a host on the default port
+std::pair<std::string, std::string> splitAddress(const std::string &address)
+{
+    if (address.starts_with('['))
+    {
+        const size_t close = address.find(']');
+        if (close != std::string::npos)
+        {
+            const std::string port = close + 2 < address.size() ? address.substr(close + 2) : "7411";
+            return {address.substr(1, close - 1), port};
+        }
+    }
+    if (const size_t colon = address.rfind(':'); colon != std::string::npos && address.find(':') == colon)
+        return {address.substr(0, colon), address.substr(colon + 1)};
+    return {address, "7411"};
+}
+
+std::string compilerTarget(const std::string &compiler)
+{
+    const JobResult result = runProcess({compiler, "-dumpmachine"}, std::chrono::milliseconds(10000));
+    if (result.exitCode != 0)
+        return {};
+    std::string target = result.output;
+    while (!target.empty() && std::isspace(static_cast<unsigned char>(target.back())))
+        target.pop_back();
+    return target;
+}
+
+// The unit's flags without what only matters for preprocessing or names a file on this machine; the worker adds
+// its own input and output
+std::vector<std::string> remoteArgs(const CompileUnit &unit)
+{
+    std::vector<std::string> args;
+    const std::string source = unit.source.string();
+    for (size_t i = 1; i < unit.args.size(); ++i)
+    {
+        const std::string &arg = unit.args[i];
+        const bool takes_value = arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ" || arg == "-include" ||
+                                 arg == "-include-pch" || arg == "-isystem" || arg == "-iquote" ||
+                                 arg == "-idirafter" || arg == "-I" || arg == "-D" || arg == "-U";
+        if (takes_value)
+        {
+            ++i;
+            continue;
+        }
+        if (arg == "-c" || arg == source || arg == "-MMD" || arg == "-MD" || arg.starts_with("-I") ||
+            arg.starts_with("-D") || arg.starts_with("-U"))
+            continue;
+        args.push_back(arg);
+    }
+    return args;
+}
+
+// Workers run the compiler with flags from the network, so only flags that select code generation, the language
+// or diagnostics are accepted. Anything else, e.g. -Wa,-adhln=<file>, -fdump-*, -fstack-usage or -save-temps,
+// could make the worker read or write files of the client's choosing, and keeps the unit local.
+bool allowedRemoteArg(const std::string &arg)
+{
+    static const std::vector<std::string_view> exact = {
+        "-w", "-g", "-pedantic", "-pedantic-errors", "-pthread", "-ansi", "-O", "-O0", "-O1", "-O2", "-O3", "-Os",
+        "-Oz", "-Og", "-Ofast", "-fPIC", "-fpic", "-fPIE", "-fpie", "-fexceptions", "-frtti", "-fopenmp",
+        "-fopenmp-simd", "-fpermissive", "-ffunction-sections", "-fdata-sections", "-fomit-frame-pointer",
+        "-fvisibility-inlines-hidden", "-fstrict-aliasing", "-fwrapv", "-ftrapv", "-ffast-math", "-funroll-loops",
+        "-fcoroutines", "-fchar8_t", "-fsigned-char", "-funsigned-char", "-fstrict-enums", "-fcf-protection",
+        "-fstack-protector", "-fstack-protector-strong", "-fstack-protector-all", "-fstack-clash-protection",
+        "-fasynchronous-unwind-tables", "-fsized-deallocation", "-faligned-new", "-flto", "-fcolor-diagnostics",
+        "-fdiagnostics-color", "-fansi-escape-codes"};
+    static const std::vector<std::string_view> prefixes = {
+        "-std=", "-stdlib=", "-march=", "-mtune=", "-mcpu=", "-mfpu=", "-mfloat-abi=", "-fvisibility=",
+        "-fsanitize=", "-fcf-protection=", "-flto=", "-fdiagnostics-color=", "-fmessage-length=",
+        "-ftemplate-depth=", "-fconstexpr-depth=", "-fconstexpr-steps=", "-ftemplate-backtrace-limit=",
+        // Only rewrite the paths recorded in the object
+        "-fdebug-prefix-map=", "-ffile-prefix-map=", "-fmacro-prefix-map="};
+    // Debug info levels and formats; -gsplit-dwarf writes a .dwo the worker would not send back
+    static const std::vector<std::string_view> debug = {"0", "1", "2", "3", "gdb", "dwarf", "line-tables-only",
+                                                        "line-directives-only", "z", "column-info", "no-column-info"};
+
+    // The worker's CPU may not be this one
+    if (arg.ends_with("=native"))
+        return false;
+    if (std::ranges::find(exact, arg) != exact.end() ||
+        std::ranges::any_of(prefixes, [&](const std::string_view prefix) { return arg.starts_with(prefix); }))
+        return true;
+    // Warnings, but not -Wa,/-Wl,/-Wp, which pass options on to other tools
+    if (arg.starts_with("-W") && arg.size() > 2 && !arg.contains(','))
+        return true;
+    // Target features such as -mavx2 or -mno-red-zone; -mllvm passes options on to LLVM
+    if (arg.starts_with("-m") && arg.size() > 2 && arg != "-mllvm" && !arg.contains('/'))
+        return true;
+    // Turning a feature off never makes the compiler touch a file
+    if (arg.starts_with("-fno-") && !arg.contains('/'))
+        return true;
+    return arg.starts_with("-g") &&
+           std::ranges::any_of(debug, [&](const std::string_view level) { return arg.substr(2).starts_with(level); });
+}
+
+#if !defined(_WIN32)
+constexpr uint32_t max_header_size = 1 << 20;
+constexpr uint64_t max_payload_size = 1ull << 30;
+
+class Socket
+{
+  public:
+    explicit Socket(const int fd = -1) : _fd(fd)
+    {
+    }
+    ~Socket()
+    {
+        if (_fd >= 0)
+            close(_fd);
+    }
+    Socket(Socket &&other) noexcept : _fd(std::exchange(other._fd, -1))
+    {
+    }
+    Socket &operator=(Socket &&other) noexcept
+    {
+        std::swap(_fd, other._fd);
+        return *this;
+    }
+
+    [[nodiscard]] int fd() const
+    {
+        return _fd;
+    }
+    explicit operator bool() const
+    {
+        return _fd >= 0;
+    }
+
+  private:
+    int _fd;
+};
+
+// A frame is a 4-byte big-endian header length, a JSON header and the number of raw bytes its "size" says
+bool sendFrame(const int fd, const json &header, const std::string_view payload = {})
+{
+    const std::string text = header.dump();
+    const auto length = static_cast<uint32_t>(text.size());
+    const char prefix[4] = {static_cast<char>(length >> 24), static_cast<char>(length >> 16),
+                            static_cast<char>(length >> 8), static_cast<char>(length)};
+    return sendAll(fd, prefix, sizeof prefix) && sendAll(fd, text.data(), text.size()) &&
+           sendAll(fd, payload.data(), payload.size());
+}
+
+std::optional<json> receiveHeader(const int fd)
+{
+    unsigned char prefix[4];
+    if (!receiveAll(fd, reinterpret_cast<char *>(prefix), sizeof prefix))
+        return std::nullopt;
+    const uint32_t length = uint32_t{prefix[0]} << 24 | uint32_t{prefix[1]} << 16 | uint32_t{prefix[2]} << 8 |
+                            uint32_t{prefix[3]};
+    if (length > max_header_size)
+        return std::nullopt;
+    std::string text(length, '\0');
+    if (!receiveAll(fd, text.data(), text.size()))
+        return std::nullopt;
+    json header = json::parse(text, nullptr, false);
+    if (!header.is_object())
+        return std::nullopt;
+    return header;
+}
+
+std::optional<std::string> receivePayload(const int fd, const json &header)
+{
+    const uint64_t size = header.value("size", uint64_t{0});
+    if (size > max_payload_size)
+        return std::nullopt;
+    std::string payload(size, '\0');
+    if (!receiveAll(fd, payload.data(), payload.size()))
+        return std::nullopt;
+    return payload;
+}
+
+void setTimeouts(const int fd, const std::chrono::milliseconds timeout)
+{
+    const timeval tv{static_cast<time_t>(timeout.count() / 1000),
+                     static_cast<suseconds_t>(timeout.count() % 1000 * 1000)};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+Socket connectTo(const std::string &host, const std::string &port, const std::chrono::milliseconds timeout,
+                 std::string &error)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (const int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &found); rc != 0)
+    {
+        error = gai_strerror(rc);
+        return Socket{};
+    }
+    std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addresses(found, &freeaddrinfo);
+
+    error = "no address";
+    for (const addrinfo *ai = found; ai; ai = ai->ai_next)
+    {
+        Socket sock(socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+        if (!sock)
+            continue;
+        setCloseOnExec(sock.fd());
+#if defined(SO_NOSIGPIPE)
+        // Where send() has no MSG_NOSIGNAL, a worker dropping the connection must not kill the build
+        const int no_sigpipe = 1;
+        setsockopt(sock.fd(), SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof no_sigpipe);
+#endif
+        // Non-blocking connect, so an unreachable host costs the connect timeout and not the kernel's minutes
+        const int flags = fcntl(sock.fd(), F_GETFL);
+        fcntl(sock.fd(), F_SETFL, flags | O_NONBLOCK);
+        if (connect(sock.fd(), ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS)
+        {
+            error = std::strerror(errno);
+            continue;
+        }
+        pollfd pfd{sock.fd(), POLLOUT, 0};
+        int so_error = 0;
+        socklen_t len = sizeof so_error;
+        if (poll(&pfd, 1, static_cast<int>(timeout.count())) != 1 ||
+            getsockopt(sock.fd(), SOL_SOCKET, SO_ERROR, &so_error, &len) != 0 || so_error != 0)
+        {
+            error = so_error != 0 ? std::strerror(so_error) : "connection timed out";
+            continue;
+        }
+        fcntl(sock.fd(), F_SETFL, flags);
+        const int on = 1;
+        setsockopt(sock.fd(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+        return sock;
+    }
+    return Socket{};
+}
+
+class WorkerServer
+{
+  public:
+    WorkerServer(const WorkerOptions &opts, const toml::table &globalConfig)
+        : _slots(opts.jobs == 0 ? defaultJobCount() : opts.jobs),
+          _token(opts.token.empty() ? loadDistributeSettings(globalConfig).token : opts.token),
+          _scratch(fs::temp_directory_path() / fmt::format("cppx-worker-{}", getpid()))
+    {
+        print_status_message("Looking for compilers...", "...", fmt::color::cyan);
+        for (const auto &compiler : discoverCompilers(globalConfig))
+        {
+            if (compiler.caps.version.empty())
+                continue;
+            if (std::string target = compilerTarget(compiler.path.string()); !target.empty())
+                _compilers.push_back({compiler.path, compiler.caps.version, std::move(target)});
+        }
+        if (_compilers.empty())
+            throw CPPX_Exception("No usable compilers found on PATH.");
+        for (const auto &compiler : _compilers)
+            fmt::print("  {} ({}, {})\n", compiler.path.string(), compiler.version, compiler.target);
+    }
+
+    void run(std::string listen)
+    {
+        // Without a token anyone who can reach the port could run compiles here, so only this machine may
+        if (listen.empty())
+            listen = _token.empty() ? "127.0.0.1:7411" : "0.0.0.0:7411";
+        if (const std::string host = splitAddress(listen).first;
+            _token.empty() && !host.starts_with("127.") && host != "::1" && host != "localhost")
+        {
+            throw CPPX_Exception(fmt::format("cppx worker needs a token to listen on {}: set [distribute] token or "
+                                             "$CPPX_DISTRIBUTE_TOKEN on workers and clients, or pass --token.",
+                                             listen));
+        }
+        const Socket server = bindListener(listen);
+        fs::create_directories(_scratch);
+        print_status_message(fmt::format("cppx worker listening on {} with {} slots", listen, _slots), "✔",
+                             fmt::color::green);
+
+        // SIGINT/SIGTERM are taken by one thread with sigwait, so the accept loop only has to watch a flag
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        std::signal(SIGPIPE, SIG_IGN);
+        std::jthread waiter([this, signals] {
+            int signal = 0;
+            sigwait(&signals, &signal);
+            _stopping = true;
+        });
+
+        std::vector<std::jthread> compilers;
+        for (size_t i = 0; i < _slots; ++i)
+            compilers.emplace_back([this] { compileLoop(); });
+
+        while (!_stopping)
+        {
+            pollfd pfd{server.fd(), POLLIN, 0};
+            if (poll(&pfd, 1, 250) != 1)
+                continue;
+            Socket conn(::accept(server.fd(), nullptr, nullptr));
+            if (!conn)
+                continue;
+            setCloseOnExec(conn.fd());
+            const int on = 1;
+            setsockopt(conn.fd(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+            // Bounds how long a silent client can hold its reader thread
+            setTimeouts(conn.fd(), std::chrono::milliseconds(5000));
+            // The header is read on a thread of its own, so a slow client does not hold up the others
+            {
+                std::lock_guard lock(_mutex);
+                if (_readers >= max_readers)
+                    continue;
+                ++_readers;
+            }
+            std::thread([this, conn = std::move(conn)]() mutable {
+                accept(std::move(conn));
+                std::lock_guard lock(_mutex);
+                --_readers;
+                _cv.notify_all();
+            }).detach();
+        }
+
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return _readers == 0; });
+            _queue.clear();
+        }
+        _cv.notify_all();
+        compilers.clear();
+        std::error_code ec;
+        fs::remove_all(_scratch, ec);
+        print_status_message("cppx worker stopped", "✔", fmt::color::green);
+    }
+
+  private:
+    struct Offered
+    {
+        fs::path path;
+        std::string version;
+        std::string target;
+    };
+
+    struct Request
+    {
+        Socket conn;
+        json header;
+    };
+
+    size_t _slots;
+    std::string _token;
+    fs::path _scratch;
+    std::vector<Offered> _compilers;
+    std::atomic<bool> _stopping = false;
+    std::atomic<uint64_t> _nextId = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<Request> _queue;
+    size_t _busy = 0;
+    size_t _readers = 0; // Connections whose header is still being read
+
+    static constexpr size_t max_readers = 64;
+
+    static Socket bindListener(const std::string &listen)
+    {
+        const auto [host, port] = splitAddress(listen);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *found = nullptr;
+        if (const int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found); rc != 0)
+            throw CPPX_Exception(fmt::format("Cannot resolve {}: {}", listen, gai_strerror(rc)));
+        std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> addresses(found, &freeaddrinfo);
+
+        std::string error = "no address";
+        for (const addrinfo *ai = found; ai; ai = ai->ai_next)
+        {
+            Socket sock(socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+            if (!sock)
+                continue;
+            setCloseOnExec(sock.fd());
+            const int on = 1;
+            setsockopt(sock.fd(), SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+            if (bind(sock.fd(), ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(sock.fd(), 128) == 0)
+                return sock;
+            error = std::strerror(errno);
+        }
+        throw CPPX_Exception(fmt::format("Cannot listen on {}: {}", listen, error));
+    }
+
+    [[nodiscard]] size_t queueDepth()
+    {
+        std::lock_guard lock(_mutex);
+        return _queue.size() + _busy;
+    }
+
+    // Status requests are answered right away; compiles wait for a slot with their source still unread
+    void accept(Socket conn)
+    {
+        const std::optional<json> header = receiveHeader(conn.fd());
+        if (!header)
+            return;
+        if (!_token.empty() && header->value("token", "") != _token)
+        {
+            sendFrame(conn.fd(), {{"error", "invalid token"}});
+            return;
+        }
+        if (header->value("type", "") == "status")
+        {
+            json compilers = json::array();
+            for (const auto &compiler : _compilers)
+                compilers.push_back({{"version", compiler.version}, {"target", compiler.target}});
+            sendFrame(conn.fd(), {{"slots", _slots}, {"queue", queueDepth()}, {"compilers", std::move(compilers)}});
+            return;
+        }
+        if (header->value("type", "") != "compile")
+        {
+            sendFrame(conn.fd(), {{"error", "unknown request"}});
+            return;
+        }
+        {
+            std::lock_guard lock(_mutex);
+            _queue.push_back({std::move(conn), *header});
+        }
+        _cv.notify_one();
+    }
+
+    void compileLoop()
+    {
+        while (true)
+        {
+            Request request;
+            {
+                std::unique_lock lock(_mutex);
+                _cv.wait_for(lock, std::chrono::milliseconds(250), [this] { return !_queue.empty() || _stopping; });
+                if (_stopping)
+                    return;
+                if (_queue.empty())
+                    continue;
+                request = std::move(_queue.front());
+                _queue.pop_front();
+                ++_busy;
+            }
+            try
+            {
+                compile(request);
+            }
+            catch (const std::exception &e)
+            {
+                sendFrame(request.conn.fd(), {{"error", e.what()}, {"queue", queueDepth()}});
+            }
+            std::lock_guard lock(_mutex);
+            --_busy;
+        }
+    }
+
+    void compile(const Request &request)
+    {
+        const int fd = request.conn.fd();
+        const json &header = request.header;
+        const std::string version = header.value("version", "");
+        const std::string target = header.value("target", "");
+        const auto compiler = std::ranges::find_if(
+            _compilers, [&](const Offered &c) { return c.version == version && c.target == target; });
+        if (compiler == _compilers.end())
+        {
+            sendFrame(fd, {{"error", fmt::format("no compiler '{}' for {}", version, target)}, {"queue", queueDepth()}});
+            return;
+        }
+        std::vector<std::string> args{compiler->path.string()};
+        for (const auto &arg : header.value("args", std::vector<std::string>{}))
+        {
+            if (!allowedRemoteArg(arg))
+            {
+                sendFrame(fd, {{"error", fmt::format("refused flag {}", arg)}, {"queue", queueDepth()}});
+                return;
+            }
+            args.push_back(arg);
+        }
+
+        setTimeouts(fd, std::chrono::milliseconds(60000)); // The source may be large and the network slow
+        const std::optional<std::string> source = receivePayload(fd, header);
+        if (!source)
+            return;
+
+        const fs::path dir = _scratch / std::to_string(_nextId++);
+        fs::create_directories(dir);
+        writeFileAtomic(dir / "in.ii", *source);
+        // Debug info names the client's directory instead of this scratch directory
+        if (const std::string cwd = header.value("cwd", ""); !cwd.empty())
+            args.push_back(fmt::format("-fdebug-prefix-map={}={}", dir.string(), cwd));
+        args.insert(args.end(), {"-c", "in.ii", "-o", "out.o"});
+
+        const Trace::Clock::time_point start = Trace::Clock::now();
+        const JobResult result = runProcess(args, ProcessOptions{.timeout = std::chrono::minutes(10), .cwd = dir});
+        const std::string object = result.exitCode == 0 ? readWholeFile(dir / "out.o") : std::string{};
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+
+        sendFrame(fd,
+                  {{"exit", result.timedOut ? 124 : result.exitCode},
+                   {"output", result.output},
+                   {"size", object.size()},
+                   {"queue", queueDepth()}},
+                  object);
+        LOG_VERBOSE("Compiled {} ({} ms, exit code {})\n", header.value("source", std::string("?")),
+                    std::chrono::duration_cast<std::chrono::milliseconds>(Trace::Clock::now() - start).count(),
+                    result.exitCode);
+    }
+};
+#endif
+} // namespace
+
+DistributeSettings loadDistributeSettings(const toml::table &globalConfig)
+{
+    DistributeSettings settings;
+    if (const auto table = globalConfig["distribute"].as_table())
+    {
+        if (const toml::array *workers = (*table)["workers"].as_array())
+        {
+            for (const auto &worker : *workers)
+            {
+                if (const auto address = worker.value<std::string>())
+                    settings.workers.push_back(*address);
+            }
+        }
+        settings.token = (*table)["token"].value_or(std::string{});
+        settings.connectTimeout =
+            std::chrono::milliseconds((*table)["connect_timeout_ms"].value_or(settings.connectTimeout.count()));
+        settings.compileTimeout =
+            std::chrono::milliseconds((*table)["compile_timeout_ms"].value_or(settings.compileTimeout.count()));
+    }
+    if (const char *token = std::getenv("CPPX_DISTRIBUTE_TOKEN"); token && *token)
+        settings.token = token;
+    return settings;
+}
+
+void runWorker(const WorkerOptions &opts, const toml::table &globalConfig)
+{
+#if defined(_WIN32)
+    (void)opts;
+    (void)globalConfig;
+    throw CPPX_Exception("cppx worker is not available on Windows.");
+#else
+    WorkerServer server(opts, globalConfig);
+    server.run(opts.listen);
+#endif
+}
+
+RemoteCompiler::RemoteCompiler(DistributeSettings settings, std::string compiler, std::string version,
+                               std::string target, fs::path pch, std::vector<Worker> workers)
+    : _settings(std::move(settings)), _compiler(std::move(compiler)), _version(std::move(version)),
+      _target(std::move(target)), _pch(std::move(pch)), _workers(std::move(workers))
+{
+}
+
+std::unique_ptr<RemoteCompiler> RemoteCompiler::open(const DistributeSettings &settings, const BuildPlan &plan,
+                                                     const ToolchainCapabilities &caps)
+{
+    const auto warn = [](const std::string &why) {
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow), "[WARNING] {}, compiling locally.\n", why);
+        return nullptr;
+    };
+#if defined(_WIN32)
+    (void)settings;
+    (void)plan;
+    (void)caps;
+    return warn("--distribute is not available on Windows");
+#else
+    if (settings.workers.empty())
+        return warn("--distribute needs workers = [\"host:port\", ...] under [distribute] in ~/.cppxglobal.toml");
+    if (plan.pgo != PgoStage::None)
+        return warn("PGO builds tie objects to local profile paths and are not distributed");
+    if (caps.version.empty())
+        return warn(fmt::format("Could not determine the version of {}", plan.compiler));
+    const std::string target = compilerTarget(plan.compiler);
+    if (target.empty())
+        return warn(fmt::format("Could not determine the target of {}", plan.compiler));
+
+    // Asked in parallel, so an unreachable worker costs one connect timeout rather than one per worker
+    std::vector<std::optional<Worker>> answers(settings.workers.size());
+    {
+        std::vector<std::jthread> queries;
+        for (size_t i = 0; i < settings.workers.size(); ++i)
+        {
+            queries.emplace_back([&, i] {
+                Worker worker;
+                worker.address = settings.workers[i];
+                std::tie(worker.host, worker.port) = splitAddress(worker.address);
+                std::string error;
+                const Socket sock = connectTo(worker.host, worker.port, settings.connectTimeout, error);
+                if (!sock)
+                {
+                    LOG_VERBOSE("Worker {}: {}\n", worker.address, error);
+                    return;
+                }
+                setTimeouts(sock.fd(), settings.connectTimeout * 2);
+                const auto reply = sendFrame(sock.fd(), {{"type", "status"}, {"token", settings.token}})
+                                       ? receiveHeader(sock.fd())
+                                       : std::nullopt;
+                if (!reply || reply->contains("error"))
+                {
+                    LOG_VERBOSE("Worker {}: {}\n", worker.address,
+                                reply ? reply->value("error", "") : std::string("no answer"));
+                    return;
+                }
+                const bool matches = std::ranges::any_of(reply->value("compilers", json::array()), [&](const json &c) {
+                    return c.value("version", "") == caps.version && c.value("target", "") == target;
+                });
+                if (!matches)
+                {
+                    LOG_VERBOSE("Worker {} has no {} for {}\n", worker.address, caps.version, target);
+                    return;
+                }
+                worker.slots = std::max<size_t>(1, reply->value("slots", size_t{1}));
+                worker.queueDepth = reply->value("queue", size_t{0});
+                answers[i] = std::move(worker);
+            });
+        }
+    }
+    std::vector<Worker> workers;
+    for (auto &answer : answers)
+    {
+        if (answer)
+            workers.push_back(std::move(*answer));
+    }
+    if (workers.empty())
+        return warn(fmt::format("None of the {} workers is reachable with {} for {}", settings.workers.size(),
+                                caps.version, target));
+
+    // GCC's -E output contains the PCH's headers; Clang's refers to the .pch, which only exists here
+    const fs::path pch = plan.pch && !isClangCompiler(plan.compiler) ? plan.pch->object : fs::path{};
+    auto remote = std::unique_ptr<RemoteCompiler>(
+        new RemoteCompiler(settings, plan.compiler, caps.version, target, pch, std::move(workers)));
+    print_status_message(fmt::format("Distributing to {} of {} workers ({} slots)", remote->_workers.size(),
+                                     settings.workers.size(), remote->capacity()),
+                         "...", fmt::color::cyan);
+    return remote;
+#endif
+}
+
+size_t RemoteCompiler::capacity() const
+{
+    std::lock_guard lock(_mutex);
+    size_t slots = 0;
+    for (const auto &worker : _workers)
+        slots += worker.slots;
+    return slots;
+}
+
+bool RemoteCompiler::eligible(const CompileUnit &unit) const
+{
+    // Flags a worker would refuse never leave this machine, so they do not count against the worker
+    return unit.extraOutputs.empty() &&
+           std::ranges::all_of(unit.implicitDeps, [this](const fs::path &dep) { return !_pch.empty() && dep == _pch; }) &&
+           std::ranges::all_of(remoteArgs(unit), allowedRemoteArg);
+}
+
+RemoteCompiler::Worker *RemoteCompiler::acquire()
+{
+    std::lock_guard lock(_mutex);
+    const auto now = std::chrono::steady_clock::now();
+    Worker *best = nullptr;
+    for (auto &worker : _workers)
+    {
+        if (worker.retryAt > now)
+            continue;
+        // Fewest jobs ahead per slot, counting what other clients queued there
+        if (!best || (worker.queueDepth + 1) * best->slots < (best->queueDepth + 1) * worker.slots)
+            best = &worker;
+    }
+    if (best)
+        ++best->queueDepth;
+    return best;
+}
+
+void RemoteCompiler::release(Worker &worker, const bool ok, const std::optional<size_t> queueDepth)
+{
+    std::lock_guard lock(_mutex);
+    if (queueDepth)
+        worker.queueDepth = *queueDepth;
+    else if (worker.queueDepth > 0)
+        --worker.queueDepth;
+    if (!ok)
+        worker.retryAt = std::chrono::steady_clock::now() + retry_after;
+}
+
+std::optional<JobResult> RemoteCompiler::compile(const CompileUnit &unit, const fs::path &preprocessed)
+{
+#if defined(_WIN32)
+    (void)unit;
+    (void)preprocessed;
+    return std::nullopt;
+#else
+    Worker *worker = acquire();
+    if (!worker)
+    {
+        ++_fallbacks;
+        return std::nullopt;
+    }
+    const auto fail = [&](const std::string &why) -> std::optional<JobResult> {
+        release(*worker, false, std::nullopt);
+        ++_fallbacks;
+        std::lock_guard lock(_mutex);
+        if (!std::exchange(worker->warned, true))
+        {
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
+                       "[WARNING] Worker {} failed ({}), compiling its jobs locally for {} s.\n", worker->address,
+                       why, retry_after.count());
+        }
+        return std::nullopt;
+    };
+
+    const Trace::Clock::time_point start = Trace::Clock::now();
+    std::string error;
+    const Socket sock = connectTo(worker->host, worker->port, _settings.connectTimeout, error);
+    if (!sock)
+        return fail(error);
+    setTimeouts(sock.fd(), _settings.compileTimeout);
+
+    const std::string source = readWholeFile(preprocessed);
+    std::error_code ec;
+    const json request = {{"type", "compile"},
+                          {"token", _settings.token},
+                          {"version", _version},
+                          {"target", _target},
+                          {"args", remoteArgs(unit)},
+                          {"source", unit.source.filename().string()},
+                          {"cwd", fs::current_path(ec).string()},
+                          {"size", source.size()}};
+    if (!sendFrame(sock.fd(), request, source))
+        return fail("connection lost while sending");
+    const std::optional<json> reply = receiveHeader(sock.fd());
+    if (!reply)
+        return fail("no reply");
+    if (reply->contains("error"))
+        return fail(reply->value("error", ""));
+    const std::optional<std::string> object = receivePayload(sock.fd(), *reply);
+    if (!object)
+        return fail("connection lost while receiving");
+
+    const int exit_code = reply->value("exit", 1);
+    release(*worker, true, reply->value("queue", size_t{0}));
+    if (Trace::enabled())
+        Trace::complete("remote compile", "compile", start, Trace::Clock::now(),
+                        {{"source", unit.source.string()}, {"worker", worker->address}});
+    if (exit_code != 0)
+    {
+        // Compile errors are the same everywhere; the local compile reports them against the real files
+        ++_fallbacks;
+        return std::nullopt;
+    }
+    writeFileAtomic(unit.object, *object);
+    {
+        std::lock_guard lock(_mutex);
+        ++worker->compiled;
+    }
+    return JobResult{0, reply->value("output", std::string{}), false};
+#endif
+}
+
+void RemoteCompiler::printSummary() const
+{
+    std::lock_guard lock(_mutex);
+    std::vector<std::string> parts;
+    size_t remote = 0;
+    for (const auto &worker : _workers)
+    {
+        remote += worker.compiled;
+        if (worker.compiled > 0)
+            parts.push_back(fmt::format("{} on {}", worker.compiled, worker.address));
+    }
+    if (remote == 0 && _fallbacks == 0)
+        return;
+    print_status_message(fmt::format("Compiled {} units remotely ({}), {} locally after a worker could not", remote,
+                                     parts.empty() ? "none" : fmt::format("{}", fmt::join(parts, ", ")),
+                                     _fallbacks.load()),
+                         "✔", fmt::color::green);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "build.hpp"
+
+#include <atomic>
+#include <mutex>
+
+// The [distribute] table of ~/.cppxglobal.toml
+struct DistributeSettings
+{
+    std::vector<std::string> workers; // host:port of each 'cppx worker'
+    std::string token;                // Shared secret; $CPPX_DISTRIBUTE_TOKEN overrides it
+    std::chrono::milliseconds connectTimeout{1000};
+    std::chrono::milliseconds compileTimeout{600000};
+};
+
+DistributeSettings loadDistributeSettings(const toml::table &globalConfig);
+
+struct WorkerOptions
+{
+    std::string listen; // Empty: 0.0.0.0:7411 with a token, 127.0.0.1:7411 without one
+    size_t jobs = 0;   // Concurrent compiles; 0 = number of cores
+    std::string token; // Empty: [distribute] token or $CPPX_DISTRIBUTE_TOKEN
+};
+
+// 'cppx worker': accepts preprocessed TUs from 'cppx build --distribute', compiles them with the local compiler
+// whose version and target match the client's, and sends the objects back. Runs until SIGINT or SIGTERM. Throws
+// CPPX_Exception when asked to listen beyond loopback without a token.
+void runWorker(const WorkerOptions &opts, const toml::table &globalConfig);
+
+// Client side of 'cppx build --distribute'. Preprocessing, the depfile and linking stay local; only compiling the
+// preprocessed source moves to a worker, chosen by the fewest queued and running jobs per slot.
+class RemoteCompiler
+{
+  public:
+    // Asks every configured worker for its toolchains and load. nullptr, after a warning, when none is reachable
+    // with the plan's compiler version and target, or when the plan cannot be distributed (PGO).
+    static std::unique_ptr<RemoteCompiler> open(const DistributeSettings &settings, const BuildPlan &plan,
+                                                const ToolchainCapabilities &caps);
+
+    // Compile slots of all usable workers, to size the local job pool
+    [[nodiscard]] size_t capacity() const;
+    // Units with extra outputs or inputs only this machine has (Clang PCHs, PGO profiles) compile locally
+    [[nodiscard]] bool eligible(const CompileUnit &unit) const;
+    // Compiles the preprocessed source of unit into unit.object on a worker. nullopt when no worker could do it,
+    // including compile errors, so the local compile that follows reports them with local paths.
+    std::optional<JobResult> compile(const CompileUnit &unit, const fs::path &preprocessed);
+    void printSummary() const;
+
+  private:
+    struct Worker
+    {
+        std::string address;
+        std::string host;
+        std::string port;
+        size_t slots = 1;
+        size_t queueDepth = 0; // Queued and running jobs from every client, as last reported plus ours since
+        std::chrono::steady_clock::time_point retryAt; // Skipped until then after a failure
+        size_t compiled = 0;
+        bool warned = false;
+    };
+
+    RemoteCompiler(DistributeSettings settings, std::string compiler, std::string version, std::string target,
+                   fs::path pch, std::vector<Worker> workers);
+
+    Worker *acquire();
+    void release(Worker &worker, bool ok, std::optional<size_t> queueDepth);
+
+    DistributeSettings _settings;
+    std::string _compiler;
+    std::string _version;
+    std::string _target;
+    fs::path _pch; // The GCC PCH, which preprocessing expands, so it does not keep a unit local
+    mutable std::mutex _mutex;
+    std::vector<Worker> _workers;
+    std::atomic<size_t> _fallbacks = 0;
+};
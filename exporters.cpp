@@ -0,0 +1,130 @@
+#include "exporters.hpp"
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+// In build and default lines, '$', ' ' and ':' separate or introduce things, so they are escaped with '$'
+std::string ninjaPath(const fs::path &path)
+{
+    std::string escaped;
+    for (const char c : path.string())
+    {
+        if (c == '$' || c == ' ' || c == ':')
+            escaped += '$';
+        escaped += c;
+    }
+    return escaped;
+}
+
+// In variable values only '$' is special
+std::string ninjaValue(const std::string &value)
+{
+    std::string escaped;
+    for (const char c : value)
+    {
+        if (c == '$')
+            escaped += '$';
+        escaped += c;
+    }
+    return escaped;
+}
+
+std::string ninjaPaths(const std::vector<fs::path> &paths)
+{
+    std::string joined;
+    for (const auto &path : paths)
+        joined += " " + ninjaPath(path);
+    return joined;
+}
+
+void appendCompileEdge(std::string &out, const CompileUnit &unit)
+{
+    out += fmt::format("build {}", ninjaPath(unit.object));
+    if (!unit.extraOutputs.empty())
+        out += " |" + ninjaPaths(unit.extraOutputs);
+    out += fmt::format(": cxx {}", ninjaPath(unit.source));
+    if (!unit.implicitDeps.empty())
+        out += " |" + ninjaPaths(unit.implicitDeps);
+    out += fmt::format("\n  cmd = {}\n  depfile = {}\n\n", ninjaValue(joinCommand(unit.args)),
+                       ninjaValue(unit.depfile.string()));
+}
+} // namespace
+
+std::string ninjaManifest(const std::vector<BuildPlan> &plans)
+{
+    const BuildPlan &project = plans.back();
+    std::string out = "# Generated by 'cppx export ninja' from config.toml, do not edit\n"
+                      "ninja_required_version = 1.7\n";
+    out += fmt::format("builddir = {}\n\n", ninjaValue(project.buildDir.string()));
+    out += "rule cxx\n"
+           "  command = $cmd\n"
+           "  depfile = $depfile\n"
+           "  deps = gcc\n"
+           "  description = Compiling $in\n\n";
+    const auto is_static = [](const BuildPlan &plan) { return plan.btype == buildType::BUILD_STATICLINK; };
+    if (std::ranges::any_of(plans, is_static))
+    {
+        // ar only adds and replaces members, so the archive is recreated to drop objects of deleted sources
+#if defined(_WIN32)
+        out += "rule archive\n  command = cmd /C \"del /F /Q $out 2>nul & $cmd\"\n";
+#else
+        out += "rule archive\n  command = rm -f $out && $cmd\n";
+#endif
+        out += "  description = Linking static library $out\n\n";
+    }
+    if (!std::ranges::all_of(plans, is_static))
+        out += "rule link\n  command = $cmd\n  description = Linking $out\n\n";
+
+    std::unordered_set<std::string> compiled;
+    for (const auto &plan : plans)
+    {
+        if (plan.pch && compiled.insert(plan.pch->object.string()).second)
+            appendCompileEdge(out, *plan.pch);
+        for (const auto &unit : plan.units)
+        {
+            if (compiled.insert(unit.object.string()).second)
+                appendCompileEdge(out, unit);
+        }
+    }
+
+    std::string outputs;
+    for (const auto &plan : plans)
+    {
+        std::vector<fs::path> objects;
+        for (const auto &unit : plan.units)
+            objects.push_back(unit.object);
+        // Libraries given as files relink the output when they change, like the objects do, and order the link
+        // after the targets that build them
+        std::vector<fs::path> libraries;
+        for (const auto &lib : plan.linkLibs)
+        {
+            if (!lib.starts_with("-"))
+                libraries.emplace_back(lib);
+        }
+        out += fmt::format("build {}: {}{}", ninjaPath(plan.output), is_static(plan) ? "archive" : "link",
+                           ninjaPaths(objects));
+        if (!libraries.empty() && !is_static(plan))
+            out += " |" + ninjaPaths(libraries);
+        out += fmt::format("\n  cmd = {}\n\n", ninjaValue(joinCommand(plan.linkArgs)));
+        outputs += " " + ninjaPath(plan.output);
+    }
+    out += fmt::format("default{}\n", outputs);
+    return out;
+}
+
+json compileCommands(const std::vector<const CompileUnit *> &units, const fs::path &directory)
+{
+    json entries = json::array();
+    for (const CompileUnit *unit : units)
+    {
+        entries.push_back({{"directory", directory.string()},
+                           {"file", unit->source.string()},
+                           {"output", unit->object.string()},
+                           {"arguments", unit->args}});
+    }
+    return entries;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "build.hpp"
+
+// A build.ninja for the plans of a workspace: one edge per TU (and PCH) with the unit's exact argv and its -MMD
+// depfile read through 'deps = gcc', and one link or archive edge per target. Objects and PCHs that targets
+// share get one edge. Ninja keeps its log and deps database in the build directory.
+std::string ninjaManifest(const std::vector<BuildPlan> &plans);
+
+// compile_commands.json entries ("arguments" form) for every unit in units, run from directory
+json compileCommands(const std::vector<const CompileUnit *> &units, const fs::path &directory);
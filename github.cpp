@@ -0,0 +1,340 @@
+#include "github.hpp"
+
+#include "cache.hpp"
+
+#include <curl/curl.h>
+
+#include <memory>
+#include <mutex>
+
+namespace
+{
+constexpr long DEFAULT_MAX_AGE = 60; // Seconds; what GitHub sends for repository metadata
+
+// One request of a fetch(), with what the response's headers tell about caching
+struct Request
+{
+    size_t index = 0;
+    CURL *handle = nullptr;
+    bool done = false;
+    std::string body;
+    std::string etag;
+    std::optional<long> maxAge;
+    std::string rateLimitRemaining;
+    curl_slist *headers = nullptr;
+};
+
+// A cached response: the body as GitHub sent it, its ETag and when it was last confirmed
+struct CacheEntry
+{
+    std::string etag;
+    int64_t fetchedAt = 0; // Seconds since the epoch
+    long maxAge = DEFAULT_MAX_AGE;
+    json body;
+};
+
+// cURL callback to write data to a string
+size_t writeCallback(void *contents, const size_t size, const size_t nmemb, void *userp)
+{
+    static_cast<std::string *>(userp)->append(static_cast<char *>(contents), size * nmemb);
+    return size * nmemb;
+}
+
+size_t headerCallback(char *buffer, const size_t size, const size_t nitems, void *userp)
+{
+    auto &request = *static_cast<Request *>(userp);
+    const std::string_view line(buffer, size * nitems);
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos)
+        return size * nitems;
+    std::string name(line.substr(0, colon));
+    std::ranges::transform(name, name.begin(), [](const unsigned char c) { return std::tolower(c); });
+    std::string_view value = line.substr(colon + 1);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front())))
+        value.remove_prefix(1);
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back())))
+        value.remove_suffix(1);
+
+    if (name == "etag")
+        request.etag = value;
+    else if (name == "x-ratelimit-remaining")
+        request.rateLimitRemaining = value;
+    else if (name == "cache-control")
+    {
+        if (const size_t pos = value.find("max-age="); pos != std::string_view::npos)
+        {
+            try
+            {
+                request.maxAge = std::stol(std::string(value.substr(pos + 8)));
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+    }
+    return size * nitems;
+}
+
+int64_t secondsSinceEpoch(const std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+std::optional<CacheEntry> readCacheEntry(const fs::path &file)
+{
+    std::ifstream in(file);
+    if (!in.is_open())
+        return std::nullopt;
+    const json data = json::parse(in, nullptr, false);
+    if (data.is_discarded() || !data.is_object() || !data.contains("body"))
+        return std::nullopt;
+    return CacheEntry{data.value("etag", ""), data.value("fetched_at", int64_t{0}),
+                      data.value("max_age", DEFAULT_MAX_AGE), data["body"]};
+}
+
+void writeCacheEntry(const fs::path &file, const CacheEntry &entry)
+{
+    const json data{
+        {"etag", entry.etag}, {"fetched_at", entry.fetchedAt}, {"max_age", entry.maxAge}, {"body", entry.body}};
+    std::error_code ec;
+    fs::create_directories(file.parent_path(), ec);
+    try
+    {
+        writeFileAtomic(file, data.dump(2) + "\n");
+    }
+    catch (const std::exception &e)
+    {
+        LOG_VERBOSE("Cannot cache GitHub response in {}: {}\n", file.string(), e.what());
+    }
+}
+
+// GitHub sends null for an empty description, which json::value() does not accept as a string
+std::string stringField(const json &body, const char *key, const std::string &fallback)
+{
+    const auto it = body.find(key);
+    return it != body.end() && it->is_string() ? it->get<std::string>() : fallback;
+}
+
+GithubInfo toGithubInfo(const CacheEntry &entry)
+{
+    GithubInfo info;
+    const json &body = entry.body;
+    info.name = stringField(body, "name", "N/A");
+    info.description = stringField(body, "description", "No description");
+    info.stars = body.value("stargazers_count", 0);
+    info.forks = body.value("forks_count", 0);
+    info.open_issues = body.value("open_issues_count", 0);
+    info.html_url = stringField(body, "html_url", "N/A");
+    // GitHub API returns the last push date as "pushed_at"
+    const std::string pushed_at = stringField(body, "pushed_at", "");
+    info.last_commit_date = pushed_at.length() >= 10 ? pushed_at.substr(0, 10) : "N/A";
+    info.fetched_at = std::chrono::system_clock::time_point(std::chrono::seconds(entry.fetchedAt));
+    info.success = true;
+    return info;
+}
+
+std::string errorMessage(const long status, const Request &request)
+{
+    if (status == 404)
+        return "Repository not found or access denied.";
+    if ((status == 403 || status == 429) && request.rateLimitRemaining == "0")
+        return "GitHub API rate limit exceeded; set $GITHUB_TOKEN or [github] token in ~/.cppxglobal.toml.";
+    const json body = json::parse(request.body, nullptr, false);
+    const std::string message = body.is_object() ? stringField(body, "message", "") : "";
+    return message.empty() ? fmt::format("GitHub answered HTTP {}.", status)
+                           : fmt::format("GitHub answered HTTP {}: {}", status, message);
+}
+} // namespace
+
+std::string githubToken(const toml::table &globalConfig)
+{
+    if (const char *token = std::getenv("GITHUB_TOKEN"); token && *token)
+        return token;
+    if (const toml::table *table = globalConfig["github"].as_table())
+        return (*table)["token"].value_or(std::string{});
+    return {};
+}
+
+GithubClient::GithubClient(std::string token, fs::path cacheDir)
+    : _token(std::move(token)),
+      _cacheDir(cacheDir.empty() ? CompilationCache::defaultDirectory() / "github" : std::move(cacheDir))
+{
+    static std::once_flag curl_init;
+    std::call_once(curl_init, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+
+GithubClient::~GithubClient()
+{
+    if (_refresh.valid())
+        _refresh.wait_for(std::chrono::milliseconds(500));
+}
+
+fs::path GithubClient::cacheFile(const Repository &repo) const
+{
+    // GitHub user and organization names cannot contain '_', so this cannot collide
+    return _cacheDir / fmt::format("{}_{}.json", repo.first, repo.second);
+}
+
+GithubInfo GithubClient::cached(const Repository &repo) const
+{
+    if (const auto entry = readCacheEntry(cacheFile(repo)))
+        return toGithubInfo(*entry);
+    GithubInfo info;
+    info.error_message = "Not fetched from GitHub yet.";
+    return info;
+}
+
+std::vector<GithubInfo> GithubClient::fetch(const std::vector<Repository> &repos)
+{
+    const int64_t now = secondsSinceEpoch(std::chrono::system_clock::now());
+    std::vector<GithubInfo> results(repos.size());
+    std::vector<std::optional<CacheEntry>> entries(repos.size());
+    std::vector<std::unique_ptr<Request>> requests;
+
+    CURLM *multi = curl_multi_init();
+    if (!multi)
+    {
+        for (size_t i = 0; i < repos.size(); ++i)
+        {
+            results[i] = cached(repos[i]);
+            results[i].error_message = "Failed to initialize cURL.";
+        }
+        return results;
+    }
+    for (size_t i = 0; i < repos.size(); ++i)
+    {
+        entries[i] = readCacheEntry(cacheFile(repos[i]));
+        if (entries[i] && now - entries[i]->fetchedAt < entries[i]->maxAge)
+        {
+            LOG_VERBOSE("GitHub: {}/{} is cached and fresh\n", repos[i].first, repos[i].second);
+            results[i] = toGithubInfo(*entries[i]);
+            continue;
+        }
+
+        CURL *curl = curl_easy_init();
+        if (!curl)
+        {
+            results[i] = entries[i] ? toGithubInfo(*entries[i]) : GithubInfo{};
+            results[i].error_message = "Failed to initialize cURL.";
+            continue;
+        }
+        auto request = std::make_unique<Request>();
+        request->index = i;
+        request->handle = curl;
+        request->headers = curl_slist_append(request->headers, "Accept: application/vnd.github+json");
+        request->headers = curl_slist_append(request->headers, "X-GitHub-Api-Version: 2022-11-28");
+        if (!_token.empty())
+            request->headers =
+                curl_slist_append(request->headers, fmt::format("Authorization: Bearer {}", _token).c_str());
+        if (entries[i] && !entries[i]->etag.empty())
+            request->headers =
+                curl_slist_append(request->headers, fmt::format("If-None-Match: {}", entries[i]->etag).c_str());
+
+        const std::string url = fmt::format("https://api.github.com/repos/{}/{}", repos[i].first, repos[i].second);
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        // Setting User-Agent is required by GitHub API
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "cppx");
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->body);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, request.get());
+        // Renamed repositories answer with a redirect
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, 3000L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, 8000L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, request.get());
+        curl_multi_add_handle(multi, curl);
+        requests.push_back(std::move(request));
+    }
+
+    int running = 0;
+    do
+    {
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+            break;
+        if (running > 0)
+            curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    } while (running > 0);
+
+    int queued = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi, &queued))
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        CURL *curl = msg->easy_handle;
+        Request *request = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &request);
+        long status = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        request->done = true;
+        const size_t i = request->index;
+        std::optional<CacheEntry> &entry = entries[i];
+
+        if (msg->data.result == CURLE_OK && status == 304 && entry)
+        {
+            // Unchanged; the cached body is confirmed as of now
+            entry->fetchedAt = now;
+            entry->maxAge = request->maxAge.value_or(DEFAULT_MAX_AGE);
+            writeCacheEntry(cacheFile(repos[i]), *entry);
+            results[i] = toGithubInfo(*entry);
+        }
+        else if (const json body = json::parse(request->body, nullptr, false);
+                 msg->data.result == CURLE_OK && status == 200 && body.is_object())
+        {
+            entry = CacheEntry{request->etag, now, request->maxAge.value_or(DEFAULT_MAX_AGE), body};
+            writeCacheEntry(cacheFile(repos[i]), *entry);
+            results[i] = toGithubInfo(*entry);
+        }
+        else
+        {
+            results[i] = entry ? toGithubInfo(*entry) : GithubInfo{};
+            results[i].error_message =
+                msg->data.result != CURLE_OK
+                    ? fmt::format("Request failed: {}", curl_easy_strerror(msg->data.result))
+                    : errorMessage(status, *request);
+            LOG_VERBOSE("GitHub: {}/{}: {}\n", repos[i].first, repos[i].second, results[i].error_message);
+        }
+    }
+
+    for (const auto &request : requests)
+    {
+        if (!request->done)
+        {
+            const size_t i = request->index;
+            results[i] = entries[i] ? toGithubInfo(*entries[i]) : GithubInfo{};
+            results[i].error_message = "Request to GitHub did not finish.";
+        }
+        curl_multi_remove_handle(multi, request->handle);
+        curl_easy_cleanup(request->handle);
+        curl_slist_free_all(request->headers);
+    }
+    curl_multi_cleanup(multi);
+    return results;
+}
+
+void GithubClient::refreshInBackground(std::vector<Repository> repos)
+{
+    // Detached with its own client, so a slow GitHub never holds up the end of the command; cache entries are
+    // written atomically, so a thread abandoned at exit leaves no partial file behind
+    auto result = std::make_shared<std::promise<std::vector<GithubInfo>>>();
+    _refresh = result->get_future();
+    std::thread([token = _token, cacheDir = _cacheDir, repos = std::move(repos), result] {
+        try
+        {
+            result->set_value(GithubClient(token, cacheDir).fetch(repos));
+        }
+        catch (...)
+        {
+            result->set_exception(std::current_exception());
+        }
+    }).detach();
+}
+
+std::optional<std::vector<GithubInfo>> GithubClient::waitForRefresh(const std::chrono::milliseconds timeout)
+{
+    if (!_refresh.valid() || _refresh.wait_for(timeout) != std::future_status::ready)
+        return std::nullopt;
+    return _refresh.get();
+}
@@ -1,8 +1,8 @@
 #pragma once
 
-#include <curl/curl.h> // Requires libcurl to be installed
-#include <nlohmann/json.hpp> // Requires nlohmann/json to be installed
-#include <string>
+#include "helpers.hpp"
+
+#include <future>
 
 // Definition of the structure to store GitHub repository information
 struct GithubInfo
@@ -14,91 +14,44 @@ struct GithubInfo
     int open_issues{};              // Number of open issues
     std::string last_commit_date; // Date of the last commit
     std::string html_url;         // GitHub repository URL
-    bool success{};                 // Whether information retrieval was successful
-    std::string error_message;    // Error message (if any)
+    bool success{};                 // Whether the fields above are filled, from GitHub or the cache
+    std::string error_message;    // Error message (if any); with success, why the cached data was not refreshed
+    std::chrono::system_clock::time_point fetched_at; // When GitHub last confirmed the fields
 };
 
-// cURL callback to write data to a string
-size_t WriteCallback(void *contents, const size_t size, const size_t nmemb, void *userp)
-{
-    static_cast<std::string *>(userp)->append(static_cast<char *>(contents), size * nmemb);
-    return size * nmemb;
-}
+// [github] token of ~/.cppxglobal.toml; $GITHUB_TOKEN overrides it
+std::string githubToken(const toml::table &globalConfig);
 
-// Function to retrieve GitHub repository information
-GithubInfo getRepoInfo(const std::string &owner, const std::string &repo_name)
+// Repository metadata from the GitHub REST API, kept per repository in <cache dir>/github/ together with the
+// response's ETag. Refreshing sends If-None-Match, and a 304 does not count against GitHub's rate limit; a response
+// younger than its Cache-Control max-age is not revalidated at all.
+class GithubClient
 {
-    GithubInfo info;
-    info.success = false; // Default to failure
-
-    CURL *curl;
-    std::string readBuffer;
-
-    curl = curl_easy_init();
-    if (curl)
-    {
-        CURLcode res;
-        std::string url = "https://api.github.com/repos/" + owner + "/" + repo_name;
-
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        // Setting User-Agent is required by GitHub API
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "C++ Github Repo Info Fetcher");
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-        // Optional: enable redirection following
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK)
-        {
-            info.error_message = "curl_easy_perform() failed: " + std::string(curl_easy_strerror(res));
-        }
-        else
-        {
-            try
-            {
-                // Parsing JSON response
-
-                // Check if the API returned an error (e.g., repository not found)
-                if (auto json_data = nlohmann::json::parse(readBuffer);json_data.contains("message") && json_data["message"] == "Not Found")
-                {
-                    info.error_message = "Repository not found or access denied.";
-                }
-                else
-                {
-                    info.name = json_data.value("name", "N/A");
-                    info.description = json_data.value("description", "No description");
-                    info.stars = json_data.value("stargazers_count", 0);
-                    info.forks = json_data.value("forks_count", 0);
-                    info.open_issues = json_data.value("open_issues_count", 0);
-                    info.html_url = json_data.value("html_url", "N/A");
-
-                    // GitHub API returns the last push date as "pushed_at"
-                    if (std::string pushed_at = json_data.value("pushed_at", "N/A");pushed_at != "N/A" && pushed_at.length() >= 10)
-                    {
-                        info.last_commit_date = pushed_at.substr(0, 10); // Get only the date (YYYY-MM-DD)
-                    }
-                    else
-                    {
-                        info.last_commit_date = "N/A";
-                    }
-                    info.success = true; // Set to success if parsing succeeded
-                }
-            }
-            catch (const nlohmann::json::exception &e)
-            {
-                info.error_message = "JSON parsing error: " + std::string(e.what());
-            }
-            catch (const std::exception &e)
-            {
-                info.error_message = "Unknown error: " + std::string(e.what());
-            }
-        }
-        curl_easy_cleanup(curl);
-    }
-    else
-    {
-        info.error_message = "Failed to initialize cURL.";
-    }
-    return info;
-}
+  public:
+    using Repository = std::pair<std::string, std::string>; // Owner, name
+
+    // An empty cacheDir is <cache dir>/github, next to the compilation cache
+    explicit GithubClient(std::string token = {}, fs::path cacheDir = {});
+    // Gives a background refresh at most half a second to land in the cache, then leaves it behind
+    ~GithubClient();
+
+    GithubClient(const GithubClient &) = delete;
+    GithubClient &operator=(const GithubClient &) = delete;
+
+    // What the cache holds, without touching the network; success is false if the repository was never fetched
+    [[nodiscard]] GithubInfo cached(const Repository &repo) const;
+    // Revalidates every repository concurrently with curl_multi and updates the cache. A failed request returns the
+    // cached information, if any, with error_message set.
+    std::vector<GithubInfo> fetch(const std::vector<Repository> &repos);
+    // fetch() on a detached thread, so callers can show cached() right away and never wait for it on exit
+    void refreshInBackground(std::vector<Repository> repos);
+    // The background refresh's results, once it finishes within timeout
+    std::optional<std::vector<GithubInfo>> waitForRefresh(std::chrono::milliseconds timeout);
+
+  private:
+    [[nodiscard]] fs::path cacheFile(const Repository &repo) const;
+
+    std::string _token;
+    fs::path _cacheDir;
+    std::future<std::vector<GithubInfo>> _refresh;
+};
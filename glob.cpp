@@ -0,0 +1,344 @@
+#include "glob.hpp"
+
+#include "scheduler.hpp"
+
+#include <deque>
+#include <unordered_set>
+
+namespace
+{
+std::vector<std::string> splitSegments(std::string_view path)
+{
+    std::vector<std::string> segments;
+    while (!path.empty())
+    {
+        const size_t slash = path.find('/');
+        const std::string_view segment = path.substr(0, slash);
+        if (!segment.empty() && segment != ".")
+            segments.emplace_back(segment);
+        if (slash == std::string_view::npos)
+            break;
+        path.remove_prefix(slash + 1);
+    }
+    return segments;
+}
+
+bool isLiteral(const std::string &segment)
+{
+    return segment.find_first_of("*?[") == std::string::npos;
+}
+
+// Matches c against the pattern element at i ('?', a bracket class or a literal) and moves i past that element
+bool matchChar(const std::string_view pattern, size_t &i, const char c)
+{
+    if (pattern[i] == '?')
+    {
+        ++i;
+        return true;
+    }
+    if (pattern[i] == '[')
+    {
+        size_t j = i + 1;
+        const bool negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+        if (negate)
+            ++j;
+        const size_t first = j;
+        bool matched = false;
+        // A ']' right after the opening bracket is a member, not the end
+        while (j < pattern.size() && (pattern[j] != ']' || j == first))
+        {
+            if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+            {
+                matched = matched || (c >= pattern[j] && c <= pattern[j + 2]);
+                j += 3;
+            }
+            else
+            {
+                matched = matched || pattern[j] == c;
+                ++j;
+            }
+        }
+        if (j < pattern.size())
+        {
+            i = j + 1;
+            return matched != negate;
+        }
+        // Unterminated: the bracket is an ordinary character
+    }
+    return pattern[i++] == c;
+}
+
+// One path segment against one pattern segment, backtracking only to the last '*'
+bool matchSegment(const std::string_view pattern, const std::string_view name)
+{
+    size_t p = 0;
+    size_t n = 0;
+    size_t star = std::string_view::npos;
+    size_t resume = 0;
+    while (n < name.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            resume = n;
+            continue;
+        }
+        if (size_t next = p; p < pattern.size() && matchChar(pattern, next, name[n]))
+        {
+            p = next;
+            ++n;
+            continue;
+        }
+        if (star == std::string_view::npos)
+            return false;
+        p = star + 1;
+        n = ++resume;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
+// The positions in a pattern that the path walked so far can have reached. A "**" position is also at the
+// position after it, since it may match no directory at all.
+using Positions = std::vector<size_t>;
+
+void closeOver(const std::vector<std::string> &pattern, Positions &positions)
+{
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        const size_t pos = positions[i];
+        if (pos < pattern.size() && pattern[pos] == "**" &&
+            std::ranges::find(positions, pos + 1) == positions.end())
+            positions.push_back(pos + 1);
+    }
+}
+
+Positions advance(const std::vector<std::string> &pattern, const Positions &positions, const std::string_view name)
+{
+    Positions next;
+    const auto add = [&next](const size_t pos) {
+        if (std::ranges::find(next, pos) == next.end())
+            next.push_back(pos);
+    };
+    for (const size_t pos : positions)
+    {
+        if (pos >= pattern.size())
+            continue;
+        if (pattern[pos] == "**")
+            add(pos);
+        else if (matchSegment(pattern[pos], name))
+            add(pos + 1);
+    }
+    closeOver(pattern, next);
+    return next;
+}
+
+struct PendingDir
+{
+    fs::path path;
+    std::string rel;                  // '/'-separated, empty for the root
+    std::vector<Positions> positions; // One entry per pattern
+};
+
+class GlobWalker
+{
+  public:
+    GlobWalker(const fs::path &root, const std::vector<std::string> &patterns, const GlobOptions &opts)
+    {
+        for (const auto &pattern : patterns)
+            _patterns.push_back(splitSegments(pattern));
+        for (const auto &dir : opts.ignore)
+        {
+            const fs::path p = dir.lexically_normal();
+            _ignored.insert(p.is_absolute() ? p.lexically_relative(root.lexically_normal()).generic_string()
+                                            : p.generic_string());
+        }
+    }
+
+    [[nodiscard]] PendingDir rootDir(const fs::path &root) const
+    {
+        PendingDir dir{root, {}, {}};
+        for (const auto &pattern : _patterns)
+        {
+            Positions start{0};
+            closeOver(pattern, start);
+            dir.positions.push_back(std::move(start));
+        }
+        return dir;
+    }
+
+    // Lists one directory: matching files go to matches, directories a pattern can still match go to children
+    void walk(const PendingDir &dir, std::vector<PendingDir> &children, std::vector<fs::path> &matches) const
+    {
+        std::error_code ec;
+        if (const auto names = literalNames(dir))
+        {
+            // Every pattern continues with a plain name here, so look those up instead of listing the directory
+            for (const auto &name : *names)
+            {
+                const fs::path path = dir.path / name;
+                const auto status = fs::status(path, ec);
+                if (fs::is_directory(status))
+                    visitDirectory(dir, path, name, false, children);
+                else if (fs::is_regular_file(status))
+                    visitFile(dir, path, name, matches);
+            }
+            return;
+        }
+
+        for (const auto &entry : fs::directory_iterator(dir.path, fs::directory_options::skip_permission_denied, ec))
+        {
+            const std::string name = entry.path().filename().string();
+            // Like recursive_directory_iterator, symlinked directories are not followed, so cycles cannot occur
+            if (entry.is_directory(ec) && !entry.is_symlink(ec))
+                visitDirectory(dir, entry.path(), name, true, children);
+            else if (entry.is_regular_file(ec))
+                visitFile(dir, entry.path(), name, matches);
+        }
+    }
+
+  private:
+    // The names the patterns need next when all of them continue with a literal segment
+    [[nodiscard]] std::optional<std::vector<std::string>> literalNames(const PendingDir &dir) const
+    {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < _patterns.size(); ++i)
+        {
+            for (const size_t pos : dir.positions[i])
+            {
+                if (pos >= _patterns[i].size())
+                    continue;
+                if (!isLiteral(_patterns[i][pos]))
+                    return std::nullopt;
+                if (std::ranges::find(names, _patterns[i][pos]) == names.end())
+                    names.push_back(_patterns[i][pos]);
+            }
+        }
+        return names;
+    }
+
+    void visitDirectory(const PendingDir &dir, const fs::path &path, const std::string &name, const bool listed,
+                        std::vector<PendingDir> &children) const
+    {
+        std::string rel = dir.rel.empty() ? name : dir.rel + "/" + name;
+        if (_ignored.contains(rel))
+            return;
+        // Tool output and VCS data only match when named literally, which the lookup path does
+        if (listed && dir.rel.empty() && (name == ".git" || name == "build" || name == "vendor") &&
+            !namedLiterally(dir, name))
+            return;
+
+        PendingDir child{path, std::move(rel), {}};
+        bool viable = false;
+        for (size_t i = 0; i < _patterns.size(); ++i)
+        {
+            child.positions.push_back(advance(_patterns[i], dir.positions[i], name));
+            // A file has to follow, so a pattern that is already complete does not need this directory
+            viable = viable || std::ranges::any_of(child.positions.back(),
+                                                   [&](const size_t pos) { return pos < _patterns[i].size(); });
+        }
+        if (viable)
+            children.push_back(std::move(child));
+    }
+
+    void visitFile(const PendingDir &dir, const fs::path &path, const std::string &name,
+                   std::vector<fs::path> &matches) const
+    {
+        for (size_t i = 0; i < _patterns.size(); ++i)
+        {
+            const Positions next = advance(_patterns[i], dir.positions[i], name);
+            if (std::ranges::find(next, _patterns[i].size()) != next.end())
+            {
+                matches.push_back(path);
+                return;
+            }
+        }
+    }
+
+    [[nodiscard]] bool namedLiterally(const PendingDir &dir, const std::string &name) const
+    {
+        for (size_t i = 0; i < _patterns.size(); ++i)
+        {
+            for (const size_t pos : dir.positions[i])
+            {
+                if (pos < _patterns[i].size() && _patterns[i][pos] == name)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::vector<std::string>> _patterns;
+    std::unordered_set<std::string> _ignored;
+};
+} // namespace
+
+bool globMatch(const std::string_view pattern, const std::string_view path)
+{
+    const std::vector<std::string> segments = splitSegments(pattern);
+    Positions positions{0};
+    closeOver(segments, positions);
+    for (const auto &segment : splitSegments(path))
+    {
+        positions = advance(segments, positions, segment);
+        if (positions.empty())
+            return false;
+    }
+    return std::ranges::find(positions, segments.size()) != positions.end();
+}
+
+std::vector<fs::path> glob(const fs::path &root, const std::vector<std::string> &patterns, const GlobOptions &opts)
+{
+    if (patterns.empty())
+        return {};
+    const GlobWalker walker(root, patterns, opts);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<PendingDir> queue{walker.rootDir(root)};
+    size_t active = 0;
+    std::vector<fs::path> result;
+
+    const auto work = [&] {
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [&] { return !queue.empty() || active == 0; });
+            if (queue.empty())
+                return; // Nothing queued and nobody left who could queue more
+            PendingDir dir = std::move(queue.front());
+            queue.pop_front();
+            ++active;
+            lock.unlock();
+
+            std::vector<PendingDir> children;
+            std::vector<fs::path> matches;
+            walker.walk(dir, children, matches);
+
+            lock.lock();
+            --active;
+            for (auto &child : children)
+                queue.push_back(std::move(child));
+            result.insert(result.end(), matches.begin(), matches.end());
+            cv.notify_all();
+        }
+    };
+
+    const size_t jobs = opts.jobs == 0 ? defaultJobCount() : opts.jobs;
+    {
+        std::vector<std::jthread> helpers;
+        for (size_t i = 1; i < jobs; ++i)
+            helpers.emplace_back(work);
+        work();
+    }
+
+    std::ranges::sort(result);
+    result.erase(std::ranges::unique(result).begin(), result.end());
+    return result;
+}
+
+std::vector<fs::path> glob(const fs::path &root, const std::string &pattern)
+{
+    return glob(root, std::vector{pattern});
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "helpers.hpp"
+
+struct GlobOptions
+{
+    // Directories never descended into, relative to the root or absolute. .git, build/ and vendor/ are always
+    // skipped unless a pattern names them literally (e.g. "build/gen/*.cpp").
+    std::vector<fs::path> ignore;
+    size_t jobs = 1; // Threads walking the tree; 0 = number of cores
+};
+
+// Matches a '/'-separated relative path: '*' and '?' stay within one segment, '[abc]', '[a-z]' and '[!a]' match
+// one character, and a "**" segment matches any number of directories (including none).
+bool globMatch(std::string_view pattern, std::string_view path);
+
+// Regular files under root matching any of the patterns, in one walk that only enters directories some pattern
+// can still match below. Sorted, without duplicates.
+std::vector<fs::path> glob(const fs::path &root, const std::vector<std::string> &patterns,
+                           const GlobOptions &opts = {});
+std::vector<fs::path> glob(const fs::path &root, const std::string &pattern);
+
+inline bool is_glob(const std::string &pattern)
+{
+    return pattern.find_first_of("*?[") != std::string::npos;
+}
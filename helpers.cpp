@@ -1,12 +1,25 @@
 #include "helpers.hpp"
 
+#include "process.hpp"
+
 #include <utility>
 #include <cstdlib>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <sstream>
-#include <regex>
+#include <random>
+#include <bit>
+#include <ranges>
+#include <unordered_set>
+#include <cctype>
+#include <cerrno>
+#include <ctime>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/socket.h>
+#endif
 
  bool isAbsolutePath(const std::string &path)
 {
@@ -32,6 +45,354 @@ std::string displayStringVector(const std::vector<std::string> &vec)
     return result;
 }
 
+std::string quoteArgument(const std::string &arg)
+{
+    if (!arg.empty() && arg.find_first_of(" \t\"'\\$`&|;<>()*?[]#~") == std::string::npos)
+        return arg;
+
+    std::string quoted = "\"";
+    for (const char c : arg)
+    {
+        if (c == '"' || c == '\\' || c == '$' || c == '`')
+            quoted += '\\';
+        quoted += c;
+    }
+    quoted += '"';
+    return quoted;
+}
+
+std::string joinCommand(const std::vector<std::string> &args)
+{
+    std::string command;
+    for (const auto &arg : args)
+    {
+        if (!command.empty())
+            command += ' ';
+        command += quoteArgument(arg);
+    }
+    return command;
+}
+
+namespace
+{
+constexpr std::array<uint32_t, 64> sha256_k = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+void sha256Block(std::array<uint32_t, 8> &state, const unsigned char *block)
+{
+    std::array<uint32_t, 64> w{};
+    for (size_t i = 0; i < 16; ++i)
+    {
+        w[i] = uint32_t{block[4 * i]} << 24 | uint32_t{block[4 * i + 1]} << 16 | uint32_t{block[4 * i + 2]} << 8 |
+               uint32_t{block[4 * i + 3]};
+    }
+    for (size_t i = 16; i < 64; ++i)
+    {
+        const uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state;
+    for (size_t i = 0; i < 64; ++i)
+    {
+        const uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                            sha256_k[i] + w[i];
+        const uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    const std::array<uint32_t, 8> result{a, b, c, d, e, f, g, h};
+    for (size_t i = 0; i < 8; ++i)
+        state[i] += result[i];
+}
+} // namespace
+
+Hasher &Hasher::update(const std::string_view data)
+{
+    auto bytes = reinterpret_cast<const unsigned char *>(data.data());
+    size_t size = data.size();
+    _length += size;
+    // Top up a partial block first, then hash whole blocks straight from the input
+    if (_buffered > 0)
+    {
+        const size_t take = std::min(size, _buffer.size() - _buffered);
+        std::copy_n(bytes, take, _buffer.data() + _buffered);
+        _buffered += take;
+        bytes += take;
+        size -= take;
+        if (_buffered < _buffer.size())
+            return *this;
+        sha256Block(_state, _buffer.data());
+        _buffered = 0;
+    }
+    for (; size >= _buffer.size(); bytes += _buffer.size(), size -= _buffer.size())
+        sha256Block(_state, bytes);
+    std::copy_n(bytes, size, _buffer.data());
+    _buffered = size;
+    return *this;
+}
+
+Hasher &Hasher::updateFile(const fs::path &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open())
+    {
+        throw CPPX_Exception(fmt::format("Failed to open {} for hashing", file.string()));
+    }
+    std::array<char, 65536> buffer{};
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+    {
+        update(std::string_view(buffer.data(), static_cast<size_t>(in.gcount())));
+    }
+    return *this;
+}
+
+std::string Hasher::hexdigest() const
+{
+    // Padding goes into copies, so the hasher can keep taking data
+    std::array<uint32_t, 8> state = _state;
+    std::array<unsigned char, 128> tail{};
+    std::copy_n(_buffer.data(), _buffered, tail.data());
+    tail[_buffered] = 0x80;
+    const size_t tail_size = _buffered < 56 ? 64 : 128;
+    const uint64_t bits = _length * 8;
+    for (size_t i = 0; i < 8; ++i)
+        tail[tail_size - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    sha256Block(state, tail.data());
+    if (tail_size == 128)
+        sha256Block(state, tail.data() + 64);
+
+    std::string digest;
+    digest.reserve(64);
+    for (const uint32_t word : state)
+        digest += fmt::format("{:08x}", word);
+    return digest;
+}
+
+std::string hashFile(const fs::path &file)
+{
+    return Hasher().updateFile(file).hexdigest();
+}
+
+std::optional<fs::path> findProgram(const std::string &name)
+{
+    std::error_code ec;
+    if (fs::path(name).has_parent_path())
+        return fs::exists(name, ec) ? std::optional<fs::path>(name) : std::nullopt;
+
+    const char *path_env = std::getenv("PATH");
+    if (!path_env)
+        return std::nullopt;
+#if defined(_WIN32)
+    constexpr char separator = ';';
+    const std::vector<std::string> suffixes{".exe", ""};
+#else
+    constexpr char separator = ':';
+    const std::vector<std::string> suffixes{""};
+#endif
+    std::string_view dirs = path_env;
+    while (!dirs.empty())
+    {
+        const size_t end = std::min(dirs.find(separator), dirs.size());
+        const fs::path dir = dirs.substr(0, end);
+        dirs.remove_prefix(std::min(end + 1, dirs.size()));
+        if (dir.empty())
+            continue;
+        for (const auto &suffix : suffixes)
+        {
+            const fs::path candidate = dir / (name + suffix);
+            if (fs::is_regular_file(candidate, ec))
+                return candidate;
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t parseSize(const std::string &size)
+{
+    size_t pos = 0;
+    uint64_t value;
+    try
+    {
+        value = std::stoull(size, &pos);
+    }
+    catch (const std::exception &)
+    {
+        throw CPPX_Exception(fmt::format("Invalid size: '{}'", size));
+    }
+
+    std::string suffix = size.substr(pos);
+    std::erase(suffix, ' ');
+    std::ranges::transform(suffix, suffix.begin(), [](const unsigned char c) { return std::toupper(c); });
+    if (suffix.empty() || suffix == "B")
+        return value;
+    if (suffix == "K" || suffix == "KB" || suffix == "KIB")
+        return value << 10;
+    if (suffix == "M" || suffix == "MB" || suffix == "MIB")
+        return value << 20;
+    if (suffix == "G" || suffix == "GB" || suffix == "GIB")
+        return value << 30;
+    throw CPPX_Exception(fmt::format("Invalid size suffix in '{}', use K, M or G", size));
+}
+
+std::pair<size_t, size_t> parseShard(const std::string &shard)
+{
+    const size_t slash = shard.find('/');
+    size_t index = 0;
+    size_t count = 0;
+    try
+    {
+        if (slash != std::string::npos)
+        {
+            index = std::stoull(shard.substr(0, slash));
+            count = std::stoull(shard.substr(slash + 1));
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+    if (count == 0 || index == 0 || index > count)
+        throw CPPX_Exception(fmt::format("Invalid shard: '{}', use i/n with 1 <= i <= n", shard));
+    return {index - 1, count};
+}
+
+std::string formatSize(const uint64_t bytes)
+{
+    if (bytes >= (1ull << 30))
+        return fmt::format("{:.1f} GiB", static_cast<double>(bytes) / (1ull << 30));
+    if (bytes >= (1ull << 20))
+        return fmt::format("{:.1f} MiB", static_cast<double>(bytes) / (1ull << 20));
+    if (bytes >= (1ull << 10))
+        return fmt::format("{:.1f} KiB", static_cast<double>(bytes) / (1ull << 10));
+    return fmt::format("{} B", bytes);
+}
+
+std::string xmlEscape(const std::string_view text)
+{
+    std::string out;
+    out.reserve(text.size());
+    for (const char c : text)
+    {
+        switch (c)
+        {
+        case '&':
+            out += "&amp;";
+            break;
+        case '<':
+            out += "&lt;";
+            break;
+        case '>':
+            out += "&gt;";
+            break;
+        case '"':
+            out += "&quot;";
+            break;
+        default:
+            // Control characters other than tab and newlines are not allowed in XML 1.0
+            if (static_cast<unsigned char>(c) < 0x20 && c != '\t' && c != '\n' && c != '\r')
+                out += '?';
+            else
+                out += c;
+        }
+    }
+    return out;
+}
+
+std::string utcTimestamp(const char *format)
+{
+    const std::time_t now = std::time(nullptr);
+    std::tm tm{};
+#if defined(_WIN32)
+    gmtime_s(&tm, &now);
+#else
+    gmtime_r(&now, &tm);
+#endif
+    char buf[32];
+    std::strftime(buf, sizeof(buf), format, &tm);
+    return buf;
+}
+
+json loadBaseline(const fs::path &dir, const std::string &baseline)
+{
+    for (const fs::path &candidate :
+         {fs::path(baseline), dir / (baseline + ".json"), dir / "history" / (baseline + ".json")})
+    {
+        std::error_code ec;
+        if (!fs::is_regular_file(candidate, ec))
+            continue;
+        std::ifstream in(candidate);
+        try
+        {
+            LOG_VERBOSE("Comparing against baseline {}\n", candidate.string());
+            return json::parse(in);
+        }
+        catch (const json::exception &e)
+        {
+            throw CPPX_Exception(fmt::format("Baseline {} is not valid JSON: {}", candidate.string(), e.what()));
+        }
+    }
+    throw CPPX_Exception(fmt::format("Baseline '{}' not found (looked for a file and for {}).", baseline,
+                                     (dir / (baseline + ".json")).string()));
+}
+
+#if !defined(_WIN32)
+void setCloseOnExec(const int fd)
+{
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+}
+
+bool sendAll(const int fd, const void *data, size_t size)
+{
+#if defined(MSG_NOSIGNAL)
+    constexpr int flags = MSG_NOSIGNAL;
+#else
+    constexpr int flags = 0;
+#endif
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        const ssize_t n = send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool receiveAll(const int fd, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0)
+    {
+        const ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+#endif
+
 std::string displayStringVectorPrefix(const std::vector<std::string> &vec, const std::string &prefix = "Prefix!",
                                              const std::string &separator = " ")
 {
@@ -50,6 +411,37 @@ std::string displayStringVectorPrefix(const std::vector<std::string> &vec, const
 }
 
 
+namespace
+{
+// "fmt/10.1.1#<revision>" -> "fmt/10.1.1"
+std::string exactRef(const std::string &ref)
+{
+    return ref.substr(0, ref.find('#'));
+}
+
+std::vector<std::string> stringArray(const json &node, const std::string &key)
+{
+    if (!node.is_object() || !node.contains(key) || !node[key].is_array())
+        return {};
+    std::vector<std::string> values;
+    for (const auto &value : node[key])
+    {
+        if (value.is_string())
+            values.push_back(value.get<std::string>());
+    }
+    return values;
+}
+
+json packageToJson(const PackageManager::PackageInfo &info)
+{
+    return {{"libs", info.libs},
+            {"includedirs", info.includePaths},
+            {"libdirs", info.libPaths},
+            {"dependencies", info.dependencies},
+            {"requested", info.requested}};
+}
+} // namespace
+
 PackageManager::PackageManager(fs::path dir) : vendor(std::move(dir))
 {
     if (!fs::exists(vendor))
@@ -58,29 +450,71 @@ PackageManager::PackageManager(fs::path dir) : vendor(std::move(dir))
     }
 }
 
-void PackageManager::install(const std::string &packageRef) const
+void PackageManager::install(const std::vector<std::string> &packageRefs, const fs::path &lockfile,
+                             const bool extendLock) const
 {
-    const std::string cmd =
-        fmt::format(R"(conan install --requires {} --build missing -of "{}" -f json --out-file "{}")", packageRef,
-                    vendor.string(), (vendor / "install_log.json").string());
+    if (packageRefs.empty())
+        return;
+
+    // One graph per install: a shared --out-file would only ever describe the last one
+    std::string graph_name =
+        packageRefs.size() == 1
+            ? exactRef(packageRefs.front())
+            : "batch-" + Hasher().update(fmt::format("{}", fmt::join(packageRefs, " "))).hexdigest().substr(0, 12);
+    std::ranges::replace(graph_name, '/', '_');
+    const fs::path graph_file = vendor / "graphs" / (graph_name + ".json");
+    fs::create_directories(graph_file.parent_path());
+
+    std::vector<std::string> cmd{"conan", "install"};
+    for (const auto &ref : packageRefs)
+        cmd.insert(cmd.end(), {"--requires", ref});
+    cmd.insert(cmd.end(), {"--build", "missing", "-of", vendor.string(), "-f", "json", "--out-file",
+                           graph_file.string(), "-c",
+                           fmt::format("core.download:parallel={}", std::max(1u, std::thread::hardware_concurrency()))});
+    if (!lockfile.empty())
+    {
+        if (fs::exists(lockfile))
+        {
+            cmd.insert(cmd.end(), {"--lockfile", lockfile.string()});
+            if (extendLock)
+                cmd.push_back("--lockfile-partial");
+        }
+        cmd.insert(cmd.end(), {"--lockfile-out", lockfile.string()});
+    }
 
-    LOG_VERBOSE("Executing Conan command: {}\n", cmd);
-    fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green), "Installing {}...\n", packageRef);
+    LOG_VERBOSE("Executing Conan command: {}\n", joinCommand(cmd));
+    if (packageRefs.size() == 1)
+        fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green), "Installing {}...\n", packageRefs.front());
+    else
+        fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green), "Installing {} packages: {}...\n",
+                   packageRefs.size(), fmt::join(packageRefs, ", "));
 
-    if (const int ret = std::system(cmd.c_str()); ret != 0)
+    if (runProcess(cmd, {.capture = false}).exitCode != 0)
     {
-        throw CPPX_Exception(fmt::format("Failed to install package '{}'.", packageRef));
+        throw CPPX_Exception(packageRefs.size() == 1
+                                 ? fmt::format("Failed to install package '{}'.", packageRefs.front())
+                                 : fmt::format("Failed to install packages: {}.", fmt::join(packageRefs, ", ")));
     }
+
+    std::ifstream file(graph_file);
+    json graph;
+    try
+    {
+        file >> graph;
+    }
+    catch (const json::exception &e)
+    {
+        throw CPPX_Exception(fmt::format("Could not read Conan's install graph {}: {}", graph_file.string(), e.what()));
+    }
+    mergeGraph(graph);
+    saveIndex();
 }
 
 PackageManager::PackageInfo PackageManager::getPackageInfo(const std::string &packageRef) const
 {
-    PackageInfo info;
-    info.packageRef = packageRef;
-    info.libs = get_info_from_package(packageRef, "libs");
-    info.includePaths = get_info_from_package(packageRef, "includedirs");
-    info.libPaths = get_info_from_package(packageRef, "libdirs");
-    return info;
+    if (const PackageInfo *info = find(packageRef))
+        return *info;
+    throw CPPX_Exception(fmt::format("Package '{}' is not installed, install it first.", packageRef));
 }
 
 std::optional<PackageManager::PackageInfo> PackageManager::remove(const std::string &packageRef) const
@@ -92,106 +526,178 @@ std::optional<PackageManager::PackageInfo> PackageManager::remove(const std::str
 
     PackageInfo info = getPackageInfo(packageRef);
 
-    const std::string cmdRemove = fmt::format("conan remove {} -f", packageRef);
-    LOG_VERBOSE("Removing from Conan cache: {}\n", cmdRemove);
-    if (const int ret = std::system(cmdRemove.c_str()); ret != 0)
+    const std::vector<std::string> cmdRemove{"conan", "remove", info.packageRef, "-f"};
+    LOG_VERBOSE("Removing from Conan cache: {}\n", joinCommand(cmdRemove));
+    if (runProcess(cmdRemove, {.capture = false}).exitCode != 0)
     {
         throw CPPX_Exception("Failed to remove package from Conan cache.");
     }
     fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green),
                "Package successfully removed from Conan cache.\n");
 
-    if (const fs::path localPackageDir = vendor / packageRef; fs::exists(localPackageDir))
+    if (const fs::path localPackageDir = vendor / info.packageRef; fs::exists(localPackageDir))
     {
         fs::remove_all(localPackageDir);
         LOG_VERBOSE("Removed local package directory: {}\n", localPackageDir.string());
     }
+    std::string graph_name = info.packageRef;
+    std::ranges::replace(graph_name, '/', '_');
+    fs::remove(vendor / "graphs" / (graph_name + ".json"));
 
+    index().erase(info.packageRef);
+    saveIndex();
     return info;
 }
 
-json PackageManager::loadInstallLog() const
+bool PackageManager::checkIfInstalled(const std::string &packageRef) const
 {
-    auto jsonPath = vendor / "install_log.json";
-    if (!fs::exists(jsonPath))
-    {
-        throw CPPX_Exception("install_log.json not found, install package first.");
-    }
+    return find(packageRef) != nullptr;
+}
 
-    std::ifstream file(jsonPath);
-    json j;
-    file >> j;
-    return j;
+std::vector<PackageManager::PackageInfo> PackageManager::installedPackages() const
+{
+    std::vector<PackageInfo> packages;
+    for (const auto &info : index() | std::views::values)
+        packages.push_back(info);
+    std::ranges::sort(packages, {}, &PackageInfo::packageRef);
+    return packages;
 }
 
-std::vector<std::string> PackageManager::get_info_from_package(const std::string &packageRef, const std::string &infoType) const
+PackageManager::Index &PackageManager::index() const
 {
-    json j = loadInstallLog();
-    if (!j.contains("graph") || !j["graph"].contains("nodes"))
-        return {};
+    if (_index)
+        return *_index;
 
-    for (auto &[key, node] : j["graph"]["nodes"].items())
+    _index.emplace();
+    const fs::path index_file = vendor / "packages.json";
+    if (std::ifstream in(index_file); in)
     {
-        if (!node.contains("ref"))
-            continue;
-
-        if (std::string ref = node["ref"]; ref.find(packageRef) == 0)
+        try
         {
-            if (node.contains("cpp_info"))
+            const json data = json::parse(in);
+            for (const auto &[ref, entry] : data.value("packages", json::object()).items())
             {
-                if (infoType == "libs")
-                {
-                    if (node["cpp_info"].contains("_fmt") && node["cpp_info"]["_fmt"].contains("libs") &&
-                        node["cpp_info"]["_fmt"]["libs"].is_array())
-                    {
-                        return node["cpp_info"]["_fmt"]["libs"].get<std::vector<std::string>>();
-                    }
-                    else if (node["cpp_info"].contains("root") && node["cpp_info"]["root"].contains("libs") &&
-                             node["cpp_info"]["root"]["libs"].is_array())
-                    {
-                        return node["cpp_info"]["root"]["libs"].get<std::vector<std::string>>();
-                    }
-                }
-                else if (node["cpp_info"].contains("root") && node["cpp_info"]["root"].contains(infoType) &&
-                         node["cpp_info"]["root"][infoType].is_array())
-                {
-                    auto paths =
-                        node["cpp_info"]["root"][infoType].get<std::vector<std::string>>();
-                    if (infoType == "includedirs" || infoType == "libdirs")
-                    {
-                        for (auto &p : paths)
-                            p = fs::absolute(p).string();
-                    }
-                    return paths;
-                }
+                PackageInfo info{ref,
+                                 stringArray(entry, "libs"),
+                                 stringArray(entry, "includedirs"),
+                                 stringArray(entry, "libdirs"),
+                                 stringArray(entry, "dependencies"),
+                                 entry.value("requested", false)};
+                _index->emplace(ref, std::move(info));
             }
+            return *_index;
+        }
+        catch (const json::exception &)
+        {
+            LOG_VERBOSE("Rebuilding unreadable package index: {}\n", index_file.string());
+        }
+    }
+
+    // Projects installed before the index existed only have the graph of their last install
+    if (std::ifstream legacy(vendor / "install_log.json"); legacy)
+    {
+        try
+        {
+            const json graph = json::parse(legacy);
+            mergeGraph(graph);
+            saveIndex();
+        }
+        catch (const json::exception &)
+        {
         }
     }
-    return {};
+    return *_index;
 }
 
-bool PackageManager::checkIfInstalled(const std::string &packageRef) const
+const PackageManager::PackageInfo *PackageManager::find(const std::string &packageRef) const
 {
-    try
+    const Index &packages = index();
+    if (const auto it = packages.find(exactRef(packageRef)); it != packages.end())
+        return &it->second;
+    // A bare name ("fmt") means whichever version is installed
+    if (packageRef.find('/') == std::string::npos)
     {
-        json j = loadInstallLog();
-        if (!j.contains("graph") || !j["graph"].contains("nodes"))
-            return false;
-
-        for (auto &[key, node] : j["graph"]["nodes"].items())
+        for (const auto &[ref, info] : packages)
         {
-            if (!node.contains("ref"))
-                continue;
+            if (ref.substr(0, ref.find('/')) == packageRef)
+                return &info;
+        }
+    }
+    return nullptr;
+}
 
-            if (std::string ref = node["ref"]; ref.find(packageRef) == 0)
-                return true;
+void PackageManager::mergeGraph(const json &graph) const
+{
+    if (!graph.contains("graph") || !graph["graph"].contains("nodes"))
+        return;
+
+    // What was asked for are the consumer's direct requirements; everything else came in as a dependency
+    std::unordered_set<std::string> requested;
+    for (const auto &node : graph["graph"]["nodes"])
+    {
+        if (!node.contains("ref") || !node["ref"].is_string() ||
+            node["ref"].get<std::string>().find('/') != std::string::npos || !node.contains("dependencies"))
+            continue;
+        for (const auto &dependency : node["dependencies"])
+        {
+            if (dependency.contains("ref") && dependency.value("direct", true))
+                requested.insert(exactRef(dependency["ref"].get<std::string>()));
         }
     }
-    catch (const CPPX_Exception &)
+
+    Index &packages = index();
+    for (const auto &[id, node] : graph["graph"]["nodes"].items())
     {
-        return false;
+        if (!node.contains("ref") || !node["ref"].is_string())
+            continue;
+        const std::string ref = exactRef(node["ref"].get<std::string>());
+        if (ref.find('/') == std::string::npos)
+            continue; // The consumer node, not a package
+
+        PackageInfo info;
+        info.packageRef = ref;
+        if (node.contains("cpp_info") && node["cpp_info"].is_object())
+        {
+            const json &cpp_info = node["cpp_info"];
+            const json root = cpp_info.value("root", json::object());
+            info.libs = stringArray(root, "libs");
+            // Packages that split into components (fmt's "_fmt") only list libraries per component
+            for (const auto &[component, component_info] : cpp_info.items())
+            {
+                if (component == "root")
+                    continue;
+                for (auto &lib : stringArray(component_info, "libs"))
+                {
+                    if (std::ranges::find(info.libs, lib) == info.libs.end())
+                        info.libs.push_back(std::move(lib));
+                }
+            }
+            for (const auto &dir : stringArray(root, "includedirs"))
+                info.includePaths.push_back(fs::absolute(dir).string());
+            for (const auto &dir : stringArray(root, "libdirs"))
+                info.libPaths.push_back(fs::absolute(dir).string());
+        }
+        if (node.contains("dependencies") && node["dependencies"].is_object())
+        {
+            for (const auto &dependency : node["dependencies"])
+            {
+                if (dependency.contains("ref") && dependency["ref"].is_string())
+                    info.dependencies.push_back(exactRef(dependency["ref"].get<std::string>()));
+            }
+        }
+
+        const auto existing = packages.find(ref);
+        info.requested = requested.contains(ref) || (existing != packages.end() && existing->second.requested);
+        packages.insert_or_assign(ref, std::move(info));
     }
-    return false;
+}
+
+void PackageManager::saveIndex() const
+{
+    json packages = json::object();
+    for (const auto &[ref, info] : index())
+        packages[ref] = packageToJson(info);
+    writeFileAtomic(vendor / "packages.json", json{{"packages", packages}}.dump(2) + "\n");
 }
 
 
@@ -236,7 +742,7 @@ ProjectSettings::ProjectSettings(std::string n, const std::vector<std::string> &
           format(std::move(format))
  {}
 
-ProjectConfig getCurrentProject()
+fs::path globalConfigPath()
 {
     fs::path pathToGlobal;
 #if defined(__linux__) || defined(__APPLE__)
@@ -256,21 +762,48 @@ ProjectConfig getCurrentProject()
 #else
     throw CPPX_Exception("Unsupported OS.");
 #endif
+    return pathToGlobal;
+}
 
-    toml::table file;
-
-    if (std::filesystem::exists(pathToGlobal))
+void writeFileAtomic(const fs::path &path, const std::string &content)
+{
+    fs::path tmp = path;
+    tmp += fmt::format(".tmp-{:08x}", std::random_device{}());
     {
-        try
-        {
-            file = toml::parse_file(pathToGlobal.string());
-        }
-        catch (const toml::parse_error &err)
+        std::ofstream ofs(tmp, std::ios::binary);
+        if (!ofs)
+            throw CPPX_Exception(fmt::format("Failed to open {} for writing", tmp.string()));
+        ofs << content;
+        if (!ofs.flush())
         {
-            throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
+            ofs.close();
+            fs::remove(tmp);
+            throw CPPX_Exception(fmt::format("Failed to write {}", tmp.string()));
         }
     }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec)
+    {
+        fs::remove(tmp);
+        throw CPPX_Exception(fmt::format("Failed to replace {}: {}", path.string(), ec.message()));
+    }
+}
+
+toml::table parseTomlFile(const fs::path &path)
+{
+    try
+    {
+        return toml::parse_file(path.string());
+    }
+    catch (const toml::parse_error &err)
+    {
+        throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
+    }
+}
 
+ProjectConfig parseCurrentProject(const toml::table &file)
+{
     std::string name;
     std::string path;
     Toolchain tc;
@@ -327,19 +860,19 @@ std::vector<std::string> readTomlArray(const toml::node *node, const std::string
     return result;
 }
 
-ProjectSettings getProjectSettings()
+buildType parseBuildType(const std::string &type)
 {
-    ProjectConfig proj = getCurrentProject();
-    toml::table config;
-    try
-    {
-        config = toml::parse_file(fmt::format("{}/config.toml", proj.path));
-    }
-    catch (const toml::parse_error &err)
-    {
-        throw CPPX_Exception(fmt::format("Error parsing config.toml: {}", err.description()));
-    }
+    if (type == "executable" || type == "_default")
+        return buildType::BUILD_EXECUTABLE;
+    if (type == "shared" || type == "dynamic")
+        return buildType::BUILD_DYNAMICLINK;
+    if (type == "static")
+        return buildType::BUILD_STATICLINK;
+    throw CPPX_Exception("Invalid configuration: Invalid build type!");
+}
 
+ProjectSettings parseProjectSettings(const ProjectConfig &proj, const toml::table &config)
+{
     std::vector<std::string> includedirs;
     std::vector<std::string> includefiles;
     std::vector<std::string> srcfiles;
@@ -433,22 +966,14 @@ ProjectSettings getProjectSettings()
     if (auto build = config["build"].as_table())
     {
         bset.outputName = (*build)["build_name"].value_or<std::string>("_default");
-        if (auto t = (*build)["build_type"].value_or<std::string>("_default"); t == "executable" || t == "_default")
-        {
-            bset.btype = buildType::BUILD_EXECUTABLE;
-        }
-        else if (t == "shared" || t == "dynamic")
-        {
-            bset.btype = buildType::BUILD_DYNAMICLINK;
-        }
-        else if (t == "static")
-        {
-            bset.btype = buildType::BUILD_STATICLINK;
-        }
-        else
-        {
-            throw CPPX_Exception("Invalid configuration: Invalid build type!");
-        }
+        bset.pch = (*build)["pch"].value_or<std::string>("");
+        bset.unityBatch = static_cast<size_t>(std::max<int64_t>((*build)["unity_batch"].value_or<int64_t>(0), 0));
+        if (build->contains("unity_exclude"))
+            bset.unityExclude = readTomlArray(build, "unity_exclude");
+        if (build->contains("deps"))
+            bset.deps = readTomlArray(build, "deps");
+        bset.modules = (*build)["modules"].value_or(false);
+        bset.btype = parseBuildType((*build)["build_type"].value_or<std::string>("_default"));
         if (bset.outputName == "_default")
         {
             bset.outputName = proj.name;
@@ -477,29 +1002,172 @@ ProjectSettings getProjectSettings()
          format.clangFormatFilepath = (*format_)["filepath"].value_or("!");
          format.clangFormatFile = (*format_)["file"].value_or<bool>(false);
      }
-    return {proj.name, includefiles, srcfiles, includedirs, ignoredDirs, ignoredFiles, dep,
-                           staticLinkFiles, LinkDirs, extra, bset, version, authors, description, license,
-                           github_username, github_repo, defines, format};
+    ProjectSettings settings{proj.name, includefiles, srcfiles, includedirs, ignoredDirs, ignoredFiles, dep,
+                             staticLinkFiles, LinkDirs, extra, bset, version, authors, description, license,
+                             github_username, github_repo, defines, format};
+    if (auto test = config["test"].as_table())
+    {
+        if (test->contains("inputs"))
+            settings.tests.inputs = readTomlArray(test, "inputs");
+        if (test->contains("env"))
+            settings.tests.env = readTomlArray(test, "env");
+    }
+    return settings;
 }
 
-std::string pickCompiler()
+std::string pickCompiler(const ProjectConfig &pc, const ProjectSettings &ps)
 {
-    const ProjectConfig pc = getCurrentProject();
+    if (ps.extra.contains("compiler"))
+        return ps.extra.at("compiler");
+    return pc.toolchain.compilerPath.string();
+}
 
-    if (const ProjectSettings ps = getProjectSettings(); ps.extra.contains("compiler"))
+namespace
+{
+// Reads a file once for both parsing and change detection
+std::string readTrackedFile(const fs::path &path, fs::file_time_type &mtime, std::string &hash)
+{
+    std::error_code ec;
+    mtime = fs::last_write_time(path, ec);
+    std::ifstream in(path, std::ios::binary);
+    std::string content{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    hash = Hasher().update(content).hexdigest();
+    return content;
+}
+
+toml::table parseGlobalConfig(const fs::path &path, fs::file_time_type &mtime, std::string &hash)
+{
+    if (!fs::exists(path))
     {
-        return ps.extra.at("compiler");
+        mtime = {};
+        hash.clear();
+        return {};
     }
-    else
+    const std::string content = readTrackedFile(path, mtime, hash);
+    try
+    {
+        return toml::parse(content, path.string());
+    }
+    catch (const toml::parse_error &err)
     {
-        return pc.toolchain.compilerPath;
+        throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
     }
 }
 
-void setExtra(const std::string &name, const std::string &value)
+toml::table parseProjectConfig(const fs::path &path, fs::file_time_type &mtime, std::string &hash)
 {
-    ProjectConfig pc = getCurrentProject();
-    toml::table table = toml::parse_file(pc.path + "/config.toml");
+    const std::string content = readTrackedFile(path, mtime, hash);
+    try
+    {
+        return toml::parse(content, path.string());
+    }
+    catch (const toml::parse_error &err)
+    {
+        throw CPPX_Exception(fmt::format("Error parsing config.toml: {}", err.description()));
+    }
+}
+
+// A touched file is only re-parsed if its content actually changed
+bool fileChanged(const fs::path &path, fs::file_time_type &mtime, const std::string &hash)
+{
+    std::error_code ec;
+    const auto current = fs::last_write_time(path, ec);
+    if (ec)
+        return !hash.empty();
+    if (current == mtime)
+        return false;
+    std::string newHash;
+    readTrackedFile(path, mtime, newHash);
+    return newHash != hash;
+}
+} // namespace
+
+ProjectContext::ProjectContext(const fs::path &globalPath)
+    : _globalPath(globalPath), _global(parseGlobalConfig(_globalPath, _globalMtime, _globalHash)),
+      _project(parseCurrentProject(_global)), _configPath(fs::path(_project.path) / "config.toml"),
+      _config(parseProjectConfig(_configPath, _configMtime, _configHash)),
+      _settings(parseProjectSettings(_project, _config)), _compiler(pickCompiler(_project, _settings))
+{
+}
+
+const ProjectConfig &ProjectContext::project() const
+{
+    return _project;
+}
+
+const ProjectSettings &ProjectContext::settings() const
+{
+    return _settings;
+}
+
+const toml::table &ProjectContext::globalConfig() const
+{
+    return _global;
+}
+
+const toml::table &ProjectContext::config() const
+{
+    return _config;
+}
+
+const std::string &ProjectContext::compiler() const
+{
+    return _compiler;
+}
+
+const fs::path &ProjectContext::configPath() const
+{
+    return _configPath;
+}
+
+fs::path ProjectContext::path() const
+{
+    return _project.path;
+}
+
+bool ProjectContext::reload()
+{
+    bool changed = false;
+    if (fileChanged(_globalPath, _globalMtime, _globalHash))
+    {
+        _global = parseGlobalConfig(_globalPath, _globalMtime, _globalHash);
+        _project = parseCurrentProject(_global);
+        _configPath = fs::path(_project.path) / "config.toml";
+        _configHash.clear(); // The project may have been switched
+        changed = true;
+    }
+    if (_configHash.empty() || fileChanged(_configPath, _configMtime, _configHash))
+    {
+        _config = parseProjectConfig(_configPath, _configMtime, _configHash);
+        changed = true;
+    }
+    if (changed)
+    {
+        _settings = parseProjectSettings(_project, _config);
+        _compiler = pickCompiler(_project, _settings);
+    }
+    return changed;
+}
+
+void ProjectContext::saveConfig(toml::table config)
+{
+    // Validate before writing, so a bad edit never reaches the file
+    ProjectSettings settings = parseProjectSettings(_project, config);
+    std::ostringstream serialized;
+    serialized << config;
+    writeFileAtomic(_configPath, serialized.str());
+
+    std::error_code ec;
+    _configMtime = fs::last_write_time(_configPath, ec);
+    _configHash = Hasher().update(serialized.str()).hexdigest();
+    _config = std::move(config);
+    _settings = std::move(settings);
+    _compiler = pickCompiler(_project, _settings);
+}
+
+void setExtra(ProjectContext &ctx, const std::string &name, const std::string &value)
+{
+    toml::table table = ctx.config();
 
     if (auto *extra = table["extra"].as_table())
     {
@@ -510,26 +1178,22 @@ void setExtra(const std::string &name, const std::string &value)
         table.insert("extra", toml::table{{name, value}});
     }
 
-    std::ofstream ofs(pc.path + "/config.toml");
-    ofs << table;
+    ctx.saveConfig(std::move(table));
 }
 
-void setMetadata(const std::string &key, const std::string &value)
+void setMetadata(ProjectContext &ctx, const std::string &key, const std::string &value)
 {
-    ProjectConfig pc = getCurrentProject();
-    toml::table table = toml::parse_file(pc.path + "/config.toml");
+    toml::table table = ctx.config();
     toml::table metadata;
     if (table.contains("metadata") && table["metadata"].is_table())
         metadata = *table["metadata"].as_table();
     metadata.insert_or_assign(key, value);
     table.insert_or_assign("metadata", metadata);
-    std::ofstream ofs(pc.path + "/config.toml");
-    ofs << table;
+    ctx.saveConfig(std::move(table));
 }
-void setMetadata(const std::string &key, const std::vector<std::string> &values)
+void setMetadata(ProjectContext &ctx, const std::string &key, const std::vector<std::string> &values)
 {
-    ProjectConfig pc = getCurrentProject();
-    toml::table table = toml::parse_file(pc.path + "/config.toml");
+    toml::table table = ctx.config();
     toml::table metadata;
     if (table.contains("metadata") && table["metadata"].is_table())
         metadata = *table["metadata"].as_table();
@@ -541,107 +1205,6 @@ void setMetadata(const std::string &key, const std::vector<std::string> &values)
     }
     metadata.insert_or_assign(key, arr);
     table.insert_or_assign("metadata", metadata);
-    std::ofstream ofs(pc.path + "/config.toml");
-    ofs << table;
+    ctx.saveConfig(std::move(table));
 }
 
-
-FileWatcher::FileWatcher(fs::path dir, Callback cb, const std::chrono::milliseconds interval)
-    : _dir(std::move(dir)), _cb(std::move(cb)), _interval(interval)
-{
-    _snapshot = snapshot_dir();
-}
-
-void FileWatcher::run(const std::stop_token &stoken)
-{
-    while (!stoken.stop_requested())
-    {
-        std::this_thread::sleep_for(_interval);
-        std::unordered_map<fs::path, fs::file_time_type> current;
-        try
-        {
-            current = snapshot_dir();
-        }
-        catch (const std::filesystem::filesystem_error &e)
-        {
-            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red),
-                       "[FileWatcher] Filesystem error: {}\n", e.what());
-            continue;
-        }
-        catch (const std::exception &e)
-        {
-            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red),
-                       "[FileWatcher] Unexpected error: {}\n", e.what());
-            continue;
-        }
-
-
-        for (const auto &p : current | std::views::keys)
-        {
-            if (!_snapshot.contains(p))
-            {
-                _cb(p, true);
-            }
-        }
-        for (const auto &p : _snapshot | std::views::keys)
-        {
-            if (!current.contains(p))
-            {
-                _cb(p, false);
-            }
-        }
-
-        _snapshot = std::move(current);
-    }
-}
-
-std::unordered_map<fs::path, fs::file_time_type> FileWatcher::snapshot_dir(fs::path const &dir)
-{
-    std::unordered_map<fs::path, fs::file_time_type> m;
-    for (auto const &entry : fs::directory_iterator(dir))
-    {
-        if (entry.is_regular_file())
-        {
-            m[entry.path().filename()] = entry.last_write_time();
-        }
-    }
-    return m;
-}
-
-std::unordered_map<fs::path, fs::file_time_type> FileWatcher::snapshot_dir() const
-{
-    return snapshot_dir(_dir);
-}
-std::string glob_to_regex(const std::string& glob) {
-     std::string regex = "^";
-     for (size_t i = 0; i < glob.size(); ++i) {
-         switch (glob[i]) {
-         case '*':
-             if (i + 1 < glob.size() && glob[i + 1] == '*') {
-                 regex += ".*";
-                 ++i;
-             } else {
-                 regex += "[^/]*";
-             }
-             break;
-         case '?': regex += '.'; break;
-         case '.': regex += "\\."; break;
-         case '/': regex += "/"; break;
-         default: regex += glob[i]; break;
-         }
-     }
-     regex += "$";
-     return regex;
- }
-std::vector<std::filesystem::path> glob(const std::filesystem::path& root, const std::string& pattern) {
-     std::vector<std::filesystem::path> result;
-     const std::regex re(glob_to_regex(pattern));
-     for (auto const& p : std::filesystem::recursive_directory_iterator(root)) {
-         if (std::filesystem::is_regular_file(p.path())) {
-             if (std::string relative = std::filesystem::relative(p.path(), root).generic_string();std::regex_match(relative, re)) {
-                 result.push_back(p.path());
-             }
-         }
-     }
-     return result;
- }
@@ -9,8 +9,10 @@
 #include <unordered_map>
 #include <chrono>
 #include <functional>
+#include <iostream>
 #include <thread>
 #include <optional>
+#include <array>
 #include <algorithm> // Required for std::find_if
 
 #include <fmt/color.h>
@@ -55,9 +57,54 @@ template <> struct fmt::formatter<std::filesystem::path> : fmt::formatter<std::s
     }
 };
  std::string displayStringVector(const std::vector<std::string> &vec);
+std::string quoteArgument(const std::string &arg);
+std::string joinCommand(const std::vector<std::string> &args);
+void print_status_message(const std::string &message, const std::string &status, fmt::color status_color);
+
+// SHA-256, since digests address the shared remote cache and a collision would serve another TU's object
+class Hasher
+{
+  public:
+    Hasher &update(std::string_view data);
+    Hasher &updateFile(const fs::path &file);
+    [[nodiscard]] std::string hexdigest() const;
+
+  private:
+    std::array<uint32_t, 8> _state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::array<unsigned char, 64> _buffer{};
+    size_t _buffered = 0;
+    uint64_t _length = 0;
+};
+
+std::string hashFile(const fs::path &file);
+// Looks name up in PATH like a shell would; names containing a directory are only checked as given
+std::optional<fs::path> findProgram(const std::string &name);
+uint64_t parseSize(const std::string &size);
+std::string formatSize(uint64_t bytes);
+// Escapes text for XML content and attribute values; control characters XML 1.0 forbids become '?'
+std::string xmlEscape(std::string_view text);
+// The current UTC time through strftime, e.g. "%Y%m%d-%H%M%S" for file names
+std::string utcTimestamp(const char *format);
+// A previous run's JSON report, as written by 'cppx bench' and 'cppx size': a path to it, or the name of one under
+// dir ('latest', a --save name) or dir/history/ (a history id)
+json loadBaseline(const fs::path &dir, const std::string &baseline);
+
+#if !defined(_WIN32)
+// Sets FD_CLOEXEC on an open descriptor: macOS has neither pipe2() nor SOCK_CLOEXEC
+void setCloseOnExec(int fd);
+// Loops over send()/recv() on a connected socket until all of data went through, retrying after EINTR; false once
+// the peer is gone. Sending never raises SIGPIPE where MSG_NOSIGNAL exists.
+bool sendAll(int fd, const void *data, size_t size);
+bool receiveAll(int fd, void *data, size_t size);
+#endif
+// Parses "i/n" (1-based) into a 0-based shard index and the shard count
+std::pair<size_t, size_t> parseShard(const std::string &shard);
  std::string displayStringVectorPrefix(const std::vector<std::string> &vec, const std::string &prefix,
                                              const std::string &separator);
 
+// Conan packages installed into vendor/. What each install reported is merged into vendor/packages.json, keyed
+// by exact reference (name/version), which is read once per PackageManager instead of on every query.
 class PackageManager
 {
     fs::path vendor;
@@ -69,19 +116,30 @@ class PackageManager
         std::vector<std::string> libs;
         std::vector<std::string> includePaths;
         std::vector<std::string> libPaths;
+        std::vector<std::string> dependencies; // References of the packages it pulled in
+        bool requested = false;                // Installed by name rather than as a dependency
     };
 
     explicit PackageManager(fs::path dir = "vendor/");
 
-    void install(const std::string &packageRef) const;
+    // Resolves every reference in one Conan graph, downloading in parallel. With a lockfile, locked versions and
+    // revisions are used; extendLock adds references the lockfile does not know yet instead of failing.
+    void install(const std::vector<std::string> &packageRefs, const fs::path &lockfile = {},
+                 bool extendLock = true) const;
     [[nodiscard]] PackageInfo getPackageInfo(const std::string &packageRef) const;
     [[nodiscard]] std::optional<PackageInfo> remove(const std::string &packageRef) const;
     [[nodiscard]] bool checkIfInstalled(const std::string &packageRef) const;
+    [[nodiscard]] std::vector<PackageInfo> installedPackages() const;
 
   private:
-    [[nodiscard]] json loadInstallLog() const;
-    [[nodiscard]] std::vector<std::string> get_info_from_package(const std::string &packageRef,
-                                                                 const std::string &infoType) const;
+    using Index = std::unordered_map<std::string, PackageInfo>;
+
+    [[nodiscard]] Index &index() const;
+    [[nodiscard]] const PackageInfo *find(const std::string &packageRef) const;
+    void mergeGraph(const json &graph) const;
+    void saveIndex() const;
+
+    mutable std::optional<Index> _index;
 };
 
 struct Toolchain
@@ -112,11 +170,103 @@ struct BuildSettings
 {
     std::string outputName;
     buildType btype = buildType::BUILD_EXECUTABLE;
+    std::string pch; // Header to precompile and force-include into every TU
+    size_t unityBatch = 0; // Sources per unity TU; 0 = unity builds only with --unity
+    std::vector<std::string> unityExclude; // Sources that are always compiled on their own
+    std::vector<std::string> deps; // [targets.<name>] of the workspace this one needs built and linked first
+    bool pic = false; // -fPIC for a static library, set when a shared library of the workspace links it
+    bool modules = false; // Scans every source for C++20 module imports, not only when there are .cppm files
 
     BuildSettings(std::string on, buildType bt);
     BuildSettings() = default;
 };
 
+// Which half of a profile-guided build a plan is for
+enum class PgoStage
+{
+    None,
+    Instrument, // Writes profiles when run
+    Optimize    // Compiles with the merged profile
+};
+
+// Options of a single 'cppx build' invocation
+struct BuildOptions
+{
+    bool debug = false;
+    std::string config;
+    size_t jobs = 0; // 0 = hardware concurrency
+    bool noCache = false;
+    bool unity = false;
+    bool noUnity = false; // Overrides [build] unity_batch, e.g. for tests that need single objects
+    bool pgo = false;        // Instrument, train and rebuild optimized (or reuse a profile that is still current)
+    bool pgoRetrain = false; // Retrains even if the stored profile still matches the sources
+    std::string pgoTrain;    // Training command; overrides [pgo] train, default is running the benchmarks once
+    PgoStage pgoStage = PgoStage::None;
+    bool trace = false;     // Writes build/trace.json
+    bool timeTrace = false; // Compiles with clang -ftime-trace and reports the most expensive headers and templates
+    bool profiling = false; // Frame pointers and debug info into build/perf/, for 'cppx perf'
+    bool distribute = false; // Compiles preprocessed TUs on the [distribute] workers
+    std::string target;      // Builds only this target of the workspace and what it depends on; empty = all
+};
+
+// Options of a single 'cppx test' invocation
+struct TestOptions
+{
+    size_t jobs = 0;
+    std::chrono::seconds timeout{300}; // Per test; 0 = no limit
+    size_t shardIndex = 0;             // 0-based; run the tests whose position modulo shardCount equals this
+    size_t shardCount = 1;
+    std::string junitReport;
+    std::string jsonReport;
+    bool noCache = false; // Re-runs every test instead of skipping the ones that passed with the same inputs
+};
+
+// Options of a single 'cppx format' invocation
+struct FormatOptions
+{
+    size_t jobs = 0;
+    bool check = false;   // Reports files that need formatting instead of rewriting them
+    bool noCache = false; // Runs clang-format on every file, even the ones known to be formatted
+};
+
+// Options of a single 'cppx perf' invocation
+struct PerfOptions
+{
+    std::string config = "release";
+    std::vector<std::string> args; // Passed to the profiled executable
+    unsigned frequency = 999;      // Samples per second with perf
+    std::string diff;              // Baseline: a .folded file, or a name under build/perf/ such as 'latest'
+    std::chrono::milliseconds interval{100}; // Between gdb samples when neither perf nor xctrace is available
+    size_t jobs = 0;
+};
+
+// Options of a single 'cppx bench' invocation
+struct BenchOptions
+{
+    std::string config = "release"; // Entry of [configurations] the benchmarks are built with
+    size_t warmup = 3;
+    size_t repetitions = 20;
+    std::optional<int> cpu;     // Pins the benchmarks to this CPU
+    std::string filter;         // Only runs benchmarks whose name contains this
+    std::string compare;        // Baseline: a file, or a name under build/bench/ such as 'latest'
+    std::string save;           // Also stores this run as build/bench/<save>.json
+    double threshold = 0.05;    // Relative median slowdown that counts as a regression
+    double alpha = 0.01;        // Significance level of the Mann-Whitney test
+    size_t jobs = 0;            // Compile jobs; benchmarks themselves always run one at a time
+};
+
+// Options of 'cppx size'
+struct SizeOptions
+{
+    std::string config = "release";
+    std::string target;    // [targets.<name>] to measure instead of the project
+    size_t top = 15;       // Rows per table
+    std::string diff;      // Baseline: a file, or a name under build/size/ such as 'latest'
+    std::string save;      // Also stores the report as build/size/<save>.json
+    std::string maxGrowth; // Overrides [size] max_growth: bytes ("16K") or a share of the baseline ("2%")
+    size_t jobs = 0;
+};
+
 struct Format
 {
     std::string formatBase{};
@@ -127,6 +277,13 @@ struct Format
 
     Format() = default;
 };
+// [test] section of config.toml: what a test binary reads at runtime besides its own code
+struct TestSettings
+{
+    std::vector<std::string> inputs; // Files, directories or globs relative to the project
+    std::vector<std::string> env;    // Names of environment variables the tests depend on
+};
+
 struct ProjectSettings
 {
     std::string name;
@@ -150,6 +307,7 @@ struct ProjectSettings
     std::string github_repo;
     std::unordered_map<std::string, std::string> defines;
     Format format;
+    TestSettings tests;
 
     ProjectSettings(std::string n,
                     const std::vector<std::string> &iff,
@@ -174,13 +332,56 @@ struct ProjectSettings
 
 };
 
-ProjectConfig getCurrentProject();
+fs::path globalConfigPath();
+// Writes to a temporary file next to path and renames it over path, so readers never see a torn file
+void writeFileAtomic(const fs::path &path, const std::string &content);
+toml::table parseTomlFile(const fs::path &path);
+ProjectConfig parseCurrentProject(const toml::table &globalConfig);
 std::vector<std::string> readTomlArray(const toml::node *node, const std::string &key);
-ProjectSettings getProjectSettings();
-std::string pickCompiler();
-void setExtra(const std::string &name, const std::string &value);
-void setMetadata(const std::string &key, const std::string &value);
-void setMetadata(const std::string &key, const std::vector<std::string> &values);
+// build_type of [build] or of a [targets.<name>]: executable, static or shared (also dynamic)
+buildType parseBuildType(const std::string &type);
+ProjectSettings parseProjectSettings(const ProjectConfig &proj, const toml::table &config);
+std::string pickCompiler(const ProjectConfig &pc, const ProjectSettings &ps);
+
+// ~/.cppxglobal.toml and the current project's config.toml, parsed and validated once per process and
+// passed to every command. Long-running commands call reload(), which re-parses a file only if its
+// mtime changed and its content hash differs.
+class ProjectContext
+{
+  public:
+    explicit ProjectContext(const fs::path &globalPath = globalConfigPath());
+
+    [[nodiscard]] const ProjectConfig &project() const;
+    [[nodiscard]] const ProjectSettings &settings() const;
+    [[nodiscard]] const toml::table &globalConfig() const;
+    [[nodiscard]] const toml::table &config() const;
+    [[nodiscard]] const std::string &compiler() const;
+    [[nodiscard]] const fs::path &configPath() const;
+    [[nodiscard]] fs::path path() const;
+
+    // Returns true if anything was re-parsed
+    bool reload();
+    // Validates and writes config.toml, then adopts it without reading it back
+    void saveConfig(toml::table config);
+
+  private:
+    fs::path _globalPath;
+    fs::file_time_type _globalMtime;
+    std::string _globalHash;
+    toml::table _global;
+    ProjectConfig _project;
+
+    fs::path _configPath;
+    fs::file_time_type _configMtime;
+    std::string _configHash;
+    toml::table _config;
+    ProjectSettings _settings;
+    std::string _compiler;
+};
+
+void setExtra(ProjectContext &ctx, const std::string &name, const std::string &value);
+void setMetadata(ProjectContext &ctx, const std::string &key, const std::string &value);
+void setMetadata(ProjectContext &ctx, const std::string &key, const std::vector<std::string> &values);
 
 // TEMPLATE FUNCTION DEFINITIONS
 // These must be in the header file for the compiler to instantiate them correctly.
@@ -238,45 +439,26 @@ void removeFromTomlArray(toml::v3::array &toml_array, const T &values_to_remove,
 
 void handle_project_new(const std::string &projectName);
 void handle_project_set(const std::string &projectName, const std::string &projectPath);
-void handle_build(bool debug, const std::string &config);
-void handle_run();
-void handle_watch(const std::string &dir, bool force);
-void handle_ignore(const std::vector<fs::path> &directories);
-void handle_pkg_install(const std::string &packageName, const std::string &packageVersion);
-void handle_pkg_remove(const std::string &packageToRemove);
-void handle_export(const std::string &format);
-void handle_config_set(const std::string &what);
+void handle_build(const ProjectContext &ctx, const BuildOptions &opts);
+void handle_run(const ProjectContext &ctx);
+void handle_perf(const ProjectContext &ctx, const PerfOptions &opts);
+void handle_watch(ProjectContext &ctx, const std::vector<std::string> &dirs, bool force,
+                  std::chrono::milliseconds debounce);
+void handle_ignore(ProjectContext &ctx, const std::vector<fs::path> &directories);
+void handle_pkg_install(ProjectContext &ctx, const std::vector<std::string> &packages, const std::string &packageVersion);
+void handle_pkg_restore(ProjectContext &ctx);
+void handle_pkg_remove(ProjectContext &ctx, const std::string &packageToRemove);
+void handle_export(const ProjectContext &ctx, const std::string &format, const BuildOptions &opts);
+void handle_config_set(ProjectContext &ctx, const std::string &what);
 void handle_profile();
-void handle_doc();
-void handle_clean();
-void handle_test();
-void handle_metadata();
-void handle_info();
-void handle_fmt(const std::vector<std::string> &range);
-void handle_list();
-class FileWatcher
-{
-  public:
-    using Callback = std::function<void(fs::path, bool created)>;
-
-    FileWatcher(fs::path dir, Callback cb, std::chrono::milliseconds interval = std::chrono::milliseconds(500));
-    void run(const std::stop_token &stoken);
-
-  private:
-    fs::path _dir;
-    Callback _cb;
-    std::chrono::milliseconds _interval;
-    std::unordered_map<fs::path, fs::file_time_type> _snapshot;
-
-    static std::unordered_map<fs::path, fs::file_time_type> snapshot_dir(fs::path const &dir);
-    [[nodiscard]] std::unordered_map<fs::path, fs::file_time_type> snapshot_dir() const;
-};
-std::string glob_to_regex(const std::string& glob);
-std::vector<std::filesystem::path> glob(const std::filesystem::path& root, const std::string& pattern); inline bool is_glob(const std::string& pattern) {
-    for (const char c : pattern) {
-        if (c == '*' || c == '?' || c == '[') {
-            return true;
-        }
-    }
-    return false;
-}
\ No newline at end of file
+void handle_doc(const ProjectContext &ctx);
+void handle_clean(const ProjectContext &ctx);
+void handle_test(const ProjectContext &ctx, const TestOptions &opts);
+void handle_bench(const ProjectContext &ctx, const BenchOptions &opts);
+void handle_size(const ProjectContext &ctx, const SizeOptions &opts);
+void handle_metadata(ProjectContext &ctx);
+void handle_info(const ProjectContext &ctx);
+void handle_fmt(const ProjectContext &ctx, const std::vector<std::string> &range, const FormatOptions &opts);
+void handle_list(const ProjectContext &ctx);
+void handle_cache_stats();
+void handle_cache_prune(const std::string &maxSize);
@@ -24,14 +24,19 @@
 */
 #include <algorithm>
 #include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits> // For numeric_limits
 #include <optional>
+#include <regex>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <csignal>
 
@@ -44,7 +49,17 @@
 #include <toml++/toml.hpp>
 
 #include "github.hpp"
+#include "glob.hpp"
+#include "build.hpp"
+#include "daemon.hpp"
+#include "distribute.hpp"
+#include "exporters.hpp"
 #include "helpers.hpp"
+#include "pgo.hpp"
+#include "scheduler.hpp"
+#include "toolchain.hpp"
+#include "trace.hpp"
+#include "watcher.hpp"
 
 void print_status_message(const std::string &message, const std::string &status, const fmt::color status_color)
 {
@@ -52,29 +67,14 @@ void print_status_message(const std::string &message, const std::string &status,
     fmt::print(fmt::emphasis::bold, "{}\n", message);
 }
 
-void show_spinner_animation(const std::chrono::milliseconds duration)
+namespace
 {
-    using namespace std::chrono;
-    const auto start = high_resolution_clock::now();
-    const auto end = start + duration;
-    size_t frame_index = 0;
+void applyWatchBatch(ProjectContext &ctx, const std::vector<FileChange> &batch);
+} // namespace
 
-    while (high_resolution_clock::now() < end)
-    {
-        constexpr std::array frames = {'-', '\\', '|', '/'};
-        fmt::print(stderr, "\r{} Running... ", frames[frame_index]);
-        std::fflush(stderr);
-        frame_index = (frame_index + 1) % frames.size();
-        std::this_thread::sleep_for(100ms);
-    }
-
-    // Clear the line
-    fmt::print(stderr, "\r{: <20}\r", "");
-    std::fflush(stderr);
-}
-
-
-int main(int argc, char **argv)
+// Parses and runs one command line. ctx_storage is empty for a plain invocation; the daemon passes the project it
+// keeps loaded.
+int runCommand(int argc, char **argv, std::optional<ProjectContext> &ctx_storage)
 {
     CLI::App app{"cppx — project manager for C++"};
 
@@ -101,20 +101,49 @@ int main(int argc, char **argv)
 
     // ─────────────────────────────────────────────────────────────────
     // build & run
-    bool build_debug = false;
-    std::string build_config;
+    BuildOptions build_opts;
     auto build = app.add_subcommand("build", "Builds the project");
-    build->add_flag("-d,--debug", build_debug, "Builds the project in debug mode");
-    build->add_option("-c,--config", build_config, "Build configuration (e.g., debug, release, custom)");
+    build->add_flag("-d,--debug", build_opts.debug, "Builds the project in debug mode");
+    build->add_option("-c,--config", build_opts.config, "Build configuration (e.g., debug, release, custom)");
+    build->add_option("-j,--jobs", build_opts.jobs, "Number of parallel compile jobs (default: number of cores)");
+    build->add_flag("--no-cache", build_opts.noCache, "Does not use the compilation cache");
+    build->add_flag("--unity", build_opts.unity, "Compiles sources in unity batches (see [build] unity_batch)");
+    auto pgo_flag = build->add_flag("--pgo", build_opts.pgo, "Profile-guided build: instruments, trains and rebuilds optimized");
+    build->add_flag("--pgo-retrain", build_opts.pgoRetrain, "Retrains even if the stored profile is still current")
+        ->needs(pgo_flag);
+    build->add_option("-t,--target", build_opts.target,
+                      "Builds only this [targets] entry of config.toml and what it depends on");
+    build->add_flag("--distribute", build_opts.distribute,
+                    "Compiles on the workers listed under [distribute] in ~/.cppxglobal.toml");
+    build->add_flag("--trace", build_opts.trace, "Writes a Chrome/Perfetto trace of the build to build/trace.json");
+    build->add_flag("--time-trace", build_opts.timeTrace,
+                    "Compiles with clang -ftime-trace and reports the most expensive headers and templates");
+    build->add_option("--pgo-train", build_opts.pgoTrain,
+                      "Shell command to train with (default: [pgo] train, or run benches/ once)")
+        ->needs(pgo_flag);
 
     auto run = app.add_subcommand("run", "Runs the project");
 
+    auto perf = app.add_subcommand("perf", "Profiles the project and writes a flame graph to build/perf/");
+    PerfOptions perf_opts;
+    size_t perf_interval = 100;
+    perf->add_option("args", perf_opts.args, "Arguments for the executable (after --)");
+    perf->add_option("-c,--config", perf_opts.config, "Build configuration from [configurations]")
+        ->capture_default_str();
+    perf->add_option("-j,--jobs", perf_opts.jobs, "Number of parallel compile jobs (default: number of cores)");
+    perf->add_option("-F,--frequency", perf_opts.frequency, "Samples per second with perf")->capture_default_str();
+    perf->add_option("--diff", perf_opts.diff, "Colors the flame graph by change against a baseline (file or 'latest')");
+    perf->add_option("--interval", perf_interval, "Milliseconds between gdb samples when perf is not available")
+        ->capture_default_str();
+
     // ─────────────────────────────────────────────────────────────────
     // watch
     auto watch = app.add_subcommand("watch", "Updates configuration after adding files");
-    std::string dir;
+    std::vector<std::string> watch_dirs{"src"};
     bool watchforce = false;
-    watch->add_option("-d,--dir", dir, "Monitored directory")->required();
+    size_t watch_debounce = 200;
+    watch->add_option("-d,--dir", watch_dirs, "Monitored directories, relative to the project (default: src)");
+    watch->add_option("--debounce", watch_debounce, "Milliseconds to collect changes before updating config.toml");
     watch->add_flag("-f,--force", watchforce, "Forces the watch command to run in the foreground");
 
     // ─────────────────────────────────────────────────────────────────
@@ -128,11 +157,15 @@ int main(int argc, char **argv)
     auto package = app.add_subcommand("pkg", "Package management commands");
 
     // pkg install
-    auto install = package->add_subcommand("install", "Installs a package");
-    std::string packageName;
+    auto install = package->add_subcommand("install", "Installs packages, resolved together in one Conan graph");
+    std::vector<std::string> packageNames;
     std::string packageVersion;
-    install->add_option("name", packageName, "Package name")->required();
-    install->add_option("-v,--version", packageVersion, "Package version")->required();
+    install->add_option("packages", packageNames, "Packages as name/version (or one name with --version)")
+        ->required();
+    install->add_option("-v,--version", packageVersion, "Version of a single package given by name");
+
+    // pkg restore
+    auto restore = package->add_subcommand("restore", "Installs the missing [dependencies], pinned by cppx.lock");
 
     // pkg remove
     auto remove = package->add_subcommand("remove", "Removes a package");
@@ -142,11 +175,42 @@ int main(int argc, char **argv)
     // pkg list
     auto list = package->add_subcommand("list", "Lists the packages");
 
+    // ─────────────────────────────────────────────────────────────────
+    // compilation cache
+    auto cache = app.add_subcommand("cache", "Compilation cache commands");
+    auto cacheStats = cache->add_subcommand("stats", "Shows cache size and hit rate");
+    auto cachePrune = cache->add_subcommand("prune", "Removes least recently used objects from the cache");
+    std::string cacheMaxSize;
+    cachePrune->add_option("--max-size", cacheMaxSize, "Size to shrink the cache to (e.g. 2G, 500M)");
+
+    // ─────────────────────────────────────────────────────────────────
+    // worker
+    auto worker = app.add_subcommand("worker", "Compiles for 'cppx build --distribute' on other machines");
+    WorkerOptions worker_opts;
+    worker->add_option("--listen", worker_opts.listen,
+                       "Address and port to accept builds on (default: 0.0.0.0:7411, 127.0.0.1:7411 without a token)");
+    worker->add_option("-j,--jobs", worker_opts.jobs, "Concurrent compiles (default: number of cores)");
+    worker->add_option("--token", worker_opts.token, "Shared secret clients must send (default: [distribute] token)");
+
+    // ─────────────────────────────────────────────────────────────────
+    // daemon
+    auto daemon = app.add_subcommand("daemon", "Background server that runs commands with the project kept loaded");
+    auto daemonStart = daemon->add_subcommand("start", "Starts the daemon; later commands are forwarded to it");
+    DaemonOptions daemon_opts;
+    daemonStart->add_flag("-f,--foreground", daemon_opts.foreground, "Stays in the foreground instead of detaching");
+    daemonStart->add_option("-w,--watch", daemon_opts.watchDirs,
+                            "Directories whose new and deleted files update config.toml, like 'cppx watch'");
+    auto daemonStop = daemon->add_subcommand("stop", "Stops the daemon once running commands have finished");
+    auto daemonStatus = daemon->add_subcommand("status", "Shows whether a daemon is running and what it serves");
+
     // ─────────────────────────────────────────────────────────────────
     // export
     auto export_cmd = app.add_subcommand("export", "Exports the configuration file to another format");
     std::string expr;
-    export_cmd->add_option("exportTo", expr, "Format to export the configuration to");
+    export_cmd->add_option("exportTo", expr, "Format to export the configuration to: cmake, ninja or compdb");
+    BuildOptions export_opts;
+    export_cmd->add_flag("-d,--debug", export_opts.debug, "Exports the debug build (ninja, compdb)");
+    export_cmd->add_option("-c,--config", export_opts.config, "Build configuration to export (ninja, compdb)");
 
     // config
     auto config_cmd = app.add_subcommand("config", "Configures project settings");
@@ -158,6 +222,45 @@ int main(int argc, char **argv)
     auto doc = app.add_subcommand("doc", "Generates documentation using Doxygen");
     auto clean = app.add_subcommand("clean", "Removes build artifacts");
     auto test = app.add_subcommand("test", "Runs tests");
+    TestOptions test_opts;
+    size_t test_timeout = 300;
+    std::string test_shard;
+    test->add_option("-j,--jobs", test_opts.jobs, "Number of parallel jobs (default: number of cores)");
+    test->add_option("--timeout", test_timeout, "Seconds a test may run before it is killed (0 = no limit)")
+        ->capture_default_str();
+    test->add_option("--shard", test_shard, "Runs only shard i of n, e.g. 2/4, to split tests across machines");
+    test->add_option("--junit", test_opts.junitReport, "Writes a JUnit XML report to this file");
+    test->add_option("--json", test_opts.jsonReport, "Writes a JSON report to this file");
+    test->add_flag("--no-cache", test_opts.noCache, "Runs every test, even those that passed with the same inputs");
+    auto bench = app.add_subcommand("bench", "Builds and runs the benchmarks in benches/");
+    BenchOptions bench_opts;
+    int bench_cpu = -1;
+    bench->add_option("-c,--config", bench_opts.config, "Build configuration from [configurations]")
+        ->capture_default_str();
+    bench->add_option("-j,--jobs", bench_opts.jobs, "Number of parallel compile jobs (default: number of cores)");
+    bench->add_option("--warmup", bench_opts.warmup, "Runs per benchmark that are not measured")->capture_default_str();
+    bench->add_option("-r,--repetitions", bench_opts.repetitions, "Measured runs per benchmark")
+        ->capture_default_str();
+    bench->add_option("--pin", bench_cpu, "Pins the benchmarks to this CPU (Linux)");
+    bench->add_option("-f,--filter", bench_opts.filter, "Only runs benchmarks whose name contains this");
+    bench->add_option("--compare", bench_opts.compare,
+                      "Fails on significant regressions against a baseline (file, 'latest' or a --save name)");
+    bench->add_option("--save", bench_opts.save, "Also stores the results as build/bench/<name>.json");
+    bench->add_option("--threshold", bench_opts.threshold, "Relative median slowdown that counts as a regression")
+        ->capture_default_str();
+    bench->add_option("--alpha", bench_opts.alpha, "Significance level of the Mann-Whitney U test")
+        ->capture_default_str();
+    auto size = app.add_subcommand("size", "Breaks the binary down by section, object, symbol and template");
+    SizeOptions size_opts;
+    size->add_option("-c,--config", size_opts.config, "Build configuration from [configurations]")
+        ->capture_default_str();
+    size->add_option("-t,--target", size_opts.target, "Measures this [targets] entry instead of the project");
+    size->add_option("-j,--jobs", size_opts.jobs, "Number of parallel compile jobs (default: number of cores)");
+    size->add_option("-n,--top", size_opts.top, "Rows per table")->capture_default_str();
+    size->add_option("--diff", size_opts.diff, "Compares against a baseline (file, 'latest' or a --save name)");
+    size->add_option("--save", size_opts.save, "Also stores the report as build/size/<name>.json");
+    size->add_option("--max-growth", size_opts.maxGrowth,
+                     "Fails when the binary grew more than this against --diff, e.g. 16K or 2% ([size] max_growth)");
     auto metadata = app.add_subcommand("metadata", "Adds metadata to config.toml");
     auto info = app.add_subcommand("info", "Displays project information");
 
@@ -167,6 +270,10 @@ int main(int argc, char **argv)
     std::vector<std::string> range{};
 
     format->add_option("Files", range, "Sets file to format");
+    FormatOptions format_opts;
+    format->add_option("-j,--jobs", format_opts.jobs, "Number of parallel jobs (default: number of cores)");
+    format->add_flag("--check", format_opts.check, "Fail if a file needs formatting instead of rewriting it");
+    format->add_flag("--no-cache", format_opts.noCache, "Run clang-format on files known to be formatted too");
 
     // ─────────────────────────────────────────────────────────────────
     // Parse & dispatch
@@ -174,42 +281,91 @@ int main(int argc, char **argv)
     {
         CLI11_PARSE(app, argc, argv);
 
+        // Loaded on first use, since 'project' and 'profile' have to work before a project is set
+        auto ctx = [&]() -> ProjectContext & {
+            if (!ctx_storage)
+            {
+                const Trace::Scope scope("load config", "config");
+                ctx_storage.emplace();
+            }
+            return *ctx_storage;
+        };
+
         if (projectNew->parsed())
             handle_project_new(projectName);
         else if (projectSet->parsed())
             handle_project_set(projectNameSet, projectPath);
         else if (build->parsed())
-            handle_build(build_debug, build_config);
+        {
+            if (build_opts.trace)
+                Trace::enable(); // Before the config is loaded, so that is part of the trace
+            handle_build(ctx(), build_opts);
+        }
         else if (run->parsed())
-            handle_run();
+            handle_run(ctx());
+        else if (perf->parsed())
+        {
+            perf_opts.interval = std::chrono::milliseconds(perf_interval);
+            handle_perf(ctx(), perf_opts);
+        }
         else if (watch->parsed())
-            handle_watch(dir, watchforce);
+            handle_watch(ctx(), watch_dirs, watchforce, std::chrono::milliseconds(watch_debounce));
         else if (ignore->parsed())
-            handle_ignore(directories);
+            handle_ignore(ctx(), directories);
         else if (install->parsed())
-            handle_pkg_install(packageName, packageVersion);
+            handle_pkg_install(ctx(), packageNames, packageVersion);
+        else if (restore->parsed())
+            handle_pkg_restore(ctx());
         else if (remove->parsed())
-            handle_pkg_remove(packageToRemove);
+            handle_pkg_remove(ctx(), packageToRemove);
         else if (export_cmd->parsed())
-            handle_export(expr);
+            handle_export(ctx(), expr, export_opts);
         else if (config_cmd->parsed())
-            handle_config_set(what);
+            handle_config_set(ctx(), what);
         else if (profile->parsed())
             handle_profile();
         else if (doc->parsed())
-            handle_doc();
+            handle_doc(ctx());
         else if (clean->parsed())
-            handle_clean();
+            handle_clean(ctx());
         else if (test->parsed())
-            handle_test();
+        {
+            test_opts.timeout = std::chrono::seconds(test_timeout);
+            if (!test_shard.empty())
+                std::tie(test_opts.shardIndex, test_opts.shardCount) = parseShard(test_shard);
+            handle_test(ctx(), test_opts);
+        }
+        else if (bench->parsed())
+        {
+            if (bench_cpu >= 0)
+                bench_opts.cpu = bench_cpu;
+            handle_bench(ctx(), bench_opts);
+        }
+        else if (size->parsed())
+            handle_size(ctx(), size_opts);
         else if (metadata->parsed())
-            handle_metadata();
+            handle_metadata(ctx());
         else if (info->parsed())
-            handle_info();
+            handle_info(ctx());
         else if (format->parsed())
-            handle_fmt(range);
+            handle_fmt(ctx(), range, format_opts);
         else if (list->parsed())
-            handle_list();
+            handle_list(ctx());
+        else if (worker->parsed())
+        {
+            const fs::path global_path = globalConfigPath();
+            runWorker(worker_opts, fs::exists(global_path) ? parseTomlFile(global_path) : toml::table{});
+        }
+        else if (daemonStart->parsed())
+            runDaemon(daemon_opts, runCommand, applyWatchBatch);
+        else if (daemonStop->parsed())
+            stopDaemon();
+        else if (daemonStatus->parsed())
+            printDaemonStatus();
+        else if (cacheStats->parsed())
+            handle_cache_stats();
+        else if (cachePrune->parsed())
+            handle_cache_prune(cacheMaxSize);
         else
             throw CPPX_Exception("Unknown command or missing required arguments.");
     }
@@ -231,6 +387,14 @@ int main(int argc, char **argv)
     return 0;
 }
 
+int main(int argc, char **argv)
+{
+    if (const auto code = forwardToDaemon(argc, argv))
+        return *code;
+    std::optional<ProjectContext> ctx;
+    return runCommand(argc, argv, ctx);
+}
+
 void handle_project_new(const std::string &projectName)
 {
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nCreating new project: {}\n\n", projectName);
@@ -326,25 +490,7 @@ void handle_project_set(const std::string &projectName, const std::string &proje
 {
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nSetting current project to: {}\n\n", projectName);
 
-    fs::path pathToGlobal;
-#if defined(__linux__) || defined(__APPLE__)
-    const char *homeDir = std::getenv("HOME");
-    if (!homeDir)
-    {
-        throw CPPX_Exception("Failed to get HOME directory.");
-    }
-    pathToGlobal = homeDir;
-    pathToGlobal /= ".cppxglobal.toml";
-#elif defined(_WIN32)
-    const char* userProfile = std::getenv("USERPROFILE");
-    if (!userProfile) {
-        throw CPPX_Exception("Failed to get USERPROFILE directory.");
-    }
-    pathToGlobal = userProfile;
-    pathToGlobal /= ".cppxglobal.toml";
-#else
-    throw CPPX_Exception("Unsupported OS.");
-#endif
+    const fs::path pathToGlobal = globalConfigPath();
 
     toml::table file;
     if (std::filesystem::exists(pathToGlobal))
@@ -382,312 +528,393 @@ void handle_project_set(const std::string &projectName, const std::string &proje
     }
 }
 
-void handle_build(bool debug, const std::string &build_config)
+void handle_build(const ProjectContext &ctx, const BuildOptions &opts)
 {
+    // Written by the outermost call only, so a PGO build gets one trace covering all of its stages
+    const Trace::File trace_file(opts.trace && opts.pgoStage == PgoStage::None
+                                     ? fs::path(ctx.project().path) / "build" / "trace.json"
+                                     : fs::path{});
+    if (opts.pgo && opts.pgoStage == PgoStage::None)
+    {
+        if (ctx.config().contains("targets"))
+            throw CPPX_Exception("--pgo does not support workspaces with [targets] yet.");
+        buildWithPgo(ctx, opts);
+        return;
+    }
+
     auto start = std::chrono::high_resolution_clock::now();
-    ProjectConfig proj = getCurrentProject();
-    ProjectSettings ps = getProjectSettings();
-    std::string compiler = pickCompiler();
+    const ProjectConfig &proj = ctx.project();
 
     fs::path build_dir = fs::path(proj.path) / "build";
 
     fmt::print(fmt::emphasis::bold, "--------------------------------------------------\n");
     print_status_message("Starting build...", "...", fmt::color::yellow);
     fmt::print(fmt::emphasis::bold, "--------------------------------------------------\n");
-    show_spinner_animation(std::chrono::milliseconds(500)); // Simulate a short delay
 
     print_status_message(fmt::format("Creating build directory: {}", build_dir.string()), "...", fmt::color::cyan);
     fs::create_directories(build_dir);
 
-    std::string command = compiler + " ";
-
-    toml::table config = toml::parse_file(fmt::format("{}/config.toml", proj.path));
-
-    std::string output_name = ps.buildsettings.outputName;
-    std::vector<std::string> extra_flags;
-    if (!build_config.empty() && config.contains("configurations"))
-    {
-        if (auto configs = config["configurations"].as_table(); configs && configs->contains(build_config))
+    std::optional<Trace::Scope> phase(std::in_place, "plan", "build");
+    // Every target of the workspace goes into one scheduler, so independent targets compile side by side
+    const std::vector<BuildPlan> plans =
+        opts.pgoStage == PgoStage::None ? makeWorkspacePlans(ctx, opts) : std::vector{makeBuildPlan(ctx, opts)};
+    std::deque<BuildDatabase> dbs;
+    for (const auto &plan : plans)
+    {
+        dbs.emplace_back(plan.objDir / "build_db.json");
+        writeGeneratedFiles(plan);
+    }
+
+    const CacheSettings cache_settings = loadCacheSettings(ctx.globalConfig(), &ctx.config());
+    const std::unique_ptr<CompilationCache> cache = opts.noCache ? nullptr : openCompilationCache(cache_settings);
+
+    std::unique_ptr<RemoteCompiler> remote;
+    if (opts.distribute)
+        remote = RemoteCompiler::open(loadDistributeSettings(ctx.globalConfig()), plans.back(),
+                                      toolchainCapabilities(plans.back().compiler, ctx.globalConfig()));
+    // Remote slots only cost a local thread each, which mostly waits on the network
+    JobScheduler scheduler(remote && opts.jobs == 0 ? defaultJobCount() + remote->capacity() : opts.jobs);
+
+    // A PCH or object shared by several targets is compiled by the first one; the others wait for its jobs
+    std::unordered_map<std::string, std::optional<JobScheduler::JobId>> pch_jobs;
+    std::unordered_map<std::string, size_t> object_owner;
+    std::vector<std::vector<JobScheduler::JobId>> compile_jobs(plans.size());
+    std::unordered_map<std::string, JobScheduler::JobId> link_jobs;
+    size_t compiled = 0;
+    size_t total_units = 0;
+    for (size_t i = 0; i < plans.size(); ++i)
+    {
+        const BuildPlan &plan = plans[i];
+        std::optional<JobScheduler::JobId> pch_job;
+        if (plan.pch)
         {
-            if (auto conf = (*configs)[build_config].as_table())
-            {
-                if (conf->contains("flags"))
-                {
-                    if (auto arr = (*conf)["flags"].as_array())
-                    {
-                        for (const auto &f : *arr)
-                        {
-                            if (auto s = f.value<std::string>())
-                                extra_flags.push_back(*s);
-                        }
-                    }
-                }
-                if (conf->contains("output"))
-                {
-                    output_name = (*conf)["output"].value_or(output_name);
-                }
-            }
+            const auto [it, first] = pch_jobs.try_emplace(plan.pch->object.string());
+            if (first)
+                it->second = schedulePch(scheduler, plan, dbs[i]);
+            pch_job = it->second;
         }
-        else
+        std::vector<const CompileUnit *> units;
+        std::set<size_t> owners;
+        for (const auto &unit : plan.units)
         {
-            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::yellow),
-                       "[WARNING] Configuration '{}' not found. Using default.\n", build_config);
+            if (const auto [it, first] = object_owner.try_emplace(unit.object.string(), i); first)
+                units.push_back(&unit);
+            else
+                owners.insert(it->second);
         }
-    }
-
-    for (const auto &flag : extra_flags)
-    {
-        command += flag + " ";
-    }
-
-    print_status_message("Adding include directories...", "...", fmt::color::cyan);
-    for (const auto &inc : ps.includepaths)
-    {
-        if (fs::path incPath = inc; incPath.is_absolute())
-            command += fmt::format("-I\"{}\" ", incPath.string());
-        else
-            command += fmt::format("-I\"{}\" ", (fs::path(proj.path) / incPath).string());
-    }
-
-    print_status_message("Adding source files...", "...", fmt::color::cyan);
-    for (const auto &src : ps.srcfiles)
-    {
-        command += fmt::format("\"{}\" ", (fs::path(proj.path) / src).string());
-    }
-
-    print_status_message("Adding link libraries...", "...", fmt::color::cyan);
-    for (const auto &lib : ps.staticLinkFiles)
-    {
-        if (fs::path libPath = lib; libPath.has_extension() &&
-                                    (libPath.extension() == ".a" || libPath.extension() == ".so" || libPath.extension()
-                                     == ".lib"))
+        compile_jobs[i] = scheduleUnitCompiles(scheduler, plan, dbs[i], cache.get(), units, pch_job, remote.get());
+        compiled += compile_jobs[i].size();
+        total_units += units.size();
+
+        std::vector<JobScheduler::JobId> link_deps = compile_jobs[i];
+        for (const size_t owner : owners)
+            link_deps.insert(link_deps.end(), compile_jobs[owner].begin(), compile_jobs[owner].end());
+        for (const auto &dep : plan.linkedTargets)
         {
-            command += fmt::format("\"{}\" ", libPath.string());
+            if (const auto it = link_jobs.find(dep); it != link_jobs.end())
+                link_deps.push_back(it->second);
         }
-        else
+        if (link_deps.empty() && dbs[i].isLinkUpToDate(plan))
         {
-            command += "-l" + lib + " ";
+            print_status_message(fmt::format("{} is up to date", plan.output.string()), "✔", fmt::color::green);
+            continue;
         }
-    }
-
-    print_status_message("Adding link directories...", "...", fmt::color::cyan);
-    for (const auto &libpath : ps.LinkDirs)
-    {
-        command += fmt::format("-L\"{}\" ", libpath);
-    }
-
-    print_status_message("Adding preprocessor definitions...", "...", fmt::color::cyan);
-
-    for (const auto &[name, value] : ps.defines)
-    {
-        command += fmt::format("-D{}=\"{}\" ", name, value);
-    }
-
-    switch (ps.buildsettings.btype)
-    {
-    case buildType::BUILD_EXECUTABLE:
-        command += "-o ";
-        command += fmt::format("\"{}/{}\"", build_dir.string(), output_name);
-        if (debug)
-            command += " -g";
-        break;
 
-    case buildType::BUILD_DYNAMICLINK: {
-        command += "-shared -fPIC ";
-        std::string so_name = fmt::format("lib{}.so", output_name);
-        command += "-o ";
-        command += fmt::format("\"{}/{}\"", build_dir.string(), so_name);
-        break;
-    }
+        LOG_VERBOSE("Executing command: {}\n", joinCommand(plan.linkArgs));
+        const bool is_static = plan.btype == buildType::BUILD_STATICLINK;
+        link_jobs.emplace(plan.target,
+                          scheduler.add({is_static ? fmt::format("Linking static library: {}",
+                                                                 plan.output.filename().string())
+                                                   : fmt::format("Linking: {}", plan.output.filename().string()),
+                                         [is_static, &plan] {
+                                             // ar would otherwise keep members of deleted sources
+                                             if (is_static)
+                                                 fs::remove(plan.output);
+                                             return runProcess(plan.linkArgs);
+                                         },
+                                         [&db = dbs[i], &plan](const JobResult &) { db.recordLink(plan); }},
+                                        link_deps));
+    }
+    phase.reset();
+    if (link_jobs.empty())
+        return;
 
-    case buildType::BUILD_STATICLINK: {
-        std::vector<std::string> object_files;
-        for (const auto &src : ps.srcfiles)
+    print_status_message(fmt::format("Compiling {} of {} files with {} jobs...", compiled, total_units,
+                                     scheduler.concurrency()),
+                         "...", fmt::color::cyan);
+    phase.emplace("compile and link", "build");
+    const bool ok = scheduler.run();
+    phase.emplace("save build database", "build");
+    for (const auto &db : dbs)
+        db.save(); // Also keeps the objects that did compile when another one failed
+    phase.reset();
+
+    if (remote)
+        remote->printSummary();
+    uint64_t cache_hits = 0;
+    if (cache)
+    {
+        cache_hits = cache->sessionHits();
+        cache->flushStats();
+        if (cache->storedAnything())
+            cache->prune(cache_settings.maxSize);
+    }
+    if (std::ranges::any_of(plans, &BuildPlan::timeTrace))
+    {
+        std::vector<std::pair<fs::path, fs::path>> traces;
+        std::vector<fs::path> include_dirs;
+        for (const auto &plan : plans)
         {
-            fs::path srcPath = fs::path(proj.path) / src;
-            std::string obj_path = (build_dir / (srcPath.stem().string() + ".o")).string();
-            std::string compile_cmd = compiler + " ";
-            for (const auto &flag : extra_flags)
-                compile_cmd += flag + " ";
-            for (const auto &inc : ps.includepaths)
+            for (const auto &unit : plan.units)
+                traces.emplace_back(unit.source, fs::path(unit.object).replace_extension(".json"));
+            for (const auto &flag : plan.compileFlags)
             {
-                auto incPath = fs::path(inc);
-                std::string incDir =
-                    incPath.is_absolute() ? incPath.string() : (fs::path(proj.path) / incPath).string();
-                compile_cmd += fmt::format("-I\"{}\" ", incDir);
+                if (flag.starts_with("-I"))
+                    include_dirs.push_back(fs::path(flag.substr(2)).lexically_normal());
             }
-            compile_cmd += fmt::format("-c \"{}\" -o {}", srcPath.string(), obj_path);
-            LOG_VERBOSE("Compiling: {}\n", compile_cmd);
-            print_status_message(fmt::format("Compiling: {}", srcPath.filename().string()), "...", fmt::color::cyan);
-            if (std::system(compile_cmd.c_str()) != 0)
-                throw CPPX_Exception(fmt::format("Compilation of {} failed.", srcPath.string()));
-            object_files.push_back(obj_path);
         }
-        std::string a_name = fmt::format("lib{}.a", output_name);
-        print_status_message(fmt::format("Linking static library: {}", a_name), "...", fmt::color::cyan);
-        std::string ar_cmd = fmt::format("ar rcs {} {}", (build_dir / a_name).string(), fmt::join(object_files, " "));
-        LOG_VERBOSE("Creating static library: {}\n", ar_cmd);
-        if (std::system(ar_cmd.c_str()) != 0)
-            throw CPPX_Exception("Static archive creation failed.");
-        fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\n");
-        print_status_message(fmt::format("Successfully built static library: {}/{}",
-                                         build_dir.string(), a_name), "✔", fmt::color::green);
-        return;
+        reportTimeTraces(traces, include_dirs);
     }
-
-    default:
-        throw CPPX_Exception("Unsupported buildType!");
+    if (!ok)
+    {
+        throw CPPX_Exception(plans.size() == 1 && plans.front().btype == buildType::BUILD_STATICLINK
+                                 ? "Static archive creation failed."
+                                 : "Build failed.");
     }
 
-    fmt::print(fmt::emphasis::bold, "\n");
-    print_status_message("Final compilation and linking...", "...", fmt::color::cyan);
-    LOG_VERBOSE("Executing command: {}\n", command);
-    if (std::system(command.c_str()) != 0)
-        throw CPPX_Exception("Build failed.");
-
-    std::string final_name =
-        (ps.buildsettings.btype == buildType::BUILD_DYNAMICLINK) ? fmt::format("lib{}.so", output_name) : output_name;
-
     auto end = std::chrono::high_resolution_clock::now();
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
 
     fmt::print(fmt::emphasis::bold, "\n");
-    print_status_message(
-        fmt::format("Successfully built: {}/{} in {}ms", build_dir.string(), final_name, duration.count()), "✔",
-        fmt::color::green);
+    print_status_message(fmt::format("Successfully built: {} in {}ms ({} of {} files compiled, {} from cache)",
+                                     plans.size() == 1 ? plans.front().output.string()
+                                                       : fmt::format("{} targets", plans.size()),
+                                     duration.count(), compiled, total_units, cache_hits),
+                         "✔", fmt::color::green);
     fmt::print(fmt::emphasis::bold, "--------------------------------------------------\n");
 }
 
-void handle_run()
+void handle_run(const ProjectContext &ctx)
 {
-    const ProjectConfig proj = getCurrentProject();
-    const ProjectSettings ps = getProjectSettings();
+    const ProjectConfig &proj = ctx.project();
+    const ProjectSettings &ps = ctx.settings();
     const fs::path executable_path = fs::path(proj.path) / "build" / ps.buildsettings.outputName;
 
     if (!fs::exists(executable_path))
     {
         fmt::print(fg(fmt::color::yellow), "Executable file does not exist. Starting compilation...\n");
-        handle_build(false, "");
+        handle_build(ctx, {});
     }
 
-    const std::string command = executable_path.string();
-    fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nRunning project: {}\n\n", command);
-    if (const int ret = std::system(command.c_str()); ret != 0)
+    fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nRunning project: {}\n\n", executable_path.string());
+    if (runProcess({executable_path.string()}, {.capture = false}).exitCode != 0)
     {
         throw CPPX_Exception("Failed to run project.");
     }
 }
 
-void handle_watch(const std::string &dir, const bool force)
+namespace
 {
-    using namespace std::chrono_literals;
-    if (tcgetpgrp(STDIN_FILENO) == getpgrp() && !force)
-    {
-        throw CPPX_Exception("The watch command must be run in the background (with &).\n"
-            "Use -f (--force) to run it in the foreground.");
-    }
+// The [source] list a watched file belongs in; tests are discovered by 'cppx test' and never listed
+std::optional<std::string> watchedSourceList(const fs::path &file)
+{
+    if (!file.empty() && *file.begin() == "tests")
+        return std::nullopt;
+    static const std::vector<std::string> sources{".cpp", ".cc", ".cxx", ".c++", ".c"};
+    static const std::vector<std::string> headers{".h", ".hpp", ".hh", ".hxx", ".h++", ".inl", ".ipp", ".tpp"};
+    const std::string ext = file.extension().string();
+    if (std::ranges::find(sources, ext) != sources.end())
+        return "src files";
+    if (std::ranges::find(headers, ext) != headers.end())
+        return "include files";
+    return std::nullopt;
+}
 
-    ProjectConfig pc = getCurrentProject();
-    fs::path watch_dir;
-    if (dir == "src")
-    {
-        watch_dir = fs::path(pc.path) / "src";
-    }
-    else
-    {
-        throw CPPX_Exception(fmt::format("Invalid directory: {}, available: src", dir));
-    }
+bool isPathUnder(const fs::path &path, const fs::path &dir)
+{
+    const auto [d, p] = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+    return d == dir.end();
+}
 
-    if (!fs::exists(watch_dir) || !fs::is_directory(watch_dir))
-    {
-        throw CPPX_Exception(fmt::format("Directory does not exist: {}", watch_dir.string()));
-    }
+// Applies one debounced batch of changes to config.toml in a single write
+void applyWatchBatch(ProjectContext &ctx, const std::vector<FileChange> &batch)
+{
+    // Picks up edits made to config.toml since the last batch, without re-parsing an unchanged file
+    ctx.reload();
+    const ProjectSettings &ps = ctx.settings();
+    const fs::path root = ctx.path();
+
+    // [ignore] entries are stored as given on the command line, relative to the project or absolute
+    const auto normalize = [&](const std::string &entry) {
+        const fs::path p = fs::path(entry).lexically_normal();
+        return p.is_absolute() ? p.lexically_relative(root) : p;
+    };
+    std::vector<fs::path> ignored_dirs;
+    std::ranges::transform(ps.ignoredPaths, std::back_inserter(ignored_dirs), normalize);
+    std::unordered_set<fs::path> ignored_files;
+    for (const auto &file : ps.ignoredFiles)
+        ignored_files.insert(normalize(file));
+    const auto is_ignored = [&](const fs::path &file) {
+        return ignored_files.contains(file) || ignored_files.contains(file.filename()) ||
+               std::ranges::any_of(ignored_dirs, [&](const fs::path &d) { return isPathUnder(file, d); });
+    };
 
-    fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nMonitoring directory: {}\n\n", watch_dir.string());
+    toml::table tbl = ctx.config();
+    if (!tbl.contains("source"))
+        tbl.insert("source", toml::table{});
+    toml::table &source_tbl = *tbl["source"].as_table();
 
-    auto cb = [&](const fs::path &filename, bool created) {
-        auto name = filename.string();
-        try
+    // Collect the net additions and removals per list first, so each list is rebuilt once per batch
+    std::unordered_map<std::string, std::unordered_set<std::string>> added;
+    std::unordered_map<std::string, std::unordered_set<std::string>> removed;
+    for (const auto &change : batch)
+    {
+        const auto list = watchedSourceList(change.path);
+        if (!list)
+            continue;
+        const std::string name = change.path.generic_string();
+        if (change.event == FileEvent::Created)
         {
-            const std::string configpath = fmt::format("{}/config.toml", pc.path);
-            toml::table tbl = toml::parse_file(configpath);
-
-            ProjectSettings projset = getProjectSettings();
-            if (created)
+            if (is_ignored(change.path))
             {
-                fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "File added: {}\n", name);
-                if (std::ranges::find(projset.ignoredFiles, name) !=
-                    projset.ignoredFiles.end())
-                {
-                    fmt::print(fmt::emphasis::bold | fg(fmt::color::yellow), "Ignoring file: {}\n\n", name);
-                    return;
-                }
-                if (auto *arr = tbl["source"]["src files"].as_array())
-                {
-                    arr->push_back(fmt::format("src/{}", name));
-                }
+                fmt::print(fmt::emphasis::bold | fg(fmt::color::yellow), "Ignoring file: {}\n", name);
+                continue;
             }
-            else
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "File added: {}\n", name);
+            added[*list].insert(name);
+        }
+        else if (change.event == FileEvent::Deleted)
+        {
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "File removed: {}\n", name);
+            removed[*list].insert(name);
+        }
+    }
+    if (added.empty() && removed.empty())
+        return;
+
+    bool changed = false;
+    for (const std::string list : {"src files", "include files"})
+    {
+        if (!added.contains(list) && !removed.contains(list))
+            continue;
+        if (!source_tbl.contains(list))
+            source_tbl.insert(list, toml::array{});
+        toml::array &arr = *source_tbl[list].as_array();
+
+        const auto &to_remove = removed[list];
+        auto &to_add = added[list];
+        toml::array new_arr;
+        for (const auto &node : arr)
+        {
+            if (const auto *str = node.as_string())
             {
-                fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "File removed: {}\n", name);
-                if (auto *arr = tbl["source"]["src files"].as_array())
+                if (to_remove.contains(str->get()))
                 {
-                    toml::array new_arr;
-                    for (auto const &node : *arr)
-                    {
-                        if (auto const *str = node.as_string())
-                        {
-                            if (*str == fmt::format("src/{}", name))
-                                continue;
-                        }
-                        new_arr.push_back(node);
-                    }
-                    *arr = std::move(new_arr);
+                    changed = true;
+                    continue;
                 }
+                to_add.erase(str->get()); // Already listed
             }
+            new_arr.push_back(node);
+        }
+        std::vector<std::string> sorted_add(to_add.begin(), to_add.end());
+        std::ranges::sort(sorted_add);
+        for (const auto &name : sorted_add)
+            new_arr.push_back(name);
+        changed |= !sorted_add.empty();
+        arr = std::move(new_arr);
+    }
 
-            std::ofstream out(configpath);
-            out << tbl;
-            fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Configuration updated: {}\n\n", configpath);
+    if (changed)
+    {
+        ctx.saveConfig(std::move(tbl));
+        fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Configuration updated: {}\n\n",
+                   ctx.configPath().string());
+    }
+}
+} // namespace
+
+void handle_watch(ProjectContext &ctx, const std::vector<std::string> &dirs, const bool force,
+                  const std::chrono::milliseconds debounce)
+{
+    if (tcgetpgrp(STDIN_FILENO) == getpgrp() && !force)
+    {
+        throw CPPX_Exception("The watch command must be run in the background (with &).\n"
+            "Use -f (--force) to run it in the foreground.");
+    }
+
+    const fs::path root = ctx.path();
+    std::vector<fs::path> watch_dirs; // Relative to the project
+    for (const auto &dir : dirs)
+    {
+        const fs::path abs = (fs::path(dir).is_absolute() ? fs::path(dir) : root / dir).lexically_normal();
+        const fs::path rel = abs.lexically_relative(root);
+        if (rel.empty() || *rel.begin() == "..")
+        {
+            throw CPPX_Exception(fmt::format("Invalid directory: {}, it must be inside the project", dir));
         }
-        catch (std::exception const &e)
+        if (!fs::exists(abs) || !fs::is_directory(abs))
         {
-            fmt::print(stderr, fg(fmt::color::red), "Error during watch callback: {}\n", e.what());
+            throw CPPX_Exception(fmt::format("Directory does not exist: {}", abs.string()));
         }
-    };
-
-    // Signal handling for graceful shutdown
-    static std::atomic_bool stop_requested{false};
-    auto signal_handler = [](int) {
-        stop_requested = true;
-    };
-    std::signal(SIGINT, signal_handler);
+        watch_dirs.push_back(rel == "." ? fs::path{} : rel);
+        fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Monitoring directory: {}\n", abs.string());
+    }
+    fmt::print("\n");
 
-    std::jthread watcher_thread([&](const std::stop_token &st) {
-        FileWatcher fw(watch_dir, cb, std::chrono::seconds(1));
-        while (!st.stop_requested() && !stop_requested)
-        {
+    // SIGINT/SIGTERM are taken with sigwait on this thread, so shutdown needs no polling and the watcher
+    // threads are stopped cleanly
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // Every watcher feeds project-relative paths into one batcher, so a checkout that touches src/ and
+    // include/ at once still results in a single config.toml write
+    ChangeBatcher batcher(debounce);
+    std::vector<std::jthread> watchers;
+    for (const auto &rel : watch_dirs)
+    {
+        watchers.emplace_back([&batcher, &root, rel](const std::stop_token &st) {
+            FileWatcher fw(
+                root / rel,
+                [&batcher, &rel](const FileChange &change) {
+                    const fs::path old_path = change.oldPath.empty() ? fs::path{} : rel / change.oldPath;
+                    batcher.push({change.event, rel / change.path, old_path});
+                },
+                std::chrono::seconds(1));
             fw.run(st);
+        });
+    }
+    std::jthread applier([&](const std::stop_token &st) {
+        while (!st.stop_requested())
+        {
+            const auto batch = batcher.next(st);
+            if (batch.empty())
+                continue;
+            try
+            {
+                applyWatchBatch(ctx, batch);
+            }
+            catch (std::exception const &e)
+            {
+                fmt::print(stderr, fg(fmt::color::red), "Error during watch callback: {}\n", e.what());
+            }
         }
     });
-    watcher_thread.join();
+
+    int signal = 0;
+    sigwait(&signals, &signal);
+    for (auto &watcher : watchers)
+        watcher.request_stop();
+    applier.request_stop();
 }
 
-void handle_ignore(const std::vector<fs::path> &directories)
+void handle_ignore(ProjectContext &ctx, const std::vector<fs::path> &directories)
 {
-    ProjectConfig pc = getCurrentProject();
-    std::string config_path = fmt::format("{}/config.toml", pc.path);
-
-    toml::table tbl;
-    try
-    {
-        tbl = toml::parse_file(config_path);
-    }
-    catch (const toml::parse_error &err)
-    {
-        throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
-    }
+    toml::table tbl = ctx.config();
 
     if (!tbl.contains("ignore"))
     {
@@ -728,36 +955,24 @@ void handle_ignore(const std::vector<fs::path> &directories)
         }
     }
 
-    std::ofstream out(config_path);
-    if (!out)
-    {
-        throw CPPX_Exception(fmt::format("Failed to open {} for writing", config_path));
-    }
-    out << tbl;
+    ctx.saveConfig(std::move(tbl));
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Successfully updated config.toml with ignored list.\n");
 }
 
-void handle_pkg_install(const std::string &packageName, const std::string &packageVersion)
+namespace
+{
+// Records an installed package in [dependencies] and its paths and libraries under [source]
+void addPackageToConfig(toml::table &tbl, const PackageManager::PackageInfo &pkgInfo)
 {
-    ProjectConfig pc = getCurrentProject();
-    PackageManager pkg(fmt::format("{}/vendor/", pc.path));
-    std::string FullName = fmt::format("{}/{}", packageName, packageVersion);
-
-    pkg.install(FullName);
-
-    auto pkgInfo = pkg.getPackageInfo(FullName);
-
     LOG_VERBOSE("Retrieved headers: {}\n", pkgInfo.includePaths);
     LOG_VERBOSE("Retrieved library paths: {}\n", pkgInfo.libPaths);
     LOG_VERBOSE("Retrieved libraries: {}\n", pkgInfo.libs);
 
-    std::string config_path = fmt::format("{}/config.toml", pc.path);
-    toml::table tbl = toml::parse_file(config_path);
-
+    const size_t slash = pkgInfo.packageRef.find('/');
     if (!tbl.contains("dependencies"))
         tbl.insert("dependencies", toml::table{});
     toml::table &dependencies_tbl = *tbl["dependencies"].as_table();
-    dependencies_tbl.insert_or_assign(packageName, packageVersion);
+    dependencies_tbl.insert_or_assign(pkgInfo.packageRef.substr(0, slash), pkgInfo.packageRef.substr(slash + 1));
 
     if (!tbl.contains("source"))
         tbl.insert("source", toml::table{});
@@ -780,16 +995,103 @@ void handle_pkg_install(const std::string &packageName, const std::string &packa
         updateTomlArray(static_linked_arr, lib, "library");
     for (const auto &libpath : pkgInfo.libPaths)
         updateTomlArray(static_linked_dirs_arr, libpath, "library directory");
+}
 
-    std::ofstream out(config_path);
-    out << tbl;
+// Whether Conan's lockfile pins every one of the references (entries look like "fmt/10.1.1#<rev>%<time>")
+bool lockfileCovers(const fs::path &lockfile, const std::vector<std::string> &refs)
+{
+    std::ifstream in(lockfile);
+    if (!in)
+        return false;
+    std::unordered_set<std::string> locked;
+    try
+    {
+        const json lock = json::parse(in);
+        for (const auto &entry : lock.value("requires", json::array()))
+        {
+            if (entry.is_string())
+                locked.insert(entry.get<std::string>().substr(0, entry.get<std::string>().find_first_of("#%")));
+        }
+    }
+    catch (const json::exception &)
+    {
+        return false;
+    }
+    return std::ranges::all_of(refs, [&](const std::string &ref) { return locked.contains(ref); });
+}
+} // namespace
+
+void handle_pkg_install(ProjectContext &ctx, const std::vector<std::string> &packages, const std::string &packageVersion)
+{
+    const ProjectConfig &pc = ctx.project();
+    std::vector<std::string> refs = packages;
+    if (!packageVersion.empty())
+    {
+        if (refs.size() != 1 || refs.front().find('/') != std::string::npos)
+            throw CPPX_Exception("--version only applies to a single package name; use name/version otherwise.");
+        refs.front() = fmt::format("{}/{}", refs.front(), packageVersion);
+    }
+    for (const auto &ref : refs)
+    {
+        if (ref.find('/') == std::string::npos)
+            throw CPPX_Exception(fmt::format("Package '{}' has no version, use name/version or --version.", ref));
+    }
+
+    PackageManager pkg(fmt::format("{}/vendor/", pc.path));
+    pkg.install(refs, fs::path(pc.path) / "cppx.lock");
+
+    toml::table tbl = ctx.config();
+    for (const auto &ref : refs)
+        addPackageToConfig(tbl, pkg.getPackageInfo(ref));
+    ctx.saveConfig(std::move(tbl));
 
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Successfully updated config.toml.\n");
 }
 
-void handle_pkg_remove(const std::string &packageToRemove)
+void handle_pkg_restore(ProjectContext &ctx)
 {
-    const ProjectConfig pc = getCurrentProject();
+    const ProjectConfig &pc = ctx.project();
+    const auto &dependencies = ctx.settings().dependencies;
+    if (dependencies.empty())
+    {
+        print_status_message("No [dependencies] to restore", "✔", fmt::color::green);
+        return;
+    }
+
+    PackageManager pkg(fmt::format("{}/vendor/", pc.path));
+    std::vector<std::string> missing;
+    for (const auto &[name, version] : dependencies)
+    {
+        if (std::string ref = fmt::format("{}/{}", name, version); !pkg.checkIfInstalled(ref))
+            missing.push_back(std::move(ref));
+    }
+    std::ranges::sort(missing);
+    if (missing.empty())
+    {
+        print_status_message(fmt::format("All {} dependencies are installed", dependencies.size()), "✔",
+                             fmt::color::green);
+        return;
+    }
+
+    // A lockfile that pins everything is used as is, so CI resolves nothing and only fetches missing binaries
+    const fs::path lockfile = fs::path(pc.path) / "cppx.lock";
+    const bool covered = lockfileCovers(lockfile, missing);
+    if (fs::exists(lockfile) && !covered)
+        fmt::print(fg(fmt::color::yellow), "cppx.lock does not pin every dependency, adding the missing ones.\n");
+    pkg.install(missing, lockfile, !covered);
+
+    toml::table tbl = ctx.config();
+    for (const auto &ref : missing)
+        addPackageToConfig(tbl, pkg.getPackageInfo(ref));
+    ctx.saveConfig(std::move(tbl));
+
+    print_status_message(fmt::format("Restored {} of {} dependencies", missing.size(), dependencies.size()), "✔",
+                         fmt::color::green);
+}
+
+void handle_pkg_remove(ProjectContext &ctx, const std::string &packageToRemove)
+{
+    const ProjectConfig &pc = ctx.project();
 
     if (PackageManager pkg(fmt::format("{}/vendor/", pc.path)); pkg.checkIfInstalled(packageToRemove))
     {
@@ -809,8 +1111,7 @@ void handle_pkg_remove(const std::string &packageToRemove)
             throw CPPX_Exception(fmt::format("Could not get package info for '{}' to remove.", packageToRemove));
         }
 
-        std::string config_path = fmt::format("{}/config.toml", pc.path);
-        toml::table tbl = toml::parse_file(config_path);
+        toml::table tbl = ctx.config();
 
         if (tbl.contains("dependencies"))
         {
@@ -839,8 +1140,7 @@ void handle_pkg_remove(const std::string &packageToRemove)
                                     "library directory");
             }
         }
-        std::ofstream out(config_path);
-        out << tbl;
+        ctx.saveConfig(std::move(tbl));
         fmt::print(fmt::emphasis::bold | fg(fmt::color::green),
                    "Successfully removed package and updated configuration.\n");
     }
@@ -850,10 +1150,10 @@ void handle_pkg_remove(const std::string &packageToRemove)
     }
 }
 
-void handle_export(const std::string &format)
+void handle_export(const ProjectContext &ctx, const std::string &format, const BuildOptions &opts)
 {
-    ProjectConfig pc = getCurrentProject();
-    ProjectSettings ps = getProjectSettings();
+    const ProjectConfig &pc = ctx.project();
+    const ProjectSettings &ps = ctx.settings();
     std::string name = replace_spaces(ps.name);
     if (format == "cmake")
     {
@@ -926,13 +1226,79 @@ void handle_export(const std::string &format)
             throw CPPX_Exception(fmt::format("Failed to save CMakeLists to {}", outPath));
         }
     }
+    else if (format == "ninja")
+    {
+        // The same plans 'cppx build' runs, so both compile exactly the same commands
+        const std::vector<BuildPlan> plans = makeWorkspacePlans(ctx, opts);
+        std::unordered_set<std::string> edges;
+        for (const auto &plan : plans)
+        {
+            writeGeneratedFiles(plan);
+            writePchForwarder(plan);
+            if (plan.pch)
+                edges.insert(plan.pch->object.string());
+            for (const auto &unit : plan.units)
+            {
+                fs::create_directories(unit.object.parent_path());
+                edges.insert(unit.object.string());
+            }
+        }
+        const fs::path outPath = fs::path(pc.path) / "build.ninja";
+        writeFileAtomic(outPath, ninjaManifest(plans));
+        fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green), "Generated {} ({} compile edges)\n",
+                   outPath.string(), edges.size());
+    }
+    else if (format == "compdb")
+    {
+        // Unity batches would hide the real sources from clangd; the flags are the same either way
+        BuildOptions compdb_opts = opts;
+        compdb_opts.noUnity = true;
+        const std::vector<BuildPlan> plans = makeWorkspacePlans(ctx, compdb_opts);
+        // Dependencies come first, so the last plan is the project (or the requested target)
+        const BuildPlan &plan = plans.back();
+        // A source that several targets compile gets the entry of the first one
+        std::vector<const CompileUnit *> units;
+        std::unordered_set<std::string> sources;
+        for (const auto &target : plans)
+        {
+            for (const auto &unit : target.units)
+            {
+                if (sources.insert(unit.source.string()).second)
+                    units.push_back(&unit);
+            }
+        }
+        // Tests and benchmarks compile with the project's flags too, so they get entries like 'cppx test' builds them
+        std::vector<CompileUnit> extra_units;
+        for (const char *dir : {"tests", "benches"})
+        {
+            std::error_code ec;
+            std::vector<fs::path> files;
+            for (const auto &entry : fs::directory_iterator(fs::path(pc.path) / dir, ec))
+            {
+                if (entry.is_regular_file() &&
+                    (entry.path().extension() == ".cpp" || entry.path().extension() == ".cc"))
+                    files.push_back(entry.path());
+            }
+            std::ranges::sort(files);
+            for (const auto &file : files)
+                extra_units.push_back(
+                    makeCompileUnit(plan, file, plan.objDir / dir / (file.filename().string() + ".o")));
+        }
+        for (const auto &unit : extra_units)
+            units.push_back(&unit);
+
+        const fs::path outPath = fs::path(pc.path) / "compile_commands.json";
+        writeFileAtomic(outPath, compileCommands(units, pc.path).dump(2) + "\n");
+        fmt::print(fmt::emphasis::bold | fmt::fg(fmt::color::green), "Generated {} ({} entries)\n",
+                   outPath.string(), units.size());
+    }
     else
     {
-        throw CPPX_Exception(fmt::format("Unsupported export format: {}", format));
+        throw CPPX_Exception(fmt::format("Unsupported export format: {} (use cmake, ninja or compdb)", format));
     }
 }
 
-void handle_config_set(const std::string &what)
+void handle_config_set(ProjectContext &ctx, const std::string &what)
 {
     const size_t pos = what.find('=');
     if (pos == std::string::npos)
@@ -949,7 +1315,7 @@ void handle_config_set(const std::string &what)
         {
             throw CPPX_Exception("cppx does not support compilers other than clang or gcc");
         }
-        setExtra(left, right);
+        setExtra(ctx, left, right);
     }
     else
     {
@@ -959,63 +1325,37 @@ void handle_config_set(const std::string &what)
 
 void handle_profile()
 {
-    std::vector<std::string> compilers = {"gcc", "g++", "clang", "clang++"};
-    struct CompilerInfo
+    const fs::path pathToGlobal = globalConfigPath();
+    toml::table file;
+    if (fs::exists(pathToGlobal))
     {
-        std::string name;
-        std::string version;
-        std::string path;
-    };
-    std::vector<CompilerInfo> found;
-    for (const auto &compiler : compilers)
-    {
-        std::string which_cmd = fmt::format("which {} 2>/dev/null", compiler);
-        std::string path; {
-            std::array<char, 128> buffer{};
-            std::string result;
-            if (FILE *pipe = popen(which_cmd.c_str(), "r"))
-            {
-                while (fgets(buffer.data(), buffer.size(), pipe) != nullptr)
-                {
-                    result += buffer.data();
-                }
-                pclose(pipe);
-            }
-            path = result;
-            if (!path.empty() && path.back() == '\n')
-                path.pop_back();
+        try
+        {
+            file = toml::parse_file(pathToGlobal.string());
         }
-        if (!path.empty())
+        catch (const toml::parse_error &err)
         {
-            std::string version_cmd = fmt::format("{} --version 2>/dev/null", compiler);
-            std::string version; {
-                std::array<char, 256> buffer{};
-                std::string result;
-                if (FILE *pipe = popen(version_cmd.c_str(), "r"))
-                {
-                    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr)
-                    {
-                        result += buffer.data();
-                    }
-                    pclose(pipe);
-                }
-                if (size_t pos = result.find('\n'); pos != std::string::npos)
-                    version = result.substr(0, pos);
-                else
-                    version = result;
-            }
-            found.push_back({compiler, version, path});
+            throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
         }
     }
+
+    print_status_message("Looking for compilers...", "...", fmt::color::cyan);
+    const std::vector<DiscoveredCompiler> found = discoverCompilers(file);
     if (found.empty())
     {
         throw CPPX_Exception("No compilers found!");
     }
+    const auto yes_no = [](const bool value) { return value ? "yes" : "no"; };
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nFound compilers:\n");
     for (size_t i = 0; i < found.size(); ++i)
     {
+        const ToolchainCapabilities &caps = found[i].caps;
         fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "  [{}] {} ({})\n", i + 1, found[i].name,
-                   found[i].version);
+                   caps.version);
+        fmt::print("      {}\n      PCH: .{}, ThinLTO: {}, -ftime-trace: {}, modules: {}, linkers: {}\n",
+                   found[i].path.string(), caps.pchFormat, yes_no(caps.thinLto), yes_no(caps.timeTrace),
+                   caps.modules ? (caps.moduleScanner.empty() ? "yes (no P1689 scanner)" : "yes") : "no",
+                   caps.linkers.empty() ? std::string("default") : fmt::format("{}", fmt::join(caps.linkers, ", ")));
     }
     size_t chosen = 0;
     if (found.size() > 1)
@@ -1036,43 +1376,12 @@ void handle_profile()
         }
     }
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nChosen: {} ({})\n", found[chosen].name,
-               found[chosen].version);
-    fs::path pathToGlobal;
-#if defined(__linux__) || defined(__APPLE__)
-    const char *homeDir = std::getenv("HOME");
-    if (!homeDir)
-    {
-        throw CPPX_Exception("Failed to get HOME directory.");
-    }
-    pathToGlobal = homeDir;
-    pathToGlobal /= ".cppxglobal.toml";
-#elif defined(_WIN32)
-    const char* userProfile = std::getenv("USERPROFILE");
-    if (!userProfile) {
-        throw CPPX_Exception("Failed to get USERPROFILE directory.");
-    }
-    pathToGlobal = userProfile;
-    pathToGlobal /= ".cppxglobal.toml";
-#else
-    throw CPPX_Exception("Unsupported OS.");
-#endif
+               found[chosen].caps.version);
 
-    toml::table file;
-    if (fs::exists(pathToGlobal))
-    {
-        try
-        {
-            file = toml::parse_file(pathToGlobal.string());
-        }
-        catch (const toml::parse_error &err)
-        {
-            throw CPPX_Exception(fmt::format("Failed to parse TOML file: {}", err.description()));
-        }
-    }
     toml::table toolchain;
     toolchain.insert_or_assign("compiler", found[chosen].name);
-    toolchain.insert_or_assign("version", found[chosen].version);
-    toolchain.insert_or_assign("path", found[chosen].path);
+    toolchain.insert_or_assign("version", found[chosen].caps.version);
+    toolchain.insert_or_assign("path", found[chosen].path.string());
     file.insert_or_assign("toolchain", toolchain);
     if (std::ofstream cfg(pathToGlobal); cfg.is_open())
     {
@@ -1086,15 +1395,15 @@ void handle_profile()
     }
 }
 
-void handle_doc()
+void handle_doc(const ProjectContext &ctx)
 {
-    ProjectConfig proj = getCurrentProject();
+    const ProjectConfig &proj = ctx.project();
 
     if (fs::path doxyfile_path = fs::path(proj.path) / "Doxyfile"; !fs::exists(doxyfile_path))
     {
         fmt::print(fmt::emphasis::bold | fg(fmt::color::yellow), "Doxyfile does not exist. Creating default...\n");
 
-        ProjectSettings ps = getProjectSettings();
+        const ProjectSettings &ps = ctx.settings();
 
         if (std::ofstream doxyfile(doxyfile_path); doxyfile.is_open())
         {
@@ -1117,14 +1426,8 @@ void handle_doc()
 
     fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Generating Doxygen documentation...\n");
 
-    fs::path original_path = fs::current_path();
-    fs::current_path(proj.path);
-
-    std::string command = "doxygen Doxyfile";
-    LOG_VERBOSE("Executing Doxygen: {}\n", command);
-    int ret = std::system(command.c_str());
-
-    fs::current_path(original_path);
+    LOG_VERBOSE("Executing Doxygen: doxygen Doxyfile\n");
+    const int ret = runProcess({"doxygen", "Doxyfile"}, {.cwd = proj.path, .capture = false}).exitCode;
 
     if (ret == 0)
     {
@@ -1137,9 +1440,9 @@ void handle_doc()
     }
 }
 
-void handle_clean()
+void handle_clean(const ProjectContext &ctx)
 {
-    const ProjectConfig proj = getCurrentProject();
+    const ProjectConfig &proj = ctx.project();
     const fs::path build_dir = fs::path(proj.path) / "build";
     const fs::path docs_dir = fs::path(proj.path) / "docs";
 
@@ -1164,68 +1467,448 @@ void handle_clean()
     }
 }
 
-void handle_test()
+namespace
 {
-    ProjectConfig proj = getCurrentProject();
-    fs::path test_dir = fs::path(proj.path) / "tests";
-    fs::path build_dir = fs::path(proj.path) / "build";
-    fs::create_directories(build_dir);
+struct TestResult
+{
+    enum class Status
+    {
+        Passed,
+        Failed,
+        TimedOut,
+        NotBuilt
+    };
 
-    if (!fs::exists(test_dir) || fs::is_empty(test_dir))
+    std::string name;
+    fs::path source;
+    Status status = Status::NotBuilt;
+    int exitCode = 0;
+    std::chrono::milliseconds duration{0};
+    std::string output;
+    bool cached = false; // Skipped because it already passed with the same binary and inputs
+};
+
+std::string_view testStatusName(const TestResult::Status status)
+{
+    switch (status)
+    {
+    case TestResult::Status::Passed:
+        return "passed";
+    case TestResult::Status::Failed:
+        return "failed";
+    case TestResult::Status::TimedOut:
+        return "timeout";
+    case TestResult::Status::NotBuilt:
+        return "not built";
+    }
+    return "unknown";
+}
+
+// build/test/results.json: per test, the key (binary plus runtime inputs) it last ran with and the outcome.
+// Binary hashes are kept with the mtime and size they were computed for, so unchanged binaries are not re-read.
+class TestResultCache
+{
+  public:
+    explicit TestResultCache(fs::path file) : _file(std::move(file))
     {
-        throw CPPX_Exception("The 'tests' directory does not exist or is empty. No tests to run.");
+        std::ifstream in(_file);
+        if (!in)
+            return;
+        try
+        {
+            _data = json::parse(in);
+        }
+        catch (const json::exception &)
+        {
+            LOG_VERBOSE("Ignoring unreadable test result cache: {}\n", _file.string());
+        }
+        if (!_data.is_object())
+            _data = json::object();
     }
 
-    std::string compiler = pickCompiler();
-    ProjectSettings ps = getProjectSettings();
+    std::string key(const std::string &name, const fs::path &executable, const std::string &inputsDigest)
+    {
+        std::error_code ec;
+        const auto mtime = fs::last_write_time(executable, ec).time_since_epoch().count();
+        const auto size = fs::file_size(executable, ec);
+        if (ec)
+            return {};
 
-    for (const auto &entry : fs::directory_iterator(test_dir))
+        std::string binary;
+        {
+            std::lock_guard lock(_mutex);
+            if (const auto it = _data.find(name); it != _data.end() && it->value("mtime", int64_t{0}) == mtime &&
+                                                    it->value("size", uint64_t{0}) == size)
+                binary = it->value("binary", "");
+        }
+        if (binary.empty())
+            binary = hashFile(executable);
+        {
+            std::lock_guard lock(_mutex);
+            _binaries[name] = {mtime, size, binary};
+        }
+        return Hasher().update(binary).update(inputsDigest).hexdigest();
+    }
+
+    [[nodiscard]] std::optional<std::chrono::milliseconds> passedWith(const std::string &name,
+                                                                    const std::string &key) const
     {
-        if (entry.is_regular_file() && (entry.path().extension() == ".cpp" || entry.path().extension() == ".cc"))
+        std::lock_guard lock(_mutex);
+        const auto it = _data.find(name);
+        if (key.empty() || it == _data.end() || it->value("key", "") != key || it->value("status", "") != "passed")
+            return std::nullopt;
+        return std::chrono::milliseconds(it->value("duration_ms", int64_t{0}));
+    }
+
+    void record(const std::string &name, const std::string &key, const TestResult &result)
+    {
+        std::lock_guard lock(_mutex);
+        json entry{{"key", key},
+                   {"status", testStatusName(result.status)},
+                   {"duration_ms", result.duration.count()}};
+        if (const auto it = _binaries.find(name); it != _binaries.end())
         {
-            const fs::path &test_file = entry.path();
-            std::string test_name = test_file.stem().string();
-            fs::path executable_path = build_dir / test_name;
+            entry["mtime"] = it->second.mtime;
+            entry["size"] = it->second.size;
+            entry["binary"] = it->second.hash;
+        }
+        _data[name] = std::move(entry);
+    }
 
-            std::string command = compiler + " ";
-            command += fmt::format("\"{}\" ", test_file.string());
+    void save() const
+    {
+        std::lock_guard lock(_mutex);
+        writeFileAtomic(_file, _data.dump(2) + "\n");
+    }
 
-            for (const auto &inc : ps.includepaths)
-            {
-                command += fmt::format("-I\"{}\" ", (fs::path(proj.path) / inc).string());
-            }
-            for (const auto &src : ps.srcfiles)
-            {
-                fs::path srcPath = fs::path(proj.path) / src;
-                if (srcPath.filename() == "main.cpp")
-                    continue;
-                command += fmt::format("\"{}\" ", srcPath.string());
-            }
+  private:
+    struct Binary
+    {
+        int64_t mtime;
+        uint64_t size;
+        std::string hash;
+    };
 
-            command += fmt::format("-o \"{}\" -g", executable_path.string());
+    fs::path _file;
+    mutable std::mutex _mutex;
+    json _data = json::object();
+    std::unordered_map<std::string, Binary> _binaries;
+};
 
-            fmt::print(fmt::emphasis::bold | fg(fmt::color::cyan), "Compiling test: {}\n", test_name);
-            LOG_VERBOSE("Compilation command: {}\n", command);
-            if (std::system(command.c_str()) != 0)
-            {
-                fmt::print(stderr, fg(fmt::color::red), "Compilation of test {} failed.\n", test_name);
-                continue; // Proceed to the next test
-            }
+// Digest of everything [test] declares as runtime input: the listed environment variables and files
+std::string testInputsDigest(const fs::path &root, const TestSettings &settings)
+{
+    Hasher hasher;
+    for (const auto &name : settings.env)
+    {
+        const char *value = std::getenv(name.c_str());
+        hasher.update(name).update(value ? fmt::format("={}", value) : std::string("<unset>")).update("\n");
+    }
 
-            fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Running test: {}\n", test_name);
-            if (std::system(executable_path.string().c_str()) != 0)
-            {
-                fmt::print(stderr, fg(fmt::color::red), "Test {} failed.\n", test_name);
-            }
-            else
+    std::vector<fs::path> files;
+    std::vector<std::string> patterns;
+    for (const auto &input : settings.inputs)
+    {
+        const fs::path path = root / input;
+        std::error_code ec;
+        if (is_glob(input))
+        {
+            patterns.push_back(input);
+        }
+        else if (fs::is_directory(path, ec))
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(path, ec))
             {
-                fmt::print(fg(fmt::color::light_green), "Test {} completed successfully.\n", test_name);
+                if (entry.is_regular_file(ec))
+                    files.push_back(entry.path());
             }
         }
+        else
+        {
+            files.push_back(path); // A missing file hashes differently from any existing one
+        }
     }
+    const auto matched = glob(root, patterns);
+    files.insert(files.end(), matched.begin(), matched.end());
+    std::ranges::sort(files);
+    for (const auto &file : files)
+    {
+        std::error_code ec;
+        hasher.update(file.lexically_relative(root).generic_string());
+        hasher.update(fs::is_regular_file(file, ec) ? hashFile(file) : std::string("<missing>"));
+    }
+    return hasher.hexdigest();
 }
 
-void handle_metadata()
+void writeJUnitReport(const fs::path &path, const std::string &suite, const std::vector<TestResult> &results,
+                      const std::chrono::milliseconds total)
+{
+    size_t failures = 0;
+    size_t errors = 0;
+    for (const auto &r : results)
+    {
+        failures += r.status == TestResult::Status::Failed;
+        errors += r.status == TestResult::Status::TimedOut || r.status == TestResult::Status::NotBuilt;
+    }
+
+    std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    xml += fmt::format("<testsuites tests=\"{}\" failures=\"{}\" errors=\"{}\" time=\"{:.3f}\">\n",
+                       results.size(), failures, errors, total.count() / 1000.0);
+    xml += fmt::format("  <testsuite name=\"{}\" tests=\"{}\" failures=\"{}\" errors=\"{}\" time=\"{:.3f}\">\n",
+                       xmlEscape(suite), results.size(), failures, errors, total.count() / 1000.0);
+    for (const auto &r : results)
+    {
+        xml += fmt::format("    <testcase classname=\"{}\" name=\"{}\" file=\"{}\" time=\"{:.3f}\">\n",
+                           xmlEscape(suite), xmlEscape(r.name), xmlEscape(r.source.generic_string()),
+                           r.duration.count() / 1000.0);
+        switch (r.status)
+        {
+        case TestResult::Status::Passed:
+            break;
+        case TestResult::Status::Failed:
+            xml += fmt::format("      <failure message=\"exit code {}\"/>\n", r.exitCode);
+            break;
+        case TestResult::Status::TimedOut:
+            xml += "      <error message=\"timed out\"/>\n";
+            break;
+        case TestResult::Status::NotBuilt:
+            xml += "      <error message=\"test did not build\"/>\n";
+            break;
+        }
+        if (!r.output.empty())
+            xml += fmt::format("      <system-out>{}</system-out>\n", xmlEscape(r.output));
+        xml += "    </testcase>\n";
+    }
+    xml += "  </testsuite>\n</testsuites>\n";
+    if (path.has_parent_path())
+        fs::create_directories(path.parent_path());
+    writeFileAtomic(path, xml);
+}
+
+void writeJsonReport(const fs::path &path, const std::vector<TestResult> &results, const std::chrono::milliseconds total,
+                     const TestOptions &opts)
+{
+    json report;
+    report["shard"] = fmt::format("{}/{}", opts.shardIndex + 1, opts.shardCount);
+    report["duration_ms"] = total.count();
+    report["tests"] = json::array();
+    for (const auto &r : results)
+    {
+        report["tests"].push_back({{"name", r.name},
+                                   {"file", r.source.generic_string()},
+                                   {"status", testStatusName(r.status)},
+                                   {"exit_code", r.exitCode},
+                                   {"duration_ms", r.duration.count()},
+                                   {"cached", r.cached},
+                                   {"output", r.output}});
+    }
+    if (path.has_parent_path())
+        fs::create_directories(path.parent_path());
+    writeFileAtomic(path, report.dump(2) + "\n");
+}
+} // namespace
+
+void handle_test(const ProjectContext &ctx, const TestOptions &opts)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const ProjectConfig &proj = ctx.project();
+    fs::path test_dir = fs::path(proj.path) / "tests";
+
+    if (!fs::exists(test_dir) || fs::is_empty(test_dir))
+    {
+        throw CPPX_Exception("The 'tests' directory does not exist or is empty. No tests to run.");
+    }
+
+    // Sorted, so every CI node agrees on which tests belong to which shard
+    std::vector<fs::path> test_files;
+    for (const auto &entry : fs::directory_iterator(test_dir))
+    {
+        if (entry.is_regular_file() && (entry.path().extension() == ".cpp" || entry.path().extension() == ".cc"))
+            test_files.push_back(entry.path());
+    }
+    std::ranges::sort(test_files);
+    std::vector<fs::path> selected;
+    for (size_t i = 0; i < test_files.size(); ++i)
+    {
+        if (i % opts.shardCount == opts.shardIndex)
+            selected.push_back(test_files[i]);
+    }
+
+    // Tests share the debug build's objects and PCH; unity batches are off so main.cpp can be left out
+    BuildOptions build_opts;
+    build_opts.debug = true;
+    build_opts.noUnity = true;
+    const BuildPlan plan = makeBuildPlan(ctx, build_opts);
+    BuildDatabase db(plan.objDir / "build_db.json");
+    const fs::path test_build_dir = plan.buildDir / "test";
+    fs::create_directories(test_build_dir);
+
+    const CacheSettings cache_settings = loadCacheSettings(ctx.globalConfig(), &ctx.config());
+    const std::unique_ptr<CompilationCache> cache = openCompilationCache(cache_settings);
+    TestResultCache result_cache(test_build_dir / "results.json");
+    const std::string inputs_digest = testInputsDigest(proj.path, ctx.settings().tests);
+
+    // A failing test must not stop the others, so only the jobs depending on a failed one are skipped
+    JobScheduler scheduler(opts.jobs, false);
+
+    // Every test links against one archive of the project's objects, so the project compiles once, not per test
+    std::vector<const CompileUnit *> project_units;
+    for (const auto &unit : plan.units)
+    {
+        if (unit.source.filename() != "main.cpp")
+            project_units.push_back(&unit);
+    }
+    std::vector<CompileUnit> test_units;
+    test_units.reserve(selected.size());
+    for (const auto &file : selected)
+        test_units.push_back(makeCompileUnit(plan, file, plan.objDir / "tests" / (file.filename().string() + ".o")));
+
+    // Staleness has to be decided before anything runs, while the database still describes the old objects
+    std::error_code ec;
+    const bool pch_stale = plan.pch && !db.isUpToDate(*plan.pch, plan.toolchainId);
+    const auto newer_than = [&](const fs::path &file, const fs::file_time_type time) {
+        const auto t = fs::last_write_time(file, ec);
+        return ec || t > time;
+    };
+    const fs::path archive = test_build_dir / fmt::format("lib{}_test_objects.a", replace_spaces(proj.name));
+    const auto archive_time = fs::last_write_time(archive, ec);
+    bool archive_stale = ec || pch_stale;
+    for (const CompileUnit *unit : project_units)
+        archive_stale =
+            archive_stale || !db.isUpToDate(*unit, plan.toolchainId) || newer_than(unit->object, archive_time);
+
+    // Each test is scheduled on its own, so a test that fails to compile only skips its own link and run
+    const auto pch_job = schedulePch(scheduler, plan, db);
+    const auto project_jobs = scheduleUnitCompiles(scheduler, plan, db, cache.get(), project_units, pch_job);
+
+    std::vector<std::string> archive_args{plan.archiver, "rcs", archive.string()};
+    for (const CompileUnit *unit : project_units)
+        archive_args.push_back(unit->object.string());
+    std::vector<JobScheduler::JobId> archive_deps;
+    if (!project_units.empty() && archive_stale)
+    {
+        archive_deps.push_back(scheduler.add({fmt::format("Archiving project objects: {}", archive.filename().string()),
+                                              [archive_args, archive] {
+                                                  fs::remove(archive);
+                                                  return runProcess(archive_args);
+                                              }},
+                                             project_jobs));
+    }
+
+    std::vector<TestResult> results(selected.size());
+    for (size_t i = 0; i < selected.size(); ++i)
+    {
+        TestResult &result = results[i];
+        result.source = selected[i];
+        result.name = selected[i].stem().string();
+        const fs::path executable_path = test_build_dir / result.name;
+
+        std::vector<std::string> link_args{plan.compiler};
+        link_args.insert(link_args.end(), plan.linkFlags.begin(), plan.linkFlags.end());
+        link_args.push_back(test_units[i].object.string());
+        if (!project_units.empty())
+            link_args.push_back(archive.string());
+        link_args.insert(link_args.end(), plan.linkLibs.begin(), plan.linkLibs.end());
+        link_args.insert(link_args.end(), {"-o", executable_path.string()});
+        LOG_VERBOSE("Link command: {}\n", joinCommand(link_args));
+
+        std::vector<JobScheduler::JobId> run_deps;
+        const auto exe_time = fs::last_write_time(executable_path, ec);
+        const bool exe_stale = ec || archive_stale || pch_stale || !db.isUpToDate(test_units[i], plan.toolchainId) ||
+                               newer_than(test_units[i].object, exe_time) ||
+                               (!project_units.empty() && newer_than(archive, exe_time));
+        const auto test_jobs = scheduleUnitCompiles(scheduler, plan, db, cache.get(), {&test_units[i]}, pch_job);
+        if (exe_stale)
+        {
+            auto link_deps = archive_deps.empty() ? project_jobs : archive_deps;
+            link_deps.insert(link_deps.end(), test_jobs.begin(), test_jobs.end());
+            run_deps.push_back(scheduler.add(
+                {fmt::format("Linking test: {}", result.name), [link_args] { return runProcess(link_args); }},
+                link_deps));
+        }
+
+        const auto timeout = opts.timeout.count() > 0
+                                 ? std::optional<std::chrono::milliseconds>(opts.timeout)
+                                 : std::nullopt;
+        scheduler.add({fmt::format("Running test: {}", result.name),
+                       [executable_path, timeout, &result, &result_cache, &inputs_digest, &opts] {
+                           // Keyed after linking, so an unchanged relinked binary still counts as unchanged
+                           const std::string key = result_cache.key(result.name, executable_path, inputs_digest);
+                           if (const auto previous = result_cache.passedWith(result.name, key);
+                               previous && !opts.noCache)
+                           {
+                               result.status = TestResult::Status::Passed;
+                               result.duration = *previous;
+                               result.cached = true;
+                               return JobResult{};
+                           }
+
+                           const auto test_start = std::chrono::steady_clock::now();
+                           JobResult run = runProcess({executable_path.string()}, timeout);
+                           result.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                               std::chrono::steady_clock::now() - test_start);
+                           result.exitCode = run.exitCode;
+                           result.output = run.output;
+                           result.status = run.timedOut         ? TestResult::Status::TimedOut
+                                           : run.exitCode == 0 ? TestResult::Status::Passed
+                                                               : TestResult::Status::Failed;
+                           if (run.timedOut)
+                               run.output += fmt::format("Timed out after {} ms\n", result.duration.count());
+                           result_cache.record(result.name, key, result);
+                           return run;
+                       },
+                       [&result](const JobResult &) {
+                           if (result.cached)
+                               fmt::print(fg(fmt::color::gray), "Test {} unchanged, passed before. (cached)\n",
+                                          result.name);
+                           else
+                               fmt::print(fg(fmt::color::light_green), "Test {} completed successfully. ({} ms)\n",
+                                          result.name, result.duration.count());
+                       }},
+                      run_deps);
+    }
+
+    print_status_message(fmt::format("Running {} of {} tests (shard {}/{}) with {} jobs...", selected.size(),
+                                     test_files.size(), opts.shardIndex + 1, opts.shardCount,
+                                     scheduler.concurrency()),
+                         "...", fmt::color::cyan);
+    scheduler.run();
+    db.save();
+    result_cache.save();
+    if (cache)
+    {
+        cache->flushStats();
+        if (cache->storedAnything())
+            cache->prune(cache_settings.maxSize);
+    }
+
+    const auto total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    if (!opts.junitReport.empty())
+        writeJUnitReport(opts.junitReport, proj.name, results, total);
+    if (!opts.jsonReport.empty())
+        writeJsonReport(opts.jsonReport, results, total, opts);
+
+    const size_t passed = std::ranges::count_if(
+        results, [](const TestResult &r) { return r.status == TestResult::Status::Passed; });
+    const size_t cached = std::ranges::count_if(results, [](const TestResult &r) { return r.cached; });
+    if (passed == results.size())
+    {
+        fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nAll {} tests passed in {} ms ({} cached).\n",
+                   results.size(), total.count(), cached);
+        return;
+    }
+
+    fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "\n{} of {} tests failed:\n",
+               results.size() - passed, results.size());
+    for (const auto &r : results)
+    {
+        if (r.status != TestResult::Status::Passed)
+            fmt::print(stderr, fg(fmt::color::red), "  {} ({})\n", r.name, testStatusName(r.status));
+    }
+    throw CPPX_Exception("Tests failed.");
+}
+
+void handle_metadata(ProjectContext &ctx)
 {
     fmt::println("Settings metadata...");
 
@@ -1299,18 +1982,25 @@ void handle_metadata()
 
     fmt::print("All done!\n");
 
-    setMetadata("version", version);
-    setMetadata("description", description);
-    setMetadata("license", license);
-    setMetadata("github_username", github_username);
-    setMetadata("github_repo", github_repo);
-    setMetadata("authors", authors);
+    setMetadata(ctx, "version", version);
+    setMetadata(ctx, "description", description);
+    setMetadata(ctx, "license", license);
+    setMetadata(ctx, "github_username", github_username);
+    setMetadata(ctx, "github_repo", github_repo);
+    setMetadata(ctx, "authors", authors);
 }
 
-void handle_info()
+void handle_info(const ProjectContext &ctx)
 {
-    ProjectConfig proj = getCurrentProject();
-    ProjectSettings ps = getProjectSettings();
+    const ProjectConfig &proj = ctx.project();
+    const ProjectSettings &ps = ctx.settings();
+
+    // Revalidated while the other sections print, and shown from the cache without waiting for it
+    const GithubClient::Repository repository{ps.github_username, ps.github_repo};
+    const bool has_repository = !ps.github_username.empty() && !ps.github_repo.empty();
+    GithubClient github(githubToken(ctx.globalConfig()));
+    if (has_repository)
+        github.refreshInBackground({repository});
 
     std::vector<std::pair<std::string, std::string> > info_items = {
         {"Project Name", ps.name},
@@ -1379,11 +2069,17 @@ void handle_info()
     fmt::print(fmt::emphasis::bold | fg(fmt::color::cyan), "- GitHub Repository {}-\n",
                std::string(display_width - std::string("- GitHub Repository ").length() - 1, '-'));
 
-    if (!ps.github_username.empty() && !ps.github_repo.empty())
+    if (has_repository)
     {
         try
         {
-            GithubInfo gi = getRepoInfo(ps.github_username, ps.github_repo);
+            // Whatever the refresh has by now; only the first lookup of a repository waits for GitHub's answer
+            GithubInfo gi = github.cached(repository);
+            const auto wait = gi.success ? std::chrono::milliseconds(0) : std::chrono::milliseconds(10000);
+            if (auto fresh = github.waitForRefresh(wait))
+                gi = fresh->front();
+            if (!gi.success)
+                throw CPPX_Exception(gi.error_message);
 
             std::vector<std::pair<std::string, std::string> > gh_items = {
                 {"Name", gi.name},
@@ -1405,6 +2101,8 @@ void handle_info()
                            fmt::styled(fst, fg(fmt::color::light_cyan) | fmt::emphasis::bold), max_label_gh,
                            fmt::styled(snd, fg(fmt::color::white)));
             }
+            if (!gi.error_message.empty())
+                fmt::print(fg(fmt::color::gray), "  Cached data; refreshing it failed: {}\n", gi.error_message);
         }
         catch (const std::exception &e)
         {
@@ -1428,10 +2126,21 @@ void handle_info()
     fmt::print("\n");
 }
 
-void handle_fmt(const std::vector<std::string> &range)
+namespace
+{
+int clangFormatMajorVersion(const std::string &versionOutput)
+{
+    std::smatch match;
+    if (std::regex_search(versionOutput, match, std::regex(R"(version (\d+))")))
+        return std::stoi(match[1].str());
+    return 0;
+}
+} // namespace
+
+void handle_fmt(const ProjectContext &ctx, const std::vector<std::string> &range, const FormatOptions &opts)
 {
-    const ProjectSettings ps = getProjectSettings();
-    const ProjectConfig pc = getCurrentProject();
+    const ProjectSettings &ps = ctx.settings();
+    const ProjectConfig &pc = ctx.project();
     std::vector<fs::path> files;
 
     // Check if the current project path is a valid directory
@@ -1441,27 +2150,14 @@ void handle_fmt(const std::vector<std::string> &range)
         return;
     }
 
+    std::vector<std::string> patterns;
     for (const auto &file : range)
     {
         fs::path p = fs::path(pc.path) / fs::path(file);
-        // Check if the file is a glob pattern
+        // Glob patterns are expanded together below, in a single walk of the tree
         if (is_glob(file))
         {
-            // Expand the glob pattern and add files to the list
-            for (const auto &t : glob(pc.path, file))
-            {
-                // Check if the glob result is a valid file
-                if (fs::exists(t) && fs::is_regular_file(t))
-                {
-                    files.push_back(t);
-                }
-                else
-                {
-                    fmt::print(fg(fmt::color::yellow),
-                               "Warning: Glob pattern '{}' matched a non-existent or non-regular file: '{}'\n", file,
-                               t.string());
-                }
-            }
+            patterns.push_back(file);
         }
         else // Treat as a direct file path
         {
@@ -1485,83 +2181,245 @@ void handle_fmt(const std::vector<std::string> &range)
         }
     }
 
+    if (!patterns.empty())
+    {
+        std::vector<fs::path> ignored(ps.ignoredPaths.begin(), ps.ignoredPaths.end());
+        const auto matched = glob(pc.path, patterns, {.ignore = std::move(ignored), .jobs = opts.jobs});
+        if (matched.empty())
+            fmt::print(fg(fmt::color::yellow), "Warning: No files match {}\n", fmt::join(patterns, ", "));
+        files.insert(files.end(), matched.begin(), matched.end());
+    }
+
     if (files.empty())
     {
         fmt::print(fg(fmt::color::yellow), "No valid files found to format. Exiting.\n");
         return;
     }
 
-    for (const auto &file : files)
-    {
-        fmt::print(fmt::text_style(fmt::emphasis::bold) | fg(fmt::color::green),
-                   "Formatting: {}\n", file.string());
+    std::ranges::sort(files);
+    files.erase(std::ranges::unique(files).begin(), files.end());
 
-        std::string command;
-        if (ps.format.clangFormatFile)
+    std::string style_arg;
+    std::string style_key; // Everything the style depends on besides the clang-format version
+    if (ps.format.clangFormatFile)
+    {
+        if (ps.format.clangFormatFilepath == "!")
         {
-            if (ps.format.clangFormatFilepath == "!")
-            {
-                fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "Invalid Format Configuration!\n");
-                return;
-            }
-
-            fs::path configPath = ps.format.clangFormatFilepath;
-            if (!fs::exists(configPath) || !fs::is_regular_file(configPath))
-            {
-                fmt::print(fmt::emphasis::bold | fg(fmt::color::red),
-                           "Error: Clang-format configuration file not found or is invalid: '{}'\n",
-                           configPath.string());
-                return;
-            }
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "Invalid Format Configuration!\n");
+            return;
+        }
 
-            command = "cd " + configPath.parent_path().string() +
-                      " && clang-format -style=file -i \"" + file.string() + "\"";
+        fs::path configPath = ps.format.clangFormatFilepath;
+        if (!fs::exists(configPath) || !fs::is_regular_file(configPath))
+        {
+            fmt::print(fmt::emphasis::bold | fg(fmt::color::red),
+                       "Error: Clang-format configuration file not found or is invalid: '{}'\n",
+                       configPath.string());
+            return;
         }
-        else
+        style_arg = "-style=file:" + fs::absolute(configPath).string();
+        std::ifstream in(configPath, std::ios::binary);
+        style_key = std::string(std::istreambuf_iterator<char>(in), {});
+    }
+    else
+    {
+        std::string style = ps.format.formatBase.empty() ? "Microsoft" : ps.format.formatBase;
+        style_arg = "-style=" + style;
+        style_key = style_arg;
+    }
+
+    const JobResult version = runProcess({"clang-format", "--version"});
+    if (version.exitCode != 0)
+        throw CPPX_Exception("clang-format not found. Install it or put it on PATH.");
+    // Before 14 there is no -style=file:<path>, and -style=file only searches the formatted file's directory and its
+    // parents for .clang-format. That finds the configured file only if it is such a file above every input.
+    if (const int major = clangFormatMajorVersion(version.output); ps.format.clangFormatFile && major < 14)
+    {
+        const fs::path config = fs::absolute(ps.format.clangFormatFilepath).lexically_normal();
+        const std::string name = config.filename().string();
+        const bool found = (name == ".clang-format" || name == "_clang-format") &&
+                           std::ranges::all_of(files, [&](const fs::path &file) {
+                               const fs::path rel = fs::absolute(file).lexically_normal().lexically_relative(
+                                   config.parent_path());
+                               return !rel.empty() && *rel.begin() != "..";
+                           });
+        if (!found)
+            throw CPPX_Exception(fmt::format("clang-format {} cannot use the style file {}: -style=file:<path> needs "
+                                             "clang-format 14. Upgrade it, or name the file .clang-format in a "
+                                             "directory above the sources.",
+                                             major, config.string()));
+        style_arg = "-style=file";
+    }
+
+    // Content hashes of the files last seen formatted, valid for one clang-format version and style
+    const fs::path cache_file = fs::path(pc.path) / "build" / "format" / "cache.json";
+    const std::string style_digest = Hasher().update(version.output).update(style_key).hexdigest();
+    json cache = json::object();
+    if (std::ifstream in(cache_file); in && !opts.noCache)
+    {
+        try
         {
-            std::string style = ps.format.formatBase.empty() ? "Microsoft" : ps.format.formatBase;
-            command = "clang-format -style=" + style + " -i \"" + file.string() + "\"";
+            cache = json::parse(in);
         }
-
-        //        fmt::print("executing: {}\n", command);
-        if (const int result = std::system(command.c_str()); result != 0)
+        catch (const json::exception &)
         {
-            fmt::print(fmt::emphasis::bold | fg(fmt::color::red), "Error: Clang-format command failed for file '{}'\n",
-                       file.string());
+            LOG_VERBOSE("Ignoring unreadable format cache: {}\n", cache_file.string());
         }
     }
-}
+    if (!cache.is_object() || cache.value("style", "") != style_digest || !cache.contains("files"))
+        cache = {{"style", style_digest}, {"files", json::object()}};
+    json &known = cache["files"];
+    const fs::path root = fs::absolute(pc.path).lexically_normal();
+    const auto cache_name = [&root](const fs::path &file) {
+        return fs::absolute(file).lexically_normal().lexically_relative(root).generic_string();
+    };
 
+    std::vector<fs::path> pending;
+    for (const auto &file : files)
+    {
+        if (const auto it = known.find(cache_name(file)); it == known.end() || *it != hashFile(file))
+            pending.push_back(file);
+    }
+    const size_t unchanged = files.size() - pending.size();
 
+    // A few files per clang-format process: far fewer process starts, still enough batches to keep every job busy
+    JobScheduler scheduler(opts.jobs, false);
+    const size_t batch_size =
+        std::clamp<size_t>((pending.size() + scheduler.concurrency() - 1) / scheduler.concurrency(), 1, 32);
+    std::vector<std::vector<fs::path>> batches;
+    for (size_t i = 0; i < pending.size(); i += batch_size)
+        batches.emplace_back(pending.begin() + static_cast<std::ptrdiff_t>(i),
+                             pending.begin() + static_cast<std::ptrdiff_t>(std::min(i + batch_size, pending.size())));
+
+    // The files each batch left formatted; every job only writes its own slot
+    std::vector<std::vector<fs::path>> formatted(batches.size());
+    for (size_t b = 0; b < batches.size(); ++b)
+    {
+        std::vector<std::string> command{"clang-format", style_arg};
+        if (opts.check)
+            command.insert(command.end(), {"--dry-run", "-Werror"});
+        else
+            command.push_back("-i");
+        for (const auto &file : batches[b])
+            command.push_back(file.string());
+
+        LOG_VERBOSE("Executing: {}\n", joinCommand(command));
+        scheduler.add({fmt::format("{} {} file(s)", opts.check ? "Checking" : "Formatting", batches[b].size()),
+                       [command, b, &batches, &formatted, &opts] {
+                           JobResult result = runProcess(command);
+                           if (result.exitCode == 0)
+                           {
+                               formatted[b] = batches[b];
+                           }
+                           else if (opts.check)
+                           {
+                               // Every violation is reported as "<file>:line:col: error: ..."
+                               for (const auto &file : batches[b])
+                               {
+                                   if (result.output.find(file.string() + ":") == std::string::npos)
+                                       formatted[b].push_back(file);
+                               }
+                           }
+                           return result;
+                       }});
+    }
+
+    const bool ok = scheduler.run();
+    size_t done = 0;
+    for (const auto &batch : formatted)
+    {
+        for (const auto &file : batch)
+            known[cache_name(file)] = hashFile(file);
+        done += batch.size();
+    }
+    fs::create_directories(cache_file.parent_path());
+    writeFileAtomic(cache_file, cache.dump(2) + "\n");
+
+    if (opts.check)
+    {
+        if (done < pending.size())
+            throw CPPX_Exception(fmt::format("{} of {} file(s) need formatting.", pending.size() - done, files.size()));
+        print_status_message(fmt::format("All {} files are formatted ({} unchanged since the last check)",
+                                         files.size(), unchanged),
+                             "✔", fmt::color::green);
+        return;
+    }
+    if (!ok)
+        throw CPPX_Exception(fmt::format("clang-format failed; {} of {} file(s) were not formatted.",
+                                         pending.size() - done, files.size()));
+    print_status_message(fmt::format("Formatted {} files, {} unchanged since the last run", done, unchanged), "✔",
+                         fmt::color::green);
+}
 
-void handle_list()
+void handle_list(const ProjectContext &ctx)
 {
     constexpr int name_width = 20;
     constexpr int version_width = 12;
+    constexpr int installed_width = 9;
 
-    std::string top_line = "+" + std::string(name_width + 2, '-') + "+" + std::string(version_width + 2, '-') + "+";
+    std::string top_line = "+" + std::string(name_width + 2, '-') + "+" + std::string(version_width + 2, '-') + "+" +
+                           std::string(installed_width + 2, '-') + "+";
     std::string sep_line = top_line;
 
     fmt::print("{}\n", top_line);
 
     fmt::print(fmt::emphasis::bold,
-               "| {:^{nw}} | {:^{vw}} |\n",
-               "Dependency", "Version",
+               "| {:^{nw}} | {:^{vw}} | {:^{iw}} |\n",
+               "Dependency", "Version", "Installed",
                fmt::arg("nw", name_width),
-               fmt::arg("vw", version_width)
+               fmt::arg("vw", version_width),
+               fmt::arg("iw", installed_width)
     );
 
     fmt::print("{}\n", sep_line);
 
-    for (const auto ps = getProjectSettings(); const auto& [name, version] : ps.dependencies)
+    // Answered from vendor/packages.json, without asking Conan
+    const fs::path vendor = fs::path(ctx.project().path) / "vendor";
+    std::optional<PackageManager> pkg;
+    if (fs::exists(vendor))
+        pkg.emplace(vendor);
+
+    for (const auto &[name, version] : ctx.settings().dependencies)
     {
+        const bool installed = pkg && pkg->checkIfInstalled(fmt::format("{}/{}", name, version));
         fmt::print(
-            "| {:<{nw}} | {:>{vw}} |\n",
-            name, version,
+            "| {:<{nw}} | {:>{vw}} | {:^{iw}} |\n",
+            name, version, installed ? "yes" : "no",
             fmt::arg("nw", name_width),
-            fmt::arg("vw", version_width)
+            fmt::arg("vw", version_width),
+            fmt::arg("iw", installed_width)
         );
     }
 
     fmt::print("{}\n", top_line);
-}
\ No newline at end of file
+}
+
+void handle_cache_stats()
+{
+    const CacheSettings settings = loadCacheSettings();
+    const CompilationCache cache(settings.directory);
+    const auto stats = cache.stats();
+    const auto usage = cache.usage();
+    const uint64_t lookups = stats.hits + stats.misses;
+
+    fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "\nCompilation cache: {}\n\n", cache.root().string());
+    fmt::print("  {:<10} : {}\n", "Enabled", settings.enabled ? "yes" : "no");
+    fmt::print("  {:<10} : {}\n", "Entries", usage.entries);
+    fmt::print("  {:<10} : {} / {}\n", "Size", formatSize(usage.bytes), formatSize(settings.maxSize));
+    fmt::print("  {:<10} : {}\n", "Remote", settings.remoteUrl.empty() ? "none" : settings.remoteUrl);
+    fmt::print("  {:<10} : {} ({} remote)\n", "Hits", stats.hits, stats.remoteHits);
+    fmt::print("  {:<10} : {}\n", "Misses", stats.misses);
+    fmt::print("  {:<10} : {:.1f}%\n\n", "Hit rate",
+               lookups == 0 ? 0.0 : 100.0 * static_cast<double>(stats.hits) / static_cast<double>(lookups));
+}
+
+void handle_cache_prune(const std::string &maxSize)
+{
+    const CacheSettings settings = loadCacheSettings();
+    const CompilationCache cache(settings.directory);
+    const uint64_t limit = maxSize.empty() ? settings.maxSize : parseSize(maxSize);
+
+    const auto removed = cache.prune(limit);
+    fmt::print(fmt::emphasis::bold | fg(fmt::color::green), "Removed {} objects ({}), cache is now {}\n",
+               removed.entries, formatSize(removed.bytes), formatSize(cache.usage().bytes));
+}
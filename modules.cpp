@@ -0,0 +1,252 @@
+#include "modules.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+struct ScanResult
+{
+    std::vector<std::string> provides; // Logical names; a unit provides at most one module or partition
+    std::vector<std::string> imports;
+    std::vector<std::string> headerUnits; // import <header>; and import "header";
+};
+
+// The unit's own compile turned into a scan, with everything the scanner writes redirected next to ddi
+std::vector<std::string> scanCommand(const CompileUnit &unit, const ToolchainCapabilities &caps, const fs::path &ddi)
+{
+    std::vector<std::string> args = unit.args;
+    const bool clang = caps.family == "clang";
+    for (size_t i = 0; i + 1 < args.size(); ++i)
+    {
+        if (args[i] == "-MF")
+            args[i + 1] = fs::path(ddi).replace_extension(".d").string();
+        else if (!clang && args[i] == "-c")
+            args[i] = "-E";
+        else if (!clang && args[i] == "-o")
+            args[i + 1] = fs::path(ddi).replace_extension(".ii").string();
+    }
+    if (clang)
+    {
+        // clang-scan-deps prints the P1689 rules instead of running the command
+        args.insert(args.begin(), {caps.moduleScanner, "-format=p1689", "--"});
+    }
+    else
+    {
+        args.insert(args.end(), {"-fdeps-format=p1689r5", "-fdeps-file=" + ddi.string(),
+                                 "-fdeps-target=" + unit.object.string()});
+    }
+    return args;
+}
+
+// Reads the rules of a P1689 file; nullopt if text is not one
+std::optional<ScanResult> parseP1689(const std::string &text)
+{
+    // clang-scan-deps writes to stdout, which also carries its warnings
+    const size_t begin = text.find('{');
+    const size_t end = text.rfind('}');
+    if (begin == std::string::npos || end == std::string::npos || end < begin)
+        return std::nullopt;
+    const json data = json::parse(text.substr(begin, end - begin + 1), nullptr, false);
+    if (data.is_discarded() || !data.contains("rules") || !data["rules"].is_array())
+        return std::nullopt;
+
+    ScanResult result;
+    for (const auto &rule : data["rules"])
+    {
+        for (const auto &provided : rule.value("provides", json::array()))
+            result.provides.push_back(provided.value("logical-name", ""));
+        for (const auto &required : rule.value("requires", json::array()))
+        {
+            const bool by_name = required.value("lookup-method", "by-name") == "by-name";
+            (by_name ? result.imports : result.headerUnits).push_back(required.value("logical-name", ""));
+        }
+    }
+    return result;
+}
+
+// Partitions such as 'app:util' become app-util, since ':' is not allowed in Windows file names
+fs::path bmiPath(const fs::path &bmiDir, std::string name, const ToolchainCapabilities &caps)
+{
+    std::ranges::replace(name, ':', '-');
+    return bmiDir / (name + (caps.family == "clang" ? ".pcm" : ".gcm"));
+}
+} // namespace
+
+bool isModuleInterfaceFile(const fs::path &source)
+{
+    static const std::vector<std::string> extensions{".cppm", ".ixx", ".mpp", ".cxxm", ".ccm", ".c++m"};
+    return std::ranges::find(extensions, source.extension().string()) != extensions.end();
+}
+
+void resolveModules(BuildPlan &plan, const ToolchainCapabilities &caps, const fs::path &bmiDir)
+{
+    if (caps.moduleScanner.empty())
+    {
+        throw CPPX_Exception(fmt::format("{} has no module dependency scanner; C++20 modules need GCC 14 or newer, "
+                                         "or Clang with clang-scan-deps installed.",
+                                         plan.compiler));
+    }
+    fs::create_directories(bmiDir);
+
+    const fs::path scan_file = bmiDir / "scan.json";
+    json scans = json::object();
+    if (std::ifstream in(scan_file); in.is_open())
+    {
+        scans = json::parse(in, nullptr, false);
+        if (scans.is_discarded() || !scans.is_object())
+            scans = json::object();
+    }
+
+    // Everything that can change what a source imports, short of a header importing on its behalf. The source is
+    // identified by its mtime and size, so planning does not read every source of the project.
+    std::vector<std::string> keys(plan.units.size());
+    std::vector<std::optional<ScanResult>> results(plan.units.size());
+    JobScheduler scheduler(0, false);
+    for (size_t i = 0; i < plan.units.size(); ++i)
+    {
+        const CompileUnit &unit = plan.units[i];
+        const fs::path ddi = bmiDir / "scan" / (unit.object.filename().string() + ".ddi");
+        const std::vector<std::string> command = scanCommand(unit, caps, ddi);
+        std::error_code ec;
+        const auto mtime = fs::last_write_time(unit.source, ec).time_since_epoch().count();
+        const auto size = fs::file_size(unit.source, ec);
+        keys[i] = Hasher().update(fmt::format("{} {}", mtime, size)).update(joinCommand(command)).hexdigest();
+        if (const auto it = scans.find(unit.source.string()); it != scans.end() && it->value("key", "") == keys[i])
+        {
+            results[i] = ScanResult{(*it)["provides"].get<std::vector<std::string>>(),
+                                    (*it)["imports"].get<std::vector<std::string>>(),
+                                    it->value("header_units", std::vector<std::string>{})};
+            continue;
+        }
+        scheduler.add({fmt::format("Scanning: {}", unit.source.filename().string()),
+                       [&, i, command, ddi] {
+                           fs::create_directories(ddi.parent_path());
+                           const JobResult result = runProcess(command);
+                           std::string p1689 = result.output;
+                           if (caps.family != "clang")
+                           {
+                               std::ifstream in(ddi);
+                               p1689.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                           }
+                           // A source that does not even preprocess is left to its compile to report
+                           if (result.exitCode == 0)
+                               results[i] = parseP1689(p1689);
+                           return JobResult{};
+                       }});
+    }
+    if (scheduler.jobCount() > 0)
+    {
+        scheduler.run();
+        json updated = json::object();
+        for (size_t i = 0; i < plan.units.size(); ++i)
+        {
+            if (results[i])
+            {
+                updated[plan.units[i].source.string()] = {{"key", keys[i]},
+                                                          {"provides", results[i]->provides},
+                                                          {"imports", results[i]->imports},
+                                                          {"header_units", results[i]->headerUnits}};
+            }
+        }
+        writeFileAtomic(scan_file, updated.dump(2) + "\n");
+    }
+
+    std::map<std::string, size_t> provider;
+    for (size_t i = 0; i < plan.units.size(); ++i)
+    {
+        if (results[i] && !results[i]->headerUnits.empty())
+        {
+            throw CPPX_Exception(fmt::format("{} imports the header unit {}, which cppx cannot build; use #include.",
+                                             plan.units[i].source.string(), results[i]->headerUnits.front()));
+        }
+        for (const auto &name : results[i] ? results[i]->provides : std::vector<std::string>{})
+        {
+            if (const auto [it, inserted] = provider.emplace(name, i); !inserted)
+            {
+                throw CPPX_Exception(fmt::format("Module '{}' is provided by both {} and {}.", name,
+                                                 plan.units[it->second].source.string(),
+                                                 plan.units[i].source.string()));
+            }
+        }
+    }
+
+    // Interfaces before their importers, everything else in its planned order
+    std::vector<size_t> order;
+    std::vector<int> state(plan.units.size(), 0); // 1 while being visited, 2 once ordered
+    std::vector<std::set<std::string>> closure(plan.units.size()); // Modules a unit imports, transitively
+    const std::function<void(size_t)> visit = [&](const size_t i) {
+        if (state[i] == 2)
+            return;
+        if (state[i] == 1)
+            throw CPPX_Exception(fmt::format("Module import cycle through {}.", plan.units[i].source.string()));
+        state[i] = 1;
+        for (const auto &name : results[i] ? results[i]->imports : std::vector<std::string>{})
+        {
+            const auto it = provider.find(name);
+            if (it == provider.end())
+            {
+                throw CPPX_Exception(fmt::format(
+                    "{} imports module '{}', which no source of {} provides{}.", plan.units[i].source.string(), name,
+                    plan.output.filename().string(),
+                    name == "std" || name == "std.compat" ? " (cppx does not build the standard library module)" : ""));
+            }
+            visit(it->second);
+            closure[i].insert(name);
+            closure[i].insert(closure[it->second].begin(), closure[it->second].end());
+        }
+        state[i] = 2;
+        order.push_back(i);
+    };
+    for (size_t i = 0; i < plan.units.size(); ++i)
+        visit(i);
+
+    std::vector<CompileUnit> units;
+    units.reserve(order.size());
+    for (const size_t i : order)
+    {
+        CompileUnit unit = std::move(plan.units[i]);
+        const std::vector<std::string> provides = results[i] ? results[i]->provides : std::vector<std::string>{};
+        if (provides.empty() && closure[i].empty())
+        {
+            units.push_back(std::move(unit));
+            continue;
+        }
+
+        // The module flags go in front of -c, where the unit's own arguments end
+        std::vector<std::string> flags;
+        if (caps.family == "clang")
+        {
+            for (const auto &name : provides)
+                flags.push_back("-fmodule-output=" + bmiPath(bmiDir, name, caps).string());
+            for (const auto &name : closure[i])
+                flags.push_back(fmt::format("-fmodule-file={}={}", name, bmiPath(bmiDir, name, caps).string()));
+        }
+        else
+        {
+            // GCC finds BMIs through a mapper file, which names the one it writes as well as the ones it reads
+            GeneratedFile modmap;
+            modmap.path = fs::path(unit.object).replace_extension(".modmap");
+            modmap.content = fmt::format("$root {}\n", bmiDir.string());
+            for (const auto &name : provides)
+                modmap.content += fmt::format("{} {}\n", name, bmiPath(bmiDir, name, caps).filename().string());
+            for (const auto &name : closure[i])
+                modmap.content += fmt::format("{} {}\n", name, bmiPath(bmiDir, name, caps).filename().string());
+            flags.push_back("-fmodule-mapper=" + modmap.path.string());
+            plan.generated.push_back(std::move(modmap));
+        }
+        unit.args.insert(std::ranges::find(unit.args, "-c"), flags.begin(), flags.end());
+        for (const auto &name : provides)
+            unit.extraOutputs.push_back(bmiPath(bmiDir, name, caps));
+        for (const auto &name : closure[i])
+            unit.implicitDeps.push_back(bmiPath(bmiDir, name, caps));
+        units.push_back(std::move(unit));
+    }
+    plan.units = std::move(units);
+}
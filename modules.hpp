@@ -0,0 +1,15 @@
+#pragma once
+
+#include "build.hpp"
+
+// .cppm, .ixx, .mpp, .cxxm, .ccm and .c++m: sources that turn on module support without [build] modules = true,
+// and that have to be compiled with an explicit -x since not every compiler knows the extension
+bool isModuleInterfaceFile(const fs::path &source);
+
+// Scans every unit of plan for the named modules it provides and imports, with the compiler's P1689 scanner
+// (clang-scan-deps, or GCC 14+ itself). Results are kept in bmiDir/scan.json per source content and command, so
+// only changed sources are rescanned, in parallel. Then reorders plan.units so that every module interface
+// comes before its importers and points each unit at the BMIs in bmiDir: the one it writes becomes an extra
+// output, the ones it imports, transitively, implicit inputs. Throws CPPX_Exception when the compiler has no
+// scanner, for imports no unit provides, header units and import cycles.
+void resolveModules(BuildPlan &plan, const ToolchainCapabilities &caps, const fs::path &bmiDir);
@@ -0,0 +1,608 @@
+#include "perf.hpp"
+
+#include "build.hpp"
+#include "scheduler.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <regex>
+#include <sstream>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+namespace
+{
+std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+        s.remove_suffix(1);
+    return s;
+}
+
+// ';' separates frames and the last ' ' separates the count in the folded format
+std::string frameName(std::string_view name)
+{
+    std::string out(trim(name));
+    std::ranges::replace(out, ';', ':');
+    std::ranges::replace(out, '\n', ' ');
+    return out.empty() ? "[unknown]" : out;
+}
+
+void addStack(FoldedStacks &stacks, const std::string &root, std::vector<std::string> leafFirst)
+{
+    if (leafFirst.empty())
+        return;
+    std::string key = frameName(root);
+    for (auto it = leafFirst.rbegin(); it != leafFirst.rend(); ++it)
+        key += ";" + *it;
+    ++stacks[key];
+}
+
+std::string xmlUnescape(std::string_view s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] != '&')
+        {
+            out += s[i];
+            continue;
+        }
+        static const std::pair<std::string_view, char> entities[] = {
+            {"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''}};
+        bool matched = false;
+        for (const auto &[entity, c] : entities)
+        {
+            if (s.substr(i, entity.size()) == entity)
+            {
+                out += c;
+                i += entity.size() - 1;
+                matched = true;
+                break;
+            }
+        }
+        if (!matched)
+            out += '&';
+    }
+    return out;
+}
+} // namespace
+
+FoldedStacks foldPerfScript(const std::string_view script)
+{
+    // A sample is a header line ("comm pid [cpu] time: period event:") followed by indented frames, leaf first:
+    //     55d4c0a0b123 std::vector<int>::push_back+0x13 (/path/to/binary)
+    FoldedStacks stacks;
+    std::string comm;
+    std::vector<std::string> frames;
+    size_t pos = 0;
+    while (pos <= script.size())
+    {
+        const size_t end = std::min(script.find('\n', pos), script.size());
+        const std::string_view line = script.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (trim(line).empty())
+        {
+            addStack(stacks, comm, std::move(frames));
+            frames.clear();
+            continue;
+        }
+        if (!std::isspace(static_cast<unsigned char>(line.front())))
+        {
+            addStack(stacks, comm, std::move(frames));
+            frames.clear();
+            comm = std::string(line.substr(0, line.find_first_of(" \t")));
+            continue;
+        }
+
+        std::string_view frame = trim(line);
+        frame.remove_prefix(std::min(frame.find(' '), frame.size())); // Address
+        frame = trim(frame);
+        if (frame.ends_with(')'))
+        {
+            if (const size_t dso = frame.rfind(" ("); dso != std::string_view::npos)
+                frame = frame.substr(0, dso);
+        }
+        if (const size_t offset = frame.rfind("+0x"); offset != std::string_view::npos)
+            frame = frame.substr(0, offset);
+        frames.push_back(frameName(frame));
+    }
+    return stacks;
+}
+
+FoldedStacks foldGdbBacktraces(const std::string_view output, const std::string &root)
+{
+    FoldedStacks stacks;
+    std::vector<std::string> frames;
+    size_t pos = 0;
+    while (pos <= output.size())
+    {
+        const size_t end = std::min(output.find('\n', pos), output.size());
+        const std::string_view line = trim(output.substr(pos, end - pos));
+        pos = end + 1;
+
+        // "#3  0x000055d4c0a0b123 in compute (n=3) at src/a.cpp:12" or "#0  compute (n=3) at src/a.cpp:12"
+        if (!line.starts_with('#'))
+        {
+            if (line.starts_with("Thread ") || line.empty())
+            {
+                addStack(stacks, root, std::move(frames));
+                frames.clear();
+            }
+            continue;
+        }
+        std::string_view frame = line.substr(std::min(line.find(' '), line.size()));
+        frame = trim(frame);
+        if (frame.starts_with("0x"))
+        {
+            const size_t in = frame.find(" in ");
+            frame = in == std::string_view::npos ? std::string_view{} : frame.substr(in + 4);
+        }
+        const size_t args = frame.find(" (");
+        frame = frame.substr(0, args == std::string_view::npos ? frame.find(" from ") : args);
+        frames.push_back(frameName(frame));
+    }
+    addStack(stacks, root, std::move(frames));
+    return stacks;
+}
+
+FoldedStacks foldXctraceExport(const std::string_view xml)
+{
+    // Rows hold a <backtrace> of <frame name=...> elements, leaf first. Repeated backtraces and frames are written
+    // once with id="N" and referenced later by ref="N".
+    FoldedStacks stacks;
+    std::unordered_map<std::string, std::string> frame_names;
+    std::unordered_map<std::string, std::vector<std::string>> backtraces;
+    std::vector<std::string> current;
+    std::string current_id;
+    bool in_backtrace = false;
+    std::vector<std::string> row_stack;
+
+    const std::regex tag_re(R"(<(/?)([A-Za-z][\w-]*)([^>]*?)(/?)>)");
+    const std::regex attr_re(R"re(([\w-]+)="([^"]*)")re");
+    const auto attribute = [&](const std::string &attrs, const std::string &key) -> std::string {
+        for (auto it = std::sregex_iterator(attrs.begin(), attrs.end(), attr_re); it != std::sregex_iterator(); ++it)
+        {
+            if ((*it)[1] == key)
+                return xmlUnescape((*it)[2].str());
+        }
+        return {};
+    };
+
+    const std::string text(xml);
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), tag_re); it != std::sregex_iterator(); ++it)
+    {
+        const bool closing = (*it)[1].length() > 0;
+        const std::string name = (*it)[2];
+        const std::string attrs = (*it)[3];
+        const bool self_closing = (*it)[4].length() > 0;
+
+        if (name == "row" && !closing)
+        {
+            row_stack.clear();
+        }
+        else if (name == "row" && closing)
+        {
+            addStack(stacks, "all", row_stack);
+        }
+        else if (name == "backtrace" && !closing)
+        {
+            if (const std::string ref = attribute(attrs, "ref"); !ref.empty())
+            {
+                row_stack = backtraces[ref];
+            }
+            else if (!self_closing)
+            {
+                in_backtrace = true;
+                current.clear();
+                current_id = attribute(attrs, "id");
+            }
+        }
+        else if (name == "backtrace" && closing && in_backtrace)
+        {
+            in_backtrace = false;
+            if (!current_id.empty())
+                backtraces[current_id] = current;
+            row_stack = current;
+        }
+        else if (name == "frame" && !closing && in_backtrace)
+        {
+            if (const std::string ref = attribute(attrs, "ref"); !ref.empty())
+            {
+                current.push_back(frame_names[ref]);
+            }
+            else
+            {
+                std::string frame = frameName(attribute(attrs, "name"));
+                if (const std::string id = attribute(attrs, "id"); !id.empty())
+                    frame_names[id] = frame;
+                current.push_back(std::move(frame));
+            }
+        }
+    }
+    return stacks;
+}
+
+FoldedStacks readFoldedStacks(const fs::path &file)
+{
+    std::ifstream in(file);
+    if (!in)
+        throw CPPX_Exception(fmt::format("Cannot read folded stacks from {}", file.string()));
+    FoldedStacks stacks;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        const size_t space = line.rfind(' ');
+        if (space == std::string::npos)
+            continue;
+        try
+        {
+            stacks[line.substr(0, space)] += std::stoull(line.substr(space + 1));
+        }
+        catch (const std::exception &)
+        {
+            LOG_VERBOSE("Skipping malformed folded line: {}\n", line);
+        }
+    }
+    return stacks;
+}
+
+void writeFoldedStacks(const fs::path &file, const FoldedStacks &stacks)
+{
+    std::string content;
+    for (const auto &[stack, count] : stacks)
+        content += fmt::format("{} {}\n", stack, count);
+    writeFileAtomic(file, content);
+}
+
+namespace
+{
+struct FlameNode
+{
+    std::string name;
+    uint64_t value = 0;
+    std::map<std::string, FlameNode> children;
+};
+
+FlameNode buildTree(const FoldedStacks &stacks)
+{
+    FlameNode root{"all"};
+    for (const auto &[stack, count] : stacks)
+    {
+        root.value += count;
+        FlameNode *node = &root;
+        size_t pos = 0;
+        while (pos <= stack.size())
+        {
+            const size_t end = std::min(stack.find(';', pos), stack.size());
+            const std::string frame = stack.substr(pos, end - pos);
+            pos = end + 1;
+            FlameNode &child = node->children[frame];
+            child.name = frame;
+            child.value += count;
+            node = &child;
+        }
+    }
+    return root;
+}
+
+size_t treeDepth(const FlameNode &node)
+{
+    size_t depth = 0;
+    for (const auto &[name, child] : node.children)
+        depth = std::max(depth, treeDepth(child));
+    return depth + 1;
+}
+
+struct FlameLayout
+{
+    double width;
+    double frameHeight;
+    double bottom;
+    double total;
+    double baseTotal;
+    double maxDelta;
+};
+
+double shareDelta(const FlameNode &node, const FlameNode *base, const FlameLayout &layout)
+{
+    const double base_share = base && layout.baseTotal > 0 ? static_cast<double>(base->value) / layout.baseTotal : 0;
+    return static_cast<double>(node.value) / layout.total - base_share;
+}
+
+double maxShareDelta(const FlameNode &node, const FlameNode *base, const FlameLayout &layout)
+{
+    double delta = std::abs(shareDelta(node, base, layout));
+    for (const auto &[name, child] : node.children)
+    {
+        const FlameNode *base_child = nullptr;
+        if (base)
+        {
+            if (const auto it = base->children.find(name); it != base->children.end())
+                base_child = &it->second;
+        }
+        delta = std::max(delta, maxShareDelta(child, base_child, layout));
+    }
+    return delta;
+}
+
+void renderNode(std::string &svg, const FlameNode &node, const FlameNode *base, const bool diff, const double x,
+                const size_t depth, const FlameLayout &layout)
+{
+    const double w = static_cast<double>(node.value) / layout.total * layout.width;
+    if (w < 0.1)
+        return;
+    const double y = layout.bottom - static_cast<double>(depth + 1) * layout.frameHeight;
+
+    std::string color;
+    std::string tooltip =
+        fmt::format("{} ({} samples, {:.2f}%)", node.name, node.value, 100.0 * node.value / layout.total);
+    if (diff)
+    {
+        const double delta = shareDelta(node, base, layout);
+        const double intensity = layout.maxDelta > 0 ? std::min(1.0, std::abs(delta) / layout.maxDelta) : 0;
+        const int fade = static_cast<int>(255 * (1 - intensity));
+        color = delta >= 0 ? fmt::format("rgb(255,{},{})", fade, fade) : fmt::format("rgb({},{},255)", fade, fade);
+        tooltip += fmt::format(", {:+.2f}% vs baseline", 100 * delta);
+    }
+    else
+    {
+        // The classic warm palette, stable per function so repeated runs look alike
+        const size_t h = std::hash<std::string>{}(node.name);
+        color = fmt::format("rgb({},{},{})", 205 + h % 50, (h >> 8) % 230, (h >> 16) % 55);
+    }
+
+    svg += fmt::format("<g><title>{}</title><rect x=\"{:.1f}\" y=\"{:.1f}\" width=\"{:.1f}\" height=\"{:.1f}\" "
+                       "fill=\"{}\" rx=\"2\" ry=\"2\"/>",
+                       xmlEscape(tooltip), x, y, w, layout.frameHeight - 1, color);
+    if (const auto chars = static_cast<size_t>((w - 6) / 7); chars >= 3)
+    {
+        const std::string label = node.name.size() <= chars ? node.name : node.name.substr(0, chars - 2) + "..";
+        svg += fmt::format("<text x=\"{:.1f}\" y=\"{:.1f}\">{}</text>", x + 3, y + layout.frameHeight - 4,
+                           xmlEscape(label));
+    }
+    svg += "</g>\n";
+
+    double child_x = x;
+    for (const auto &[name, child] : node.children)
+    {
+        const FlameNode *base_child = nullptr;
+        if (base)
+        {
+            if (const auto it = base->children.find(name); it != base->children.end())
+                base_child = &it->second;
+        }
+        renderNode(svg, child, base_child, diff, child_x, depth + 1, layout);
+        child_x += static_cast<double>(child.value) / layout.total * layout.width;
+    }
+}
+} // namespace
+
+std::string renderFlameGraph(const FoldedStacks &stacks, const std::string &title, const FoldedStacks *baseline)
+{
+    const FlameNode root = buildTree(stacks);
+    const FlameNode base_root = baseline ? buildTree(*baseline) : FlameNode{};
+    constexpr double width = 1200;
+    constexpr double frame_height = 16;
+    const size_t depth = treeDepth(root);
+    const double height = static_cast<double>(depth) * frame_height + 60;
+
+    FlameLayout layout{width - 20,
+                       frame_height,
+                       height - 10,
+                       static_cast<double>(std::max<uint64_t>(root.value, 1)),
+                       static_cast<double>(base_root.value),
+                       0};
+    if (baseline)
+        layout.maxDelta = maxShareDelta(root, &base_root, layout);
+
+    std::string svg = fmt::format(
+        "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+        "<svg version=\"1.1\" width=\"{:.0f}\" height=\"{:.0f}\" xmlns=\"http://www.w3.org/2000/svg\" "
+        "font-family=\"Verdana, sans-serif\" font-size=\"12\">\n"
+        "<rect x=\"0\" y=\"0\" width=\"100%\" height=\"100%\" fill=\"#f8f8f8\"/>\n"
+        "<text x=\"{:.0f}\" y=\"24\" text-anchor=\"middle\" font-size=\"17\">{}</text>\n"
+        "<g transform=\"translate(10,0)\">\n",
+        width, height, width / 2, xmlEscape(title));
+    renderNode(svg, root, baseline ? &base_root : nullptr, baseline != nullptr, 0, 0, layout);
+    svg += "</g>\n</svg>\n";
+    return svg;
+}
+
+namespace
+{
+fs::path resolveBaseline(const fs::path &perfDir, const std::string &baseline)
+{
+    for (const fs::path &candidate :
+         {fs::path(baseline), perfDir / (baseline + ".folded"), perfDir / baseline})
+    {
+        if (std::error_code ec; fs::is_regular_file(candidate, ec))
+            return candidate;
+    }
+    throw CPPX_Exception(fmt::format("Baseline '{}' not found (looked for a file and for {}).", baseline,
+                                     (perfDir / (baseline + ".folded")).string()));
+}
+
+#if !defined(_WIN32)
+// Poor man's profiler: attaches gdb every interval and records all threads' backtraces
+FoldedStacks sampleWithGdb(const std::vector<std::string> &argv, const std::chrono::milliseconds interval)
+{
+    std::vector<char *> args;
+    for (const auto &arg : argv)
+        args.push_back(const_cast<char *>(arg.c_str()));
+    args.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+#if defined(__linux__)
+        // Yama's ptrace_scope=1 only lets ancestors attach; gdb is a sibling, so allow it explicitly
+        prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+#endif
+        execvp(args[0], args.data());
+        _exit(127);
+    }
+    if (pid < 0)
+        throw CPPX_Exception(fmt::format("fork failed: {}", std::strerror(errno)));
+
+    const std::string root = fs::path(argv.front()).filename().string();
+    FoldedStacks stacks;
+    size_t samples = 0;
+    int status = 0;
+    while (true)
+    {
+        std::this_thread::sleep_for(interval);
+        if (const pid_t done = waitpid(pid, &status, WNOHANG); done == pid)
+            break;
+        const JobResult bt = runProcess({"gdb", "-p", std::to_string(pid), "-batch", "-nx", "-ex", "set pagination off",
+                                         "-ex", "thread apply all bt"},
+                                        std::chrono::milliseconds(10000));
+        for (const auto &[stack, count] : foldGdbBacktraces(bt.output, root))
+            stacks[stack] += count;
+        ++samples;
+    }
+    LOG_VERBOSE("Took {} gdb samples\n", samples);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127 && samples == 0)
+        throw CPPX_Exception(fmt::format("Failed to start {}", argv.front()));
+    return stacks;
+}
+#endif
+
+void printSelfTime(const FoldedStacks &stacks, const FoldedStacks *baseline, const size_t top)
+{
+    const auto self_time = [](const FoldedStacks &s, uint64_t &total) {
+        std::unordered_map<std::string, uint64_t> self;
+        total = 0;
+        for (const auto &[stack, count] : s)
+        {
+            const size_t leaf = stack.rfind(';');
+            self[leaf == std::string::npos ? stack : stack.substr(leaf + 1)] += count;
+            total += count;
+        }
+        return self;
+    };
+    uint64_t total = 0;
+    uint64_t base_total = 0;
+    const auto self = self_time(stacks, total);
+    const auto base_self = baseline ? self_time(*baseline, base_total) : std::unordered_map<std::string, uint64_t>{};
+    if (total == 0)
+        return;
+
+    std::vector<std::pair<std::string, uint64_t>> sorted(self.begin(), self.end());
+    std::ranges::sort(sorted, [](const auto &a, const auto &b) { return a.second > b.second; });
+    fmt::print(fmt::emphasis::bold, "\nTop functions by self time ({} samples)\n", total);
+    for (size_t i = 0; i < std::min(top, sorted.size()); ++i)
+    {
+        const double share = 100.0 * sorted[i].second / total;
+        fmt::print("  {:>6.2f}%  {}", share, sorted[i].first);
+        if (baseline && base_total > 0)
+        {
+            const auto it = base_self.find(sorted[i].first);
+            const double base_share = it == base_self.end() ? 0 : 100.0 * it->second / base_total;
+            const double delta = share - base_share;
+            fmt::print(delta > 0.5    ? fg(fmt::color::red)
+                       : delta < -0.5 ? fg(fmt::color::green)
+                                      : fg(fmt::color::gray),
+                       "  ({:+.2f}%)", delta);
+        }
+        fmt::print("\n");
+    }
+}
+} // namespace
+
+void handle_perf(const ProjectContext &ctx, const PerfOptions &opts)
+{
+    if (ctx.settings().buildsettings.btype != buildType::BUILD_EXECUTABLE)
+        throw CPPX_Exception("cppx perf needs a project that builds an executable.");
+
+    const fs::path perf_dir = fs::path(ctx.project().path) / "build" / "perf";
+    fs::create_directories(perf_dir);
+    // Read the baseline before this run replaces 'latest'
+    std::optional<FoldedStacks> baseline;
+    if (!opts.diff.empty())
+        baseline = readFoldedStacks(resolveBaseline(perf_dir, opts.diff));
+
+    BuildOptions build_opts;
+    build_opts.config = opts.config;
+    build_opts.profiling = true;
+    build_opts.jobs = opts.jobs;
+    handle_build(ctx, build_opts);
+    const fs::path executable = makeBuildPlan(ctx, build_opts).output;
+
+    std::vector<std::string> target{executable.string()};
+    target.insert(target.end(), opts.args.begin(), opts.args.end());
+    const std::string id = utcTimestamp("%Y%m%d-%H%M%S");
+    FoldedStacks stacks;
+
+#if defined(_WIN32)
+    throw CPPX_Exception("cppx perf is not supported on Windows yet; use Visual Studio's or WPA's profiler.");
+#else
+    if (const auto perf = findProgram("perf"))
+    {
+        const fs::path data = perf_dir / (id + ".data");
+        std::vector<std::string> record{perf->string(), "record", "-F", std::to_string(opts.frequency), "-g",
+                                        "--call-graph", "fp", "-o", data.string(), "--"};
+        record.insert(record.end(), target.begin(), target.end());
+        print_status_message(fmt::format("Profiling with perf: {}", joinCommand(target)), "...", fmt::color::cyan);
+        if (const int rc = runProcess(record, {.capture = false}).exitCode; rc != 0)
+            fmt::print(stderr, fg(fmt::color::yellow), "[WARNING] perf record exited with {}\n", rc);
+        const JobResult script = runProcess({perf->string(), "script", "-i", data.string()});
+        if (script.exitCode != 0)
+            throw CPPX_Exception(fmt::format("perf script failed (check kernel.perf_event_paranoid):\n{}",
+                                             script.output));
+        stacks = foldPerfScript(script.output);
+    }
+#if defined(__APPLE__)
+    else if (findProgram("xctrace"))
+    {
+        const fs::path trace = perf_dir / (id + ".trace");
+        std::vector<std::string> record{"xctrace", "record", "--template", "Time Profiler", "--output",
+                                        trace.string(), "--launch", "--"};
+        record.insert(record.end(), target.begin(), target.end());
+        print_status_message(fmt::format("Profiling with xctrace: {}", joinCommand(target)), "...", fmt::color::cyan);
+        runProcess(record, {.capture = false});
+        const JobResult exported = runProcess(
+            {"xctrace", "export", "--input", trace.string(), "--xpath",
+             R"(/trace-toc/run[@number="1"]/data/table[@schema="time-profile"])"});
+        if (exported.exitCode != 0)
+            throw CPPX_Exception(fmt::format("xctrace export failed:\n{}", exported.output));
+        stacks = foldXctraceExport(exported.output);
+    }
+#endif
+    else if (findProgram("gdb"))
+    {
+        print_status_message(
+            fmt::format("perf not found, sampling with gdb every {} ms: {}", opts.interval.count(), joinCommand(target)),
+            "...", fmt::color::yellow);
+        stacks = sampleWithGdb(target, opts.interval);
+    }
+    else
+    {
+        throw CPPX_Exception("No profiler found: install perf (Linux), Xcode's xctrace (macOS) or gdb.");
+    }
+#endif
+
+    if (stacks.empty())
+        throw CPPX_Exception("The profiler recorded no samples; the program may have exited too quickly.");
+
+    const std::string title = fmt::format("{} ({})", executable.filename().string(), id);
+    const std::string svg = renderFlameGraph(stacks, title, baseline ? &*baseline : nullptr);
+    writeFoldedStacks(perf_dir / (id + ".folded"), stacks);
+    writeFileAtomic(perf_dir / (id + ".svg"), svg);
+    writeFoldedStacks(perf_dir / "latest.folded", stacks);
+    writeFileAtomic(perf_dir / "latest.svg", svg);
+
+    printSelfTime(stacks, baseline ? &*baseline : nullptr, 15);
+    print_status_message(fmt::format("Flame graph: {}", (perf_dir / (id + ".svg")).string()), "✔", fmt::color::green);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "helpers.hpp"
+
+#include <map>
+
+// Folded stacks ("root;caller;leaf" -> samples), the input format of flame graphs
+using FoldedStacks = std::map<std::string, uint64_t>;
+
+// Folds the text output of 'perf script'
+FoldedStacks foldPerfScript(std::string_view script);
+// Folds 'thread apply all bt' output of gdb; every thread's backtrace counts as one sample
+FoldedStacks foldGdbBacktraces(std::string_view output, const std::string &root);
+// Folds the XML of 'xctrace export' for the time-profile table
+FoldedStacks foldXctraceExport(std::string_view xml);
+
+FoldedStacks readFoldedStacks(const fs::path &file);
+void writeFoldedStacks(const fs::path &file, const FoldedStacks &stacks);
+
+// Renders an SVG flame graph with a tooltip per frame. With a baseline, frames are colored by how much their share of the
+// samples grew (red) or shrank (blue) compared to it.
+std::string renderFlameGraph(const FoldedStacks &stacks, const std::string &title,
+                             const FoldedStacks *baseline = nullptr);
@@ -0,0 +1,263 @@
+#include "pgo.hpp"
+
+#include "bench.hpp"
+#include "build.hpp"
+
+#include <cstdlib>
+#include <regex>
+#include <unordered_set>
+
+namespace
+{
+fs::path resolve(const ProjectConfig &proj, const std::string &p)
+{
+    const fs::path path = p;
+    return path.is_absolute() ? path : fs::path(proj.path) / path;
+}
+
+// What a profile was trained on. GCC rejects .gcda files of a changed function and Clang's matching is fuzzy,
+// so any change to a source, header, flag or the training workload retrains.
+std::string trainingFingerprint(const ProjectContext &ctx, const BuildPlan &plan, const std::string &training)
+{
+    const ProjectConfig &proj = ctx.project();
+    const ProjectSettings &ps = ctx.settings();
+    Hasher hasher;
+    hasher.update(plan.toolchainId).update("\n").update(joinCommand(plan.compileFlags)).update("\n");
+    hasher.update(training.empty() ? std::string("<benches>") : training).update("\n");
+
+    std::vector<fs::path> files;
+    for (const auto &src : ps.srcfiles)
+        files.push_back(resolve(proj, src));
+    for (const auto &inc : ps.includefiles)
+        files.push_back(resolve(proj, inc));
+    if (!ps.buildsettings.pch.empty())
+        files.push_back(resolve(proj, ps.buildsettings.pch));
+    std::error_code ec;
+    if (const fs::path benches = fs::path(proj.path) / "benches"; training.empty() && fs::is_directory(benches, ec))
+    {
+        for (const auto &entry : fs::recursive_directory_iterator(benches, ec))
+        {
+            if (entry.is_regular_file(ec))
+                files.push_back(entry.path());
+        }
+    }
+    std::ranges::sort(files);
+    for (const auto &file : files)
+    {
+        hasher.update(file.lexically_relative(proj.path).generic_string());
+        hasher.update(fs::is_regular_file(file, ec) ? hashFile(file) : std::string("<missing>"));
+    }
+    return hasher.hexdigest();
+}
+
+bool profileIsCurrent(const BuildPlan &plan, const std::string &fingerprint)
+{
+    std::ifstream in(plan.pgoDir / "profile.json");
+    if (!in)
+        return false;
+    try
+    {
+        const json manifest = json::parse(in);
+        if (manifest.value("fingerprint", "") != fingerprint)
+            return false;
+    }
+    catch (const json::exception &)
+    {
+        return false;
+    }
+    std::error_code ec;
+    return isClangCompiler(plan.compiler) ? fs::is_regular_file(plan.pgoDir / "merged.profdata", ec)
+                                          : fs::is_directory(plan.pgoDir / "gcda", ec);
+}
+
+void removeFilesWithExtension(const fs::path &dir, const std::string &extension)
+{
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec))
+        return;
+    for (const auto &entry : fs::recursive_directory_iterator(dir, ec))
+    {
+        if (entry.is_regular_file(ec) && entry.path().extension() == extension)
+            fs::remove(entry.path(), ec);
+    }
+}
+
+// llvm-profdata has to match the compiler's LLVM version, so prefer the one installed next to it
+std::vector<std::string> findProfdata(const ProjectContext &ctx)
+{
+    const Toolchain &toolchain = ctx.project().toolchain;
+    std::vector<std::string> candidates;
+    if (!toolchain.compilerPath.empty())
+        candidates.push_back((toolchain.compilerPath.parent_path() / "llvm-profdata").string());
+    if (std::smatch m; std::regex_search(toolchain.compilerVersion, m, std::regex(R"(version (\d+))")))
+        candidates.push_back("llvm-profdata-" + m[1].str());
+    candidates.emplace_back("llvm-profdata");
+    for (const auto &candidate : candidates)
+    {
+        if (const auto path = findProgram(candidate))
+            return {path->string()};
+    }
+#if defined(__APPLE__)
+    if (findProgram("xcrun"))
+        return {"xcrun", "llvm-profdata"};
+#endif
+    throw CPPX_Exception("llvm-profdata not found. Install it next to the compiler or put it on PATH.");
+}
+
+void runTraining(const ProjectContext &ctx, const BuildOptions &instrumentOpts, const std::string &command,
+                 const ProcessOptions &runOpts)
+{
+    if (!command.empty())
+    {
+        LOG_VERBOSE("Training command: {}\n", command);
+        const JobResult result = runShellCommand(command, runOpts);
+        LOG_VERBOSE("{}", result.output);
+        if (result.exitCode != 0)
+        {
+            fmt::print(stderr, "{}", result.output);
+            throw CPPX_Exception(fmt::format("PGO training command failed with exit code {}.", result.exitCode));
+        }
+        return;
+    }
+
+    // One run of every benchmark; the instrumented binaries are far too slow to be worth measuring
+    for (const auto &bench : buildBenchmarks(ctx, instrumentOpts, {}, instrumentOpts.jobs))
+    {
+        LOG_VERBOSE("Training with {}\n", bench.name);
+        const JobResult result = runProcess({bench.executable.string()}, runOpts);
+        if (result.exitCode != 0)
+        {
+            fmt::print(stderr, "{}", result.output);
+            throw CPPX_Exception(
+                fmt::format("PGO training benchmark {} failed with exit code {}.", bench.name, result.exitCode));
+        }
+    }
+}
+
+// Copies the stored .gcda files next to the optimized build's objects, touching only the ones that changed so
+// up-to-date objects stay up to date. An object whose profile disappeared is removed so it gets recompiled.
+void syncGcda(const fs::path &store, const fs::path &objDir)
+{
+    std::error_code ec;
+    std::unordered_set<std::string> stored;
+    for (const auto &entry : fs::recursive_directory_iterator(store, ec))
+    {
+        if (!entry.is_regular_file(ec))
+            continue;
+        const fs::path rel = entry.path().lexically_relative(store);
+        const fs::path dest = objDir / rel;
+        stored.insert(rel.generic_string());
+        if (fs::exists(dest, ec) && hashFile(dest) == hashFile(entry.path()))
+            continue;
+        fs::create_directories(dest.parent_path());
+        fs::copy_file(entry.path(), dest, fs::copy_options::overwrite_existing);
+    }
+    if (!fs::is_directory(objDir, ec))
+        return;
+    for (const auto &entry : fs::recursive_directory_iterator(objDir, ec))
+    {
+        if (!entry.is_regular_file(ec) || entry.path().extension() != ".gcda" ||
+            stored.contains(entry.path().lexically_relative(objDir).generic_string()))
+            continue;
+        fs::remove(entry.path(), ec);
+        fs::remove(fs::path(entry.path()).replace_extension(".o"), ec);
+    }
+}
+} // namespace
+
+void buildWithPgo(const ProjectContext &ctx, const BuildOptions &opts)
+{
+    // Instrumented objects embed where they write their profile, so they must not be shared through the cache
+    BuildOptions instrument = opts;
+    instrument.pgoStage = PgoStage::Instrument;
+    instrument.noCache = true;
+    BuildOptions optimize = opts;
+    optimize.pgoStage = PgoStage::Optimize;
+
+    const BuildPlan instrument_plan = makeBuildPlan(ctx, instrument);
+    const fs::path &pgo_dir = instrument_plan.pgoDir;
+    const bool clang = isClangCompiler(instrument_plan.compiler);
+
+    std::string training = opts.pgoTrain;
+    if (training.empty())
+    {
+        if (const auto *pgo = ctx.config()["pgo"].as_table())
+            training = (*pgo)["train"].value_or(std::string{});
+    }
+    const std::string fingerprint = trainingFingerprint(ctx, instrument_plan, training);
+
+    if (opts.pgoRetrain || !profileIsCurrent(instrument_plan, fingerprint))
+    {
+        print_status_message("PGO 1/3: Building instrumented binaries...", "...", fmt::color::cyan);
+        handle_build(ctx, instrument);
+
+        fs::create_directories(pgo_dir);
+        const fs::path raw_dir = pgo_dir / "raw";
+        fs::remove_all(raw_dir);
+        ProcessOptions training_run;
+        if (clang)
+        {
+            fs::create_directories(raw_dir);
+            training_run.env.emplace_back("LLVM_PROFILE_FILE", (raw_dir / "%p-%m.profraw").string());
+        }
+        else
+        {
+            // GCC adds up counters across runs, so stale data from the last training would skew this one
+            removeFilesWithExtension(instrument_plan.objDir, ".gcda");
+        }
+
+        print_status_message(fmt::format("PGO 2/3: Training with {}...", training.empty() ? "benches/" : training),
+                             "...", fmt::color::cyan);
+        runTraining(ctx, instrument, training, training_run);
+
+        if (clang)
+        {
+            std::vector<std::string> merge = findProfdata(ctx);
+            merge.insert(merge.end(), {"merge", "-output=" + (pgo_dir / "merged.profdata").string()});
+            for (const auto &entry : fs::directory_iterator(raw_dir))
+                merge.push_back(entry.path().string());
+            if (merge.back().find(".profraw") == std::string::npos)
+                throw CPPX_Exception("The training run did not write any profile. Does it run the built code?");
+            LOG_VERBOSE("Merging profiles: {}\n", joinCommand(merge));
+            if (const JobResult result = runProcess(merge); result.exitCode != 0)
+                throw CPPX_Exception(fmt::format("llvm-profdata failed:\n{}", result.output));
+            fs::remove_all(raw_dir);
+        }
+        else
+        {
+            const fs::path store = pgo_dir / "gcda";
+            fs::remove_all(store);
+            size_t collected = 0;
+            for (const auto &entry : fs::recursive_directory_iterator(instrument_plan.objDir))
+            {
+                if (!entry.is_regular_file() || entry.path().extension() != ".gcda")
+                    continue;
+                const fs::path dest = store / entry.path().lexically_relative(instrument_plan.objDir);
+                fs::create_directories(dest.parent_path());
+                fs::copy_file(entry.path(), dest, fs::copy_options::overwrite_existing);
+                ++collected;
+            }
+            if (collected == 0)
+                throw CPPX_Exception("The training run did not write any profile. Does it run the built code?");
+            LOG_VERBOSE("Collected {} .gcda files into {}\n", collected, store.string());
+        }
+
+        writeFileAtomic(pgo_dir / "profile.json",
+                        json{{"fingerprint", fingerprint},
+                             {"toolchain", instrument_plan.toolchainId},
+                             {"training", training}}
+                                .dump(2) +
+                            "\n");
+    }
+    else
+    {
+        print_status_message(fmt::format("Reusing the PGO profile in {} (sources unchanged)", pgo_dir.string()), "✔",
+                             fmt::color::green);
+    }
+
+    if (!clang)
+        syncGcda(pgo_dir / "gcda", makeBuildPlan(ctx, optimize).objDir);
+
+    print_status_message("PGO 3/3: Building with the profile...", "...", fmt::color::cyan);
+    handle_build(ctx, optimize);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "helpers.hpp"
+
+// 'cppx build --pgo': builds instrumented binaries under build/obj/<profile>-pgo-gen/, runs the training workload,
+// merges what it recorded into build/pgo/<profile>/ and rebuilds under build/obj/<profile>-pgo-use/ with it.
+// The stored profile is reused as long as the sources, flags, toolchain and training command are unchanged.
+void buildWithPgo(const ProjectContext &ctx, const BuildOptions &opts);
@@ -0,0 +1,494 @@
+#include "process.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// posix_spawn_file_actions_addchdir_np() arrived with glibc 2.29 and macOS 10.15
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 29)
+#define CPPX_HAVE_SPAWN_CHDIR 1
+#endif
+#elif defined(__APPLE__)
+#if __ENVIRONMENT_MAC_OS_X_VERSION_MIN_REQUIRED__ >= 101500
+#define CPPX_HAVE_SPAWN_CHDIR 1
+#endif
+#endif
+#endif
+
+namespace
+{
+// Merges the overrides into the current environment, as NAME=value entries.
+std::vector<std::string> mergedEnvironment(const std::vector<std::pair<std::string, std::string>> &overrides,
+                                           const std::vector<std::string> &current)
+{
+    std::vector<std::string> merged;
+    for (const auto &entry : current)
+    {
+        const std::string name = entry.substr(0, entry.find('=', 1));
+        const bool overridden = std::ranges::any_of(overrides, [&](const auto &kv) {
+#if defined(_WIN32)
+            return _stricmp(kv.first.c_str(), name.c_str()) == 0;
+#else
+            return kv.first == name;
+#endif
+        });
+        if (!overridden)
+            merged.push_back(entry);
+    }
+    for (const auto &[name, value] : overrides)
+        merged.push_back(name + "=" + value);
+    return merged;
+}
+
+#if defined(_WIN32)
+// Quotes one argument the way CommandLineToArgvW and the MSVC runtime split it again.
+std::string quoteWindowsArgument(const std::string &arg)
+{
+    if (!arg.empty() && arg.find_first_of(" \t\n\v\"") == std::string::npos)
+        return arg;
+
+    std::string quoted = "\"";
+    for (auto it = arg.begin();; ++it)
+    {
+        size_t backslashes = 0;
+        while (it != arg.end() && *it == '\\')
+        {
+            ++it;
+            ++backslashes;
+        }
+        if (it == arg.end())
+        {
+            quoted.append(backslashes * 2, '\\');
+            break;
+        }
+        quoted.append(*it == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+        quoted += *it;
+    }
+    quoted += '"';
+    return quoted;
+}
+#endif
+} // namespace
+
+void Process::fail(std::string message)
+{
+    _result.exitCode = -1;
+    _result.output = std::move(message);
+    _finished = true;
+}
+
+int Process::remainingMs() const
+{
+    if (!_opts.timeout)
+        return -1;
+    const auto left =
+        std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - std::chrono::steady_clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+JobResult Process::wait()
+{
+    while (!_finished)
+    {
+        const int left = remainingMs();
+        if (left == 0)
+        {
+            _result.timedOut = true;
+            kill();
+            reap(true);
+            break;
+        }
+        if (!_outputClosed)
+        {
+            pump(left);
+            continue;
+        }
+        if (left < 0)
+        {
+            reap(true);
+            break;
+        }
+        // Nothing to read from an uncaptured child with a timeout, so check on it periodically
+        reap(false);
+        if (!_finished)
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min(left, 10)));
+    }
+    return _result;
+}
+
+std::optional<JobResult> Process::tryWait()
+{
+    if (!_finished && remainingMs() == 0)
+    {
+        _result.timedOut = true;
+        kill();
+        reap(true);
+    }
+    while (!_finished && !_outputClosed && pump(0) > 0)
+    {
+    }
+    // With capture on, the process is only done once its output is, so nothing is lost
+    if (!_finished && _outputClosed)
+        reap(false);
+    if (!_finished)
+        return std::nullopt;
+    return _result;
+}
+
+#if defined(_WIN32)
+
+Process::Process(const std::vector<std::string> &argv, ProcessOptions opts)
+    : _program(argv.empty() ? std::string() : argv.front()), _opts(std::move(opts)),
+      _deadline(std::chrono::steady_clock::now() + _opts.timeout.value_or(std::chrono::milliseconds(0)))
+{
+    if (argv.empty())
+    {
+        fail("Failed to start: empty command\n");
+        return;
+    }
+
+    SECURITY_ATTRIBUTES inheritable{sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    HANDLE read_end = nullptr;
+    HANDLE write_end = nullptr;
+    HANDLE null_input = nullptr;
+    STARTUPINFOA startup{};
+    startup.cb = sizeof(startup);
+    if (_opts.capture)
+    {
+        if (!CreatePipe(&read_end, &write_end, &inheritable, 0))
+        {
+            fail(fmt::format("Failed to start {}: cannot create pipe (error {})\n", _program, GetLastError()));
+            return;
+        }
+        SetHandleInformation(read_end, HANDLE_FLAG_INHERIT, 0);
+        null_input = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &inheritable,
+                                 OPEN_EXISTING, 0, nullptr);
+        startup.dwFlags = STARTF_USESTDHANDLES;
+        startup.hStdInput = null_input;
+        startup.hStdOutput = write_end;
+        startup.hStdError = write_end;
+    }
+
+    std::string command_line;
+    for (const auto &arg : argv)
+    {
+        if (!command_line.empty())
+            command_line += ' ';
+        command_line += quoteWindowsArgument(arg);
+    }
+
+    std::string environment_block;
+    if (!_opts.env.empty())
+    {
+        std::vector<std::string> current;
+        char *strings = GetEnvironmentStringsA();
+        for (const char *entry = strings; entry && *entry; entry += std::strlen(entry) + 1)
+            current.emplace_back(entry);
+        FreeEnvironmentStringsA(strings);
+        for (const auto &entry : mergedEnvironment(_opts.env, current))
+        {
+            environment_block += entry;
+            environment_block += '\0';
+        }
+        environment_block += '\0';
+    }
+
+    // A job object takes the whole process tree down on timeout, like a process group on POSIX
+    _job = CreateJobObjectA(nullptr, nullptr);
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+    limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(_job, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+
+    const std::string cwd = _opts.cwd.string();
+    PROCESS_INFORMATION info{};
+    const BOOL started =
+        CreateProcessA(nullptr, command_line.data(), nullptr, nullptr, TRUE, CREATE_SUSPENDED,
+                       environment_block.empty() ? nullptr : environment_block.data(),
+                       cwd.empty() ? nullptr : cwd.c_str(), &startup, &info);
+    const DWORD error = GetLastError();
+    if (write_end)
+        CloseHandle(write_end);
+    if (null_input && null_input != INVALID_HANDLE_VALUE)
+        CloseHandle(null_input);
+    if (!started)
+    {
+        if (read_end)
+            CloseHandle(read_end);
+        fail(fmt::format("Failed to start {}: error {}\n", _program, error));
+        return;
+    }
+
+    AssignProcessToJobObject(_job, info.hProcess);
+    ResumeThread(info.hThread);
+    CloseHandle(info.hThread);
+    _process = info.hProcess;
+    _output = read_end;
+    _outputClosed = !_opts.capture;
+}
+
+Process::~Process()
+{
+    if (!_finished && _process)
+    {
+        kill();
+        reap(true);
+    }
+    if (_output)
+        CloseHandle(_output);
+    if (_job)
+        CloseHandle(_job);
+}
+
+size_t Process::pump(const int timeoutMs)
+{
+    // Anonymous pipes cannot be waited on, so peek until data shows up or the time is over
+    const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeoutMs, 0));
+    while (!_outputClosed)
+    {
+        DWORD available = 0;
+        if (!PeekNamedPipe(_output, nullptr, 0, nullptr, &available, nullptr))
+        {
+            // Broken pipe: every writer is gone
+            CloseHandle(_output);
+            _output = nullptr;
+            _outputClosed = true;
+            return 0;
+        }
+        if (available > 0)
+        {
+            std::array<char, 4096> buffer{};
+            DWORD n = 0;
+            ReadFile(_output, buffer.data(), std::min<DWORD>(available, buffer.size()), &n, nullptr);
+            _result.output.append(buffer.data(), n);
+            return n;
+        }
+        if (timeoutMs >= 0 && std::chrono::steady_clock::now() >= until)
+            return 0;
+        WaitForSingleObject(_process, 5);
+    }
+    return 0;
+}
+
+void Process::reap(const bool block)
+{
+    if (WaitForSingleObject(_process, block ? INFINITE : 0) != WAIT_OBJECT_0)
+        return;
+    DWORD code = 0;
+    GetExitCodeProcess(_process, &code);
+    CloseHandle(_process);
+    _process = nullptr;
+    if (_output)
+    {
+        CloseHandle(_output);
+        _output = nullptr;
+        _outputClosed = true;
+    }
+    _result.exitCode = _result.timedOut ? -1 : static_cast<int>(code);
+    _finished = true;
+}
+
+void Process::kill()
+{
+    if (!_finished && _job)
+        TerminateJobObject(_job, 1);
+}
+
+#else
+
+Process::Process(const std::vector<std::string> &argv, ProcessOptions opts)
+    : _program(argv.empty() ? std::string() : argv.front()), _opts(std::move(opts)),
+      _deadline(std::chrono::steady_clock::now() + _opts.timeout.value_or(std::chrono::milliseconds(0)))
+{
+    if (argv.empty())
+    {
+        fail("Failed to start: empty command\n");
+        return;
+    }
+
+    int pipefd[2] = {-1, -1};
+    if (_opts.capture && pipe(pipefd) != 0)
+    {
+        fail(fmt::format("Failed to start {}: {}\n", _program, std::strerror(errno)));
+        return;
+    }
+    if (_opts.capture)
+    {
+        setCloseOnExec(pipefd[0]);
+        setCloseOnExec(pipefd[1]);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    // Threads of ours that block or ignore signals (the sigwait thread of 'cppx worker', SIGPIPE for sockets) must
+    // not pass that on: the child starts with an empty mask and default handlers
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (const int signal : {SIGPIPE, SIGINT, SIGTERM})
+        sigaddset(&defaults, signal);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (_opts.capture)
+    {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+        // Own process group, so a timeout also kills whatever the process started. A child sharing the terminal
+        // stays in ours, otherwise it could not read from it.
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    std::vector<std::string> command = argv;
+    if (!_opts.cwd.empty())
+    {
+#if defined(CPPX_HAVE_SPAWN_CHDIR)
+        posix_spawn_file_actions_addchdir_np(&actions, _opts.cwd.c_str());
+#else
+        // Without the spawn action a shell changes directory and then becomes the program
+        command.insert(command.begin(), {"/bin/sh", "-c", "cd \"$0\" && exec \"$@\"", _opts.cwd.string()});
+#endif
+    }
+
+    std::vector<char *> args;
+    for (const auto &arg : command)
+        args.push_back(const_cast<char *>(arg.c_str()));
+    args.push_back(nullptr);
+
+    std::vector<std::string> environment;
+    std::vector<char *> envp;
+    if (!_opts.env.empty())
+    {
+        std::vector<std::string> current;
+        for (char **entry = environ; *entry; ++entry)
+            current.emplace_back(*entry);
+        environment = mergedEnvironment(_opts.env, current);
+        for (auto &entry : environment)
+            envp.push_back(entry.data());
+        envp.push_back(nullptr);
+    }
+
+    pid_t pid = 0;
+    const int rc =
+        posix_spawnp(&pid, args[0], &actions, &attr, args.data(), envp.empty() ? environ : envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (pipefd[1] >= 0)
+        close(pipefd[1]);
+    if (rc != 0)
+    {
+        if (pipefd[0] >= 0)
+            close(pipefd[0]);
+        fail(fmt::format("Failed to start {}: {}\n", _program, std::strerror(rc)));
+        return;
+    }
+
+    _pid = pid;
+    _output = pipefd[0];
+    _outputClosed = !_opts.capture;
+}
+
+Process::~Process()
+{
+    if (!_finished && _pid > 0)
+    {
+        kill();
+        reap(true);
+    }
+    if (_output >= 0)
+        close(_output);
+}
+
+size_t Process::pump(const int timeoutMs)
+{
+    if (_outputClosed)
+        return 0;
+    pollfd pfd{_output, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0)
+        return 0; // Nothing yet, or interrupted
+    std::array<char, 4096> buffer{};
+    const ssize_t n = read(_output, buffer.data(), buffer.size());
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return 0;
+    if (n <= 0)
+    {
+        // EOF: every writer is gone
+        close(_output);
+        _output = -1;
+        _outputClosed = true;
+        return 0;
+    }
+    _result.output.append(buffer.data(), static_cast<size_t>(n));
+    return static_cast<size_t>(n);
+}
+
+void Process::reap(const bool block)
+{
+    int status = 0;
+    pid_t rc;
+    while ((rc = waitpid(_pid, &status, block ? 0 : WNOHANG)) < 0 && errno == EINTR)
+    {
+    }
+    if (rc == 0)
+        return; // Still running
+    _pid = -1;
+    if (_output >= 0)
+    {
+        close(_output);
+        _output = -1;
+        _outputClosed = true;
+    }
+    if (rc < 0 || _result.timedOut)
+        _result.exitCode = -1;
+    else if (WIFEXITED(status))
+        _result.exitCode = WEXITSTATUS(status);
+    else
+        _result.exitCode = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+    _finished = true;
+}
+
+void Process::kill()
+{
+    if (!_finished && _pid > 0)
+        ::kill(_opts.capture ? -_pid : _pid, SIGKILL);
+}
+
+#endif
+
+JobResult runProcess(const std::vector<std::string> &argv, const std::optional<std::chrono::milliseconds> timeout)
+{
+    return Process(argv, {.timeout = timeout}).wait();
+}
+
+JobResult runProcess(const std::vector<std::string> &argv, const ProcessOptions &opts)
+{
+    return Process(argv, opts).wait();
+}
+
+JobResult runShellCommand(const std::string &command, const ProcessOptions &opts)
+{
+#if defined(_WIN32)
+    return runProcess({"cmd", "/C", command}, opts);
+#else
+    return runProcess({"/bin/sh", "-c", command}, opts);
+#endif
+}
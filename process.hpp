@@ -0,0 +1,75 @@
+#pragma once
+
+#include "helpers.hpp"
+
+struct JobResult
+{
+    int exitCode = 0;
+    std::string output;
+    bool timedOut = false;
+};
+
+struct ProcessOptions
+{
+    // The process and everything it started are killed once it expires; the result is marked timedOut.
+    std::optional<std::chrono::milliseconds> timeout;
+    // Working directory of the child; empty keeps ours.
+    fs::path cwd;
+    // Capture stdout and stderr into one buffer (stdin reads /dev/null). Off, the child shares our terminal.
+    bool capture = true;
+    // Variables set on top of the inherited environment.
+    std::vector<std::pair<std::string, std::string>> env;
+};
+
+// A child process started from an argv vector, without a shell in between. Start several and wait for them in
+// any order; a Process that is destroyed before it was waited for is killed.
+class Process
+{
+  public:
+    explicit Process(const std::vector<std::string> &argv, ProcessOptions opts = {});
+    ~Process();
+
+    Process(const Process &) = delete;
+    Process &operator=(const Process &) = delete;
+
+    // Blocks until the process exits (or its timeout expires) and returns the result.
+    JobResult wait();
+    // Collects pending output without blocking; returns the result once the process has exited.
+    std::optional<JobResult> tryWait();
+    void kill();
+
+    [[nodiscard]] bool running() const
+    {
+        return !_finished;
+    }
+
+  private:
+    void fail(std::string message);
+    // Reads whatever output arrives within timeoutMs (-1 blocks); returns the bytes read.
+    size_t pump(int timeoutMs);
+    void reap(bool block);
+    [[nodiscard]] int remainingMs() const;
+
+    std::string _program;
+    ProcessOptions _opts;
+    std::chrono::steady_clock::time_point _deadline;
+    JobResult _result;
+    bool _finished = false;
+    bool _outputClosed = true;
+#if defined(_WIN32)
+    void *_process = nullptr;
+    void *_job = nullptr;
+    void *_output = nullptr;
+#else
+    int _pid = -1;
+    int _output = -1;
+#endif
+};
+
+// Runs argv to completion with stdout and stderr captured.
+JobResult runProcess(const std::vector<std::string> &argv,
+                     std::optional<std::chrono::milliseconds> timeout = std::nullopt);
+JobResult runProcess(const std::vector<std::string> &argv, const ProcessOptions &opts);
+// Runs a command line through the platform shell (/bin/sh -c, cmd /C). Only for commands the user wrote as a
+// string, such as a training command in config.toml; everything cppx builds itself goes through runProcess.
+JobResult runShellCommand(const std::string &command, const ProcessOptions &opts = {});
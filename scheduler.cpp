@@ -0,0 +1,167 @@
+#include "scheduler.hpp"
+
+#include "trace.hpp"
+
+size_t defaultJobCount()
+{
+    const unsigned hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : hw;
+}
+
+JobScheduler::JobScheduler(const size_t jobs, const bool failFast)
+    : _jobs(jobs == 0 ? defaultJobCount() : jobs), _failFast(failFast)
+{
+}
+
+JobScheduler::JobId JobScheduler::add(Job job, const std::vector<JobId> &deps)
+{
+    const JobId id = _nodes.size();
+    Node node;
+    node.job = std::move(job);
+    node.pendingDeps = deps.size();
+    _nodes.push_back(std::move(node));
+    for (const JobId dep : deps)
+    {
+        Assert(dep < id);
+        _nodes[dep].dependents.push_back(id);
+    }
+    return id;
+}
+
+size_t JobScheduler::jobCount() const
+{
+    return _nodes.size();
+}
+
+size_t JobScheduler::failedCount() const
+{
+    return _failed;
+}
+
+size_t JobScheduler::concurrency() const
+{
+    return _jobs;
+}
+
+bool JobScheduler::run()
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (JobId id = 0; id < _nodes.size(); ++id)
+    {
+        if (_nodes[id].pendingDeps == 0)
+        {
+            _nodes[id].readyAt = now;
+            _ready.push_back(id);
+        }
+    }
+    // Pop from the back, so keep the ready list in reverse to start jobs in the order they were added
+    std::ranges::reverse(_ready);
+
+    const size_t workers = std::min(_jobs, std::max<size_t>(_nodes.size(), 1));
+    {
+        std::vector<std::jthread> threads;
+        threads.reserve(workers);
+        for (size_t i = 0; i < workers; ++i)
+        {
+            threads.emplace_back([this, i] {
+                Trace::nameThread(fmt::format("worker {}", i + 1));
+                worker();
+            });
+        }
+    }
+
+    return _failed == 0;
+}
+
+void JobScheduler::skipDependents(const JobId id)
+{
+    for (const JobId dep : _nodes[id].dependents)
+    {
+        if (!_nodes[dep].skipped)
+        {
+            _nodes[dep].skipped = true;
+            ++_finished;
+            skipDependents(dep);
+        }
+    }
+}
+
+void JobScheduler::worker()
+{
+    std::unique_lock lock(_mutex);
+    while (true)
+    {
+        _cv.wait(lock, [this] { return !_ready.empty() || _running == 0 || (_failFast && _failed > 0); });
+
+        // Nothing left to start: either everything finished, or the rest is blocked behind failed jobs
+        if ((_failFast && _failed > 0) || _ready.empty())
+        {
+            _cv.notify_all();
+            return;
+        }
+
+        const JobId id = _ready.back();
+        _ready.pop_back();
+        Node &node = _nodes[id];
+        if (node.skipped)
+            continue;
+
+        ++_running;
+        ++_started;
+        if (!node.job.description.empty())
+        {
+            fmt::print(fmt::emphasis::bold, "[{}/{}] ", _started, _nodes.size());
+            fmt::print("{}\n", node.job.description);
+        }
+
+        lock.unlock();
+        const auto started = std::chrono::steady_clock::now();
+        JobResult result;
+        try
+        {
+            result = node.job.work();
+        }
+        catch (const std::exception &e)
+        {
+            result.exitCode = -1;
+            result.output += fmt::format("{}\n", e.what());
+        }
+        if (Trace::enabled())
+        {
+            Trace::async(node.job.description, "queue", id, node.readyAt, started);
+            Trace::complete(node.job.description, "job", started, std::chrono::steady_clock::now(),
+                            {{"exit_code", result.exitCode}, {"queued_ms", std::chrono::duration<double, std::milli>(
+                                                                             started - node.readyAt)
+                                                                             .count()}});
+        }
+        lock.lock();
+
+        --_running;
+        ++_finished;
+        if (result.exitCode == 0)
+        {
+            if (!result.output.empty())
+                fmt::print("{}", result.output);
+            if (node.job.done)
+                node.job.done(result);
+            for (const JobId dep : node.dependents)
+            {
+                if (--_nodes[dep].pendingDeps == 0)
+                {
+                    _nodes[dep].readyAt = std::chrono::steady_clock::now();
+                    _ready.push_back(dep);
+                }
+            }
+        }
+        else
+        {
+            ++_failed;
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "FAILED: {}\n", node.job.description);
+            if (!result.output.empty())
+                fmt::print(stderr, "{}", result.output);
+            skipDependents(id);
+        }
+        std::fflush(stdout);
+        _cv.notify_all();
+    }
+}
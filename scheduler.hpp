@@ -0,0 +1,58 @@
+#pragma once
+
+#include "process.hpp"
+
+#include <condition_variable>
+#include <mutex>
+
+// Runs jobs on a fixed number of worker threads, honouring dependencies between them.
+// A job's captured output is printed in one piece once it finishes, so parallel jobs never interleave.
+class JobScheduler
+{
+  public:
+    using JobId = size_t;
+
+    struct Job
+    {
+        std::string description;
+        std::function<JobResult()> work;
+        std::function<void(const JobResult &)> done; // Runs under the scheduler lock after a successful job
+    };
+
+    explicit JobScheduler(size_t jobs = 0, bool failFast = true);
+
+    JobId add(Job job, const std::vector<JobId> &deps = {});
+    // Returns false if any job failed. With failFast, no new job starts after the first failure;
+    // otherwise only the dependents of a failed job are skipped.
+    bool run();
+
+    [[nodiscard]] size_t jobCount() const;
+    [[nodiscard]] size_t failedCount() const;
+    [[nodiscard]] size_t concurrency() const;
+
+  private:
+    struct Node
+    {
+        Job job;
+        std::vector<JobId> dependents;
+        size_t pendingDeps = 0;
+        bool skipped = false;
+        std::chrono::steady_clock::time_point readyAt; // For the queue wait in traces
+    };
+
+    size_t _jobs;
+    bool _failFast;
+    std::vector<Node> _nodes;
+    std::vector<JobId> _ready;
+    size_t _running = 0;
+    size_t _finished = 0;
+    size_t _failed = 0;
+    size_t _started = 0;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+
+    void worker();
+    void skipDependents(JobId id);
+};
+
+size_t defaultJobCount();
@@ -0,0 +1,639 @@
+#include "size.hpp"
+
+#include "build.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+namespace
+{
+constexpr uint64_t SHT_NOBITS = 8;
+constexpr uint64_t SHF_ALLOC = 0x2;
+constexpr uint64_t SHF_EXECINSTR = 0x4;
+
+std::optional<fs::path> findTool(const std::string &gnu, const std::string &llvm)
+{
+    // Apple's own tools lack the GNU options, its llvm- ones have them
+#if defined(__APPLE__)
+    const std::vector<std::string> candidates{llvm, gnu};
+#else
+    const std::vector<std::string> candidates{gnu, llvm};
+#endif
+    for (const auto &name : candidates)
+    {
+        if (auto path = findProgram(name))
+            return path;
+    }
+    return std::nullopt;
+}
+
+// nullopt when file is not ELF; only the header, the section table and the section names are read
+std::optional<std::vector<BinarySection>> readElfSections(const fs::path &file)
+{
+    std::ifstream in(file, std::ios::binary);
+    char ident[16]{};
+    if (!in.read(ident, sizeof(ident)) || std::memcmp(ident, "\177ELF", 4) != 0)
+        return std::nullopt;
+    const bool is64 = ident[4] == 2;
+    const bool big_endian = ident[5] == 2;
+    const size_t word = is64 ? 8 : 4;
+
+    std::error_code ec;
+    const uint64_t file_size = fs::file_size(file, ec);
+    const auto read = [&](const uint64_t offset, const uint64_t count) {
+        if (ec || offset > file_size || count > file_size - offset)
+            return std::string{};
+        std::string buf(count, '\0');
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(offset));
+        in.read(buf.data(), static_cast<std::streamsize>(count));
+        return in ? buf : std::string{};
+    };
+    const auto field = [big_endian](const std::string_view buf, const size_t offset, const size_t width) {
+        uint64_t value = 0;
+        if (offset + width > buf.size())
+            return value;
+        for (size_t i = 0; i < width; ++i)
+            value = value << 8 | static_cast<unsigned char>(buf[big_endian ? offset + i : offset + width - 1 - i]);
+        return value;
+    };
+
+    const std::string header = read(0, is64 ? 64 : 52);
+    const uint64_t table_offset = field(header, is64 ? 0x28 : 0x20, word);
+    const uint64_t entry_size = field(header, is64 ? 0x3A : 0x2E, 2);
+    uint64_t count = field(header, is64 ? 0x3C : 0x30, 2);
+    uint64_t names_index = field(header, is64 ? 0x3E : 0x32, 2);
+    if (table_offset == 0 || entry_size < (is64 ? 64u : 40u))
+        return std::vector<BinarySection>{};
+    // With 0xff00 sections or more the real counts are in the otherwise unused section 0
+    const std::string first = read(table_offset, entry_size);
+    if (count == 0)
+        count = field(first, 8 + 3 * word, word);
+    if (names_index == 0xffff)
+        names_index = field(first, 8 + 4 * word, 4);
+    if (count == 0 || count > file_size / entry_size || names_index >= count)
+        return std::vector<BinarySection>{};
+
+    // Section header: name, type (4 bytes each), then flags, address, offset and size (one word each)
+    const std::string table = read(table_offset, count * entry_size);
+    if (table.empty())
+        return std::vector<BinarySection>{};
+    const auto entry = [&](const uint64_t i) { return std::string_view(table).substr(i * entry_size, entry_size); };
+    const std::string names = read(field(entry(names_index), 8 + 2 * word, word),
+                                   field(entry(names_index), 8 + 3 * word, word));
+
+    std::vector<BinarySection> sections;
+    for (uint64_t i = 1; i < count; ++i)
+    {
+        const std::string_view e = entry(i);
+        const uint64_t flags = field(e, 8, word);
+        if (!(flags & SHF_ALLOC))
+            continue;
+        const uint64_t name = field(e, 0, 4);
+        BinarySection section;
+        section.name = name < names.size() ? std::string(names.c_str() + name) : std::string{};
+        section.size = field(e, 8 + 3 * word, word);
+        section.kind = field(e, 4, 4) == SHT_NOBITS ? SectionKind::Bss
+                       : flags & SHF_EXECINSTR     ? SectionKind::Code
+                                                   : SectionKind::Data;
+        sections.push_back(std::move(section));
+    }
+    return sections;
+}
+
+// 'size -A' prints one "<name> <size> <address>" line per section, loaded or not
+std::vector<BinarySection> readSectionsWithSize(const fs::path &file)
+{
+    const auto size = findTool("size", "llvm-size");
+    if (!size)
+        return {};
+    const JobResult result = runProcess({size->string(), "-A", "-d", file.string()});
+    if (result.exitCode != 0)
+    {
+        LOG_VERBOSE("{} -A failed on {}:\n{}", size->string(), file.string(), result.output);
+        return {};
+    }
+    std::vector<BinarySection> sections;
+    std::istringstream lines(result.output);
+    for (std::string line; std::getline(lines, line);)
+    {
+        std::istringstream fields(line);
+        BinarySection section;
+        uint64_t address = 0;
+        if (!(fields >> section.name >> section.size >> address) || section.name == "Total")
+            continue;
+        std::string lower = section.name;
+        std::ranges::transform(lower, lower.begin(), [](const unsigned char c) { return std::tolower(c); });
+        if (lower.contains("debug") || lower.contains("comment") || lower.contains(".note"))
+            continue;
+        section.kind = lower.contains("bss") || lower.contains("common") ? SectionKind::Bss
+                       : lower.contains("text")                         ? SectionKind::Code
+                                                                        : SectionKind::Data;
+        sections.push_back(std::move(section));
+    }
+    return sections;
+}
+
+// -ffunction-sections and -fdata-sections objects have a .text.<symbol> per function, which the linker merges
+std::string outputSectionName(const std::string &name)
+{
+    for (const std::string prefix : {".text", ".rodata", ".data.rel.ro", ".data", ".bss", ".tdata", ".tbss"})
+    {
+        if (name.starts_with(prefix + "."))
+            return prefix;
+    }
+    return name;
+}
+
+bool isIdentifierChar(const char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// The [size] table of config.toml
+struct SizeBudget
+{
+    std::optional<uint64_t> total;           // budget: loaded bytes of the whole binary
+    std::map<std::string, uint64_t> sections; // [size.sections]: loaded bytes per section
+    std::optional<uint64_t> growthBytes;      // max_growth = "16K" over the baseline's total
+    std::optional<double> growthRatio;        // max_growth = "2%"
+};
+
+void parseGrowth(SizeBudget &budget, const std::string &growth)
+{
+    budget.growthBytes.reset();
+    budget.growthRatio.reset();
+    if (!growth.ends_with('%'))
+    {
+        budget.growthBytes = parseSize(growth);
+        return;
+    }
+    try
+    {
+        budget.growthRatio = std::stod(growth.substr(0, growth.size() - 1)) / 100;
+    }
+    catch (const std::exception &)
+    {
+        throw CPPX_Exception(fmt::format("Invalid max_growth: '{}'", growth));
+    }
+}
+
+SizeBudget loadSizeBudget(const toml::table &config, const std::string &maxGrowth)
+{
+    SizeBudget budget;
+    if (const auto *size = config["size"].as_table())
+    {
+        for (const auto &[key, node] : *size)
+        {
+            if (key.str() == "budget" && node.is_string())
+                budget.total = parseSize(*node.value<std::string>());
+            else if (key.str() == "max_growth" && node.is_string())
+                parseGrowth(budget, *node.value<std::string>());
+            else if (key.str() == "sections" && node.is_table())
+            {
+                for (const auto &[section, limit] : *node.as_table())
+                {
+                    if (!limit.is_string())
+                        throw CPPX_Exception(fmt::format("[size.sections] {} must be a size such as \"1M\".",
+                                                         section.str()));
+                    budget.sections[std::string(section.str())] = parseSize(*limit.value<std::string>());
+                }
+            }
+            else
+            {
+                fmt::print(stderr, fg(fmt::color::yellow), "[WARNING] Ignoring [size] {} in config.toml.\n",
+                           key.str());
+            }
+        }
+    }
+    if (!maxGrowth.empty())
+        parseGrowth(budget, maxGrowth);
+    return budget;
+}
+
+std::string formatDelta(const int64_t bytes)
+{
+    return fmt::format("{}{}", bytes < 0 ? "-" : "+", formatSize(static_cast<uint64_t>(std::abs(bytes))));
+}
+
+// Prints the change against the baseline's value at key of table, or nothing without a baseline
+void printDelta(const json *baseline, const char *table, const std::string &key, const uint64_t bytes)
+{
+    if (!baseline)
+        return;
+    const json &base = baseline->contains(table) ? (*baseline)[table] : json::object();
+    if (!base.is_object() || !base.contains(key))
+    {
+        fmt::print(fg(fmt::color::gray), "  (new)");
+        return;
+    }
+    const json &entry = base[key];
+    const auto before = entry.is_object() ? entry.value("size", uint64_t{0}) : entry.get<uint64_t>();
+    const auto delta = static_cast<int64_t>(bytes) - static_cast<int64_t>(before);
+    if (delta != 0)
+        fmt::print(delta > 0 ? fg(fmt::color::red) : fg(fmt::color::green), "  ({})", formatDelta(delta));
+}
+
+template <typename Map> std::vector<std::pair<std::string, uint64_t>> largestFirst(const Map &sizes)
+{
+    std::vector<std::pair<std::string, uint64_t>> sorted;
+    for (const auto &[name, value] : sizes)
+    {
+        if constexpr (std::is_same_v<std::remove_cvref_t<decltype(value)>, uint64_t>)
+            sorted.emplace_back(name, value);
+        else
+            sorted.emplace_back(name, value.size);
+    }
+    std::ranges::stable_sort(sorted, [](const auto &a, const auto &b) { return a.second > b.second; });
+    return sorted;
+}
+
+struct ObjectSize
+{
+    uint64_t code = 0;
+    uint64_t data = 0;
+    uint64_t bss = 0;
+    uint64_t size = 0; // All three
+};
+
+struct TemplateSize
+{
+    uint64_t size = 0;
+    size_t instantiations = 0;
+};
+} // namespace
+
+std::vector<BinarySection> readSections(const fs::path &file)
+{
+    if (auto elf = readElfSections(file))
+        return std::move(*elf);
+    std::ifstream in(file, std::ios::binary);
+    char magic[8]{};
+    if (!in.read(magic, sizeof(magic)) || std::string_view(magic, sizeof(magic)) == "!<arch>\n")
+        return {};
+    return readSectionsWithSize(file);
+}
+
+std::map<std::string, uint64_t> readSymbolSizes(const fs::path &file)
+{
+    const auto nm = findTool("nm", "llvm-nm");
+    if (!nm)
+        return {};
+    const JobResult result = runProcess({nm->string(), "--print-size", "--size-sort", "--demangle", file.string()});
+    if (result.exitCode != 0)
+    {
+        LOG_VERBOSE("{} failed on {}:\n{}", nm->string(), file.string(), result.output);
+        return {};
+    }
+
+    std::map<std::string, uint64_t> sizes;
+    std::set<std::pair<std::string, uint64_t>> seen; // Name and address
+    std::istringstream lines(result.output);
+    for (std::string line; std::getline(lines, line);)
+    {
+        // <address> <size> <type> <name>; archives add "member.o:" headers, and warnings end up here too
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::istringstream fields(line);
+        std::string address;
+        std::string size;
+        std::string type;
+        std::string name;
+        if (!(fields >> address >> size >> type) || type.size() != 1 || !std::getline(fields >> std::ws, name))
+            continue;
+        uint64_t addr = 0;
+        uint64_t bytes = 0;
+        if (std::from_chars(address.data(), address.data() + address.size(), addr, 16).ec != std::errc{} ||
+            std::from_chars(size.data(), size.data() + size.size(), bytes, 16).ec != std::errc{})
+            continue;
+        // Complete and base object constructors and destructors are often one function under two symbols
+        if (seen.emplace(name, addr).second)
+            sizes[name] += bytes;
+    }
+    return sizes;
+}
+
+std::string templateKey(const std::string_view demangled)
+{
+    // GCC's [clone .cold] and [clone .isra.0] parts belong to the function they were split from
+    const std::string_view name = demangled.substr(0, demangled.find(" [clone "));
+    constexpr std::string_view anonymous = "(anonymous namespace)";
+
+    std::string key;
+    size_t depth = 0;      // Of the template argument lists being skipped
+    size_t braces = 0;     // Inside {lambda(...)#1} and the like
+    size_t name_start = 0; // Where the name starts after a function's return type
+    bool collapsed = false;
+    bool in_operator = false;
+    bool seen_parameters = false;
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        const char c = name[i];
+        if (depth > 0)
+        {
+            if (c == '<')
+                ++depth;
+            else if (c == '>')
+                --depth;
+            continue;
+        }
+        if (name.substr(i).starts_with(anonymous))
+        {
+            key += anonymous;
+            i += anonymous.size() - 1;
+            continue;
+        }
+        if (name.substr(i).starts_with("operator") && (i == 0 || !isIdentifierChar(name[i - 1])) &&
+            (i + 8 == name.size() || !isIdentifierChar(name[i + 8])))
+        {
+            // The symbol of operator<<, operator() and the like is part of the name, not an argument list
+            size_t end = i + 8;
+            if (name.substr(end).starts_with("()"))
+                end += 2;
+            else
+            {
+                while (end < name.size() && std::string_view("<>=!+-*/%^&|~").contains(name[end]))
+                    ++end;
+            }
+            key += name.substr(i, end - i);
+            i = end - 1;
+            in_operator = true;
+            continue;
+        }
+        if (c == '<')
+        {
+            key += "<>";
+            depth = 1;
+            collapsed = true;
+        }
+        else if (c == '(')
+        {
+            // Skip the parameters, which are spelled out per instantiation
+            size_t parens = 1;
+            while (++i < name.size() && parens > 0)
+            {
+                if (name[i] == '(')
+                    ++parens;
+                else if (name[i] == ')')
+                    --parens;
+            }
+            --i;
+            key += "()";
+            if (braces == 0)
+            {
+                seen_parameters = true;
+                in_operator = false;
+            }
+        }
+        else
+        {
+            key += c;
+            if (c == '{')
+                ++braces;
+            else if (c == '}' && braces > 0)
+                --braces;
+            else if (c == ' ' && braces == 0 && !in_operator && !seen_parameters)
+                name_start = key.size();
+        }
+    }
+    if (!collapsed)
+        return std::string(demangled);
+
+    if (!seen_parameters)
+        return key;
+    // 'guard variable for f<>()::x' and 'non-virtual thunk to X<>::f()' keep what they are
+    const std::string_view prefix = std::string_view(key).substr(0, name_start);
+    size_t keep = 0;
+    for (const std::string_view phrase : {" for ", " to "})
+    {
+        if (const size_t pos = prefix.rfind(phrase); pos != std::string_view::npos)
+            keep = std::max(keep, pos + phrase.size());
+    }
+    key.erase(keep, name_start - keep);
+    return key;
+}
+
+void handle_size(const ProjectContext &ctx, const SizeOptions &opts)
+{
+    const fs::path size_dir = fs::path(ctx.project().path) / "build" / "size";
+    // Read the baseline before this run replaces 'latest'
+    std::optional<json> baseline;
+    if (!opts.diff.empty())
+        baseline = loadBaseline(size_dir, opts.diff);
+    const SizeBudget budget = loadSizeBudget(ctx.config(), opts.maxGrowth);
+
+    BuildOptions build_opts;
+    build_opts.config = opts.config;
+    build_opts.target = opts.target;
+    build_opts.jobs = opts.jobs;
+    handle_build(ctx, build_opts);
+    const BuildPlan plan = opts.target.empty() ? makeBuildPlan(ctx, build_opts)
+                                               : makeWorkspacePlans(ctx, build_opts).back();
+    if (!fs::exists(plan.output))
+        throw CPPX_Exception(fmt::format("{} was not built.", plan.output.string()));
+
+    // What every object contributes before linking; inline functions and templates count in each object that
+    // instantiates them, even though the linker keeps one copy
+    std::map<std::string, ObjectSize> objects;
+    std::map<std::string, uint64_t> sections;
+    for (const auto &unit : plan.units)
+    {
+        ObjectSize &object = objects[fs::relative(unit.source, ctx.project().path).generic_string()];
+        for (const auto &section : readSections(unit.object))
+        {
+            (section.kind == SectionKind::Code ? object.code
+             : section.kind == SectionKind::Bss ? object.bss
+                                                : object.data) += section.size;
+            object.size += section.size;
+            if (plan.btype == buildType::BUILD_STATICLINK)
+                sections[outputSectionName(section.name)] += section.size;
+        }
+    }
+    // A static library is the sum of its objects; anything linked has its own section table
+    uint64_t total = 0;
+    uint64_t bss = 0;
+    if (plan.btype != buildType::BUILD_STATICLINK)
+    {
+        for (const auto &section : readSections(plan.output))
+        {
+            sections[section.name] += section.size;
+            bss += section.kind == SectionKind::Bss ? section.size : 0;
+        }
+    }
+    for (const auto &[name, bytes] : sections)
+        total += bytes;
+    if (sections.empty())
+    {
+        fmt::print(stderr, fg(fmt::color::yellow), "[WARNING] Cannot read the sections of {}; install binutils.\n",
+                   plan.output.string());
+    }
+
+    const std::map<std::string, uint64_t> symbols = readSymbolSizes(plan.output);
+    if (symbols.empty())
+    {
+        fmt::print(stderr, fg(fmt::color::yellow),
+                   "[WARNING] No symbol sizes for {}: it is stripped, or nm is not installed.\n",
+                   plan.output.string());
+    }
+    std::map<std::string, TemplateSize> templates;
+    for (const auto &[name, bytes] : symbols)
+    {
+        if (std::string key = templateKey(name); key != name)
+        {
+            TemplateSize &t = templates[std::move(key)];
+            t.size += bytes;
+            ++t.instantiations;
+        }
+    }
+
+    std::error_code ec;
+    const uint64_t file_size = fs::file_size(plan.output, ec);
+    const json *base = baseline ? &*baseline : nullptr;
+    fmt::print(fmt::emphasis::bold, "{} ({}): {} loaded, {} on disk", plan.output.filename().string(), opts.config,
+               formatSize(total), formatSize(file_size));
+    if (baseline && baseline->contains("total"))
+    {
+        const auto delta = static_cast<int64_t>(total) - static_cast<int64_t>((*baseline)["total"].get<uint64_t>());
+        fmt::print(delta > 0 ? fg(fmt::color::red) : delta < 0 ? fg(fmt::color::green) : fg(fmt::color::gray),
+                   "  ({} against '{}')", formatDelta(delta), opts.diff);
+    }
+    fmt::print("\n");
+
+    fmt::print(fmt::emphasis::bold, "\nSections\n");
+    for (const auto &[name, bytes] : largestFirst(sections))
+    {
+        fmt::print("  {:<24} {:>10}  {:>5.1f}%", name, formatSize(bytes), total ? 100.0 * bytes / total : 0.0);
+        printDelta(base, "sections", name, bytes);
+        fmt::print("\n");
+    }
+    if (bss > 0)
+        fmt::print(fg(fmt::color::gray), "  ({} of that is zero-initialized and takes no space on disk)\n",
+                   formatSize(bss));
+
+    fmt::print(fmt::emphasis::bold, "\nObjects (before linking)\n");
+    const auto sorted_objects = largestFirst(objects);
+    for (size_t i = 0; i < std::min(opts.top, sorted_objects.size()); ++i)
+    {
+        const ObjectSize &object = objects.at(sorted_objects[i].first);
+        fmt::print("  {:>10}  code {:>10}  data {:>10}  bss {:>10}  {}", formatSize(object.size),
+                   formatSize(object.code), formatSize(object.data), formatSize(object.bss), sorted_objects[i].first);
+        printDelta(base, "objects", sorted_objects[i].first, object.size);
+        fmt::print("\n");
+    }
+
+    if (!symbols.empty())
+    {
+        fmt::print(fmt::emphasis::bold, "\nLargest symbols\n");
+        const auto sorted = largestFirst(symbols);
+        for (size_t i = 0; i < std::min(opts.top, sorted.size()); ++i)
+        {
+            fmt::print("  {:>10}  {}", formatSize(sorted[i].second), sorted[i].first);
+            printDelta(base, "symbols", sorted[i].first, sorted[i].second);
+            fmt::print("\n");
+        }
+    }
+    if (!templates.empty())
+    {
+        fmt::print(fmt::emphasis::bold, "\nTemplates (all instantiations together)\n");
+        const auto sorted = largestFirst(templates);
+        for (size_t i = 0; i < std::min(opts.top, sorted.size()); ++i)
+        {
+            fmt::print("  {:>10}  {:>4}x  {}", formatSize(sorted[i].second),
+                       templates.at(sorted[i].first).instantiations, sorted[i].first);
+            printDelta(base, "templates", sorted[i].first, sorted[i].second);
+            fmt::print("\n");
+        }
+    }
+
+    // The symbols that changed the most, which the tables above only show when they are among the largest
+    if (baseline && baseline->contains("symbols") && (*baseline)["symbols"].is_object())
+    {
+        std::vector<std::pair<std::string, int64_t>> changes;
+        const json &before = (*baseline)["symbols"];
+        for (const auto &[name, bytes] : symbols)
+        {
+            const auto old = before.contains(name) ? before[name].get<int64_t>() : 0;
+            if (const int64_t delta = static_cast<int64_t>(bytes) - old; delta != 0)
+                changes.emplace_back(name, delta);
+        }
+        for (const auto &[name, bytes] : before.items())
+        {
+            if (!symbols.contains(name))
+                changes.emplace_back(name, -bytes.get<int64_t>());
+        }
+        std::ranges::sort(changes,
+                          [](const auto &a, const auto &b) { return std::abs(a.second) > std::abs(b.second); });
+        if (!changes.empty())
+        {
+            fmt::print(fmt::emphasis::bold, "\nLargest changes against '{}'\n", opts.diff);
+            for (size_t i = 0; i < std::min(opts.top, changes.size()); ++i)
+            {
+                fmt::print(changes[i].second > 0 ? fg(fmt::color::red) : fg(fmt::color::green), "  {:>11}",
+                           formatDelta(changes[i].second));
+                fmt::print("  {}{}\n", changes[i].first,
+                           !before.contains(changes[i].first) ? " (new)"
+                           : !symbols.contains(changes[i].first) ? " (removed)"
+                                                                 : "");
+            }
+        }
+    }
+
+    json report{{"timestamp", utcTimestamp("%Y-%m-%dT%H:%M:%SZ")},
+                {"config", opts.config},
+                {"target", plan.target},
+                {"file", plan.output.filename().string()},
+                {"file_size", file_size},
+                {"total", total},
+                {"sections", sections},
+                {"objects", json::object()},
+                {"symbols", symbols},
+                {"templates", json::object()}};
+    for (const auto &[name, object] : objects)
+    {
+        report["objects"][name] = {
+            {"size", object.size}, {"code", object.code}, {"data", object.data}, {"bss", object.bss}};
+    }
+    for (const auto &[key, t] : templates)
+        report["templates"][key] = {{"size", t.size}, {"instantiations", t.instantiations}};
+    const std::string content = report.dump(2) + "\n";
+    const fs::path history = size_dir / "history" / (utcTimestamp("%Y%m%d-%H%M%S") + ".json");
+    fs::create_directories(history.parent_path());
+    writeFileAtomic(history, content);
+    writeFileAtomic(size_dir / "latest.json", content);
+    if (!opts.save.empty())
+        writeFileAtomic(size_dir / (opts.save + ".json"), content);
+    LOG_VERBOSE("Report written to {}\n", history.string());
+
+    std::vector<std::string> violations;
+    if (budget.total && total > *budget.total)
+    {
+        violations.push_back(
+            fmt::format("{} loaded, over the budget of {}", formatSize(total), formatSize(*budget.total)));
+    }
+    for (const auto &[name, limit] : budget.sections)
+    {
+        if (const auto it = sections.find(name); it != sections.end() && it->second > limit)
+            violations.push_back(fmt::format("{} is {}, over its budget of {}", name, formatSize(it->second),
+                                             formatSize(limit)));
+    }
+    if (baseline && baseline->contains("total") && (budget.growthBytes || budget.growthRatio))
+    {
+        const auto before = (*baseline)["total"].get<uint64_t>();
+        const uint64_t allowed = budget.growthBytes ? *budget.growthBytes
+                                                    : static_cast<uint64_t>(static_cast<double>(before) *
+                                                                            *budget.growthRatio);
+        if (total > before + allowed)
+            violations.push_back(fmt::format("grew by {} against '{}', more than the allowed {}",
+                                             formatSize(total - before), opts.diff, formatSize(allowed)));
+    }
+    if (!violations.empty())
+    {
+        for (const auto &violation : violations)
+            fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "[SIZE] {}: {}\n",
+                       plan.output.filename().string(), violation);
+        throw CPPX_Exception(fmt::format("{} is over its size budget.", plan.output.filename().string()));
+    }
+    print_status_message(fmt::format("Size report: {}", (size_dir / "latest.json").string()), "✔", fmt::color::green);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "helpers.hpp"
+
+#include <map>
+
+enum class SectionKind
+{
+    Code,
+    Data, // Read-only data included
+    Bss   // Takes memory at run time but no space in the file
+};
+
+struct BinarySection
+{
+    std::string name;
+    uint64_t size = 0;
+    SectionKind kind = SectionKind::Data;
+};
+
+// The sections of an object file or linked binary that are loaded at run time. ELF is read directly, other formats
+// (Mach-O, PE/COFF) through 'size -A'. Empty for anything else, such as an archive.
+std::vector<BinarySection> readSections(const fs::path &file);
+
+// Demangled symbol -> bytes, from 'nm --print-size'. Aliases (one address under one name) count once. Empty when the
+// file is stripped or no nm is installed.
+std::map<std::string, uint64_t> readSymbolSizes(const fs::path &file);
+
+// Key under which every instantiation of a template adds up: template arguments become '<>', and for functions the
+// parameters become '()' and the return type goes, so both 'int f<int>(int)' and 'double f<double>(double)' are
+// 'f<>()'. Names without template arguments come back unchanged.
+std::string templateKey(std::string_view demangled);
@@ -0,0 +1,328 @@
+#include "toolchain.hpp"
+
+#include "cache.hpp"
+#include "scheduler.hpp"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <unordered_set>
+
+namespace
+{
+// Identifies one build of a binary; an upgraded compiler changes both
+std::pair<int64_t, int64_t> binaryStamp(const fs::path &path)
+{
+    std::error_code ec;
+    const auto mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    if (ec)
+        return {-1, -1};
+    const auto size = fs::file_size(path, ec);
+    return {static_cast<int64_t>(mtime), ec ? -1 : static_cast<int64_t>(size)};
+}
+
+// One file per compiler binary under <cache dir>/toolchains/, so probing never rewrites ~/.cppxglobal.toml and two
+// processes storing different compilers do not race
+fs::path capabilitiesFile(const toml::table &globalConfig, const fs::path &path)
+{
+    return loadCacheSettings(globalConfig).directory / "toolchains" /
+           (Hasher().update(path.string()).hexdigest().substr(0, 16) + ".json");
+}
+
+std::optional<ToolchainCapabilities> cachedCapabilities(const toml::table &globalConfig, const fs::path &path)
+{
+    std::ifstream in(capabilitiesFile(globalConfig, path));
+    if (!in.is_open())
+        return std::nullopt;
+    const json entry = json::parse(in, nullptr, false);
+    if (!entry.is_object() || entry.value("path", std::string{}) != path.string())
+        return std::nullopt;
+    const auto [mtime, size] = binaryStamp(path);
+    if (entry.value("mtime", int64_t{-2}) != mtime || entry.value("size", int64_t{-2}) != size)
+        return std::nullopt;
+
+    ToolchainCapabilities caps;
+    caps.version = entry.value("version", std::string{});
+    caps.family = entry.value("family", std::string{});
+    caps.pchFormat = entry.value("pch", std::string{});
+    caps.thinLto = entry.value("thin_lto", false);
+    caps.timeTrace = entry.value("time_trace", false);
+    caps.modules = entry.value("modules", false);
+    caps.moduleScanner = entry.value("module_scanner", std::string{});
+    caps.linkers = entry.value("linkers", std::vector<std::string>{});
+    caps.march = entry.value("march", std::vector<std::string>{});
+    return caps;
+}
+
+void storeCapabilities(const toml::table &globalConfig,
+                       const std::vector<std::pair<fs::path, ToolchainCapabilities>> &entries)
+{
+    for (const auto &[path, caps] : entries)
+    {
+        const auto [mtime, size] = binaryStamp(path);
+        const json entry = {{"path", path.string()},
+                            {"mtime", mtime},
+                            {"size", size},
+                            {"version", caps.version},
+                            {"family", caps.family},
+                            {"pch", caps.pchFormat},
+                            {"thin_lto", caps.thinLto},
+                            {"time_trace", caps.timeTrace},
+                            {"modules", caps.modules},
+                            {"module_scanner", caps.moduleScanner},
+                            {"linkers", caps.linkers},
+                            {"march", caps.march}};
+        try
+        {
+            const fs::path file = capabilitiesFile(globalConfig, path);
+            fs::create_directories(file.parent_path());
+            writeFileAtomic(file, entry.dump(2) + "\n");
+        }
+        catch (const std::exception &e)
+        {
+            LOG_VERBOSE("Could not cache toolchain capabilities: {}\n", e.what());
+        }
+    }
+}
+
+std::vector<std::string> parseMarchList(const std::string &output, const bool clang)
+{
+    std::vector<std::string> values;
+    if (clang)
+    {
+        // "Available CPUs for this target:", a blank line, one indented name per line, a blank line
+        std::istringstream lines(output.substr(std::min(output.find("Available CPUs"), output.size())));
+        std::string line;
+        std::getline(lines, line);
+        while (std::getline(lines, line))
+        {
+            const size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos)
+            {
+                if (!values.empty())
+                    break;
+                continue;
+            }
+            values.push_back(line.substr(start, line.find_first_of(" \t\r", start) - start));
+        }
+    }
+    else if (std::smatch m; std::regex_search(output, m, std::regex(R"(valid arguments to '-march=' switch are: ([^;\n]*))")))
+    {
+        std::istringstream names(m[1].str());
+        for (std::string name; names >> name;)
+            values.push_back(name);
+    }
+    return values;
+}
+
+// The clang-scan-deps belonging to a Clang driver: the one next to it with the same version suffix, if any
+std::string findClangScanDeps(const fs::path &compiler)
+{
+    const std::string stem = compiler.stem().string();
+    const size_t dash = stem.find('-', stem.find("clang"));
+    const std::string suffix = dash == std::string::npos ? std::string() : stem.substr(dash);
+    for (const std::string &name : {"clang-scan-deps" + suffix, std::string("clang-scan-deps")})
+    {
+        std::error_code ec;
+        if (const fs::path sibling = compiler.parent_path() / name; fs::is_regular_file(sibling, ec))
+            return sibling.string();
+        if (const auto found = findProgram(name))
+            return found->string();
+    }
+    return {};
+}
+
+// C and C++ drivers on PATH, in PATH order; a name shadowed by an earlier directory or a second name for the same
+// binary (g++ -> g++-13) is left out
+std::vector<std::pair<std::string, fs::path>> findCompilersOnPath()
+{
+    static const std::regex name_re(R"((gcc|g\+\+|clang|clang\+\+)(-\d+(\.\d+)*)?)");
+    const char *path_env = std::getenv("PATH");
+#if defined(_WIN32)
+    constexpr char separator = ';';
+#else
+    constexpr char separator = ':';
+#endif
+    std::vector<std::pair<std::string, fs::path>> found;
+    std::unordered_set<std::string> names;
+    std::unordered_set<std::string> binaries;
+    std::istringstream dirs(path_env ? path_env : "");
+    for (std::string dir; std::getline(dirs, dir, separator);)
+    {
+        if (dir.empty())
+            continue;
+        std::error_code ec;
+        std::vector<fs::path> entries;
+        for (const auto &entry : fs::directory_iterator(dir, ec))
+            entries.push_back(entry.path());
+        std::ranges::sort(entries);
+        for (const auto &path : entries)
+        {
+#if defined(_WIN32)
+            if (path.extension() != ".exe")
+                continue;
+            const std::string name = path.stem().string();
+#else
+            const std::string name = path.filename().string();
+#endif
+            if (!std::regex_match(name, name_re) || !fs::is_regular_file(path, ec))
+                continue;
+#if !defined(_WIN32)
+            if ((fs::status(path, ec).permissions() & (fs::perms::owner_exec | fs::perms::group_exec |
+                                                       fs::perms::others_exec)) == fs::perms::none)
+                continue;
+#endif
+            if (!names.insert(name).second)
+                continue;
+            const fs::path canonical = fs::canonical(path, ec);
+            if (!binaries.insert(ec ? path.string() : canonical.string()).second)
+                continue;
+            found.emplace_back(name, path);
+        }
+    }
+    return found;
+}
+} // namespace
+
+int compilerMajorVersion(const std::string &version)
+{
+    if (std::smatch m; std::regex_search(version, m, std::regex(R"((\d+)\.\d+)")))
+        return std::stoi(m[1].str());
+    return 0;
+}
+
+ToolchainCapabilities probeCompiler(const fs::path &compiler)
+{
+    ToolchainCapabilities caps;
+    const std::string cc = compiler.string();
+    const JobResult version = runProcess({cc, "--version"}, std::chrono::seconds(10));
+    if (version.exitCode != 0)
+        return caps;
+    caps.version = version.output.substr(0, version.output.find('\n'));
+    if (!caps.version.empty() && caps.version.back() == '\r')
+        caps.version.pop_back();
+    const bool clang = caps.version.find("clang") != std::string::npos;
+    caps.family = clang ? "clang" : "gcc";
+    caps.pchFormat = clang ? "pch" : "gch";
+
+    const fs::path dir = fs::temp_directory_path() / fmt::format("cppx-probe-{:08x}", std::random_device{}());
+    fs::create_directories(dir);
+    std::ofstream(dir / "probe.cpp") << "int main() { return 0; }\n";
+    std::ofstream(dir / "probe.cppm") << "export module probe;\nexport int probe() { return 42; }\n";
+
+    // A probe passes when the compiler accepts the flag; all of them run at once
+    std::vector<std::pair<std::string, std::unique_ptr<Process>>> probes;
+    const auto start = [&](std::string name, std::vector<std::string> args) {
+        args.insert(args.begin(), cc);
+        probes.emplace_back(std::move(name),
+                            std::make_unique<Process>(args, ProcessOptions{.timeout = std::chrono::seconds(60),
+                                                                           .cwd = dir}));
+    };
+    start("thin_lto", {"-flto=thin", "-c", "probe.cpp", "-o", "thin.o"});
+    start("time_trace", {"-ftime-trace", "-c", "probe.cpp", "-o", "trace.o"});
+    if (clang)
+        start("modules", {"-std=c++20", "-x", "c++-module", "--precompile", "probe.cppm", "-o", "probe.pcm"});
+    else
+        start("modules", {"-std=c++20", "-fmodules-ts", "-x", "c++", "-c", "probe.cppm", "-o", "module.o"});
+    start("march_native", {"-march=native", "-c", "probe.cpp", "-o", "native.o"});
+    if (clang)
+        start("march_list", {"--print-supported-cpus"});
+    else
+        start("march_list", {"-march=cppx-probe", "-c", "probe.cpp", "-o", "march.o"});
+    const std::vector<std::string> linkers{"mold", "lld", "gold", "bfd"};
+    for (const auto &linker : linkers)
+        start("ld:" + linker, {"-fuse-ld=" + linker, "probe.cpp", "-o", "ld-" + linker});
+
+    bool native = false;
+    for (auto &[name, process] : probes)
+    {
+        const JobResult result = process->wait();
+        const bool ok = result.exitCode == 0;
+        if (name == "thin_lto")
+            caps.thinLto = ok;
+        else if (name == "time_trace")
+            caps.timeTrace = ok;
+        else if (name == "modules")
+            caps.modules = ok;
+        else if (name == "march_native")
+            native = ok;
+        else if (name == "march_list")
+            caps.march = parseMarchList(result.output, clang);
+        else if (ok)
+            caps.linkers.push_back(name.substr(3));
+    }
+    if (native && std::ranges::find(caps.march, "native") == caps.march.end())
+        caps.march.emplace_back("native");
+
+    if (caps.modules)
+        caps.moduleScanner = clang ? findClangScanDeps(compiler)
+                                   : (compilerMajorVersion(caps.version) >= 14 ? cc : std::string());
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return caps;
+}
+
+ToolchainCapabilities toolchainCapabilities(const std::string &compiler, const toml::table &globalConfig)
+{
+    // Remembered per process so a build reads each cache file once. The stamp is kept with it, so a long-running
+    // process such as the daemon notices an upgraded compiler.
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::pair<std::pair<int64_t, int64_t>, ToolchainCapabilities>> probed;
+
+    std::error_code ec;
+    const fs::path given = compiler;
+    const std::optional<fs::path> path =
+        given.has_parent_path() && fs::is_regular_file(given, ec) ? std::optional(given) : findProgram(compiler);
+    if (!path)
+        return {};
+
+    const auto stamp = binaryStamp(*path);
+    std::lock_guard lock(mutex);
+    if (const auto it = probed.find(path->string()); it != probed.end() && it->second.first == stamp)
+        return it->second.second;
+    if (auto cached = cachedCapabilities(globalConfig, *path))
+        return probed.insert_or_assign(path->string(), std::pair(stamp, std::move(*cached))).first->second.second;
+
+    LOG_VERBOSE("Probing toolchain capabilities of {}\n", path->string());
+    ToolchainCapabilities caps = probeCompiler(*path);
+    storeCapabilities(globalConfig, {{*path, caps}});
+    return probed.insert_or_assign(path->string(), std::pair(stamp, std::move(caps))).first->second.second;
+}
+
+std::vector<DiscoveredCompiler> discoverCompilers(const toml::table &globalConfig, const size_t jobs)
+{
+    std::vector<DiscoveredCompiler> compilers;
+    for (auto &[name, path] : findCompilersOnPath())
+        compilers.push_back({std::move(name), std::move(path), {}});
+
+    std::vector<bool> fresh(compilers.size(), false);
+    JobScheduler scheduler(jobs, false);
+    for (size_t i = 0; i < compilers.size(); ++i)
+    {
+        if (auto cached = cachedCapabilities(globalConfig, compilers[i].path))
+        {
+            compilers[i].caps = std::move(*cached);
+            continue;
+        }
+        fresh[i] = true;
+        scheduler.add({fmt::format("Probing {}", compilers[i].name), [&compilers, i] {
+                           compilers[i].caps = probeCompiler(compilers[i].path);
+                           return JobResult{};
+                       }});
+    }
+    scheduler.run();
+
+    std::vector<std::pair<fs::path, ToolchainCapabilities>> probed;
+    for (size_t i = 0; i < compilers.size(); ++i)
+    {
+        if (fresh[i])
+            probed.emplace_back(compilers[i].path, compilers[i].caps);
+    }
+    storeCapabilities(globalConfig, probed);
+
+    std::erase_if(compilers, [](const DiscoveredCompiler &c) { return c.caps.version.empty(); });
+    return compilers;
+}
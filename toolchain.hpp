@@ -0,0 +1,38 @@
+#pragma once
+
+#include "helpers.hpp"
+
+// What a compiler binary can do, found by running it on small probe sources
+struct ToolchainCapabilities
+{
+    std::string version;              // First line of --version; empty if the compiler could not be run
+    std::string family;               // "gcc" or "clang"
+    std::string pchFormat;            // "gch" or "pch"
+    bool thinLto = false;
+    bool timeTrace = false;
+    bool modules = false;             // Compiles a named module interface
+    std::string moduleScanner;        // P1689 scanner: clang-scan-deps, or GCC 14+ itself; empty if none
+    std::vector<std::string> linkers; // -fuse-ld values that link a test program
+    std::vector<std::string> march;   // Accepted -march values, "native" included when it works
+};
+
+struct DiscoveredCompiler
+{
+    std::string name; // As found on PATH, e.g. "g++-13"
+    fs::path path;
+    ToolchainCapabilities caps;
+};
+
+int compilerMajorVersion(const std::string &version);
+
+// Runs every probe against compiler, concurrently, without looking at the cache.
+ToolchainCapabilities probeCompiler(const fs::path &compiler);
+
+// The capabilities of compiler (a name on PATH or a path), from its file in <cache dir>/toolchains/ while the
+// binary's mtime and size match; otherwise it is probed and the file rewritten. Never throws: a compiler
+// that cannot be found yields empty capabilities.
+ToolchainCapabilities toolchainCapabilities(const std::string &compiler, const toml::table &globalConfig);
+
+// gcc, g++, clang, clang++ and their versioned variants (g++-13, clang++-18) on PATH, one entry per binary,
+// probed in parallel on up to jobs threads (0 = number of cores) and cached like toolchainCapabilities.
+std::vector<DiscoveredCompiler> discoverCompilers(const toml::table &globalConfig, size_t jobs = 0);
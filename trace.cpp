@@ -0,0 +1,263 @@
+#include "trace.hpp"
+
+std::mutex Trace::_mutex;
+std::atomic<bool> Trace::_enabled{false};
+Trace::Clock::time_point Trace::_epoch;
+json Trace::_events = json::array();
+std::unordered_map<std::thread::id, int> Trace::_threads;
+
+void Trace::enable()
+{
+    std::lock_guard lock(_mutex);
+    if (_enabled.load(std::memory_order_relaxed))
+        return;
+    _epoch = Clock::now();
+    threadIdLocked(); // The enabling thread is the main one and gets the first track
+    _enabled.store(true, std::memory_order_release);
+}
+
+int Trace::threadIdLocked(const bool defaultName)
+{
+    const auto [it, inserted] = _threads.try_emplace(std::this_thread::get_id(), static_cast<int>(_threads.size()));
+    if (inserted && defaultName)
+    {
+        _events.push_back(json{{"ph", "M"},
+                               {"name", "thread_name"},
+                               {"pid", 1},
+                               {"tid", it->second},
+                               {"args", {{"name", it->second == 0 ? "cppx" : fmt::format("thread {}", it->second)}}}});
+    }
+    return it->second;
+}
+
+double Trace::micros(const Clock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time - _epoch).count();
+}
+
+void Trace::nameThread(const std::string &name)
+{
+    if (!enabled())
+        return;
+    std::lock_guard lock(_mutex);
+    _events.push_back(
+        json{{"ph", "M"}, {"name", "thread_name"}, {"pid", 1}, {"tid", threadIdLocked(false)}, {"args", {{"name", name}}}});
+}
+
+void Trace::complete(const std::string &name, const std::string &category, const Clock::time_point start,
+                     const Clock::time_point end, json args)
+{
+    if (!enabled())
+        return;
+    std::lock_guard lock(_mutex);
+    _events.push_back(json{{"ph", "X"},
+                           {"name", name},
+                           {"cat", category},
+                           {"pid", 1},
+                           {"tid", threadIdLocked()},
+                           {"ts", micros(start)},
+                           {"dur", micros(end) - micros(start)},
+                           {"args", std::move(args)}});
+}
+
+void Trace::async(const std::string &name, const std::string &category, const uint64_t id,
+                  const Clock::time_point start, const Clock::time_point end)
+{
+    if (!enabled())
+        return;
+    std::lock_guard lock(_mutex);
+    for (const auto &[phase, time] : {std::pair{"b", start}, std::pair{"e", end}})
+    {
+        _events.push_back(json{{"ph", phase},
+                               {"name", name},
+                               {"cat", category},
+                               {"id", id},
+                               {"pid", 1},
+                               {"tid", 0},
+                               {"ts", micros(time)}});
+    }
+}
+
+void Trace::instant(const std::string &name, const std::string &category, json args)
+{
+    if (!enabled())
+        return;
+    std::lock_guard lock(_mutex);
+    _events.push_back(json{{"ph", "i"},
+                           {"s", "t"},
+                           {"name", name},
+                           {"cat", category},
+                           {"pid", 1},
+                           {"tid", threadIdLocked()},
+                           {"ts", micros(Clock::now())},
+                           {"args", std::move(args)}});
+}
+
+void Trace::write(const fs::path &file)
+{
+    if (!enabled())
+        return;
+    std::lock_guard lock(_mutex);
+    fs::create_directories(file.parent_path());
+    writeFileAtomic(file, json{{"traceEvents", _events}, {"displayTimeUnit", "ms"}}.dump() + "\n");
+    fmt::print(fg(fmt::color::gray), "Trace written to {} (open it in ui.perfetto.dev or chrome://tracing)\n",
+               file.string());
+}
+
+Trace::Scope::Scope(std::string name, std::string category)
+    : _name(std::move(name)), _category(std::move(category)), _start(Clock::now())
+{
+}
+
+Trace::Scope::~Scope()
+{
+    complete(_name, _category, _start, Clock::now());
+}
+
+Trace::File::File(fs::path path) : _path(std::move(path))
+{
+}
+
+Trace::File::~File()
+{
+    if (_path.empty())
+        return;
+    try
+    {
+        write(_path);
+    }
+    catch (const std::exception &e)
+    {
+        fmt::print(stderr, fg(fmt::color::yellow), "[WARNING] Could not write {}: {}\n", _path.string(), e.what());
+    }
+}
+
+namespace
+{
+struct Cost
+{
+    double micros = 0;
+    size_t count = 0;
+};
+
+void printTop(const std::string &title, const std::unordered_map<std::string, Cost> &costs, const size_t top)
+{
+    if (costs.empty())
+        return;
+    std::vector<std::pair<std::string, Cost>> sorted(costs.begin(), costs.end());
+    std::ranges::sort(sorted, [](const auto &a, const auto &b) { return a.second.micros > b.second.micros; });
+    fmt::print(fmt::emphasis::bold, "\n{}\n", title);
+    fmt::print(fg(fmt::color::gray), "  {:>10}  {:>6}  {}\n", "total ms", "count", "name");
+    for (size_t i = 0; i < std::min(top, sorted.size()); ++i)
+        fmt::print("  {:>10.1f}  {:>6}  {}\n", sorted[i].second.micros / 1000.0, sorted[i].second.count,
+                   sorted[i].first);
+}
+
+bool isUnder(const fs::path &path, const fs::path &dir)
+{
+    const auto [d, p] = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+    return d == dir.end();
+}
+} // namespace
+
+void reportTimeTraces(const std::vector<std::pair<fs::path, fs::path>> &traces,
+                      const std::vector<fs::path> &includeDirs, const size_t top)
+{
+    std::unordered_map<std::string, Cost> units;
+    std::unordered_map<std::string, Cost> headers;
+    std::unordered_map<std::string, Cost> directories;
+    std::unordered_map<std::string, Cost> templates;
+    size_t read = 0;
+
+    for (const auto &[source, file] : traces)
+    {
+        std::ifstream in(file);
+        if (!in)
+            continue;
+        json data;
+        try
+        {
+            data = json::parse(in);
+        }
+        catch (const json::exception &e)
+        {
+            LOG_VERBOSE("Skipping unreadable time trace {}: {}\n", file.string(), e.what());
+            continue;
+        }
+        ++read;
+
+        struct Include
+        {
+            double ts;
+            double dur;
+            std::string header;
+        };
+        std::vector<Include> includes;
+        for (const auto &event : data.value("traceEvents", json::array()))
+        {
+            if (event.value("ph", "") != "X")
+                continue;
+            const std::string name = event.value("name", "");
+            const double dur = event.value("dur", 0.0);
+            const std::string detail =
+                event.contains("args") ? event["args"].value("detail", std::string{}) : std::string{};
+            if (name == "Total ExecuteCompiler")
+            {
+                units[source.string()].micros += dur;
+                ++units[source.string()].count;
+            }
+            else if (name == "Source" && !detail.empty())
+            {
+                includes.push_back({event.value("ts", 0.0), dur, detail});
+            }
+            else if ((name == "InstantiateClass" || name == "InstantiateFunction") && !detail.empty())
+            {
+                templates[detail].micros += dur;
+                ++templates[detail].count;
+            }
+        }
+
+        // Header times are inclusive of what they include. A directory is only charged where it is entered from
+        // outside, so its nested headers are not counted twice.
+        std::ranges::sort(includes, {}, &Include::ts);
+        std::vector<std::pair<double, std::string>> open; // End time, directory
+        for (const auto &inc : includes)
+        {
+            headers[inc.header].micros += inc.dur;
+            ++headers[inc.header].count;
+
+            const fs::path header = fs::path(inc.header).lexically_normal();
+            std::string dir = "(outside the -I directories)";
+            size_t best = 0;
+            for (const auto &candidate : includeDirs)
+            {
+                const size_t depth = std::distance(candidate.begin(), candidate.end());
+                if (depth > best && isUnder(header, candidate))
+                {
+                    best = depth;
+                    dir = candidate.string();
+                }
+            }
+            while (!open.empty() && open.back().first <= inc.ts)
+                open.pop_back();
+            if (open.empty() || open.back().second != dir)
+            {
+                directories[dir].micros += inc.dur;
+                ++directories[dir].count;
+            }
+            open.emplace_back(inc.ts + inc.dur, dir);
+        }
+    }
+
+    if (read == 0)
+    {
+        fmt::print(fg(fmt::color::yellow), "No -ftime-trace output found; only recompiled files produce one.\n");
+        return;
+    }
+    fmt::print(fmt::emphasis::bold | fg(fmt::color::cyan), "\nCompile-time hotspots across {} translation units\n",
+               read);
+    printTop("Slowest translation units", units, top);
+    printTop("Most expensive headers (inclusive parse time)", headers, top);
+    printTop("Include directories", directories, top);
+    printTop("Most expensive template instantiations", templates, top);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "helpers.hpp"
+
+#include <atomic>
+#include <mutex>
+
+// Recorder for 'cppx build --trace', written in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+// Nothing is recorded until enable() is called, so instrumented code only pays for one atomic load; the mutex is
+// taken only to record.
+class Trace
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static void enable();
+    // Acquire, so a thread that sees the trace enabled also sees the epoch enable() set
+    [[nodiscard]] static bool enabled()
+    {
+        return _enabled.load(std::memory_order_acquire);
+    }
+    // Names the calling thread's track
+    static void nameThread(const std::string &name);
+
+    // A span on the calling thread's track
+    static void complete(const std::string &name, const std::string &category, Clock::time_point start,
+                         Clock::time_point end, json args = json::object());
+    // A span on its own track, for time that is not spent on any thread, such as waiting in the job queue
+    static void async(const std::string &name, const std::string &category, uint64_t id, Clock::time_point start,
+                      Clock::time_point end);
+    static void instant(const std::string &name, const std::string &category, json args = json::object());
+    static void write(const fs::path &file);
+
+    // Records a span from construction to destruction
+    class Scope
+    {
+      public:
+        Scope(std::string name, std::string category);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        std::string _name;
+        std::string _category;
+        Clock::time_point _start;
+    };
+
+    // Writes the trace when it goes out of scope, including when a failed build unwinds
+    class File
+    {
+      public:
+        explicit File(fs::path path);
+        ~File();
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+
+      private:
+        fs::path _path;
+    };
+
+  private:
+    static std::mutex _mutex;
+    static std::atomic<bool> _enabled;
+    static Clock::time_point _epoch;
+    static json _events;
+    static std::unordered_map<std::thread::id, int> _threads;
+
+    // Registers the calling thread on first use, naming its track unless the caller is about to
+    static int threadIdLocked(bool defaultName = true);
+    static double micros(Clock::time_point time);
+};
+
+// Aggregates clang -ftime-trace files (one per TU) and prints the TUs, headers, include directories and template
+// instantiations that cost the most compile time across the project. traces holds (source, trace file) pairs.
+void reportTimeTraces(const std::vector<std::pair<fs::path, fs::path>> &traces,
+                      const std::vector<fs::path> &includeDirs, size_t top = 10);
@@ -0,0 +1,629 @@
+#include "watcher.hpp"
+
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <ranges>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace
+{
+bool isUnder(const fs::path &path, const fs::path &dir)
+{
+    const auto [d, p] = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+    return d == dir.end();
+}
+
+// Sleeps until timeout or until stoken is stopped; without a timeout, simply waits for the stop
+void waitForStop(const std::stop_token &stoken, const std::optional<std::chrono::milliseconds> timeout = std::nullopt)
+{
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mutex);
+    if (timeout)
+        cv.wait_for(lock, stoken, *timeout, [] { return false; });
+    else
+        cv.wait(lock, stoken, [] { return false; });
+}
+} // namespace
+
+FileWatcher::FileWatcher(fs::path dir, Callback cb, const std::chrono::milliseconds interval)
+    : _dir(std::move(dir)), _cb(std::move(cb)), _interval(interval)
+{
+    _snapshot = snapshot_dir();
+}
+
+void FileWatcher::run(const std::stop_token &stoken)
+{
+    if (!runNative(stoken))
+    {
+        LOG_VERBOSE("No native file watching available, polling every {} ms\n", _interval.count());
+        runPolling(stoken);
+    }
+}
+
+void FileWatcher::runPolling(const std::stop_token &stoken)
+{
+    while (!stoken.stop_requested())
+    {
+        waitForStop(stoken, _interval);
+        if (stoken.stop_requested())
+            break;
+        rescan();
+    }
+}
+
+void FileWatcher::rescan()
+{
+    std::unordered_map<fs::path, fs::file_time_type> current;
+    try
+    {
+        current = snapshot_dir();
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "[FileWatcher] Filesystem error: {}\n",
+                   e.what());
+        return;
+    }
+    catch (const std::exception &e)
+    {
+        fmt::print(stderr, fmt::emphasis::bold | fg(fmt::color::red), "[FileWatcher] Unexpected error: {}\n",
+                   e.what());
+        return;
+    }
+
+    const auto previous = std::exchange(_snapshot, current);
+    for (const auto &[p, mtime] : current)
+    {
+        if (const auto it = previous.find(p); it == previous.end())
+            _cb({FileEvent::Created, p, {}});
+        else if (it->second != mtime)
+            _cb({FileEvent::Modified, p, {}});
+    }
+    for (const auto &p : previous | std::views::keys)
+    {
+        if (!current.contains(p))
+            _cb({FileEvent::Deleted, p, {}});
+    }
+}
+
+void FileWatcher::deliver(const FileChange &change)
+{
+    std::error_code ec;
+    switch (change.event)
+    {
+    case FileEvent::Deleted:
+        if (_snapshot.erase(change.path) == 0)
+            return;
+        break;
+    case FileEvent::Renamed:
+        _snapshot.erase(change.oldPath);
+        _snapshot[change.path] = fs::last_write_time(_dir / change.path, ec);
+        break;
+    case FileEvent::Created:
+    case FileEvent::Modified:
+        _snapshot[change.path] = fs::last_write_time(_dir / change.path, ec);
+        break;
+    }
+    _cb(change);
+}
+
+void FileWatcher::discoverTree(const fs::path &rel)
+{
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(_dir / rel, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec))
+    {
+        if (const fs::path p = it->path().lexically_relative(_dir); it->is_regular_file(ec) && !_snapshot.contains(p))
+            deliver({FileEvent::Created, p, {}});
+    }
+}
+
+void FileWatcher::forgetTree(const fs::path &rel)
+{
+    std::vector<fs::path> gone;
+    for (const auto &p : _snapshot | std::views::keys)
+    {
+        if (isUnder(p, rel))
+            gone.push_back(p);
+    }
+    for (const auto &p : gone)
+        deliver({FileEvent::Deleted, p, {}});
+}
+
+ChangeBatcher::ChangeBatcher(const std::chrono::milliseconds window, const unsigned maxWindows)
+    : _window(window), _maxLatency(window * std::max(maxWindows, 1u))
+{
+}
+
+void ChangeBatcher::push(FileChange change)
+{
+    {
+        std::lock_guard lock(_mutex);
+        _last = std::chrono::steady_clock::now();
+        if (_pending.empty())
+            _first = _last;
+        if (change.event == FileEvent::Renamed)
+        {
+            merge(FileEvent::Deleted, change.oldPath);
+            merge(FileEvent::Created, change.path);
+        }
+        else
+        {
+            merge(change.event, change.path);
+        }
+    }
+    _cv.notify_all();
+}
+
+void ChangeBatcher::merge(const FileEvent event, const fs::path &path)
+{
+    const auto it = _index.find(path);
+    if (it == _index.end())
+    {
+        _index.emplace(path, _pending.size());
+        _pending.push_back({event, path});
+        return;
+    }
+
+    Entry &entry = _pending[it->second];
+    if (entry.cancelled)
+    {
+        entry = {event, path};
+    }
+    else if (entry.event == FileEvent::Created && event == FileEvent::Deleted)
+    {
+        entry.cancelled = true;
+    }
+    else if (entry.event == FileEvent::Deleted && event == FileEvent::Created)
+    {
+        entry.event = FileEvent::Modified;
+    }
+    else if (entry.event != FileEvent::Created)
+    {
+        // A file created in this batch stays created no matter how often it is written
+        entry.event = event;
+    }
+}
+
+std::vector<FileChange> ChangeBatcher::next(const std::stop_token &stoken)
+{
+    std::unique_lock lock(_mutex);
+    while (true)
+    {
+        if (!_cv.wait(lock, stoken, [this] { return !_pending.empty(); }))
+            return {};
+        // Wait until the window has passed since the most recent change, but no longer than the maximum latency
+        const auto deadline = std::min(_last + _window, _first + _maxLatency);
+        if (std::chrono::steady_clock::now() < deadline)
+        {
+            _cv.wait_until(lock, stoken, deadline, [] { return false; });
+            if (stoken.stop_requested())
+                return {};
+            continue;
+        }
+
+        std::vector<FileChange> batch;
+        batch.reserve(_pending.size());
+        for (auto &entry : _pending)
+        {
+            if (!entry.cancelled)
+                batch.push_back({entry.event, std::move(entry.path), {}});
+        }
+        _pending.clear();
+        _index.clear();
+        if (!batch.empty())
+            return batch;
+    }
+}
+
+std::unordered_map<fs::path, fs::file_time_type> FileWatcher::snapshot_dir() const
+{
+    std::unordered_map<fs::path, fs::file_time_type> m;
+    for (auto const &entry : fs::recursive_directory_iterator(_dir, fs::directory_options::skip_permission_denied))
+    {
+        if (entry.is_regular_file())
+        {
+            m[entry.path().lexically_relative(_dir)] = entry.last_write_time();
+        }
+    }
+    return m;
+}
+
+#if defined(__linux__)
+bool FileWatcher::runNative(const std::stop_token &stoken)
+{
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return false;
+    const int wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    constexpr uint32_t mask = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    std::unordered_map<int, fs::path> dirs; // Watch descriptor -> directory relative to _dir
+
+    // inotify is not recursive, so every directory gets its own watch; fails when the watch limit is reached
+    const auto addTree = [&](const fs::path &rel) {
+        std::vector<fs::path> pending{rel};
+        while (!pending.empty())
+        {
+            const fs::path current = std::move(pending.back());
+            pending.pop_back();
+            const int wd = inotify_add_watch(fd, (_dir / current).c_str(), mask);
+            if (wd < 0)
+            {
+                if (errno == ENOENT || errno == ENOTDIR)
+                    continue; // Already gone again
+                return false;
+            }
+            dirs[wd] = current.lexically_normal();
+            std::error_code ec;
+            for (const auto &entry : fs::directory_iterator(_dir / current, ec))
+            {
+                if (entry.is_directory(ec) && !entry.is_symlink(ec))
+                    pending.push_back(current / entry.path().filename());
+            }
+        }
+        return true;
+    };
+    const auto removeTree = [&](const fs::path &rel) {
+        for (auto it = dirs.begin(); it != dirs.end();)
+        {
+            if (isUnder(it->second, rel))
+            {
+                inotify_rm_watch(fd, it->first);
+                it = dirs.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    };
+
+    if (!addTree({}))
+    {
+        close(wake);
+        close(fd);
+        return false;
+    }
+
+    bool fallBack = false;
+    {
+        std::stop_callback wakeup(stoken, [wake] {
+            const uint64_t one = 1;
+            (void)!write(wake, &one, sizeof one);
+        });
+
+        alignas(inotify_event) std::array<char, 64 * 1024> buffer{};
+        std::unordered_map<uint32_t, fs::path> moves; // Cookie -> path of an IN_MOVED_FROM waiting for its pair
+        while (!stoken.stop_requested() && !fallBack)
+        {
+            std::array<pollfd, 2> fds{{{fd, POLLIN, 0}, {wake, POLLIN, 0}}};
+            // Both halves of a move arrive back to back; an unpaired IN_MOVED_FROM means the file left the tree
+            const int ready = poll(fds.data(), fds.size(), moves.empty() ? -1 : 50);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready < 0 || (fds[1].revents & POLLIN))
+                break;
+            if (ready == 0)
+            {
+                for (const auto &from : moves | std::views::values)
+                    deliver({FileEvent::Deleted, from, {}});
+                moves.clear();
+                continue;
+            }
+
+            const ssize_t len = read(fd, buffer.data(), buffer.size());
+            for (ssize_t offset = 0; offset < len;)
+            {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    rescan();
+                    continue;
+                }
+                const auto dir = dirs.find(event->wd);
+                if (dir == dirs.end())
+                    continue;
+                if (event->mask & IN_IGNORED)
+                {
+                    dirs.erase(dir);
+                    continue;
+                }
+                if (event->len == 0)
+                    continue;
+
+                const fs::path rel = (dir->second / event->name).lexically_normal();
+                if (event->mask & IN_ISDIR)
+                {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    {
+                        if (!addTree(rel))
+                        {
+                            fmt::print(stderr, fg(fmt::color::yellow),
+                                       "[FileWatcher] inotify watch limit reached, falling back to polling\n");
+                            fallBack = true;
+                            break;
+                        }
+                        // Files created before the watch was in place would otherwise be missed
+                        discoverTree(rel);
+                    }
+                    else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                    {
+                        removeTree(rel);
+                        forgetTree(rel);
+                    }
+                    continue;
+                }
+
+                if (event->mask & IN_CREATE)
+                {
+                    deliver({FileEvent::Created, rel, {}});
+                }
+                else if (event->mask & IN_CLOSE_WRITE)
+                {
+                    deliver({FileEvent::Modified, rel, {}});
+                }
+                else if (event->mask & IN_DELETE)
+                {
+                    deliver({FileEvent::Deleted, rel, {}});
+                }
+                else if (event->mask & IN_MOVED_FROM)
+                {
+                    moves[event->cookie] = rel;
+                }
+                else if (event->mask & IN_MOVED_TO)
+                {
+                    if (const auto from = moves.find(event->cookie); from != moves.end())
+                    {
+                        deliver({FileEvent::Renamed, rel, from->second});
+                        moves.erase(from);
+                    }
+                    else
+                    {
+                        deliver({FileEvent::Created, rel, {}});
+                    }
+                }
+            }
+        }
+    }
+    close(wake);
+    close(fd);
+
+    if (fallBack)
+    {
+        rescan();
+        runPolling(stoken);
+    }
+    return true;
+}
+
+#elif defined(__APPLE__)
+bool FileWatcher::runNative(const std::stop_token &stoken)
+{
+    std::error_code ec;
+    const fs::path root = fs::canonical(_dir, ec);
+    if (ec)
+        return false;
+
+    // FSEvents reports canonical absolute paths, so events are mapped back through the canonical root
+    struct Context
+    {
+        FileWatcher *self;
+        fs::path root;
+    } context{this, root};
+
+    const auto callback = [](ConstFSEventStreamRef, void *info, const size_t count, void *eventPaths,
+                             const FSEventStreamEventFlags flags[], const FSEventStreamEventId[]) {
+        auto &ctx = *static_cast<Context *>(info);
+        FileWatcher &self = *ctx.self;
+        const auto paths = static_cast<char **>(eventPaths);
+        fs::path renamedFrom;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (flags[i] & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped |
+                            kFSEventStreamEventFlagKernelDropped))
+            {
+                self.rescan();
+                continue;
+            }
+            const fs::path rel = fs::path(paths[i]).lexically_relative(ctx.root);
+            std::error_code e;
+            const bool exists = fs::exists(self._dir / rel, e);
+            if (flags[i] & kFSEventStreamEventFlagItemIsDir)
+            {
+                if (exists)
+                    self.discoverTree(rel);
+                else
+                    self.forgetTree(rel);
+                continue;
+            }
+            if (!(flags[i] & kFSEventStreamEventFlagItemIsFile))
+                continue;
+
+            // Flags of one path are coalesced, so the file's current existence decides what happened
+            if (flags[i] & kFSEventStreamEventFlagItemRenamed)
+            {
+                if (!exists)
+                {
+                    renamedFrom = rel;
+                    continue;
+                }
+                if (!renamedFrom.empty() && self._snapshot.contains(renamedFrom))
+                    self.deliver({FileEvent::Renamed, rel, renamedFrom});
+                else
+                    self.deliver({FileEvent::Created, rel, {}});
+                renamedFrom.clear();
+            }
+            else if (!exists)
+            {
+                self.deliver({FileEvent::Deleted, rel, {}});
+            }
+            else if (!self._snapshot.contains(rel))
+            {
+                self.deliver({FileEvent::Created, rel, {}});
+            }
+            else if (flags[i] & kFSEventStreamEventFlagItemModified)
+            {
+                self.deliver({FileEvent::Modified, rel, {}});
+            }
+        }
+        if (!renamedFrom.empty())
+            self.deliver({FileEvent::Deleted, renamedFrom, {}});
+    };
+
+    CFStringRef path = CFStringCreateWithCString(nullptr, root.c_str(), kCFStringEncodingUTF8);
+    CFArrayRef paths = CFArrayCreate(nullptr, reinterpret_cast<const void **>(&path), 1, &kCFTypeArrayCallBacks);
+    FSEventStreamContext streamContext{0, &context, nullptr, nullptr, nullptr};
+    FSEventStreamRef stream =
+        FSEventStreamCreate(nullptr, callback, &streamContext, paths, kFSEventStreamEventIdSinceNow, 0.05,
+                            kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagNoDefer);
+    CFRelease(paths);
+    CFRelease(path);
+    if (!stream)
+        return false;
+
+    dispatch_queue_t queue = dispatch_queue_create("cppx.watch", DISPATCH_QUEUE_SERIAL);
+    FSEventStreamSetDispatchQueue(stream, queue);
+    const bool started = FSEventStreamStart(stream);
+    if (started)
+    {
+        // Events are delivered on the serial queue; this thread only waits for the stop request
+        waitForStop(stoken);
+        FSEventStreamStop(stream);
+    }
+    FSEventStreamInvalidate(stream);
+    FSEventStreamRelease(stream);
+    dispatch_release(queue);
+    return started;
+}
+
+#elif defined(_WIN32)
+bool FileWatcher::runNative(const std::stop_token &stoken)
+{
+    HANDLE dir = CreateFileW(_dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (dir == INVALID_HANDLE_VALUE)
+        return false;
+
+    HANDLE stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    bool started = false;
+    {
+        std::stop_callback wakeup(stoken, [stopEvent] { SetEvent(stopEvent); });
+
+        alignas(DWORD) std::array<std::byte, 64 * 1024> buffer{};
+        fs::path renamedFrom;
+        while (!stoken.stop_requested())
+        {
+            ResetEvent(overlapped.hEvent);
+            if (!ReadDirectoryChangesW(dir, buffer.data(), static_cast<DWORD>(buffer.size()), TRUE,
+                                       FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+                                           FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                       nullptr, &overlapped, nullptr))
+                break;
+            started = true;
+
+            HANDLE handles[] = {overlapped.hEvent, stopEvent};
+            DWORD bytes = 0;
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+            {
+                CancelIoEx(dir, &overlapped);
+                GetOverlappedResult(dir, &overlapped, &bytes, TRUE);
+                break;
+            }
+            if (!GetOverlappedResult(dir, &overlapped, &bytes, FALSE))
+                break;
+            if (bytes == 0)
+            {
+                // The kernel buffer overflowed and the events are lost
+                rescan();
+                continue;
+            }
+
+            for (auto *info = reinterpret_cast<FILE_NOTIFY_INFORMATION *>(buffer.data());;)
+            {
+                const fs::path rel =
+                    fs::path(std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR))).lexically_normal();
+                std::error_code ec;
+                const bool isFile = fs::is_regular_file(_dir / rel, ec);
+                switch (info->Action)
+                {
+                case FILE_ACTION_ADDED:
+                    if (isFile)
+                        deliver({FileEvent::Created, rel, {}});
+                    else
+                        discoverTree(rel);
+                    break;
+                case FILE_ACTION_MODIFIED:
+                    if (isFile)
+                        deliver({FileEvent::Modified, rel, {}});
+                    break;
+                case FILE_ACTION_REMOVED:
+                    // The path is gone, so only the snapshot knows whether it was a file or a directory
+                    if (_snapshot.contains(rel))
+                        deliver({FileEvent::Deleted, rel, {}});
+                    else
+                        forgetTree(rel);
+                    break;
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    renamedFrom = rel;
+                    break;
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    if (isFile && _snapshot.contains(renamedFrom))
+                    {
+                        deliver({FileEvent::Renamed, rel, renamedFrom});
+                    }
+                    else
+                    {
+                        forgetTree(renamedFrom);
+                        if (isFile)
+                            deliver({FileEvent::Created, rel, {}});
+                        else
+                            discoverTree(rel);
+                    }
+                    renamedFrom.clear();
+                    break;
+                default:
+                    break;
+                }
+                if (info->NextEntryOffset == 0)
+                    break;
+                info = reinterpret_cast<FILE_NOTIFY_INFORMATION *>(reinterpret_cast<std::byte *>(info) +
+                                                                   info->NextEntryOffset);
+            }
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    CloseHandle(stopEvent);
+    CloseHandle(dir);
+    return started;
+}
+
+#else
+bool FileWatcher::runNative(const std::stop_token &)
+{
+    return false;
+}
+#endif
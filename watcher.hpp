@@ -0,0 +1,87 @@
+#pragma once
+
+#include "helpers.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <stop_token>
+
+enum class FileEvent
+{
+    Created,
+    Modified,
+    Deleted,
+    Renamed
+};
+
+struct FileChange
+{
+    FileEvent event;
+    fs::path path;    // Relative to the watched directory
+    fs::path oldPath; // Previous path of a rename
+};
+
+// Watches a directory tree for changes to regular files. Uses inotify on Linux, FSEvents on macOS and
+// ReadDirectoryChangesW on Windows, and falls back to polling snapshots every interval elsewhere or when the
+// native API is unavailable (e.g. the inotify watch limit is reached).
+class FileWatcher
+{
+  public:
+    using Callback = std::function<void(const FileChange &change)>;
+
+    FileWatcher(fs::path dir, Callback cb, std::chrono::milliseconds interval = std::chrono::milliseconds(500));
+    // Blocks and delivers events until stoken is stopped
+    void run(const std::stop_token &stoken);
+
+  private:
+    fs::path _dir;
+    Callback _cb;
+    std::chrono::milliseconds _interval;
+    std::unordered_map<fs::path, fs::file_time_type> _snapshot;
+
+    // Returns false without delivering events if no native backend could be started
+    bool runNative(const std::stop_token &stoken);
+    void runPolling(const std::stop_token &stoken);
+    // Reports the difference between the last snapshot and now, used by polling and after a lost event queue
+    void rescan();
+    // Keeps the snapshot in sync with events from a native backend, so a later rescan() only reports what was missed
+    void deliver(const FileChange &change);
+    // Reports the files of a directory that appeared or disappeared as a whole
+    void discoverTree(const fs::path &rel);
+    void forgetTree(const fs::path &rel);
+
+    [[nodiscard]] std::unordered_map<fs::path, fs::file_time_type> snapshot_dir() const;
+};
+
+// Collects changes from any number of watchers and hands them out as one batch once no new change arrived for the
+// debounce window, or at the latest maxWindows windows after its first change, so a stream of writes (a generator,
+// a checkout) cannot hold a batch back forever. Changes to the same path are merged into their net effect (created
+// then deleted cancels out), and renames are split into a delete of the old and a create of the new path.
+class ChangeBatcher
+{
+  public:
+    explicit ChangeBatcher(std::chrono::milliseconds window, unsigned maxWindows = 10);
+
+    void push(FileChange change);
+    // Blocks until a batch is complete; returns an empty batch once stoken is stopped
+    std::vector<FileChange> next(const std::stop_token &stoken);
+
+  private:
+    std::chrono::milliseconds _window;
+    std::chrono::milliseconds _maxLatency;
+    std::mutex _mutex;
+    std::condition_variable_any _cv;
+    struct Entry
+    {
+        FileEvent event;
+        fs::path path;
+        bool cancelled = false;
+    };
+
+    std::vector<Entry> _pending;
+    std::unordered_map<fs::path, size_t> _index; // Path -> position in _pending
+    std::chrono::steady_clock::time_point _first; // Arrival of the oldest change in _pending
+    std::chrono::steady_clock::time_point _last;
+
+    void merge(FileEvent event, const fs::path &path);
+};